@@ -37,9 +37,11 @@ IPAddress gateway(192, 168, 0, 0);
 IPAddress subnet(255, 255, 255, 0);
 #endif
 
-#ifdef SET_DISPLAY
-// The frequency of measurement updates.
+// The frequency of measurement updates. Scrapes are served from the last
+// measurement, so this is the only thing that touches the sensors.
 const int updateFrequency = 5000;
+
+#ifdef SET_DISPLAY
 const int displayTime = 5000;
 #endif // SET_DISPLAY
 
@@ -55,9 +57,11 @@ TMP_RH value_sht;
 int value_pm;
 int value_co2;
 
-#ifdef SET_DISPLAY
-long lastUpdate = 0;
-#endif // SET_DISPLAY
+// Snapshot of the last measurement: which sensors failed and the metrics
+// text served to every scrape until the next measurement.
+uint8_t lastError = ERROR_PMS | ERROR_SHT | ERROR_CO2;
+String metrics = "";
+unsigned long lastUpdate = 0;
 
 SSD1306Wire display(0x3c, SDA, SCL);
 ESP8266WebServer server(port);
@@ -128,15 +132,34 @@ void setup() {
 #ifdef SET_DISPLAY
   showTextRectangle("Listening To", WiFi.localIP().toString() + ":" + String(port), true);
 #endif // SET_DISPLAY
+
+  sample();
+  lastUpdate = millis();
 }
 
 void loop() {
   server.handleClient();
+
+  unsigned long now = millis();
+  if (now - lastUpdate >= (unsigned long)updateFrequency) {
+    // keep to a fixed rate, but don't try to catch up on missed samples
+    lastUpdate += updateFrequency;
+    if (now - lastUpdate >= (unsigned long)updateFrequency) {
+      lastUpdate = now;
+    }
+    sample();
+  }
+
 #ifdef SET_DISPLAY
-  updateScreen(millis());
+  updateScreen(now);
 #endif // SET_DISPLAY
 }
 
+void sample() {
+  lastError = update();
+  metrics = GenerateMetrics();
+}
+
 uint8_t update() {
   uint8_t result = 0;
 #ifdef SET_PM
@@ -169,9 +192,6 @@ uint8_t update() {
   }
 #endif // SET_SHT
 
-#ifdef SET_DISPLAY
-  lastUpdate = millis();
-#endif
   return result;
 }
 
@@ -179,8 +199,7 @@ String GenerateMetrics() {
   String message = "";
   String idString = "{id=\"" + String(deviceId) + "\",mac=\"" + WiFi.macAddress().c_str() + "\"}";
 
-  // Update sensor data
-  uint8_t error = update();
+  uint8_t error = lastError;
 
 #ifdef SET_PM
   if(!(error & ERROR_PMS))
@@ -227,7 +246,7 @@ String GenerateMetrics() {
 }
 
 void HandleRoot() {
-  server.send(200, "text/plain", GenerateMetrics() );
+  server.send(200, "text/plain", metrics);
 }
 
 void HandleNotFound() {
@@ -264,11 +283,6 @@ void updateScreen(long now) {
   static long lastDisplayUpdate = millis();
   static uint8_t state = 0;
 
-  if ((now - lastUpdate) > updateFrequency) {
-    // Take a measurement at a fixed interval.
-    update();
-  }
-  
   switch (state) {
     case 0:
 #ifdef SET_PM
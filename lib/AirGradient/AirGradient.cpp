@@ -7,9 +7,27 @@ PMS::PMS()
 {
 }
 
-void PMS::init(Stream &stream)
+void PMS::init(Stream &stream, PmsModel model)
 {
   _stream = &stream;
+  switch (model)
+  {
+  case PmsModel::PMS5003T:
+    _modelFrameLen = PmsLayout<PmsModel::PMS5003T>::frameLength;
+    _decode = decodePmsFrame<PmsModel::PMS5003T>;
+    break;
+  case PmsModel::PMS5003ST:
+    _modelFrameLen = PmsLayout<PmsModel::PMS5003ST>::frameLength;
+    _decode = decodePmsFrame<PmsModel::PMS5003ST>;
+    break;
+  case PmsModel::PMSA003:
+    _modelFrameLen = PmsLayout<PmsModel::PMSA003>::frameLength;
+    _decode = decodePmsFrame<PmsModel::PMSA003>;
+    break;
+  default:
+    _modelFrameLen = PmsLayout<PmsModel::PMS5003>::frameLength;
+    _decode = decodePmsFrame<PmsModel::PMS5003>;
+  }
 }
 
 // Standby mode. For low power consumption and prolong the life of the sensor.
@@ -48,6 +66,11 @@ void PMS::requestRead()
 {
   if (_mode == MODE_PASSIVE)
   {
+    if (_awaiting)
+    {
+      _counters.timeouts++;
+    }
+    _awaiting = true;
     uint8_t command[] = {0x42, 0x4D, 0xE2, 0x00, 0x00, 0x01, 0x71};
     _stream->write(command, sizeof(command));
   }
@@ -79,6 +102,19 @@ const PMS::Data& PMS::getData() const
   return _data;
 }
 
+const LinkCounters &PMS::getCounters() const
+{
+  return _counters;
+}
+
+// The bytes of a header that didn't check out are dropped with it.
+void PMS::dropHeader()
+{
+  _counters.resyncs++;
+  _counters.discarded += _index + 1;
+  _index = 0;
+}
+
 void PMS::loop()
 {
   _PMSstatus = STATUS_WAITING;
@@ -91,6 +127,7 @@ void PMS::loop()
     case 0:
       if (ch != 0x42)
       {
+        _counters.discarded++;
         return;
       }
       _calculatedChecksum = ch;
@@ -99,7 +136,7 @@ void PMS::loop()
     case 1:
       if (ch != 0x4D)
       {
-        _index = 0;
+        dropHeader();
         return;
       }
       _calculatedChecksum += ch;
@@ -112,10 +149,14 @@ void PMS::loop()
 
     case 3:
       _frameLen |= ch;
-      // Unsupported sensor, different frame length, transmission error e.t.c.
-      if (_frameLen != 2 * 9 + 2 && _frameLen != 2 * 13 + 2)
+      // Another model, transmission error e.t.c.
+      if (_frameLen != _modelFrameLen)
       {
-        _index = 0;
+        if (_frameLen - 2 > MAX_PAYLOAD)
+        {
+          _counters.overflows++;
+        }
+        dropHeader();
         return;
       }
       _calculatedChecksum += ch;
@@ -133,31 +174,13 @@ void PMS::loop()
         if (_calculatedChecksum == _checksum)
         {
           _PMSstatus = STATUS_OK;
-
-          // Standard Particles, CF=1.
-          _data.PM_SP_UG_1_0 = makeWord(_payload[0], _payload[1]);
-          _data.PM_SP_UG_2_5 = makeWord(_payload[2], _payload[3]);
-          _data.PM_SP_UG_10_0 = makeWord(_payload[4], _payload[5]);
-
-          // Atmospheric Environment.
-          _data.PM_AE_UG_1_0 = makeWord(_payload[6], _payload[7]);
-          _data.PM_AE_UG_2_5 = makeWord(_payload[8], _payload[9]);
-          _data.PM_AE_UG_10_0 = makeWord(_payload[10], _payload[11]);
-
-          // Total particles count per 100ml air
-          _data.PM_RAW_0_3 = makeWord(_payload[12], _payload[13]);
-          _data.PM_RAW_0_5 = makeWord(_payload[14], _payload[15]);
-          _data.PM_RAW_1_0 = makeWord(_payload[16], _payload[17]);
-          _data.PM_RAW_2_5 = makeWord(_payload[18], _payload[19]);
-          _data.PM_RAW_5_0 = makeWord(_payload[20], _payload[21]);
-          _data.PM_RAW_10_0 = makeWord(_payload[22], _payload[23]);
-
-          // Formaldehyde concentration (PMSxxxxST units only)
-          _data.AMB_HCHO = makeWord(_payload[24], _payload[25]) / 1000;
-
-          // Temperature & humidity (PMSxxxxST units only)
-          _data.PM_TMP = makeWord(_payload[20], _payload[21]);
-          _data.PM_HUM = makeWord(_payload[22], _payload[23]);
+          _decode(_payload, _data);
+          _counters.frames++;
+          _awaiting = false;
+        }
+        else
+        {
+          _counters.checksumErrors++;
         }
 
         _index = 0;
@@ -166,13 +189,8 @@ void PMS::loop()
       else
       {
         _calculatedChecksum += ch;
-        uint8_t payloadIndex = _index - 4;
-
-        // Payload is common to all sensors (first 2x6 bytes).
-        if (payloadIndex < sizeof(_payload))
-        {
-          _payload[payloadIndex] = ch;
-        }
+        // the frame length was checked against the model, so this fits
+        _payload[_index - 4] = ch;
       }
 
       break;
@@ -187,15 +205,7 @@ CO2Sensor::CO2Sensor() {}
 void CO2Sensor::init(Stream &stream)
 {
   _stream = &stream;
-
-  if (getCO2_Raw() == -1)
-  {
-    Serial.println("CO2 Sensor Failed to Initialize ");
-  }
-  else
-  {
-    Serial.println("CO2 Successfully Initialized.");
-  }
+  _modbus.begin(stream, ADDRESS);
 }
 
 int CO2Sensor::getCO2(int numberOfSamplesToTake)
@@ -207,14 +217,9 @@ int CO2Sensor::getCO2(int numberOfSamplesToTake)
     int co2AsPpm = getCO2_Raw();
     if (co2AsPpm > 300 && co2AsPpm < 10000)
     {
-      Serial.println("CO2 read success " + String(co2AsPpm));
       successfulSamplesCounter++;
       co2AsPpmSum += co2AsPpm;
     }
-    else
-    {
-      Serial.println("CO2Sensor read failed with " + String(co2AsPpm));
-    }
 
     // without delay we get a few 10ms spacing, add some more
     delay(250);
@@ -225,27 +230,13 @@ int CO2Sensor::getCO2(int numberOfSamplesToTake)
     // total failure
     return -5;
   }
-  Serial.println("# of CO2Sensor reads that worked: " + String(successfulSamplesCounter));
-  Serial.println("CO2Sensor reads sum " + String(co2AsPpmSum));
   return co2AsPpmSum / successfulSamplesCounter;
 }
 
 // <<>>
 int CO2Sensor::getCO2_Raw()
 {
-  while (_stream->available()) // flush whatever we might have
-    _stream->read();
-
-  const byte CO2Command[] = {0XFE, 0X04, 0X00, 0X03, 0X00, 0X01, 0XD5, 0XC5};
-  byte CO2Response[] = {0, 0, 0, 0, 0, 0, 0};
-  int datapos = -1;
-
-  const int commandSize = 8;
-  const int responseSize = 7;
-
-  int numberOfBytesWritten = _stream->write(CO2Command, commandSize);
-
-  if (numberOfBytesWritten != commandSize)
+  if (!requestRead())
   {
     // failed to write request
     return -2;
@@ -253,7 +244,7 @@ int CO2Sensor::getCO2_Raw()
 
   // attempt to read response
   int timeoutCounter = 0;
-  while (_stream->available() < responseSize)
+  while (!responseAvailable())
   {
     timeoutCounter++;
     if (timeoutCounter > 10)
@@ -264,16 +255,101 @@ int CO2Sensor::getCO2_Raw()
     delay(50);
   }
 
-  // we have 7 bytes ready to be read
-  for (int i = 0; i < responseSize; i++)
+  return readResponse();
+}
+
+// The ABC period is read right after a CO2 read and collected here, before
+// the next one goes out, so it never costs a round trip of its own.
+void CO2Sensor::collectAbcPeriod()
+{
+  if (_modbus.pending() && _modbus.function() == ModbusRtu::READ_HOLDING_REGISTERS)
   {
-    CO2Response[i] = _stream->read();
-    if ((CO2Response[i] == 0xFE) && (datapos == -1))
+    if (_modbus.poll() == ModbusRtu::OK)
     {
-      datapos = i;
+      _abcPeriod = _modbus.getRegister(0);
     }
-    Serial.print(CO2Response[i], HEX);
-    Serial.print(":");
   }
-  return CO2Response[datapos + 3] * 256 + CO2Response[datapos + 4];
-}
\ No newline at end of file
+}
+
+// Send the read command without waiting for the response.
+bool CO2Sensor::requestRead()
+{
+  collectAbcPeriod();
+  _result = ModbusRtu::PENDING;
+  if (!_modbus.request(ModbusRtu::READ_INPUT_REGISTERS, STATUS_REGISTER, READ_REGISTERS))
+  {
+    _result = ModbusRtu::WRITE_ERROR;
+  }
+  return _result == ModbusRtu::PENDING;
+}
+
+bool CO2Sensor::responseAvailable()
+{
+  if (_result == ModbusRtu::PENDING)
+  {
+    _result = _modbus.poll();
+  }
+  return _result != ModbusRtu::PENDING;
+}
+
+// Parse the response once responseAvailable() returns true. Failures are
+// -2 write failed, -3 no response yet, -4 malformed frame, -6 CRC mismatch
+// and -7 Modbus exception.
+int CO2Sensor::readResponse()
+{
+  switch (_result)
+  {
+  case ModbusRtu::OK:
+    break;
+  case ModbusRtu::WRITE_ERROR:
+  case ModbusRtu::IDLE:
+    return -2;
+  case ModbusRtu::PENDING:
+    return -3;
+  case ModbusRtu::FRAME_ERROR:
+    return -4;
+  case ModbusRtu::CRC_ERROR:
+    return -6;
+  case ModbusRtu::EXCEPTION:
+    return -7;
+  }
+  _result = ModbusRtu::IDLE;
+
+  _status = _modbus.getRegister(0);
+  int co2 = _modbus.getRegister(CO2_INDEX);
+
+  if (_abcPeriod < 0 || ++_readsSinceAbc >= ABC_REFRESH_READS)
+  {
+    _readsSinceAbc = 0;
+    _modbus.request(ModbusRtu::READ_HOLDING_REGISTERS, ABC_PERIOD_REGISTER, 1);
+  }
+  return co2;
+}
+
+uint16_t CO2Sensor::getStatus() const
+{
+  return _status;
+}
+
+int CO2Sensor::getAbcPeriod() const
+{
+  return _abcPeriod;
+}
+
+const ModbusRtu::Counters &CO2Sensor::getCounters() const
+{
+  return _modbus.counters();
+}
+
+LinkCounters CO2Sensor::getLinkCounters() const
+{
+  const ModbusRtu::Counters &modbus = _modbus.counters();
+  LinkCounters counters = {};
+  counters.frames = modbus.responses;
+  counters.checksumErrors = modbus.crcErrors;
+  counters.resyncs = modbus.resyncs;
+  counters.discarded = modbus.discarded;
+  counters.timeouts = modbus.timeouts;
+  counters.overflows = modbus.overflows;
+  return counters;
+}
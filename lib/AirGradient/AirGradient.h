@@ -8,7 +8,9 @@
 #define AirGradient_h
 
 #include <Print.h>
+#include <stddef.h>
 #include "Stream.h"
+#include "ModbusRtu.h"
 
 // ENUMS STRUCTS FOR CO2 START
 struct CO2_READ_RESULT
@@ -18,9 +20,34 @@ struct CO2_READ_RESULT
 };
 // ENUMS STRUCTS FOR CO2 END
 
+// Health of a sensor's serial link, running totals since boot.
+struct LinkCounters
+{
+  uint32_t frames;
+  uint32_t checksumErrors;
+  // headers that didn't check out, so parsing started over
+  uint32_t resyncs;
+  // bytes skipped outside of frames
+  uint32_t discarded;
+  // reads requested again before the last one was answered
+  uint32_t timeouts;
+  // frames longer than the receive buffer
+  uint32_t overflows;
+};
+
+// Plantower models by frame layout, see PmsLayout below.
+enum class PmsModel : uint8_t
+{
+  PMS5003,
+  PMS5003T,
+  PMS5003ST,
+  PMSA003
+};
+
 class PMS
 {
 public:
+  // Fields the model doesn't report stay 0.
   struct Data
   {
     // Standard Particles, CF=1
@@ -41,14 +68,17 @@ public:
     uint16_t PM_RAW_5_0;
     uint16_t PM_RAW_10_0;
 
-    // Formaldehyde (HCHO) concentration in mg/m^3 - PMSxxxxST units only
+    // Formaldehyde (HCHO) in ug/m^3, the sensor sends mg/m^3 x 1000 - PMS5003ST only
     uint16_t AMB_HCHO;
 
-    // Temperature & humidity - PMSxxxxST units only
+    // Temperature & humidity in tenths of a degree and percent - PMS5003T/ST only
     int16_t PM_TMP;
     uint16_t PM_HUM;
   };
 
+  // Data words of the longest frame, the PMS5003ST's 17
+  static const uint8_t MAX_PAYLOAD = 2 * 17;
+
 private:
   static const uint16_t SINGLE_RESPONSE_TIME = 1000;
   static const uint16_t TOTAL_RESPONSE_TIME = 1000 * 10;
@@ -67,9 +97,15 @@ private:
     MODE_PASSIVE
   };
 
-  uint8_t _payload[32];
+  // the frame after its length, decoded in place once the checksum matches
+  uint8_t _payload[MAX_PAYLOAD];
   Stream *_stream;
-  Data _data;
+  Data _data = {};
+  uint16_t _modelFrameLen = 0;
+  void (*_decode)(const uint8_t *payload, Data &data) = nullptr;
+  LinkCounters _counters = {};
+  bool _awaiting = false;
+  void dropHeader();
   STATUS _PMSstatus;
   MODE _mode = MODE_ACTIVE;
 
@@ -84,7 +120,8 @@ private:
 
 public:
   PMS();
-  void init(Stream &);
+  // Frames of any other length than the model's are dropped.
+  void init(Stream &, PmsModel model = PmsModel::PMS5003);
   void sleep();
   void wakeUp();
   void activeMode();
@@ -94,18 +131,131 @@ public:
   bool readPMS();
   bool readUntil(uint16_t timeout = SINGLE_RESPONSE_TIME);
   const Data& getData() const;
+  const LinkCounters &getCounters() const;
+};
+
+// A value in a PMS frame: the index of its data word after the frame length,
+// and where it goes in PMS::Data. PM_TMP is the only signed one, stored as
+// the same 16 bits.
+struct PmsField
+{
+  uint8_t word;
+  uint8_t offset;
+};
+
+#define PMS_FIELD(word, name) PmsField{word, offsetof(PMS::Data, name)}
+
+template <PmsModel model>
+struct PmsLayout;
+
+template <>
+struct PmsLayout<PmsModel::PMS5003>
+{
+  // data words and checksum, word 12 is reserved
+  static constexpr uint16_t frameLength = 2 * 13 + 2;
+  static constexpr PmsField fields[] = {
+    PMS_FIELD(0, PM_SP_UG_1_0), PMS_FIELD(1, PM_SP_UG_2_5), PMS_FIELD(2, PM_SP_UG_10_0),
+    PMS_FIELD(3, PM_AE_UG_1_0), PMS_FIELD(4, PM_AE_UG_2_5), PMS_FIELD(5, PM_AE_UG_10_0),
+    PMS_FIELD(6, PM_RAW_0_3), PMS_FIELD(7, PM_RAW_0_5), PMS_FIELD(8, PM_RAW_1_0),
+    PMS_FIELD(9, PM_RAW_2_5), PMS_FIELD(10, PM_RAW_5_0), PMS_FIELD(11, PM_RAW_10_0)
+  };
+};
+
+// same frame as the PMS5003
+template <>
+struct PmsLayout<PmsModel::PMSA003> : PmsLayout<PmsModel::PMS5003>
+{
+};
+
+// temperature and humidity in place of the 5.0 and 10 um counts
+template <>
+struct PmsLayout<PmsModel::PMS5003T>
+{
+  static constexpr uint16_t frameLength = 2 * 13 + 2;
+  static constexpr PmsField fields[] = {
+    PMS_FIELD(0, PM_SP_UG_1_0), PMS_FIELD(1, PM_SP_UG_2_5), PMS_FIELD(2, PM_SP_UG_10_0),
+    PMS_FIELD(3, PM_AE_UG_1_0), PMS_FIELD(4, PM_AE_UG_2_5), PMS_FIELD(5, PM_AE_UG_10_0),
+    PMS_FIELD(6, PM_RAW_0_3), PMS_FIELD(7, PM_RAW_0_5), PMS_FIELD(8, PM_RAW_1_0),
+    PMS_FIELD(9, PM_RAW_2_5), PMS_FIELD(10, PM_TMP), PMS_FIELD(11, PM_HUM)
+  };
 };
 
+// the PMS5003 frame plus formaldehyde, temperature and humidity, then a
+// reserved word and the firmware version and error code
+template <>
+struct PmsLayout<PmsModel::PMS5003ST>
+{
+  static constexpr uint16_t frameLength = 2 * 17 + 2;
+  static constexpr PmsField fields[] = {
+    PMS_FIELD(0, PM_SP_UG_1_0), PMS_FIELD(1, PM_SP_UG_2_5), PMS_FIELD(2, PM_SP_UG_10_0),
+    PMS_FIELD(3, PM_AE_UG_1_0), PMS_FIELD(4, PM_AE_UG_2_5), PMS_FIELD(5, PM_AE_UG_10_0),
+    PMS_FIELD(6, PM_RAW_0_3), PMS_FIELD(7, PM_RAW_0_5), PMS_FIELD(8, PM_RAW_1_0),
+    PMS_FIELD(9, PM_RAW_2_5), PMS_FIELD(10, PM_RAW_5_0), PMS_FIELD(11, PM_RAW_10_0),
+    PMS_FIELD(12, AMB_HCHO), PMS_FIELD(13, PM_TMP), PMS_FIELD(14, PM_HUM)
+  };
+};
+
+#undef PMS_FIELD
+
+/**
+ * Decodes a frame with a checksum already checked straight out of the
+ * receive buffer, into only the fields the model reports.
+ */
+template <PmsModel model>
+void decodePmsFrame(const uint8_t *payload, PMS::Data &data)
+{
+  using Layout = PmsLayout<model>;
+  static_assert(Layout::frameLength - 2 <= PMS::MAX_PAYLOAD, "frame doesn't fit the receive buffer");
+  for (const PmsField &field : Layout::fields)
+  {
+    uint16_t value = makeWord(payload[2 * field.word], payload[2 * field.word + 1]);
+    memcpy(reinterpret_cast<uint8_t *>(&data) + field.offset, &value, sizeof(value));
+  }
+}
+
+// SenseAir S8 over Modbus RTU
 class CO2Sensor
 {
+  static const uint8_t ADDRESS = 0xFE; // any sensor
+
+  // IR1..IR4 are meter status, alarm status, output status and CO2
+  static const uint16_t STATUS_REGISTER = 0x0000;
+  static const uint8_t READ_REGISTERS = 4;
+  static const uint8_t CO2_INDEX = 3;
+  // HR32 is the ABC period in hours, 0 when ABC is disabled
+  static const uint16_t ABC_PERIOD_REGISTER = 0x001F;
+  // re-read the ABC period about hourly at one read per 5 seconds
+  static const uint16_t ABC_REFRESH_READS = 720;
+
   Stream *_stream;
   char Char_CO2[10];
 
+  ModbusRtu _modbus;
+  ModbusRtu::Result _result = ModbusRtu::IDLE;
+  uint16_t _status = 0;
+  int _abcPeriod = -1;
+  uint16_t _readsSinceAbc = 0;
+
+  void collectAbcPeriod();
+
 public:
   CO2Sensor();
   void init(Stream &);
   int getCO2(int numberOfSamplesToTake = 5);
   int getCO2_Raw();
+
+  // Non-blocking halves of getCO2_Raw()
+  bool requestRead();
+  bool responseAvailable();
+  int readResponse();
+
+  // Meter status from the last good read, 0 when the sensor is healthy
+  uint16_t getStatus() const;
+  // ABC period in hours, 0 when disabled, -1 until it has been read
+  int getAbcPeriod() const;
+  const ModbusRtu::Counters &getCounters() const;
+  // the Modbus counters as PMS reports its own
+  LinkCounters getLinkCounters() const;
 };
 
 #endif
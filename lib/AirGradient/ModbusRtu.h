@@ -0,0 +1,93 @@
+/*
+  ModbusRtu.h - non-blocking Modbus RTU master for a single device on a Stream.
+
+  request() sends a read, then poll() is called as often as convenient and
+  consumes whatever bytes have arrived. It reports PENDING until a whole
+  response frame is in, then the outcome. Frames are checked for address,
+  function, length and CRC. Each kind of failure has its own counter, a
+  response too long for the frame buffer counts as an overflow rather than
+  a frame error.
+*/
+
+#ifndef ModbusRtu_h
+#define ModbusRtu_h
+
+#include <Arduino.h>
+#include "Stream.h"
+
+// CRC-16/MODBUS, table driven. Sent low byte first.
+uint16_t modbusCrc16(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF);
+
+class ModbusRtu
+{
+public:
+  static const uint8_t READ_HOLDING_REGISTERS = 0x03;
+  static const uint8_t READ_INPUT_REGISTERS = 0x04;
+  static const uint8_t MAX_REGISTERS = 8;
+
+  enum Result
+  {
+    IDLE,
+    PENDING,
+    OK,
+    WRITE_ERROR,
+    FRAME_ERROR,
+    CRC_ERROR,
+    EXCEPTION
+  };
+
+  struct Counters
+  {
+    uint32_t requests;
+    uint32_t responses;
+    // requests replaced by a new one before their response arrived
+    uint32_t timeouts;
+    uint32_t writeErrors;
+    uint32_t frameErrors;
+    uint32_t crcErrors;
+    uint32_t exceptions;
+    // stray bytes skipped while looking for our address
+    uint32_t discarded;
+    // runs of stray bytes, each ended by finding the address
+    uint32_t resyncs;
+    // responses announcing more registers than fit the frame
+    uint32_t overflows;
+  };
+
+private:
+  static const uint8_t HEADER_SIZE = 3;
+  static const uint8_t CRC_SIZE = 2;
+  static const uint8_t FRAME_SIZE = HEADER_SIZE + 2 * MAX_REGISTERS + CRC_SIZE;
+
+  Stream *_stream = nullptr;
+  uint8_t _address = 0xFE;
+  uint8_t _function = 0;
+  uint8_t _count = 0;
+  bool _pending = false;
+
+  uint8_t _frame[FRAME_SIZE];
+  uint8_t _length = 0;
+  bool _skipping = false;
+  uint8_t _exception = 0;
+  Counters _counters = {};
+
+  uint8_t expectedLength() const;
+  Result finish();
+
+public:
+  void begin(Stream &stream, uint8_t address);
+
+  // Send a read of count registers starting at start. Anything still on the
+  // wire from an earlier request is dropped.
+  bool request(uint8_t function, uint16_t start, uint16_t count);
+  Result poll();
+
+  bool pending() const { return _pending; }
+  uint8_t function() const { return _function; }
+  uint8_t registerCount() const { return _count; }
+  uint16_t getRegister(uint8_t index) const;
+  uint8_t exceptionCode() const { return _exception; }
+  const Counters &counters() const { return _counters; }
+};
+
+#endif
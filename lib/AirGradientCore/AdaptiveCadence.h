@@ -0,0 +1,78 @@
+/*
+  AdaptiveCadence.h - picks a sensor's sampling interval from how fast its
+  readings move.
+
+  After each read the driver compares every variable it publishes with the
+  previous reading of that variable, then calls decide(). A variable moved
+  if it changed by its threshold or more, which should be a little above the
+  sensor's noise. Any movement drops the interval straight to the fastest,
+  and stableReads quiet reads in a row double it, up to the slowest. A still
+  room then costs a read every slowest interval, an event is followed at the
+  fastest rate within one slow interval, and a slow drift settles at about
+  the interval over which it moves by its threshold.
+*/
+
+#ifndef AdaptiveCadence_h
+#define AdaptiveCadence_h
+
+#include <Arduino.h>
+#include <algorithm>
+
+class AdaptiveCadence
+{
+  uint32_t fastestMs;
+  uint32_t slowestMs;
+  uint32_t interval;
+  uint32_t lastRead = 0;
+  uint32_t meanGap;
+  bool moved = false;
+  uint8_t quietReads = 0;
+  bool first = true;
+
+  public:
+    static constexpr uint8_t stableReads = 3;
+
+    // interval changes, to the fastest and towards the slowest
+    uint32_t bursts = 0;
+    uint32_t backoffs = 0;
+
+    AdaptiveCadence(uint32_t fastest, uint32_t slowest)
+      : fastestMs(fastest), slowestMs(slowest), interval(fastest), meanGap(fastest) {}
+
+    void compare(int32_t value, int32_t previous, uint16_t threshold) {
+      const uint32_t delta = value > previous ? value - previous : previous - value;
+      moved = moved || delta >= threshold;
+    }
+
+    void decide(uint32_t now) {
+      const uint32_t gap = now - lastRead;
+      if (!first) {
+        meanGap = meanGap - meanGap / 8 + gap / 8;
+        if (moved) {
+          quietReads = 0;
+          if (interval > fastestMs) {
+            interval = fastestMs;
+            ++bursts;
+          }
+        } else if (++quietReads >= stableReads && interval < slowestMs) {
+          quietReads = 0;
+          interval = std::min(interval * 2, slowestMs);
+          ++backoffs;
+        }
+      }
+      first = false;
+      lastRead = now;
+      moved = false;
+    }
+
+    uint32_t intervalMs() const {
+      return interval;
+    }
+
+    // average time between reads, the rate the schedule actually achieved
+    uint32_t sampleMs() const {
+      return meanGap;
+    }
+};
+
+#endif
@@ -0,0 +1,93 @@
+/*
+  AirBoard.h - compile-time traits for each AirGradient board.
+
+  Each platformio env defines one AG_BOARD_* flag and the shared code asks
+  `Board` what the hardware and settings look like, so the parts a board
+  doesn't use are compiled out instead of carried along.
+*/
+
+#ifndef AirBoard_h
+#define AirBoard_h
+
+#include <Arduino.h>
+
+/**
+ * Placeholder history for boards without a sparkline on their display.
+ */
+struct NoHistory
+{
+};
+
+#if defined(AG_BOARD_DIY_PRO_V4_2)
+
+#include "SparkHistory.h"
+
+struct DiyProV42Board
+{
+  // 5 minutes of 5 second samples
+  static constexpr uint16_t historyLength = 60;
+  using History = SparkHistory<uint16_t, historyLength>;
+
+  // a record in flash every 5 seconds, see AirHistory.h
+  static constexpr bool hasSampleStore = true;
+  static constexpr const char* recordFields =
+    "rco2,pm01,pm02,pm10,pm003_count,tvoc_index,nox_index,kelvin_hundredths,rhum";
+
+  static constexpr bool hasUnitSettings = true;
+  static constexpr bool hasSparkInterval = true;
+  static constexpr bool hasAverageWindow = false;
+
+  // which dead-bands the portal offers, see AirReport.h
+  static constexpr bool hasCo2 = true;
+  static constexpr bool hasGasIndex = true;
+};
+using Board = DiyProV42Board;
+
+#elif defined(AG_BOARD_DIY_BASIC)
+
+struct DiyBasicBoard
+{
+  using History = NoHistory;
+  static constexpr uint16_t historyLength = 0;
+
+  static constexpr bool hasSampleStore = false;
+  static constexpr const char* recordFields = "";
+
+  static constexpr bool hasUnitSettings = true;
+  static constexpr bool hasSparkInterval = false;
+  static constexpr bool hasAverageWindow = false;
+
+  // which dead-bands the portal offers, see AirReport.h
+  static constexpr bool hasCo2 = true;
+  static constexpr bool hasGasIndex = false;
+};
+using Board = DiyBasicBoard;
+
+#elif defined(AG_BOARD_DIY_OUTDOOR_C3)
+
+struct DiyOutdoorC3Board
+{
+  using History = NoHistory;
+  static constexpr uint16_t historyLength = 0;
+
+  // a record of the window averages each time they are posted, temperature
+  // and humidity in tenths with the temperature as an int16_t
+  static constexpr bool hasSampleStore = true;
+  static constexpr const char* recordFields =
+    "pm01,pm02,pm10,pm003_count,atmp_tenths,rhum_tenths";
+
+  static constexpr bool hasUnitSettings = false;
+  static constexpr bool hasSparkInterval = false;
+  static constexpr bool hasAverageWindow = true;
+
+  // which dead-bands the portal offers, see AirReport.h
+  static constexpr bool hasCo2 = false;
+  static constexpr bool hasGasIndex = false;
+};
+using Board = DiyOutdoorC3Board;
+
+#else
+#error "Set one of AG_BOARD_DIY_PRO_V4_2, AG_BOARD_DIY_BASIC or AG_BOARD_DIY_OUTDOOR_C3 in build_flags"
+#endif
+
+#endif
@@ -0,0 +1,173 @@
+/*
+  AirCbor.h - a CBOR (RFC 8949) encoder that writes into a caller's buffer.
+*/
+
+#ifndef AirCbor_h
+#define AirCbor_h
+
+#include <Arduino.h>
+
+#include "AirFixed.h"
+#include "AirFlash.h"
+
+/**
+ * Writes CBOR items into a fixed buffer without allocating. Once something
+ * doesn't fit the writer stops and ok() turns false, so callers only need to
+ * check once at the end.
+ */
+class CborWriter
+{
+  uint8_t* buffer;
+  size_t capacity;
+  size_t length = 0;
+  bool overflow = false;
+
+  enum Major : uint8_t
+  {
+    UNSIGNED = 0,
+    NEGATIVE = 1,
+    BYTES = 2,
+    TEXT = 3,
+    ARRAY = 4,
+    MAP = 5,
+    TAG = 6,
+    SIMPLE = 7
+  };
+
+  // RFC 8949 3.4.4 and the IANA registered tag for embedded JSON
+  static const uint8_t decimalFractionTag = 4;
+  static const uint16_t embeddedJsonTag = 262;
+
+  bool reserve(size_t size) {
+    if (overflow || length + size > capacity) {
+      overflow = true;
+      return false;
+    }
+    return true;
+  }
+
+  void put(uint8_t byte) {
+    if (reserve(1)) {
+      buffer[length++] = byte;
+    }
+  }
+
+  // the initial byte and argument, in the shortest form as CBOR requires
+  void putHead(Major major, uint32_t value) {
+    const uint8_t type = major << 5;
+    if (value < 24) {
+      put(type | value);
+    } else if (value <= 0xFF) {
+      put(type | 24);
+      put(value);
+    } else if (value <= 0xFFFF) {
+      put(type | 25);
+      put(value >> 8);
+      put(value & 0xFF);
+    } else {
+      put(type | 26);
+      put(value >> 24);
+      put((value >> 16) & 0xFF);
+      put((value >> 8) & 0xFF);
+      put(value & 0xFF);
+    }
+  }
+
+  void putBytes(Major major, const char* data, size_t size) {
+    putHead(major, size);
+    if (reserve(size)) {
+      memcpy(buffer + length, data, size);
+      length += size;
+    }
+  }
+
+  public:
+    CborWriter(uint8_t* target, size_t size) : buffer(target), capacity(size) {}
+
+    // Maps are written with indefinite length so fields can be streamed.
+    void beginMap() {
+      put(MAP << 5 | 31);
+    }
+
+    void end() {
+      put(0xFF);
+    }
+
+    void integer(int32_t value) {
+      if (value >= 0) {
+        putHead(UNSIGNED, value);
+      } else {
+        // -1 - value without overflowing for INT32_MIN
+        putHead(NEGATIVE, static_cast<uint32_t>(-(value + 1)));
+      }
+    }
+
+    /**
+     * Whole numbers are plain integers, anything else a decimal fraction
+     * [exponent, mantissa] with trailing zeros dropped, so 21.5 is [-1, 215]
+     * and the value round trips exactly.
+     */
+    void fixed(Fixed value) {
+      int32_t mantissa = value.raw();
+      int32_t exponent = -3;
+      while (exponent < 0 && mantissa % 10 == 0) {
+        mantissa /= 10;
+        ++exponent;
+      }
+      if (exponent == 0) {
+        integer(mantissa);
+        return;
+      }
+      putHead(TAG, decimalFractionTag);
+      putHead(ARRAY, 2);
+      integer(exponent);
+      integer(mantissa);
+    }
+
+    void boolean(bool value) {
+      put(SIMPLE << 5 | (value ? 21 : 20));
+    }
+
+    void text(const char* data, size_t size) {
+      putBytes(TEXT, data, size);
+    }
+
+    void text(const String& value) {
+      text(value.c_str(), value.length());
+    }
+
+    void text(FlashString value) {
+      PGM_P p = flashPointer(value);
+      const size_t size = strlen_P(p);
+      putHead(TEXT, size);
+      if (reserve(size)) {
+        memcpy_P(buffer + length, p, size);
+        length += size;
+      }
+    }
+
+    // JSON that has no CBOR equivalent here, kept as tagged UTF-8 bytes
+    void embeddedJson(const String& json) {
+      putHead(TAG, embeddedJsonTag);
+      putBytes(BYTES, json.c_str(), json.length());
+    }
+
+    void reset() {
+      length = 0;
+      overflow = false;
+    }
+
+    bool ok() const {
+      return !overflow;
+    }
+
+    uint8_t* data() const {
+      return buffer;
+    }
+
+    size_t size() const {
+      return length;
+    }
+};
+
+#endif
@@ -0,0 +1,66 @@
+/*
+  AirConversions.h - unit conversions for the raw uint16_t measurements.
+*/
+
+#ifndef AirConversions_h
+#define AirConversions_h
+
+#include <Arduino.h>
+
+#include "AirFixed.h"
+
+using UnitConversionFunction = Fixed (*)(const uint16_t x);
+
+constexpr Fixed identity(const uint16_t val) {
+  return Fixed::fromInt(val);
+}
+
+// temperatures are stored as hundredths of a Kelvin to avoid using floats
+constexpr Fixed K_TO_C(const uint16_t kelvin_hundredths) {
+  return Fixed::fromHundredths(static_cast<int32_t>(kelvin_hundredths) - 27315);
+}
+constexpr Fixed K_TO_F(const uint16_t kelvin_hundredths) {
+  // hundredths of a degree C * 9 / 5 is exactly 18 thousandths of a degree F
+  return Fixed::fromThousandths((static_cast<int32_t>(kelvin_hundredths) - 27315) * 18 + 32000);
+}
+
+/**
+ * US EPA PM2.5 breakpoints, concentrations in tenths of a µg/m³. Each
+ * segment starts at the previous segment's upper concentration.
+ */
+struct AqiBreakpoint
+{
+  uint16_t concentration;
+  uint16_t index;
+};
+
+constexpr AqiBreakpoint AQI_US_BREAKPOINTS[] = {
+  {0, 0},
+  {120, 50},
+  {354, 100},
+  {554, 150},
+  {1504, 200},
+  {2504, 300},
+  {3504, 400},
+  {5004, 500},
+};
+
+// Calculate PM2.5 US AQI
+constexpr Fixed PM_TO_AQI_US(const uint16_t pm02) {
+  const int32_t concentration = static_cast<int32_t>(pm02) * 10;
+  for (size_t i = 1; i < sizeof(AQI_US_BREAKPOINTS) / sizeof(AQI_US_BREAKPOINTS[0]); i++) {
+    const AqiBreakpoint& low = AQI_US_BREAKPOINTS[i - 1];
+    const AqiBreakpoint& high = AQI_US_BREAKPOINTS[i];
+    if (concentration <= high.concentration) {
+      return Fixed::fromThousandths(
+        Fixed::divideRounded(
+          static_cast<int32_t>(high.index - low.index) * 1000 * (concentration - low.concentration),
+          high.concentration - low.concentration
+        ) + low.index * 1000
+      );
+    }
+  }
+  return Fixed::fromInt(500);
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include "AirEvents.h"
+#include "AirJson.h"
+#include "AirLog.h"
+#include "AirPortal.h"
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif
+
+// proxies and browsers give up on a silent stream after a minute or so
+static const uint32_t keepAliveMs = 15000;
+
+static WiFiClient subscribers[AG_EVENTS_MAX_SUBSCRIBERS];
+static uint32_t lastWrite = 0;
+
+void __attribute__((weak)) addVariables(JsonPayload& payload) {
+}
+
+static bool deliver(WiFiClient& client, const String& message) {
+#if defined(ESP8266)
+  // a client whose send window can't take the whole event is too slow
+  if (client.availableForWrite() < static_cast<int>(message.length())) {
+    return false;
+  }
+#endif
+  return client.write(reinterpret_cast<const uint8_t*>(message.c_str()), message.length()) == message.length();
+}
+
+static void broadcast(const String& message) {
+  for (WiFiClient& client : subscribers) {
+    if (!client.connected()) {
+      continue;
+    }
+    if (!deliver(client, message)) {
+      LOG_INFO("Dropping slow event subscriber");
+      client.stop();
+    }
+  }
+  lastWrite = millis();
+}
+
+uint8_t eventSubscribers() {
+  uint8_t count = 0;
+  for (WiFiClient& client : subscribers) {
+    if (client.connected()) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+void events_handleSubscribe() {
+  auto& server = wifiManager.server;
+  for (WiFiClient& slot : subscribers) {
+    if (slot.connected()) {
+      continue;
+    }
+    // keep our own reference to the connection, the server lets go of it
+    // once this handler returns
+    slot = server->client();
+    slot.setNoDelay(true);
+    slot.print(F(
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: text/event-stream\r\n"
+      "Cache-Control: no-cache\r\n"
+      "Connection: keep-alive\r\n"
+      "Access-Control-Allow-Origin: *\r\n"
+      "\r\n"
+    ));
+    LOG_INFO("Event subscriber %u connected", eventSubscribers());
+    return;
+  }
+  server->sendHeader(F("Retry-After"), F("10"));
+  server->send(503, "text/plain", F("Too many subscribers"));
+}
+
+void publishEvents(uint32_t id) {
+  if (eventSubscribers() == 0) {
+    return;
+  }
+  JsonPayload data;
+  // device uptime when the sample was published, for latency measurements
+  data.addRaw(F("t"), String(millis()));
+  addMeasurements(data);
+  addVariables(data);
+
+  String message;
+  message.reserve(400);
+  message += F("id: ");
+  message += id;
+  message += F("\ndata: ");
+  message += data.finish();
+  message += F("\n\n");
+  broadcast(message);
+}
+
+void processEvents() {
+  if (millis() - lastWrite >= keepAliveMs) {
+    broadcast(String(F(": keep-alive\n\n")));
+  }
+}
@@ -0,0 +1,30 @@
+/*
+  AirEvents.h - Server-Sent Events stream of new readings on /events.
+
+  Each time measurementsChanged() is called the current measurements are
+  pushed to every subscriber as one event, so dashboards see a sample as
+  soon as it is read instead of on their next poll. Subscribers are capped
+  at AG_EVENTS_MAX_SUBSCRIBERS and any that can't take a whole event right
+  away are disconnected rather than allowed to stall loop().
+*/
+
+#ifndef AirEvents_h
+#define AirEvents_h
+
+#include <Arduino.h>
+
+#ifndef AG_EVENTS_MAX_SUBSCRIBERS
+#define AG_EVENTS_MAX_SUBSCRIBERS 3
+#endif
+
+void events_handleSubscribe();
+
+// Send the current measurements as event id to every subscriber.
+void publishEvents(uint32_t id);
+
+// Call from loop(), sends keep-alives and forgets closed connections.
+void processEvents();
+
+uint8_t eventSubscribers();
+
+#endif
@@ -0,0 +1,124 @@
+/*
+  AirFixed.h - fixed point numbers for the ESP8266 and ESP32-C3, neither of
+  which has an FPU.
+*/
+
+#ifndef AirFixed_h
+#define AirFixed_h
+
+#include <Arduino.h>
+
+/**
+ * A signed number stored as an integer count of thousandths. Temperatures
+ * arrive as hundredths of a Kelvin, so Celsius and Fahrenheit are exact and
+ * the one rounding step happens when the value is formatted for display.
+ */
+class Fixed
+{
+  int32_t thousandths = 0;
+
+  constexpr explicit Fixed(int32_t value) : thousandths(value) {}
+
+  public:
+    constexpr Fixed() = default;
+
+    static constexpr Fixed fromInt(int32_t value) {
+      return Fixed(value * 1000);
+    }
+
+    static constexpr Fixed fromHundredths(int32_t value) {
+      return Fixed(value * 10);
+    }
+
+    static constexpr Fixed fromThousandths(int32_t value) {
+      return Fixed(value);
+    }
+
+    // numerator / denominator rounded half away from zero
+    static constexpr int32_t divideRounded(int64_t numerator, int64_t denominator) {
+      if (denominator < 0) {
+        numerator = -numerator;
+        denominator = -denominator;
+      }
+      return static_cast<int32_t>(
+        numerator >= 0
+          ? (numerator + denominator / 2) / denominator
+          : (numerator - denominator / 2) / denominator
+      );
+    }
+
+    // numerator / denominator to the nearest thousandth
+    static constexpr Fixed ratio(int64_t numerator, int64_t denominator) {
+      return Fixed(divideRounded(numerator * 1000, denominator));
+    }
+
+    constexpr int32_t raw() const {
+      return thousandths;
+    }
+
+    constexpr int32_t round() const {
+      return divideRounded(thousandths, 1000);
+    }
+
+    constexpr bool isInteger() const {
+      return thousandths % 1000 == 0;
+    }
+
+    constexpr bool operator==(Fixed other) const {
+      return thousandths == other.thousandths;
+    }
+
+    constexpr bool operator<(Fixed other) const {
+      return thousandths < other.thousandths;
+    }
+
+    /**
+     * Writes the value rounded to 0 to 3 decimals without going through
+     * printf. Returns the length, or 0 if it doesn't fit in size.
+     */
+    size_t format(char* buffer, size_t size, uint8_t decimals) const {
+      static const int32_t scale[] = {1000, 100, 10, 1};
+      decimals = decimals > 3 ? 3 : decimals;
+      int32_t value = divideRounded(thousandths, scale[decimals]);
+
+      char digits[16];
+      size_t count = 0;
+      uint32_t magnitude = value < 0 ? -static_cast<uint32_t>(value) : value;
+      // digits are produced least significant first
+      for (uint8_t i = 0; i < decimals; i++) {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+      }
+      if (decimals > 0) {
+        digits[count++] = '.';
+      }
+      do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+      } while (magnitude > 0);
+      if (value < 0) {
+        digits[count++] = '-';
+      }
+
+      if (count + 1 > size) {
+        if (size > 0) {
+          buffer[0] = '\0';
+        }
+        return 0;
+      }
+      for (size_t i = 0; i < count; i++) {
+        buffer[i] = digits[count - 1 - i];
+      }
+      buffer[count] = '\0';
+      return count;
+    }
+
+    // Two decimals, the same text String(float) produced for payloads.
+    String toString() const {
+      char buffer[16];
+      format(buffer, sizeof(buffer), 2);
+      return String(buffer);
+    }
+};
+
+#endif
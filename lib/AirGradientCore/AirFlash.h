@@ -0,0 +1,36 @@
+/*
+  AirFlash.h - helpers for constant strings kept in flash instead of DRAM.
+
+  On the ESP8266 string literals are copied into the ~40KB of DRAM at boot
+  unless they are declared PROGMEM, and PROGMEM data can only be read with
+  aligned 32 bit loads. These wrap the pgm_read/_P functions so labels,
+  JSON keys and portal HTML can stay in flash. On the ESP32 PROGMEM is a
+  no-op and these are plain string functions.
+*/
+
+#ifndef AirFlash_h
+#define AirFlash_h
+
+#include <Arduino.h>
+
+using FlashString = const __FlashStringHelper*;
+
+inline PGM_P flashPointer(FlashString str) {
+  return reinterpret_cast<PGM_P>(str);
+}
+
+inline bool equalsFlash(const char* ram, FlashString flash) {
+  return ram != nullptr && strcmp_P(ram, flashPointer(flash)) == 0;
+}
+
+/**
+ * Copy a flash string into a caller provided (usually stack) buffer for APIs
+ * that read strings a byte at a time, always null terminating it.
+ */
+inline const char* copyFlash(char* buffer, size_t size, FlashString flash) {
+  strncpy_P(buffer, flashPointer(flash), size - 1);
+  buffer[size - 1] = '\0';
+  return buffer;
+}
+
+#endif
@@ -0,0 +1,222 @@
+#include "AirHistory.h"
+#include "AirBoard.h"
+#include "AirLog.h"
+#include "AirPortal.h"
+#include "RecordRing.h"
+
+#if defined(ESP8266)
+#include <flash_hal.h>
+#else
+#include <esp_idf_version.h>
+#include <esp_partition.h>
+#endif
+
+#if defined(ESP8266)
+
+// The filesystem area of the flash layout, read and written a sector at a
+// time. Only the first megabyte of flash is memory mapped on the ESP8266, so
+// reads are always copied.
+class FlashRegion
+{
+  public:
+    static constexpr size_t sectorSize = FLASH_SECTOR_SIZE;
+
+    bool begin() {
+      return FS_PHYS_SIZE > 0;
+    }
+
+    size_t size() const {
+      return FS_PHYS_SIZE;
+    }
+
+    const uint8_t* map() const {
+      return nullptr;
+    }
+
+    bool read(size_t offset, void* out, size_t size) const {
+      return ESP.flashRead(FS_PHYS_ADDR + offset, static_cast<uint8_t*>(out), size);
+    }
+
+    bool write(size_t offset, const void* data, size_t size) {
+      return ESP.flashWrite(FS_PHYS_ADDR + offset, static_cast<const uint8_t*>(data), size);
+    }
+
+    bool eraseSector(size_t offset) {
+      return ESP.flashEraseSector((FS_PHYS_ADDR + offset) / sectorSize);
+    }
+};
+
+#else
+
+// The "history" data partition, memory mapped once so /history can send
+// records without copying them. The flash driver keeps the mapping coherent
+// with writes.
+class FlashRegion
+{
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_partition_mmap_handle_t handle;
+  static constexpr esp_partition_mmap_memory_t mmapData = ESP_PARTITION_MMAP_DATA;
+#else
+  spi_flash_mmap_handle_t handle;
+  static constexpr spi_flash_mmap_memory_t mmapData = SPI_FLASH_MMAP_DATA;
+#endif
+  const esp_partition_t* partition = nullptr;
+  const void* mapped = nullptr;
+
+  public:
+    static constexpr size_t sectorSize = 4096;
+
+    bool begin() {
+      partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "history");
+      if (partition == nullptr) {
+        return false;
+      }
+      if (esp_partition_mmap(partition, 0, partition->size, mmapData, &mapped, &handle) != ESP_OK) {
+        LOG_WARN("Couldn't map the history partition, copying reads");
+        mapped = nullptr;
+      }
+      return true;
+    }
+
+    size_t size() const {
+      return partition ? partition->size : 0;
+    }
+
+    const uint8_t* map() const {
+      return static_cast<const uint8_t*>(mapped);
+    }
+
+    bool read(size_t offset, void* out, size_t size) const {
+      if (mapped) {
+        memcpy(out, map() + offset, size);
+        return true;
+      }
+      return esp_partition_read(partition, offset, out, size) == ESP_OK;
+    }
+
+    bool write(size_t offset, const void* data, size_t size) {
+      return esp_partition_write(partition, offset, data, size) == ESP_OK;
+    }
+
+    bool eraseSector(size_t offset) {
+      return esp_partition_erase_range(partition, offset, sectorSize) == ESP_OK;
+    }
+};
+
+#endif
+
+static FlashRegion region;
+static RecordRing<FlashRegion> ring(region);
+static bool ready = false;
+// device time carries on from the newest record after a reboot
+static uint32_t timeBase = 0;
+
+static uint32_t deviceTime() {
+  return timeBase + millis() / 1000;
+}
+
+void setupHistory() {
+  if constexpr (!Board::hasSampleStore) {
+    return;
+  }
+  ready = region.begin() && ring.begin();
+  if (!ready) {
+    LOG_WARN("No flash region for history");
+    return;
+  }
+  if (ring.count() > 0) {
+    timeBase = ring.lastTime() + 1;
+  }
+  LOG_INFO(
+    "History: %u records in %u bytes of flash",
+    static_cast<unsigned>(ring.count()),
+    static_cast<unsigned>(region.size())
+  );
+}
+
+void recordSample(std::initializer_list<uint16_t> values) {
+  if (!ready) {
+    return;
+  }
+  SampleRecord record;
+  memset(&record, 0, sizeof(record));
+  record.time = deviceTime();
+  size_t i = 0;
+  for (uint16_t value : values) {
+    if (i < sizeof(record.values) / sizeof(record.values[0])) {
+      record.values[i++] = value;
+    }
+  }
+  if (!ring.append(record)) {
+    LOG_WARN("History write failed");
+  }
+}
+
+uint32_t historyRecords() {
+  return ready ? ring.count() : 0;
+}
+
+static uint32_t argNumber(const char* name) {
+  return strtoul(wifiManager.server->arg(name).c_str(), nullptr, 10);
+}
+
+void history_handleRequest() {
+  auto& server = wifiManager.server;
+  if (!ready) {
+    server->send(503, "text/plain", "No history storage");
+    return;
+  }
+
+  // the records selected by the query, as indexes oldest first
+  size_t first = 0;
+  size_t end = ring.count();
+  if (server->hasArg("after")) {
+    size_t index = ring.upperBoundSequence(argNumber("after"));
+    first = index > first ? index : first;
+  }
+  if (server->hasArg("since")) {
+    size_t index = ring.lowerBoundTime(argNumber("since"));
+    first = index > first ? index : first;
+  }
+  if (server->hasArg("until")) {
+    size_t index = ring.lowerBoundTime(argNumber("until"));
+    end = index < end ? index : end;
+  }
+  end = end > first ? end : first;
+
+  const size_t total = (end - first) * sizeof(SampleRecord);
+  size_t offset = first * sizeof(SampleRecord);
+  size_t length = total;
+
+  SampleRecord firstRecord;
+  server->sendHeader(F("Accept-Ranges"), F("bytes"));
+  server->sendHeader(F("X-Record-Fields"), Board::recordFields);
+  server->sendHeader(F("X-Device-Time"), String(deviceTime()));
+  if (first < end && ring.recordAt(first, firstRecord)) {
+    server->sendHeader(F("X-First-Sequence"), String(firstRecord.sequence));
+  }
+
+  int code = 200;
+  String range = server->header("Range");
+  if (range.length() > 0) {
+    size_t from;
+    size_t to;
+    if (!parseByteRange(range.c_str(), total, from, to)) {
+      server->sendHeader(F("Content-Range"), String(F("bytes */")) + total);
+      server->send(416);
+      return;
+    }
+    server->sendHeader(F("Content-Range"), String(F("bytes ")) + from + '-' + to + '/' + total);
+    offset += from;
+    length = to - from + 1;
+    code = 206;
+  }
+
+  server->setContentLength(length);
+  server->send(code, "application/octet-stream", "");
+  static uint8_t scratch[AG_HISTORY_CHUNK];
+  ring.stream(offset, length, scratch, sizeof(scratch), [&server](const uint8_t* data, size_t size) {
+    server->sendContent(reinterpret_cast<const char*>(data), size);
+    return server->client().connected();
+  });
+}
@@ -0,0 +1,41 @@
+/*
+  AirHistory.h - samples stored in flash and served on /history.
+
+  Each recorded sample is a 32 byte SampleRecord appended to a ring of flash
+  sectors: the "history" data partition on the ESP32, or the filesystem area
+  on the ESP8266, which these sketches don't mount. /history returns the raw
+  records oldest first as application/octet-stream, copied to the socket in
+  AG_HISTORY_CHUNK byte pieces, and on the ESP32 straight from memory mapped
+  flash. It takes these query parameters:
+
+    after=<sequence>  records with a higher sequence, for incremental pulls
+    since=<time>      records at or after this device time
+    until=<time>      records before this device time
+
+  and a single byte Range over the selected records. X-Record-Fields names
+  the values, X-First-Sequence is the first record's sequence and
+  X-Device-Time is the current device time.
+*/
+
+#ifndef AirHistory_h
+#define AirHistory_h
+
+#include <Arduino.h>
+#include <initializer_list>
+
+#ifndef AG_HISTORY_CHUNK
+#define AG_HISTORY_CHUNK 512
+#endif
+
+// Finds and scans the flash region, call once from setup().
+void setupHistory();
+
+// Append one record, values in the order of Board::recordFields.
+void recordSample(std::initializer_list<uint16_t> values);
+
+void history_handleRequest();
+
+// number of records stored
+uint32_t historyRecords();
+
+#endif
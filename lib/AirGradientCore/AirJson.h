@@ -0,0 +1,186 @@
+/*
+  AirJson.h - builds the flat JSON objects used for uploads and /metrics, or
+  the same fields as a CBOR map.
+*/
+
+#ifndef AirJson_h
+#define AirJson_h
+
+#include <Arduino.h>
+
+#include "AirCbor.h"
+#include "AirFixed.h"
+#include "AirFlash.h"
+
+/**
+ * Append a flash string as a quoted JSON string. Labels use Latin-1 for the
+ * display font, so bytes above 0x7F become \u00XX escapes.
+ */
+inline void appendJsonString(String& out, FlashString text) {
+  PGM_P p = flashPointer(text);
+  out += '"';
+  for (char c = pgm_read_byte(p); c != '\0'; c = pgm_read_byte(++p)) {
+    uint8_t byte = static_cast<uint8_t>(c);
+    if (byte >= 0x80 || byte < 0x20 || c == '"' || c == '\\') {
+      char escape[7];
+      snprintf(escape, sizeof(escape), "\\u%04x", byte);
+      out += escape;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+class JsonPayload
+{
+  public:
+    // receives each field instead of the JSON body, values unquoted
+    using FieldCallback = void (*)(FlashString key, const String& value, void* context);
+
+  private:
+    String body;
+    bool empty = true;
+    FieldCallback callback = nullptr;
+    void* context = nullptr;
+    CborWriter* cbor = nullptr;
+
+    void addKey(FlashString key) {
+      body += empty ? F("{\"") : F(", \"");
+      body += key;
+      body += F("\":");
+      empty = false;
+    }
+
+  public:
+    JsonPayload() {
+      body.reserve(320);
+    }
+
+    // Hands every field to callback rather than building JSON.
+    JsonPayload(FieldCallback fieldCallback, void* fieldContext)
+      : callback(fieldCallback),
+        context(fieldContext)
+    {}
+
+    // Writes the fields as a CBOR map into writer, numbers stay numbers.
+    explicit JsonPayload(CborWriter& writer) : cbor(&writer) {
+      writer.beginMap();
+    }
+
+    // The platform API expects measurements as quoted strings.
+    JsonPayload& add(FlashString key, const String& value) {
+      if (callback) {
+        callback(key, value, context);
+      } else if (cbor) {
+        cbor->text(key);
+        cbor->text(value);
+      } else {
+        addKey(key);
+        body += '"';
+        body += value;
+        body += '"';
+      }
+      return *this;
+    }
+
+    // A measurement, quoted in JSON like the other platform fields.
+    JsonPayload& add(FlashString key, int32_t value) {
+      if (cbor) {
+        cbor->text(key);
+        cbor->integer(value);
+        return *this;
+      }
+      return add(key, String(value));
+    }
+
+    JsonPayload& add(FlashString key, Fixed value) {
+      if (cbor) {
+        cbor->text(key);
+        cbor->fixed(value);
+        return *this;
+      }
+      return add(key, value.toString());
+    }
+
+    // Numbers, nested objects and anything else already valid JSON.
+    JsonPayload& addRaw(FlashString key, const String& value) {
+      if (callback) {
+        callback(key, value, context);
+      } else if (cbor) {
+        cbor->text(key);
+        cbor->embeddedJson(value);
+      } else {
+        addKey(key);
+        body += value;
+      }
+      return *this;
+    }
+
+    // An unquoted number, for values that aren't platform measurements.
+    JsonPayload& addRaw(FlashString key, int32_t value) {
+      if (cbor) {
+        cbor->text(key);
+        cbor->integer(value);
+        return *this;
+      }
+      return addRaw(key, String(value));
+    }
+
+    JsonPayload& addRaw(FlashString key, Fixed value) {
+      if (cbor) {
+        cbor->text(key);
+        cbor->fixed(value);
+        return *this;
+      }
+      return addRaw(key, value.toString());
+    }
+
+    JsonPayload& addFlag(FlashString key, bool value) {
+      if (cbor) {
+        cbor->text(key);
+        cbor->boolean(value);
+        return *this;
+      }
+      return addRaw(key, value ? F("true") : F("false"));
+    }
+
+    // In CBOR mode this closes the map and the body is in the writer.
+    const String& finish() {
+      if (cbor) {
+        cbor->end();
+        return body;
+      }
+      body += empty ? F("{}") : F("}");
+      empty = true;
+      return body;
+    }
+};
+
+/**
+ * Implemented by each sketch, adds the board's current measurements using the
+ * platform field names (rco2, pm02, atmp, ...). Keys are flash strings, so
+ * pass them with F().
+ */
+void addMeasurements(JsonPayload& payload);
+
+/**
+ * Optionally implemented by a sketch to add health and timing values to
+ * /metrics only, they are never uploaded. The default adds nothing.
+ */
+void addDiagnostics(JsonPayload& payload);
+
+/**
+ * Optionally implemented by a sketch to add its sensors' serial link
+ * counters, to /metrics and to uploads, so a degrading cable shows up across
+ * the fleet. The default adds nothing.
+ */
+void addLinkHealth(JsonPayload& payload);
+
+/**
+ * Optionally implemented by boards with a display to add the values as shown
+ * on screen to the /events stream. The default adds nothing.
+ */
+void addVariables(JsonPayload& payload);
+
+#endif
@@ -0,0 +1,223 @@
+#include "AirLiveness.h"
+#include "AirLog.h"
+
+#if defined(ESP32)
+#include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+struct Task
+{
+  const char* name;
+  uint32_t deadlineMs;
+  volatile uint32_t lastProgress;
+};
+
+static Task tasks[AG_LIVENESS_MAX_TASKS];
+static uint8_t taskCount = 0;
+static int feedPin = -1;
+static uint32_t lastFeed = 0;
+static bool pulsing = false;
+static StallRecord previous;
+
+// Written by the checker, read by livenessService() for logging. On the
+// ESP32 they are on different tasks and the log buffer has one producer.
+static const uint8_t none = AG_LIVENESS_MAX_TASKS;
+static volatile uint8_t stalled = none;
+static volatile uint32_t stalledMs = 0;
+static volatile uint32_t stalls = 0;
+static volatile uint32_t recovered = 0;
+static uint32_t lastSave = 0;
+
+// a running stall is saved again this often, so the record has its length
+static const uint32_t saveIntervalMs = 5000;
+
+#if defined(ESP32)
+
+// NVS, an external watchdog resets the whole chip including RTC memory
+static void save(const StallRecord& record) {
+  Preferences store;
+  if (store.begin("liveness", false)) {
+    store.putBytes("stall", &record, sizeof(record));
+    store.end();
+  }
+}
+
+static bool restore(StallRecord& record) {
+  Preferences store;
+  if (!store.begin("liveness", false)) {
+    return false;
+  }
+  bool found = store.getBytes("stall", &record, sizeof(record)) == sizeof(record);
+  store.end();
+  return found;
+}
+
+static void erase() {
+  Preferences store;
+  if (store.begin("liveness", false)) {
+    store.remove("stall");
+    store.end();
+  }
+}
+
+#else
+
+// RTC user memory survives the watchdog resets a stall ends in
+struct RtcStall
+{
+  uint32_t magic;
+  StallRecord record;
+};
+static const uint32_t rtcMagic = 0x53544C4C;
+
+static void save(const StallRecord& record) {
+  RtcStall stored = {rtcMagic, record};
+  ESP.rtcUserMemoryWrite(0, reinterpret_cast<uint32_t*>(&stored), sizeof(stored));
+}
+
+static bool restore(StallRecord& record) {
+  RtcStall stored;
+  if (!ESP.rtcUserMemoryRead(0, reinterpret_cast<uint32_t*>(&stored), sizeof(stored)) || stored.magic != rtcMagic) {
+    return false;
+  }
+  record = stored.record;
+  return true;
+}
+
+static void erase() {
+  RtcStall stored = {};
+  ESP.rtcUserMemoryWrite(0, reinterpret_cast<uint32_t*>(&stored), sizeof(stored));
+}
+
+#endif
+
+LivenessTask livenessRegister(const char* name, uint32_t deadlineMs) {
+  if (taskCount == AG_LIVENESS_MAX_TASKS) {
+    return none;
+  }
+  tasks[taskCount] = {name, deadlineMs, millis()};
+  return taskCount++;
+}
+
+void livenessProgress(LivenessTask task) {
+  if (task < taskCount) {
+    tasks[task].lastProgress = millis();
+  }
+}
+
+/**
+ * Feeds the watchdog if every task is within its deadline, otherwise saves
+ * the first overdue task. The feed pulse lasts until the next check.
+ */
+static void check() {
+  const uint32_t now = millis();
+  if (pulsing) {
+    digitalWrite(feedPin, LOW);
+    pulsing = false;
+  }
+
+  uint8_t overdue = none;
+  for (uint8_t i = 0; i < taskCount; i++) {
+    if (now - tasks[i].lastProgress > tasks[i].deadlineMs) {
+      overdue = i;
+      break;
+    }
+  }
+
+  if (overdue == none) {
+    if (stalled != none) {
+      erase();
+      stalled = none;
+      ++recovered;
+    }
+    if (now - lastFeed >= AG_LIVENESS_FEED_MS) {
+      digitalWrite(feedPin, HIGH);
+      pulsing = true;
+      lastFeed = now;
+    }
+    return;
+  }
+
+  stalledMs = now - tasks[overdue].lastProgress;
+  if (overdue != stalled || now - lastSave >= saveIntervalMs) {
+    StallRecord record = {};
+    strncpy(record.task, tasks[overdue].name, sizeof(record.task) - 1);
+    record.stalledMs = stalledMs;
+    record.uptimeMs = now;
+    save(record);
+    lastSave = now;
+    if (overdue != stalled) {
+      stalled = overdue;
+      ++stalls;
+    }
+  }
+}
+
+#if defined(ESP32)
+static void monitor(void*) {
+  while (true) {
+    check();
+    vTaskDelay(pdMS_TO_TICKS(50));
+  }
+}
+#endif
+
+void setupLiveness(uint8_t pin) {
+  if (restore(previous)) {
+    previous.task[sizeof(previous.task) - 1] = '\0';
+    LOG_WARN(
+      "Watchdog reset: %s made no progress for %lu ms, %lu s after boot",
+      previous.task,
+      static_cast<unsigned long>(previous.stalledMs),
+      static_cast<unsigned long>(previous.uptimeMs / 1000)
+    );
+    erase();
+  }
+
+  feedPin = pin;
+  pinMode(feedPin, OUTPUT);
+  digitalWrite(feedPin, LOW);
+
+  // setup() can take minutes in the WiFi portal, deadlines start from here
+  const uint32_t now = millis();
+  for (uint8_t i = 0; i < taskCount; i++) {
+    tasks[i].lastProgress = now;
+  }
+  lastFeed = now - AG_LIVENESS_FEED_MS;
+
+#if defined(ESP32)
+  // loop() runs at priority 1
+  xTaskCreate(monitor, "liveness", 4096, nullptr, 2, nullptr);
+#endif
+}
+
+void livenessService() {
+#if !defined(ESP32)
+  if (feedPin >= 0) {
+    check();
+  }
+#endif
+  static uint32_t loggedStalls = 0;
+  static uint32_t loggedRecoveries = 0;
+  if (stalls != loggedStalls) {
+    loggedStalls = stalls;
+    uint8_t task = stalled;
+    if (task != none) {
+      LOG_ERROR("%s made no progress for %lu ms, not feeding the watchdog", tasks[task].name, static_cast<unsigned long>(stalledMs));
+    }
+  }
+  if (recovered != loggedRecoveries) {
+    loggedRecoveries = recovered;
+    LOG_WARN("Stalled task recovered, feeding the watchdog again");
+  }
+}
+
+const StallRecord& lastStall() {
+  return previous;
+}
+
+uint32_t recoveredStalls() {
+  return recovered;
+}
@@ -0,0 +1,57 @@
+/*
+  AirLiveness.h - feeds an external watchdog only while every registered
+  task keeps making progress, and remembers which one stalled across the
+  reset that follows.
+*/
+
+#ifndef AirLiveness_h
+#define AirLiveness_h
+
+#include <Arduino.h>
+
+#ifndef AG_LIVENESS_MAX_TASKS
+#define AG_LIVENESS_MAX_TASKS 4
+#endif
+
+// how often the watchdog is fed while every task is on time
+#ifndef AG_LIVENESS_FEED_MS
+#define AG_LIVENESS_FEED_MS 1000
+#endif
+
+using LivenessTask = uint8_t;
+
+/**
+ * Registers a task that has to call livenessProgress() at least every
+ * deadlineMs. Call before setupLiveness(). Returns AG_LIVENESS_MAX_TASKS
+ * once the table is full, which livenessProgress() ignores.
+ */
+LivenessTask livenessRegister(const char* name, uint32_t deadlineMs);
+
+void livenessProgress(LivenessTask task);
+
+/**
+ * Logs a stall saved before the last reset and starts pulsing feedPin.
+ * On the ESP32 the deadlines are checked by a FreeRTOS task above loop()'s
+ * priority, so a loop() that never returns is caught as well. The ESP8266
+ * has no preemption and checks in livenessService() instead.
+ */
+void setupLiveness(uint8_t feedPin);
+
+// Call from every loop() iteration, logs stalls and recoveries.
+void livenessService();
+
+struct StallRecord
+{
+  char task[16];
+  // how long the task had gone without progress when last saved
+  uint32_t stalledMs;
+  uint32_t uptimeMs;
+};
+
+// The stall the watchdog reset this device for, task is empty if none.
+const StallRecord& lastStall();
+
+// stalls that cleared up before the watchdog fired
+uint32_t recoveredStalls();
+
+#endif
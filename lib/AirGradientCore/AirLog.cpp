@@ -0,0 +1,106 @@
+#include "AirLog.h"
+
+#include <algorithm>
+#include <stdarg.h>
+
+static_assert(
+  (AG_LOG_BUFFER_SIZE & (AG_LOG_BUFFER_SIZE - 1)) == 0,
+  "AG_LOG_BUFFER_SIZE must be a power of two"
+);
+
+static const uint16_t ringMask = AG_LOG_BUFFER_SIZE - 1;
+
+static char ring[AG_LOG_BUFFER_SIZE];
+// head is only written by the producer, tail only by logDrain(). Both boards
+// are single core, so a compiler barrier is all the ordering needed.
+static volatile uint16_t head = 0;
+static volatile uint16_t tail = 0;
+static LogStats stats;
+
+#define LOG_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+bool logRecord(const uint8_t* record, size_t length) {
+  uint16_t h = head;
+  uint16_t used = (h - tail) & ringMask;
+  if (length > static_cast<size_t>(ringMask - used)) {
+    stats.dropped++;
+    return false;
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    ring[(h + i) & ringMask] = record[i];
+  }
+  LOG_BARRIER();
+  head = (h + length) & ringMask;
+
+  used += length;
+  if (used > stats.highWater) {
+    stats.highWater = used;
+  }
+  stats.written++;
+  return true;
+}
+
+void logWrite(uint8_t level, PGM_P format, ...) {
+  static const char levels[] PROGMEM = "-EWID";
+
+  char line[AG_LOG_LINE_SIZE];
+  int length = snprintf_P(
+    line,
+    sizeof(line),
+    PSTR("%lu %c "),
+    static_cast<unsigned long>(millis()),
+    pgm_read_byte(levels + level)
+  );
+
+  va_list args;
+  va_start(args, format);
+  // leave room for the newline
+  int message = vsnprintf_P(line + length, sizeof(line) - length - 1, format, args);
+  va_end(args);
+  if (message < 0) {
+    message = 0;
+  }
+
+  length += message;
+  if (length > static_cast<int>(sizeof(line)) - 2) {
+    stats.truncated++;
+    length = sizeof(line) - 2;
+  }
+  line[length++] = '\n';
+
+  logRecord(reinterpret_cast<const uint8_t*>(line), length);
+}
+
+void logDrain() {
+  uint16_t t = tail;
+  uint16_t h = head;
+  LOG_BARRIER();
+
+  while (t != h) {
+    int room = Serial.availableForWrite();
+    if (room <= 0) {
+      break;
+    }
+    // contiguous bytes before the end of the ring
+    uint16_t available = h > t ? h - t : AG_LOG_BUFFER_SIZE - t;
+    size_t length = std::min(static_cast<size_t>(room), static_cast<size_t>(available));
+    Serial.write(reinterpret_cast<const uint8_t*>(ring + t), length);
+    t = (t + length) & ringMask;
+  }
+
+  LOG_BARRIER();
+  tail = t;
+}
+
+void logFlush() {
+  while (head != tail) {
+    logDrain();
+    yield();
+  }
+  Serial.flush();
+}
+
+const LogStats& logStats() {
+  return stats;
+}
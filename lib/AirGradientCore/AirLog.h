@@ -0,0 +1,164 @@
+/*
+  AirLog.h - non-blocking logging into a RAM ring drained to Serial.
+
+  LOG_ERROR/LOG_WARN/LOG_INFO/LOG_DEBUG take printf style arguments. Levels
+  above AG_LOG_LEVEL compile to nothing, arguments included, so debug logging
+  costs nothing in a release build. Formatted lines are copied into a ring
+  buffer and logDrain(), called from loop(), hands them to the UART only as
+  fast as its FIFO accepts them, so logging never waits on 115200 baud. If
+  the ring is full the line is dropped and counted instead of blocking.
+
+  Build with -D AG_LOG_BINARY to log compact binary records instead of text:
+
+    0xA5, level << 4 | argument count, millis (4 bytes), format address (4)
+
+  followed by each argument, integers and floats as 4 little endian bytes
+  and strings as a length byte and up to 32 characters. The format address
+  points at the PSTR in flash and can be resolved against the firmware ELF.
+
+  The ring has a single producer (loop() and the callbacks it runs) and a
+  single consumer (logDrain()). Don't log from an interrupt.
+*/
+
+#ifndef AirLog_h
+#define AirLog_h
+
+#include <Arduino.h>
+#include <type_traits>
+
+#define AG_LOG_LEVEL_NONE 0
+#define AG_LOG_LEVEL_ERROR 1
+#define AG_LOG_LEVEL_WARN 2
+#define AG_LOG_LEVEL_INFO 3
+#define AG_LOG_LEVEL_DEBUG 4
+
+#ifndef AG_LOG_LEVEL
+#define AG_LOG_LEVEL AG_LOG_LEVEL_INFO
+#endif
+
+// must be a power of two
+#ifndef AG_LOG_BUFFER_SIZE
+#define AG_LOG_BUFFER_SIZE 1024
+#endif
+
+// longest formatted line, longer ones are truncated
+#ifndef AG_LOG_LINE_SIZE
+#define AG_LOG_LINE_SIZE 160
+#endif
+
+struct LogStats
+{
+  uint32_t written = 0;
+  uint32_t dropped = 0;
+  uint32_t truncated = 0;
+  // most bytes ever waiting in the ring
+  uint16_t highWater = 0;
+};
+
+void logWrite(uint8_t level, PGM_P format, ...) __attribute__((format(printf, 2, 3)));
+
+// Copy an already encoded record into the ring, dropping it if it won't fit.
+bool logRecord(const uint8_t* record, size_t length);
+
+// Send whatever the UART will take right now. Call from every loop().
+void logDrain();
+
+// Block until the ring is empty, for use right before a restart.
+void logFlush();
+
+const LogStats& logStats();
+
+#if defined(AG_LOG_BINARY)
+
+class LogEncoder
+{
+  uint8_t record[AG_LOG_LINE_SIZE];
+  size_t length = 0;
+  bool truncated = false;
+
+  void put(const void* data, size_t size) {
+    if (length + size > sizeof(record)) {
+      truncated = true;
+      return;
+    }
+    memcpy(record + length, data, size);
+    length += size;
+  }
+
+  public:
+    LogEncoder(uint8_t level, uint8_t count, PGM_P format) {
+      uint32_t now = millis();
+      uint32_t address = reinterpret_cast<uintptr_t>(format);
+      record[length++] = 0xA5;
+      record[length++] = level << 4 | (count & 0x0F);
+      put(&now, sizeof(now));
+      put(&address, sizeof(address));
+    }
+
+    void add(const char* str) {
+      uint8_t size = strnlen(str, 32);
+      put(&size, 1);
+      put(str, size);
+    }
+
+    void add(char* str) {
+      add(static_cast<const char*>(str));
+    }
+
+    template <typename T>
+    void add(T value) {
+      static_assert(std::is_arithmetic<T>::value, "binary logs only take numbers and strings");
+      if constexpr (std::is_floating_point<T>::value) {
+        float asFloat = value;
+        put(&asFloat, 4);
+      } else {
+        int32_t asInt = static_cast<int32_t>(value);
+        put(&asInt, 4);
+      }
+    }
+
+    void send() {
+      logRecord(record, length);
+    }
+};
+
+template <typename... Args>
+void logBinary(uint8_t level, PGM_P format, Args... args) {
+  LogEncoder encoder(level, sizeof...(Args), format);
+  (encoder.add(args), ...);
+  encoder.send();
+}
+
+#define AG_LOG(level, format, ...) logBinary(level, PSTR(format), ##__VA_ARGS__)
+
+#else
+
+#define AG_LOG(level, format, ...) logWrite(level, PSTR(format), ##__VA_ARGS__)
+
+#endif
+
+#if AG_LOG_LEVEL >= AG_LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) AG_LOG(AG_LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) do {} while (0)
+#endif
+
+#if AG_LOG_LEVEL >= AG_LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) AG_LOG(AG_LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) do {} while (0)
+#endif
+
+#if AG_LOG_LEVEL >= AG_LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) AG_LOG(AG_LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) do {} while (0)
+#endif
+
+#if AG_LOG_LEVEL >= AG_LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) AG_LOG(AG_LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) do {} while (0)
+#endif
+
+#endif
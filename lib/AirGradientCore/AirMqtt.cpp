@@ -0,0 +1,498 @@
+#include "AirMqtt.h"
+#include "AirJson.h"
+#include "AirLog.h"
+#include "AirPortal.h"
+#include "AirSettings.h"
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif
+#include <WiFiClient.h>
+
+namespace {
+
+enum PacketType : uint8_t
+{
+  CONNECT = 1,
+  CONNACK = 2,
+  PUBLISH = 3,
+  PUBACK = 4,
+  PINGREQ = 12,
+  PINGRESP = 13,
+  DISCONNECT = 14
+};
+
+enum class MqttState : uint8_t
+{
+  DISCONNECTED,
+  CONNECTING,
+  CONNECTED
+};
+
+const uint16_t keepAliveSeconds = 60;
+// connect() blocks loop() until the TCP handshake is done or this passes, a
+// broker on the LAN answers well within it
+const uint32_t connectTimeoutMs = 1000;
+const uint32_t connackTimeoutMs = 5000;
+const uint32_t minBackoffMs = 1000;
+const uint32_t maxBackoffMs = 60000;
+
+// a QoS 1 message waiting for its PUBACK, its topic and payload are in arena
+struct InFlight
+{
+  // 0 once acknowledged
+  uint16_t id = 0;
+  // DUP is only set once the message has gone out before
+  bool sent = false;
+  uint16_t offset = 0;
+  uint16_t topicLength = 0;
+  uint16_t payloadLength = 0;
+
+  uint16_t size() const {
+    return topicLength + payloadLength;
+  }
+};
+
+WiFiClient client;
+MqttState state = MqttState::DISCONNECTED;
+MqttStats stats;
+
+uint32_t stateSince = 0;
+uint32_t nextAttempt = 0;
+uint32_t backoffMs = minBackoffMs;
+uint32_t lastSent = 0;
+uint32_t pingSent = 0;
+bool pingOutstanding = false;
+
+// QoS 1 messages in publish order, with their topics and payloads back to
+// back in a ring of bytes, so holding them costs no heap
+InFlight inFlight[AG_MQTT_INFLIGHT];
+uint8_t inFlightFirst = 0;
+uint8_t inFlightCount = 0;
+const uint16_t arenaSize = AG_MQTT_INFLIGHT_BYTES;
+uint8_t arena[arenaSize];
+uint16_t arenaStart = 0;
+uint16_t arenaUsed = 0;
+uint16_t lastPacketId = 0;
+
+static_assert(AG_MQTT_INFLIGHT <= UINT8_MAX, "in flight messages are counted in a byte");
+static_assert(AG_MQTT_INFLIGHT_BYTES <= UINT16_MAX, "arena offsets are 16 bit");
+
+// how much of size bytes at offset fits before the arena wraps around
+uint16_t beforeWrap(uint16_t offset, uint16_t size) {
+  return arenaSize - offset < size ? arenaSize - offset : size;
+}
+
+// Packets are built at body and the fixed header is written in front of it,
+// so each one leaves in a single write.
+const size_t headerRoom = 3;
+uint8_t packet[headerRoom + AG_MQTT_PACKET_SIZE];
+
+// incoming packet parser, only the first bytes of a body are kept
+enum class RxStage : uint8_t
+{
+  TYPE,
+  LENGTH,
+  BODY
+};
+RxStage rxStage = RxStage::TYPE;
+uint8_t rxType = 0;
+uint32_t rxRemaining = 0;
+uint8_t rxShift = 0;
+uint32_t rxCount = 0;
+uint8_t rxBody[4];
+
+class PacketWriter
+{
+  uint8_t* body = packet + headerRoom;
+  size_t length = 0;
+  bool overflow = false;
+
+  public:
+    void put(uint8_t b) {
+      if (length < AG_MQTT_PACKET_SIZE) {
+        body[length++] = b;
+      } else {
+        overflow = true;
+      }
+    }
+
+    void put16(uint16_t value) {
+      put(value >> 8);
+      put(value & 0xFF);
+    }
+
+    void putBytes(const char* data, size_t size) {
+      if (length + size > AG_MQTT_PACKET_SIZE) {
+        overflow = true;
+        return;
+      }
+      memcpy(body + length, data, size);
+      length += size;
+    }
+
+    // MQTT strings are a 16 bit length followed by the bytes
+    void putString(const String& value) {
+      put16(value.length());
+      putBytes(value.c_str(), value.length());
+    }
+
+    void putArena(uint16_t offset, uint16_t size) {
+      const uint16_t first = beforeWrap(offset, size);
+      putBytes(reinterpret_cast<const char*>(arena + offset), first);
+      putBytes(reinterpret_cast<const char*>(arena), size - first);
+    }
+
+    bool send(uint8_t typeAndFlags) {
+      if (overflow) {
+        LOG_WARN("MQTT packet too large");
+        return false;
+      }
+      uint8_t header[headerRoom];
+      size_t headerLength = 0;
+      header[headerLength++] = typeAndFlags;
+      size_t remaining = length;
+      do {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        header[headerLength++] = remaining > 0 ? digit | 0x80 : digit;
+      } while (remaining > 0);
+
+      uint8_t* start = body - headerLength;
+      memcpy(start, header, headerLength);
+      size_t total = headerLength + length;
+      if (client.write(start, total) != total) {
+        return false;
+      }
+      lastSent = millis();
+      return true;
+    }
+};
+
+bool enabled() {
+  return settings.mqttHost[0] != '\0';
+}
+
+String deviceTopic() {
+  return String(settings.mqttTopic) + '/' + deviceId();
+}
+
+void disconnect() {
+  client.stop();
+  state = MqttState::DISCONNECTED;
+  pingOutstanding = false;
+  rxStage = RxStage::TYPE;
+}
+
+// back off exponentially with some jitter so a fleet doesn't retry in step
+void retryLater() {
+  disconnect();
+  nextAttempt = millis() + backoffMs + random(backoffMs / 4 + 1);
+  LOG_INFO("MQTT retry in %lu ms", static_cast<unsigned long>(nextAttempt - millis()));
+  backoffMs = backoffMs * 2 < maxBackoffMs ? backoffMs * 2 : maxBackoffMs;
+}
+
+bool sendPublish(const String& topic, const String& payload) {
+  PacketWriter writer;
+  writer.putString(topic);
+  writer.putBytes(payload.c_str(), payload.length());
+  if (!writer.send(PUBLISH << 4)) {
+    return false;
+  }
+  stats.published++;
+  return true;
+}
+
+InFlight& inFlightAt(uint8_t index) {
+  return inFlight[(inFlightFirst + index) % AG_MQTT_INFLIGHT];
+}
+
+bool sendPublish(InFlight& message) {
+  PacketWriter writer;
+  writer.put16(message.topicLength);
+  writer.putArena(message.offset, message.topicLength);
+  writer.put16(message.id);
+  writer.putArena((message.offset + message.topicLength) % arenaSize, message.payloadLength);
+  // DUP and QoS 1
+  const uint8_t flags = (message.sent ? 0x08 : 0) | 0x02;
+  if (!writer.send(PUBLISH << 4 | flags)) {
+    return false;
+  }
+  message.sent = true;
+  stats.published++;
+  return true;
+}
+
+void removeOldest() {
+  const InFlight& oldest = inFlightAt(0);
+  arenaStart = (arenaStart + oldest.size()) % arenaSize;
+  arenaUsed -= oldest.size();
+  inFlightFirst = (inFlightFirst + 1) % AG_MQTT_INFLIGHT;
+  inFlightCount--;
+}
+
+// bytes are freed in order, behind the oldest unacknowledged message
+void removeAcknowledged() {
+  while (inFlightCount > 0 && inFlightAt(0).id == 0) {
+    removeOldest();
+  }
+}
+
+void arenaWrite(uint16_t offset, const String& value) {
+  const uint16_t first = beforeWrap(offset, value.length());
+  memcpy(arena + offset, value.c_str(), first);
+  memcpy(arena, value.c_str() + first, value.length() - first);
+}
+
+void resendInFlight() {
+  for (uint8_t i = 0; i < inFlightCount; i++) {
+    InFlight& message = inFlightAt(i);
+    if (message.id != 0 && !sendPublish(message)) {
+      retryLater();
+      return;
+    }
+  }
+}
+
+void connect() {
+  stats.connects++;
+  LOG_INFO("MQTT connecting to %s:%u", settings.mqttHost, settings.mqttPort);
+#if defined(ESP32)
+  const bool connected = client.connect(settings.mqttHost, settings.mqttPort, connectTimeoutMs);
+#else
+  // bounds the lookup, the handshake and later writes
+  client.setTimeout(connectTimeoutMs);
+  const bool connected = client.connect(settings.mqttHost, settings.mqttPort);
+#endif
+  if (!connected) {
+    LOG_WARN("MQTT connect failed");
+    retryLater();
+    return;
+  }
+  client.setNoDelay(true);
+
+  PacketWriter writer;
+  writer.putString(String(F("MQTT")));
+  writer.put(4); // protocol level 3.1.1
+  writer.put(0); // no clean session, so QoS 1 state survives reconnects
+  writer.put16(keepAliveSeconds);
+  writer.putString("AG-" + deviceId());
+  if (!writer.send(CONNECT << 4)) {
+    retryLater();
+    return;
+  }
+  state = MqttState::CONNECTING;
+  stateSince = millis();
+}
+
+void handlePacket() {
+  switch (rxType >> 4) {
+    case CONNACK:
+      if (state != MqttState::CONNECTING || rxCount < 2 || rxBody[1] != 0) {
+        LOG_WARN("MQTT connection refused (%u)", rxCount < 2 ? 0xFF : rxBody[1]);
+        retryLater();
+        return;
+      }
+      LOG_INFO("MQTT connected, session %s", (rxBody[0] & 1) ? "resumed" : "new");
+      state = MqttState::CONNECTED;
+      backoffMs = minBackoffMs;
+      resendInFlight();
+      return;
+
+    case PUBACK: {
+      if (rxCount < 2) {
+        return;
+      }
+      uint16_t id = rxBody[0] << 8 | rxBody[1];
+      for (uint8_t i = 0; i < inFlightCount; i++) {
+        InFlight& message = inFlightAt(i);
+        if (message.id == id) {
+          message.id = 0;
+          stats.acknowledged++;
+        }
+      }
+      removeAcknowledged();
+      return;
+    }
+
+    case PINGRESP:
+      pingOutstanding = false;
+      return;
+
+    default:
+      // nothing is subscribed, anything else is ignored
+      return;
+  }
+}
+
+void readPackets() {
+  while (client.available() > 0 && state != MqttState::DISCONNECTED) {
+    uint8_t b = client.read();
+    switch (rxStage) {
+      case RxStage::TYPE:
+        rxType = b;
+        rxRemaining = 0;
+        rxShift = 0;
+        rxCount = 0;
+        rxStage = RxStage::LENGTH;
+        break;
+
+      case RxStage::LENGTH:
+        rxRemaining |= static_cast<uint32_t>(b & 0x7F) << rxShift;
+        rxShift += 7;
+        if (b & 0x80) {
+          break;
+        }
+        if (rxRemaining == 0) {
+          rxStage = RxStage::TYPE;
+          handlePacket();
+        } else {
+          rxStage = RxStage::BODY;
+        }
+        break;
+
+      case RxStage::BODY:
+        if (rxCount < sizeof(rxBody)) {
+          rxBody[rxCount] = b;
+        }
+        if (++rxCount == rxRemaining) {
+          rxStage = RxStage::TYPE;
+          handlePacket();
+        }
+        break;
+    }
+  }
+}
+
+void publish(const String& topic, const String& payload) {
+  if (settings.mqttQos == 0) {
+    if (state != MqttState::CONNECTED || !sendPublish(topic, payload)) {
+      stats.dropped++;
+    }
+    return;
+  }
+
+  // topic length, packet id and the fixed header must fit in a packet too
+  const uint32_t size = topic.length() + payload.length();
+  if (size > arenaSize || size + 4 + headerRoom > sizeof(packet)) {
+    LOG_WARN("MQTT message too large");
+    stats.dropped++;
+    return;
+  }
+  // the oldest messages make room, the newest readings matter most; the
+  // oldest is never acknowledged, those behind it may have been and were
+  // only waiting for it to go
+  while (inFlightCount == AG_MQTT_INFLIGHT || static_cast<uint32_t>(arenaSize - arenaUsed) < size) {
+    stats.dropped++;
+    removeOldest();
+    removeAcknowledged();
+  }
+  if (inFlightCount == 0) {
+    arenaStart = 0;
+  }
+
+  if (++lastPacketId == 0) {
+    lastPacketId = 1;
+  }
+  InFlight& message = inFlightAt(inFlightCount++);
+  message.id = lastPacketId;
+  message.sent = false;
+  message.offset = (arenaStart + arenaUsed) % arenaSize;
+  message.topicLength = topic.length();
+  message.payloadLength = payload.length();
+  arenaWrite(message.offset, topic);
+  arenaWrite((message.offset + message.topicLength) % arenaSize, payload);
+  arenaUsed += size;
+
+  // held messages go out once the connection is back
+  if (state == MqttState::CONNECTED && !sendPublish(message)) {
+    retryLater();
+  }
+}
+
+void publishField(FlashString key, const String& value, void* context) {
+  const String& prefix = *static_cast<const String*>(context);
+  publish(prefix + key, value);
+}
+
+} // namespace
+
+void publishMqtt() {
+  if (!enabled()) {
+    return;
+  }
+  if (settings.mqttBatch) {
+    JsonPayload payload;
+    addMeasurements(payload);
+    publish(deviceTopic(), payload.finish());
+  } else {
+    String prefix = deviceTopic() + '/';
+    JsonPayload fields(publishField, &prefix);
+    addMeasurements(fields);
+  }
+}
+
+void processMqtt() {
+  if (!enabled() || WiFi.status() != WL_CONNECTED) {
+    if (state != MqttState::DISCONNECTED) {
+      disconnect();
+    }
+    return;
+  }
+
+  uint32_t now = millis();
+  switch (state) {
+    case MqttState::DISCONNECTED:
+      if (static_cast<int32_t>(now - nextAttempt) >= 0) {
+        connect();
+      }
+      return;
+
+    case MqttState::CONNECTING:
+      readPackets();
+      if (state == MqttState::CONNECTING && now - stateSince > connackTimeoutMs) {
+        LOG_WARN("MQTT CONNACK timed out");
+        retryLater();
+      }
+      return;
+
+    case MqttState::CONNECTED:
+      if (!client.connected()) {
+        LOG_WARN("MQTT connection lost");
+        retryLater();
+        return;
+      }
+      readPackets();
+      if (pingOutstanding && now - pingSent > keepAliveSeconds * 1000UL) {
+        LOG_WARN("MQTT broker stopped answering");
+        retryLater();
+      } else if (!pingOutstanding && now - lastSent >= keepAliveSeconds * 500UL) {
+        PacketWriter writer;
+        if (writer.send(PINGREQ << 4)) {
+          pingOutstanding = true;
+          pingSent = now;
+        }
+      }
+      return;
+  }
+}
+
+void restartMqtt() {
+  if (state == MqttState::CONNECTED) {
+    PacketWriter writer;
+    writer.send(DISCONNECT << 4);
+  }
+  disconnect();
+  backoffMs = minBackoffMs;
+  nextAttempt = millis();
+}
+
+bool mqttConnected() {
+  return state == MqttState::CONNECTED;
+}
+
+const MqttStats& mqttStats() {
+  return stats;
+}
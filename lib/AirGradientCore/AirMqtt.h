@@ -0,0 +1,55 @@
+/*
+  AirMqtt.h - publishes measurements to an MQTT broker (MQTT 3.1.1).
+
+  The connection is kept open with a persistent session (clean session off)
+  so each sample costs one PUBLISH instead of a TCP connection and an HTTP
+  request. Measurements go to <topic>/<device id> as one JSON object, or to
+  <topic>/<device id>/<field> with one bare value each. At QoS 1 messages
+  are kept until the broker acknowledges them, at most AG_MQTT_INFLIGHT or
+  AG_MQTT_INFLIGHT_BYTES of them at a time with the oldest making room, and
+  resent with DUP after a reconnect. Failed connections are retried with
+  exponential backoff. Publishing is off while no broker host is configured.
+*/
+
+#ifndef AirMqtt_h
+#define AirMqtt_h
+
+#include <Arduino.h>
+
+#ifndef AG_MQTT_INFLIGHT
+#define AG_MQTT_INFLIGHT 12
+#endif
+
+// room for the topics and payloads of the QoS 1 messages in flight
+#ifndef AG_MQTT_INFLIGHT_BYTES
+#define AG_MQTT_INFLIGHT_BYTES 2048
+#endif
+
+// largest packet, topic and payload included
+#ifndef AG_MQTT_PACKET_SIZE
+#define AG_MQTT_PACKET_SIZE 512
+#endif
+
+struct MqttStats
+{
+  uint32_t published = 0;
+  uint32_t acknowledged = 0;
+  // QoS 0 messages sent while disconnected, or QoS 1 pushed out of a full
+  // window by newer ones
+  uint32_t dropped = 0;
+  uint32_t connects = 0;
+};
+
+// Publish the current measurements, call when new readings are published.
+void publishMqtt();
+
+// Call from loop(), connects, reads acknowledgements and keeps alive.
+void processMqtt();
+
+// Drop the connection so the next processMqtt() uses the new settings.
+void restartMqtt();
+
+bool mqttConnected();
+const MqttStats& mqttStats();
+
+#endif
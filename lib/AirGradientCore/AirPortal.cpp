@@ -0,0 +1,426 @@
+#include "AirPortal.h"
+#include "AirBoard.h"
+#include "AirCbor.h"
+#include "AirEvents.h"
+#include "AirFlash.h"
+#include "AirHistory.h"
+#include "AirJson.h"
+#include "AirLog.h"
+#include "AirMqtt.h"
+#include "AirRadio.h"
+#include "AirReport.h"
+#include "AirSettings.h"
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif
+
+WiFiManager wifiManager;
+WiFiManagerParameter wifi_hostname("hostname", "Hostname", "hostname", 23);
+WiFiManagerParameter wifi_mqttHost("mqtt_host", "MQTT Broker (empty to disable)", "", 39);
+WiFiManagerParameter wifi_mqttPort("mqtt_port", "MQTT Port", "1883", 5);
+WiFiManagerParameter wifi_mqttTopic("mqtt_topic", "MQTT Topic", "airgradient", 31);
+WiFiManagerParameter wifi_reportHeartbeat("report_heartbeat", "Upload on change, at least every N minutes (0 uploads every sample)", "0", 4);
+WiFiManagerParameter wifi_deadbandCo2("deadband_co2", "CO2 dead-band (ppm)", "20", 4);
+WiFiManagerParameter wifi_deadbandPm("deadband_pm", "PM dead-band (µg/m³)", "2", 4);
+WiFiManagerParameter wifi_deadbandTemp("deadband_temp", "Temperature dead-band (0.1 °C)", "2", 4);
+WiFiManagerParameter wifi_deadbandHum("deadband_hum", "Humidity dead-band (%RH)", "2", 4);
+WiFiManagerParameter wifi_deadbandIndex("deadband_index", "VOC/NOx dead-band (index points)", "5", 4);
+
+// Note that each param's name is important. param_# is a format that 
+// WiFiManager insists on if you're going to implement completely custom params.
+// The # is the position the parameter is added in, so the board specific
+// parameters are only built by the boards that add them.
+//
+// The values and HTML stay in flash: WiFiManager only reads them through
+// strncpy and String, which are PROGMEM safe in the ESP8266 core.
+CustomParameter& agPlatformParameter() {
+  static const char value[] PROGMEM = "yes";
+  static const char html[] PROGMEM =
+    "<label for=\"param_1\">AirGradient Platform</label>"
+    "<select id=\"param_1\" name=\"param_1\">"
+      "<option value=\"yes\" selected>Yes</option>"
+      "<option value=\"no\">No</option>"
+    "</select>";
+  static CustomParameter parameter(value, 4, html);
+  return parameter;
+}
+
+CustomParameter& tempUnitsParameter() {
+  static const char value[] PROGMEM = "Celsius";
+  static const char html[] PROGMEM =
+    "<label for=\"param_2\">Temperature Units</label>"
+    "<select id=\"param_2\" name=\"param_2\">"
+      "<option value=\"fahrenheit\" selected>°F</option>"
+      "<option value=\"celsius\">°C</option>"
+    "</select>";
+  static CustomParameter parameter(value, 10, html);
+  return parameter;
+}
+
+CustomParameter& pmUnitsParameter() {
+  static const char value[] PROGMEM = "USAQI";
+  static const char html[] PROGMEM =
+    "<label for=\"param_3\">PM 2.5 Units</label>"
+    "<select id=\"param_3\" name=\"param_3\">"
+      "<option value=\"USAQI\" selected>AQI</option>"
+      "<option value=\"cubic_mg\">µg/m³</option>"
+    "</select>";
+  static CustomParameter parameter(value, 10, html);
+  return parameter;
+}
+
+CustomParameter& sparkIntervalParameter() {
+  static const char value[] PROGMEM = "1";
+  static const char html[] PROGMEM =
+    "<label for=\"param_4\">Chart Time Window</label>"
+    "<select id=\"param_4\" name=\"param_4\">"
+      "<option value=\"1\" selected>5 min</option>"
+      "<option value=\"2\">10 min</option>"
+      "<option value=\"6\">30 min</option>"
+      "<option value=\"12\">1 hour</option>"
+      "<option value=\"72\">6 hour</option>"
+      "<option value=\"144\">12 hour</option>"
+      "<option value=\"288\">1 day</option>"
+    "</select>";
+  static CustomParameter parameter(value, 4, html);
+  return parameter;
+}
+
+// Boards with an averaging window have no unit settings, so this is param_2.
+static_assert(
+  !(Board::hasAverageWindow && Board::hasUnitSettings),
+  "renumber the averaging window parameter"
+);
+CustomParameter& averageWindowParameter() {
+  static const char value[] PROGMEM = "40";
+  static const char html[] PROGMEM =
+    "<label for=\"param_2\">Averaging Window</label>"
+    "<select id=\"param_2\" name=\"param_2\">"
+      "<option value=\"10\">10 samples</option>"
+      "<option value=\"20\">20 samples</option>"
+      "<option value=\"40\" selected>40 samples</option>"
+      "<option value=\"80\">80 samples</option>"
+      "<option value=\"120\">120 samples</option>"
+    "</select>";
+  static CustomParameter parameter(value, 4, html);
+  return parameter;
+}
+
+// The MQTT parameters follow the board's own, so the mode's position depends
+// on which of those the board adds.
+constexpr int mqttModePosition =
+  2 + (Board::hasUnitSettings ? 2 : 0) + Board::hasSparkInterval + Board::hasAverageWindow + 3;
+
+CustomParameter& mqttModeParameter() {
+  static const char value[] PROGMEM = "1";
+  static const char format[] PROGMEM =
+    "<label for=\"param_%d\">MQTT Messages</label>"
+    "<select id=\"param_%d\" name=\"param_%d\">"
+      "<option value=\"1\" selected>JSON per sample, QoS 1</option>"
+      "<option value=\"0\">JSON per sample, QoS 0</option>"
+      "<option value=\"3\">Topic per field, QoS 1</option>"
+      "<option value=\"2\">Topic per field, QoS 0</option>"
+    "</select>";
+  static char html[sizeof(format) + 8];
+  snprintf_P(html, sizeof(html), format, mqttModePosition, mqttModePosition, mqttModePosition);
+  static CustomParameter parameter(value, 2, html);
+  return parameter;
+}
+
+String deviceId() {
+#if defined(ESP8266)
+  return String(ESP.getChipId(), HEX);
+#else
+  String mac = WiFi.macAddress();
+  mac.replace(":", "");
+  mac.toLowerCase();
+  return mac;
+#endif
+}
+
+void __attribute__((weak)) addDiagnostics(JsonPayload& payload) {
+}
+
+void __attribute__((weak)) addLinkHealth(JsonPayload& payload) {
+}
+
+// The serialized /metrics bodies and their ETags are rebuilt at most once per
+// generation, so any number of scrapers share one serialization.
+static uint32_t metricsGeneration = 1;
+static uint32_t cachedGeneration = 0;
+static String cachedMetrics;
+static String cachedETag;
+static uint32_t cachedCborGeneration = 0;
+static uint8_t cachedCbor[AG_CBOR_METRICS_SIZE];
+static size_t cachedCborSize = 0;
+static String cachedCborETag;
+static uint16_t metricsMaxAge = 5;
+
+// Lowest free heap between loop() passes, what's left once the uploads,
+// MQTT, the portal and /events have all had their turn. The ESP32's
+// allocator keeps its own low-water mark, which also sees inside handlers.
+#if defined(ESP8266)
+static uint32_t heapLow = UINT32_MAX;
+#endif
+
+static uint32_t freeHeapLow() {
+#if defined(ESP8266)
+  return heapLow;
+#else
+  return ESP.getMinFreeHeap();
+#endif
+}
+
+// the largest allocation that can still succeed, less than free_heap once
+// the heap is fragmented
+static uint32_t largestFreeBlock() {
+#if defined(ESP8266)
+  return ESP.getMaxFreeBlockSize();
+#else
+  return ESP.getMaxAllocHeap();
+#endif
+}
+
+void invalidateMetrics() {
+  ++metricsGeneration;
+}
+
+void measurementsChanged() {
+  invalidateMetrics();
+  publishEvents(metricsGeneration);
+  publishMqtt();
+}
+
+void setMetricsMaxAge(uint16_t seconds) {
+  metricsMaxAge = seconds;
+}
+
+// FNV-1a of the body, so the tag stays valid across reboots
+static String etagFor(const uint8_t* body, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ body[i]) * 16777619u;
+  }
+  char tag[11];
+  snprintf(tag, sizeof(tag), "\"%08x\"", hash);
+  return String(tag);
+}
+
+static void addMetrics(JsonPayload& metrics) {
+  // Use json-exporter if you want to ingest this to prometheus. Not worth being 
+  // prometheus-specific at this point.
+  metrics.add(F("id"), deviceId());
+  metrics.add(F("mac"), WiFi.macAddress());
+  metrics.add(F("hostname"), String(settings.hostname));
+  addMeasurements(metrics);
+  addDiagnostics(metrics);
+  addLinkHealth(metrics);
+  metrics.addRaw(F("free_heap"), ESP.getFreeHeap());
+  metrics.addRaw(F("free_heap_min"), freeHeapLow());
+  metrics.addRaw(F("heap_max_block"), largestFreeBlock());
+  metrics.addRaw(F("log_dropped"), logStats().dropped);
+  metrics.addRaw(F("event_subscribers"), eventSubscribers());
+  metrics.addFlag(F("mqtt_connected"), mqttConnected());
+  metrics.addRaw(F("mqtt_dropped"), mqttStats().dropped);
+  metrics.addRaw(F("radio_on_ms_hour"), radioOnMsLastHour());
+  metrics.addRaw(F("radio_windows"), radioStats().windows);
+  metrics.addRaw(F("radio_deferred"), radioStats().deferred);
+  metrics.addRaw(F("radio_coalesced"), radioStats().coalesced);
+  const ReportStats& report = reportStats();
+  metrics.addRaw(F("report_due"), report.due);
+  metrics.addRaw(F("report_heartbeats"), report.heartbeats);
+  metrics.addRaw(F("report_suppressed"), report.suppressed);
+  // of all samples, the share that wasn't uploaded
+  const uint32_t samples = report.due + report.suppressed;
+  metrics.addRaw(F("report_suppressed_ratio"), samples == 0 ? Fixed() : Fixed::ratio(report.suppressed, samples));
+  if constexpr (Board::hasSampleStore) {
+    metrics.addRaw(F("history_records"), historyRecords());
+  }
+}
+
+static void refreshMetrics() {
+  if (cachedGeneration == metricsGeneration) {
+    return;
+  }
+  JsonPayload metrics;
+  addMetrics(metrics);
+  cachedMetrics = metrics.finish();
+  cachedETag = etagFor(reinterpret_cast<const uint8_t*>(cachedMetrics.c_str()), cachedMetrics.length());
+  cachedGeneration = metricsGeneration;
+}
+
+// false if the metrics don't fit AG_CBOR_METRICS_SIZE
+static bool refreshCborMetrics() {
+  if (cachedCborGeneration != metricsGeneration) {
+    CborWriter writer(cachedCbor, sizeof(cachedCbor));
+    JsonPayload metrics(writer);
+    addMetrics(metrics);
+    metrics.finish();
+    if (!writer.ok()) {
+      LOG_WARN("CBOR metrics over %d bytes", AG_CBOR_METRICS_SIZE);
+    }
+    cachedCborSize = writer.ok() ? writer.size() : 0;
+    cachedCborETag = etagFor(cachedCbor, cachedCborSize);
+    cachedCborGeneration = metricsGeneration;
+  }
+  return cachedCborSize > 0;
+}
+
+void wifi_handleMetrics() {
+  auto& server = wifiManager.server;
+  // plain JSON unless the client asks for CBOR
+  const bool cbor = server->header("Accept").indexOf("application/cbor") >= 0 && refreshCborMetrics();
+  if (!cbor) {
+    refreshMetrics();
+  }
+  const String& etag = cbor ? cachedCborETag : cachedETag;
+  server->sendHeader(F("ETag"), etag);
+  server->sendHeader(F("Cache-Control"), String(F("max-age=")) + metricsMaxAge);
+  server->sendHeader(F("Vary"), F("Accept"));
+
+  String match = server->header("If-None-Match");
+  if (match == "*" || (match.length() > 0 && match.indexOf(etag) >= 0)) {
+    server->send(304);
+    return;
+  }
+  if (cbor) {
+    server->send_P(200, "application/cbor", reinterpret_cast<PGM_P>(cachedCbor), cachedCborSize);
+  } else {
+    server->send(200, "application/json", cachedMetrics);
+  }
+}
+
+void wifi_addRoutes() {
+  LOG_DEBUG("Adding metrics route");
+  // the web server drops request headers that aren't asked for up front
+  static const char* headers[] = {"If-None-Match", "Accept", "Range"};
+  wifiManager.server->collectHeaders(headers, sizeof(headers) / sizeof(headers[0]));
+  wifiManager.server->on("/metrics", wifi_handleMetrics);
+  wifiManager.server->on("/events", events_handleSubscribe);
+  if constexpr (Board::hasSampleStore) {
+    wifiManager.server->on("/history", history_handleRequest);
+  }
+}
+
+void wifi_saveParameters() {
+  strncpy(settings.hostname, wifi_hostname.getValue(), sizeof(settings.hostname) - 1);
+  LOG_INFO("hostname param: %s", wifi_hostname.getValue());
+
+  LOG_INFO("platform param: %s", agPlatformParameter().getValue());
+  settings.useAGPlatform = equalsFlash(agPlatformParameter().getValue(), F("yes"));
+
+  if constexpr (Board::hasUnitSettings) {
+    LOG_INFO("temp param: %s", tempUnitsParameter().getValue());
+    LOG_INFO("pm units param: %s", pmUnitsParameter().getValue());
+    settings.useFahrenheit = equalsFlash(tempUnitsParameter().getValue(), F("fahrenheit"));
+    settings.useUSAQI = equalsFlash(pmUnitsParameter().getValue(), F("USAQI"));
+  }
+  if constexpr (Board::hasSparkInterval) {
+    LOG_INFO("spark interval param: %s", sparkIntervalParameter().getValue());
+    settings.sparkInterval = String(sparkIntervalParameter().getValue()).toInt();
+  }
+  if constexpr (Board::hasAverageWindow) {
+    LOG_INFO("average window param: %s", averageWindowParameter().getValue());
+    settings.averageWindow = String(averageWindowParameter().getValue()).toInt();
+  }
+
+  LOG_INFO("mqtt params: %s:%s %s mode %s", wifi_mqttHost.getValue(), wifi_mqttPort.getValue(),
+    wifi_mqttTopic.getValue(), mqttModeParameter().getValue());
+  strncpy(settings.mqttHost, wifi_mqttHost.getValue(), sizeof(settings.mqttHost) - 1);
+  strncpy(settings.mqttTopic, wifi_mqttTopic.getValue(), sizeof(settings.mqttTopic) - 1);
+  settings.mqttPort = String(wifi_mqttPort.getValue()).toInt();
+  uint8_t mqttMode = String(mqttModeParameter().getValue()).toInt();
+  settings.mqttQos = mqttMode & 1;
+  settings.mqttBatch = (mqttMode & 2) == 0;
+
+  LOG_INFO("report params: heartbeat %s", wifi_reportHeartbeat.getValue());
+  settings.reportHeartbeat = String(wifi_reportHeartbeat.getValue()).toInt();
+  if constexpr (Board::hasCo2) {
+    settings.deadbandCo2 = String(wifi_deadbandCo2.getValue()).toInt();
+  }
+  settings.deadbandPm = String(wifi_deadbandPm.getValue()).toInt();
+  settings.deadbandTemp = String(wifi_deadbandTemp.getValue()).toInt();
+  settings.deadbandHum = String(wifi_deadbandHum.getValue()).toInt();
+  if constexpr (Board::hasGasIndex) {
+    settings.deadbandIndex = String(wifi_deadbandIndex.getValue()).toInt();
+  }
+
+  writeSettings();
+  restartMqtt();
+  // the settings show up in /metrics, but nothing was measured
+  invalidateMetrics();
+}
+
+void setupWifi() {
+  wifiManager.setTimeout(90);
+  wifiManager.setConfigPortalBlocking(false);
+
+  wifiManager.setSaveParamsCallback(wifi_saveParameters);
+  wifiManager.setWebServerCallback(wifi_addRoutes);
+
+  wifiManager.addParameter(&wifi_hostname);
+  wifiManager.addParameter(&agPlatformParameter());
+  if constexpr (Board::hasUnitSettings) {
+    wifiManager.addParameter(&tempUnitsParameter());
+    wifiManager.addParameter(&pmUnitsParameter());
+  }
+  if constexpr (Board::hasSparkInterval) {
+    wifiManager.addParameter(&sparkIntervalParameter());
+  }
+  if constexpr (Board::hasAverageWindow) {
+    wifiManager.addParameter(&averageWindowParameter());
+  }
+  wifiManager.addParameter(&wifi_mqttHost);
+  wifiManager.addParameter(&wifi_mqttPort);
+  wifiManager.addParameter(&wifi_mqttTopic);
+  wifiManager.addParameter(&mqttModeParameter());
+  // plain inputs after the last custom one, so they don't renumber it
+  wifiManager.addParameter(&wifi_reportHeartbeat);
+  if constexpr (Board::hasCo2) {
+    wifiManager.addParameter(&wifi_deadbandCo2);
+  }
+  wifiManager.addParameter(&wifi_deadbandPm);
+  wifiManager.addParameter(&wifi_deadbandTemp);
+  wifiManager.addParameter(&wifi_deadbandHum);
+  if constexpr (Board::hasGasIndex) {
+    wifiManager.addParameter(&wifi_deadbandIndex);
+  }
+  LOG_DEBUG("Params: %d", wifiManager.getParametersCount());
+
+  String HOTSPOT = "AG-" + deviceId();
+  if (String(settings.hostname).isEmpty()) {
+    strncpy(settings.hostname, HOTSPOT.c_str(), sizeof(settings.hostname) - 1);
+  }
+  wifi_hostname.setValue(settings.hostname, 24);
+  wifi_mqttHost.setValue(settings.mqttHost, 39);
+  wifi_mqttPort.setValue(String(settings.mqttPort).c_str(), 5);
+  wifi_mqttTopic.setValue(settings.mqttTopic, 31);
+  wifi_reportHeartbeat.setValue(String(settings.reportHeartbeat).c_str(), 4);
+  wifi_deadbandCo2.setValue(String(settings.deadbandCo2).c_str(), 4);
+  wifi_deadbandPm.setValue(String(settings.deadbandPm).c_str(), 4);
+  wifi_deadbandTemp.setValue(String(settings.deadbandTemp).c_str(), 4);
+  wifi_deadbandHum.setValue(String(settings.deadbandHum).c_str(), 4);
+  wifi_deadbandIndex.setValue(String(settings.deadbandIndex).c_str(), 4);
+  wifiManager.autoConnect((const char*)settings.hostname);
+}
+
+void processWifi() {
+  wifiManager.process();
+  processEvents();
+  processMqtt();
+  processRadio();
+  // if the wifi is connected and the web portal is not active, then start it.
+  if (
+    WiFi.status() == WL_CONNECTED &&
+    !wifiManager.getWebPortalActive() && 
+    !wifiManager.getConfigPortalActive()
+  ) {
+    wifiManager.startWebPortal();
+  }
+#if defined(ESP8266)
+  heapLow = std::min<uint32_t>(heapLow, ESP.getFreeHeap());
+#endif
+}
@@ -0,0 +1,64 @@
+/*
+  AirPortal.h - the WiFiManager portal and the routes served next to it.
+*/
+
+#ifndef AirPortal_h
+#define AirPortal_h
+
+#include <Arduino.h>
+#include <WiFiManager.h>
+
+// buffer for /metrics as CBOR, served to clients that send Accept: application/cbor
+#ifndef AG_CBOR_METRICS_SIZE
+#define AG_CBOR_METRICS_SIZE 1024
+#endif
+
+/** 
+ * WiFiManagerParameter sucks if you want something other than a text input 
+ * The only way to get it to use the entire customHTML is to null out getID
+ * and if you do that, then value can never be set.
+ * 
+ * init() always nulls out _value.
+ * init() calls setValue().
+ * setValue() is the only way to set _value.
+ * setValue() only sets _value if _id is not null.
+ * init() is the only way to set _id
+ */
+class CustomParameter : public WiFiManagerParameter
+{
+  public:
+    CustomParameter(
+      const char* value, 
+      int length, 
+      const char* customHtml
+    ) : WiFiManagerParameter(customHtml) {
+      _id = "";
+      setValue(value, length);
+      _id = nullptr;
+    }
+};
+
+extern WiFiManager wifiManager;
+
+// Chip id on the ESP8266, normalized MAC address on the ESP32.
+String deviceId();
+
+void setupWifi();
+
+// Call from loop(), keeps the web portal up whenever the WiFi is connected.
+void processWifi();
+
+// Call when new readings are published: rebuilds /metrics and sends the
+// sample to /events subscribers and the MQTT broker.
+void measurementsChanged();
+
+// /metrics is cached between changes, call when anything else it shows
+// changes. Sends nothing.
+void invalidateMetrics();
+
+// Cache-Control max-age for /metrics, normally the sampling interval.
+void setMetricsMaxAge(uint16_t seconds);
+
+void wifi_handleMetrics();
+
+#endif
@@ -0,0 +1,160 @@
+#include "AirRadio.h"
+#include "AirLog.h"
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif
+
+struct PendingSend
+{
+  void (*send)();
+  RadioSend kind;
+  uint32_t queuedAt;
+};
+
+static PendingSend pending[AG_RADIO_MAX_SENDS];
+static uint8_t pendingCount = 0;
+static RadioStats stats;
+
+static bool asleep = false;
+static bool lingering = false;
+static uint32_t lingerStart = 0;
+static uint32_t lastWindow = 0;
+
+// radio on time in 5 minute buckets, an hour of them and the one filling
+static const uint32_t bucketMs = 5 * 60 * 1000UL;
+static const uint8_t bucketCount = 13;
+static uint32_t onMs[bucketCount];
+static uint8_t bucket = 0;
+static uint32_t bucketStart = 0;
+static uint32_t lastAccount = 0;
+
+static void account(uint32_t now) {
+  if (now - bucketStart >= bucketMs * bucketCount) {
+    memset(onMs, 0, sizeof(onMs));
+    bucketStart = now;
+  }
+  while (now - bucketStart >= bucketMs) {
+    bucketStart += bucketMs;
+    bucket = (bucket + 1) % bucketCount;
+    onMs[bucket] = 0;
+  }
+  // a blocking upload lands in the bucket it ended in, close enough
+  if (!asleep) {
+    onMs[bucket] += now - lastAccount;
+  }
+  lastAccount = now;
+}
+
+static void setAsleep(bool sleep) {
+  if (sleep == asleep) {
+    return;
+  }
+  account(millis());
+  asleep = sleep;
+#if defined(ESP8266)
+  if (sleep) {
+    WiFi.setSleepMode(WIFI_MODEM_SLEEP, AG_RADIO_LISTEN_INTERVAL);
+  } else {
+    WiFi.setSleepMode(WIFI_NONE_SLEEP);
+  }
+#else
+  // MAX_MODEM sleeps for the station's listen interval instead of every DTIM
+  WiFi.setSleep(sleep ? WIFI_PS_MAX_MODEM : WIFI_PS_NONE);
+#endif
+}
+
+// the config portal's access point has to stay up for its clients
+static bool canSleep() {
+  return WiFi.status() == WL_CONNECTED && WiFi.getMode() == WIFI_STA;
+}
+
+void radioQueue(void (*send)(), RadioSend kind) {
+  for (uint8_t i = 0; i < pendingCount; i++) {
+    if (pending[i].send == send) {
+      ++stats.coalesced;
+      return;
+    }
+  }
+  if (pendingCount == AG_RADIO_MAX_SENDS) {
+    LOG_WARN("More than %d sends waiting, dropped one", AG_RADIO_MAX_SENDS);
+    return;
+  }
+  pending[pendingCount++] = {send, kind, millis()};
+}
+
+static void runWindow(uint32_t now) {
+  if (pendingCount == 0) {
+    return;
+  }
+
+  uint32_t waited = 0;
+  bool hasData = false;
+  for (uint8_t i = 0; i < pendingCount; i++) {
+    if (now - pending[i].queuedAt > waited) {
+      waited = now - pending[i].queuedAt;
+    }
+    hasData = hasData || pending[i].kind == RadioSend::Data;
+  }
+  if (waited < AG_RADIO_MAX_DEFER_MS) {
+    if (WiFi.status() != WL_CONNECTED) {
+      ++stats.deferred;
+      return;
+    }
+    int rssi = WiFi.RSSI();
+    if (rssi < AG_RADIO_POOR_RSSI) {
+      LOG_DEBUG("RSSI %d, deferring %u sends", rssi, pendingCount);
+      ++stats.deferred;
+      return;
+    }
+  }
+
+  setAsleep(false);
+  ++stats.windows;
+  // a send may queue another, which waits for the next window
+  PendingSend batch[AG_RADIO_MAX_SENDS];
+  const uint8_t count = pendingCount;
+  memcpy(batch, pending, sizeof(PendingSend) * count);
+  pendingCount = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (hasData && batch[i].kind == RadioSend::Heartbeat) {
+      ++stats.coalesced;
+      continue;
+    }
+    batch[i].send();
+  }
+  lingering = true;
+  lingerStart = millis();
+}
+
+void processRadio() {
+  const uint32_t now = millis();
+  account(now);
+
+  if (now - lastWindow >= AG_RADIO_WINDOW_MS) {
+    // keep the cadence unless a blocking loop() put us a whole window behind
+    lastWindow = now - lastWindow >= 2 * AG_RADIO_WINDOW_MS ? now : lastWindow + AG_RADIO_WINDOW_MS;
+    runWindow(now);
+  }
+  if (lingering && millis() - lingerStart >= AG_RADIO_LINGER_MS) {
+    lingering = false;
+  }
+  setAsleep(!lingering && canSleep());
+}
+
+const RadioStats& radioStats() {
+  return stats;
+}
+
+uint32_t radioOnMsLastHour() {
+  account(millis());
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < bucketCount; i++) {
+    if (i != bucket) {
+      total += onMs[i];
+    }
+  }
+  return total;
+}
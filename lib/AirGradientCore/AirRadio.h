@@ -0,0 +1,75 @@
+/*
+  AirRadio.h - runs uploads together in transmit windows and keeps the WiFi
+  in modem sleep between them.
+
+  Sends are queued with radioQueue() and run at the next window, one every
+  AG_RADIO_WINDOW_MS. Queuing a send that is already waiting doesn't add a
+  second one, so an upload that waited goes out once with the latest
+  measurements, and a heartbeat is dropped from a window that carries data.
+  While the link is down or below AG_RADIO_POOR_RSSI, windows are skipped
+  until the oldest send has waited AG_RADIO_MAX_DEFER_MS.
+
+  Modem sleep keeps the station associated and waking for beacons, so
+  /metrics, /events and MQTT still work between windows, with a few hundred
+  ms more latency. The radio stays fully on for AG_RADIO_LINGER_MS after a
+  window, and whenever the WiFi isn't connected in station mode.
+*/
+
+#ifndef AirRadio_h
+#define AirRadio_h
+
+#include <Arduino.h>
+
+#ifndef AG_RADIO_WINDOW_MS
+#define AG_RADIO_WINDOW_MS 10000
+#endif
+
+#ifndef AG_RADIO_LINGER_MS
+#define AG_RADIO_LINGER_MS 1000
+#endif
+
+// dBm, below this sends wait for a better window
+#ifndef AG_RADIO_POOR_RSSI
+#define AG_RADIO_POOR_RSSI -80
+#endif
+
+#ifndef AG_RADIO_MAX_DEFER_MS
+#define AG_RADIO_MAX_DEFER_MS 60000
+#endif
+
+// beacon intervals slept between wake ups in modem sleep
+#ifndef AG_RADIO_LISTEN_INTERVAL
+#define AG_RADIO_LISTEN_INTERVAL 3
+#endif
+
+#ifndef AG_RADIO_MAX_SENDS
+#define AG_RADIO_MAX_SENDS 4
+#endif
+
+enum class RadioSend : uint8_t
+{
+  Data,
+  // says nothing a data send doesn't, skipped when one goes in the same window
+  Heartbeat
+};
+
+struct RadioStats
+{
+  uint32_t windows = 0;
+  uint32_t deferred = 0;
+  // sends merged into one already waiting or into a data send
+  uint32_t coalesced = 0;
+};
+
+// Run send at the next transmit window, see above.
+void radioQueue(void (*send)(), RadioSend kind = RadioSend::Data);
+
+// Call from loop(), processWifi() does.
+void processRadio();
+
+const RadioStats& radioStats();
+
+// ms the radio was fully on in the last full hour, updated every 5 minutes
+uint32_t radioOnMsLastHour();
+
+#endif
@@ -0,0 +1,20 @@
+#include "AirReport.h"
+#include "AirSettings.h"
+
+static ReportFilter filter;
+
+bool reportDue() {
+  return filter.due(settings, millis(), addMeasurements);
+}
+
+void reportSent() {
+  filter.sent(millis());
+}
+
+void addReportSummary(JsonPayload& payload) {
+  filter.addSummary(payload, settings);
+}
+
+const ReportStats& reportStats() {
+  return filter.stats();
+}
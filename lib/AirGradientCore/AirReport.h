@@ -0,0 +1,39 @@
+/*
+  AirReport.h - report by exception, decides whether an upload has anything
+  new to say.
+
+  With a heartbeat set in the portal, uploads only go out when a measurement
+  has moved by more than its dead-band since the last upload the server
+  accepted, or when the heartbeat has passed since then. Dead-bands are in
+  the units the platform gets, see Settings. pm003_count and anything else
+  without a dead-band goes along with an upload but never causes one. A
+  heartbeat of 0 uploads every sample, as before. The state lives in a
+  ReportFilter, see ReportFilter.h.
+*/
+
+#ifndef AirReport_h
+#define AirReport_h
+
+#include <Arduino.h>
+
+#include "AirJson.h"
+#include "ReportFilter.h"
+
+/**
+ * True if the current measurements should be uploaded. Call once per sample
+ * just before uploading, and reportSent() if the upload was accepted.
+ */
+bool reportDue();
+
+// The measurements reportDue() saw become the reference for the dead-bands.
+void reportSent();
+
+/**
+ * Adds the samples held back since the last upload, so the platform can
+ * tell a quiet device from a missing one. Adds nothing without a heartbeat.
+ */
+void addReportSummary(JsonPayload& payload);
+
+const ReportStats& reportStats();
+
+#endif
@@ -0,0 +1,203 @@
+#include "AirSettings.h"
+#include "AirBoard.h"
+#include "AirPortal.h"
+
+#include <EEPROM.h>
+
+// for persistent saving and loading
+const uint8_t settings_addr = 4;
+const uint8_t hostname_addr = 8;
+const uint8_t hostname_len = 24;
+const uint8_t sparkInterval_addr = 32;
+const uint8_t averageWindow_addr = 34;
+const uint8_t mqttHost_addr = 36;
+const uint8_t mqttPort_addr = 76;
+const uint8_t mqttMode_addr = 78;
+const uint8_t mqttTopic_addr = 80;
+const uint8_t reportHeartbeat_addr = 112;
+const uint8_t deadbands_addr = 114;
+
+static uint16_t Settings::* const deadbands[] = {
+  &Settings::deadbandCo2,
+  &Settings::deadbandPm,
+  &Settings::deadbandTemp,
+  &Settings::deadbandHum,
+  &Settings::deadbandIndex
+};
+
+Settings settings;
+String APIROOT = AG_API_ROOT;
+
+void validateSparkInterval() {
+  switch (settings.sparkInterval) {
+    case 1:
+    case 2:
+    case 6:
+    case 12:
+    case 72:
+    case 144:
+    case 288:
+      return;
+    default:
+      settings.sparkInterval = 1;
+  }
+}
+
+void validateAverageWindow() {
+  switch (settings.averageWindow) {
+    case 10:
+    case 20:
+    case 40:
+    case 80:
+    case 120:
+      return;
+    default:
+      settings.averageWindow = 40;
+  }
+}
+
+// true for a terminated string of printable ASCII, which 0xFF filled
+// EEPROM from before these settings existed is not
+static bool isPrintable(const char* text, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (text[i] == '\0') {
+      return true;
+    }
+    if (text[i] < ' ' || text[i] > '~') {
+      return false;
+    }
+  }
+  return false;
+}
+
+void validateMqtt() {
+  if (!isPrintable(settings.mqttHost, sizeof(settings.mqttHost))) {
+    settings.mqttHost[0] = '\0';
+  }
+  if (!isPrintable(settings.mqttTopic, sizeof(settings.mqttTopic)) || settings.mqttTopic[0] == '\0') {
+    strcpy(settings.mqttTopic, Settings().mqttTopic);
+  }
+  if (settings.mqttPort == 0 || settings.mqttPort == 0xFFFF) {
+    settings.mqttPort = 1883;
+  }
+  if (settings.mqttQos > 1) {
+    settings.mqttQos = 1;
+  }
+}
+
+void validateReport() {
+  const Settings defaults;
+  // a day at most, anything over is 0xFFFF from before these settings existed
+  if (settings.reportHeartbeat > 24 * 60) {
+    settings.reportHeartbeat = defaults.reportHeartbeat;
+  }
+  for (uint16_t Settings::* band : deadbands) {
+    if (settings.*band == 0xFFFF) {
+      settings.*band = defaults.*band;
+    }
+  }
+}
+
+static void readString(uint16_t address, char* text, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    text[i] = EEPROM.read(address + i);
+  }
+}
+
+static void writeString(uint16_t address, const char* text, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    EEPROM.write(address + i, text[i]);
+  }
+}
+
+void readSettings() {
+  uint8_t flags = EEPROM.read(settings_addr);
+  settings.useAGPlatform = (flags & 1) == 1;
+  settings.useFahrenheit = ((flags >> 1) & 1) == 1;
+  settings.useUSAQI = ((flags >> 2) & 1) == 1;
+
+  for (unsigned long i = 0; i < hostname_len; i++) {
+    settings.hostname[i] = EEPROM.read(hostname_addr + i);
+  }
+  settings.hostname[hostname_len - 1] = '\0';
+
+  if constexpr (Board::hasSparkInterval) {
+    EEPROM.get(sparkInterval_addr, settings.sparkInterval);
+    validateSparkInterval();
+  }
+  if constexpr (Board::hasAverageWindow) {
+    EEPROM.get(averageWindow_addr, settings.averageWindow);
+    validateAverageWindow();
+  }
+
+  readString(mqttHost_addr, settings.mqttHost, sizeof(settings.mqttHost));
+  readString(mqttTopic_addr, settings.mqttTopic, sizeof(settings.mqttTopic));
+  EEPROM.get(mqttPort_addr, settings.mqttPort);
+  // bit 0 is the QoS, bit 1 picks one message per field
+  uint8_t mqttMode = EEPROM.read(mqttMode_addr);
+  if (mqttMode > 3) {
+    mqttMode = 1;
+  }
+  settings.mqttQos = mqttMode & 1;
+  settings.mqttBatch = (mqttMode & 2) == 0;
+  validateMqtt();
+
+  EEPROM.get(reportHeartbeat_addr, settings.reportHeartbeat);
+  for (size_t i = 0; i < sizeof(deadbands) / sizeof(deadbands[0]); i++) {
+    EEPROM.get(deadbands_addr + 2 * i, settings.*deadbands[i]);
+  }
+  validateReport();
+
+  wifiManager.setHostname(settings.hostname);
+  applySettings();
+}
+
+void writeSettings() {
+  validateSparkInterval();
+  validateAverageWindow();
+
+  uint8_t flags = 0;
+  if (settings.useAGPlatform) {
+    flags |= 1;
+  }
+  if (settings.useFahrenheit) {
+    flags |= (1 << 1);
+  }
+  if (settings.useUSAQI) {
+    flags |= (1 << 2);
+  }
+  EEPROM.write(settings_addr, flags);
+
+  for (unsigned long i = 0; i < hostname_len; i++) {
+    EEPROM.write(hostname_addr + i, settings.hostname[i]);
+  }
+
+  if constexpr (Board::hasSparkInterval) {
+    EEPROM.put(sparkInterval_addr, settings.sparkInterval);
+  }
+  if constexpr (Board::hasAverageWindow) {
+    EEPROM.put(averageWindow_addr, settings.averageWindow);
+  }
+
+  validateMqtt();
+  writeString(mqttHost_addr, settings.mqttHost, sizeof(settings.mqttHost));
+  writeString(mqttTopic_addr, settings.mqttTopic, sizeof(settings.mqttTopic));
+  EEPROM.put(mqttPort_addr, settings.mqttPort);
+  EEPROM.write(mqttMode_addr, settings.mqttQos | (settings.mqttBatch ? 0 : 2));
+
+  validateReport();
+  EEPROM.put(reportHeartbeat_addr, settings.reportHeartbeat);
+  for (size_t i = 0; i < sizeof(deadbands) / sizeof(deadbands[0]); i++) {
+    EEPROM.put(deadbands_addr + 2 * i, settings.*deadbands[i]);
+  }
+  EEPROM.commit();
+
+  wifiManager.setHostname(settings.hostname);
+  applySettings();
+}
+
+void resetSettings() {
+  wifiManager.resetSettings();
+  settings = Settings();
+  writeSettings();
+}
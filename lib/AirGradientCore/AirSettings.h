@@ -0,0 +1,73 @@
+/*
+  AirSettings.h - settings persisted to EEPROM and shared by every board.
+*/
+
+#ifndef AirSettings_h
+#define AirSettings_h
+
+#include <Arduino.h>
+
+// Where uploads go. Point a build at a local server with
+// -D 'AG_API_ROOT="http://192.168.1.10:8080/"'
+#ifndef AG_API_ROOT
+#define AG_API_ROOT "http://hw.airgradient.com/"
+#endif
+
+struct Settings
+{
+  //set to the endpoint you would like to use
+  boolean useAGPlatform = false;
+
+  // set to true to switch from Celcius to Fahrenheit
+  boolean useFahrenheit = true;
+
+  // PM2.5 in US AQI (default ug/m3)
+  boolean useUSAQI = true;
+
+  // interval to record measurements to spark
+  uint16_t sparkInterval = 1;
+
+  // number of samples averaged per channel on the outdoor monitor
+  uint16_t averageWindow = 40;
+
+  char hostname[24] = "";
+
+  // MQTT broker, publishing is off while the host is empty
+  char mqttHost[40] = "";
+  uint16_t mqttPort = 1883;
+  char mqttTopic[32] = "airgradient";
+  uint8_t mqttQos = 1;
+  // one JSON message per sample instead of one message per field
+  boolean mqttBatch = true;
+
+  // report by exception, see AirReport.h: minutes between uploads while no
+  // measurement leaves its dead-band, 0 uploads every sample
+  uint16_t reportHeartbeat = 0;
+  uint16_t deadbandCo2 = 20;    // ppm
+  uint16_t deadbandPm = 2;      // ug/m3, for PM1, PM2.5 and PM10
+  uint16_t deadbandTemp = 2;    // tenths of a degree C
+  uint16_t deadbandHum = 2;     // %RH
+  uint16_t deadbandIndex = 5;   // VOC and NOx index points
+};
+
+extern Settings settings;
+extern String APIROOT;
+
+void readSettings();
+void writeSettings();
+
+// Back to factory settings, including the saved WiFi credentials.
+void resetSettings();
+
+void validateSparkInterval();
+void validateAverageWindow();
+void validateMqtt();
+void validateReport();
+
+/**
+ * Implemented by each sketch, called whenever settings are read or written so
+ * the board can push them into its variables and display.
+ */
+void applySettings();
+
+#endif
@@ -0,0 +1,96 @@
+#include "AirUpload.h"
+#include "AirJson.h"
+#include "AirLog.h"
+#include "AirPortal.h"
+#include "AirReport.h"
+#include "AirSettings.h"
+
+#if defined(ESP8266)
+#include <ESP8266HTTPClient.h>
+#include <ESP8266WiFi.h>
+#else
+#include <HTTPClient.h>
+#include <WiFi.h>
+#endif
+#include <WiFiClient.h>
+
+// send is called with the HTTPClient once it's set up, and POSTs the body
+template <typename Send>
+static int post(const char* contentType, Send send) {
+  if (WiFi.status() != WL_CONNECTED) {
+    LOG_WARN("WiFi Disconnected");
+    return -1;
+  }
+
+  String POSTURL = APIROOT + "sensors/airgradient:" + deviceId() + "/measures";
+  WiFiClient client;
+  HTTPClient http;
+#if defined(ESP32)
+  http.setConnectTimeout(5 * 1000);
+#endif
+  http.begin(client, POSTURL);
+  http.addHeader("content-type", contentType);
+  int httpCode = send(http);
+  LOG_INFO("POST returned %d", httpCode);
+#if AG_LOG_LEVEL >= AG_LOG_LEVEL_DEBUG
+  LOG_DEBUG("%s", http.getString().c_str());
+#endif
+  http.end();
+  return httpCode;
+}
+
+int postPayload(const String& payload) {
+  LOG_DEBUG("POST %s", payload.c_str());
+  return post("application/json", [&](HTTPClient& http) {
+    return http.POST(payload);
+  });
+}
+
+int postPayload(uint8_t* payload, size_t size) {
+  LOG_DEBUG("POST %u bytes of CBOR", static_cast<unsigned>(size));
+  return post("application/cbor", [&](HTTPClient& http) {
+    return http.POST(payload, size);
+  });
+}
+
+int uploadPayload(void (*fill)(JsonPayload& payload)) {
+#if AG_UPLOAD_CBOR
+  static bool cborRejected = false;
+  if (!cborRejected) {
+    static uint8_t buffer[AG_CBOR_PAYLOAD_SIZE];
+    CborWriter writer(buffer, sizeof(buffer));
+    JsonPayload payload(writer);
+    fill(payload);
+    payload.finish();
+    if (writer.ok()) {
+      int httpCode = postPayload(writer.data(), writer.size());
+      if (httpCode != 415) {
+        return httpCode;
+      }
+      LOG_WARN("server doesn't take CBOR, uploading JSON");
+      cborRejected = true;
+    } else {
+      LOG_WARN("CBOR payload over %d bytes, uploading JSON", AG_CBOR_PAYLOAD_SIZE);
+    }
+  }
+#endif
+  JsonPayload payload;
+  fill(payload);
+  return postPayload(payload.finish());
+}
+
+void sendToServer() {
+  if (!settings.useAGPlatform || !reportDue()) { 
+    return;
+  }
+
+  int httpCode = uploadPayload([](JsonPayload& payload) {
+    payload.add(F("wifi"), WiFi.RSSI());
+    addMeasurements(payload);
+    addLinkHealth(payload);
+    addReportSummary(payload);
+  });
+  if (httpCode >= 200 && httpCode < 300) {
+    reportSent();
+  }
+}
@@ -0,0 +1,41 @@
+/*
+  AirUpload.h - posting measurements to APIROOT.
+*/
+
+#ifndef AirUpload_h
+#define AirUpload_h
+
+#include <Arduino.h>
+
+#include "AirJson.h"
+
+// Upload as CBOR, falling back to JSON for good if the server answers 415.
+#ifndef AG_UPLOAD_CBOR
+#define AG_UPLOAD_CBOR 0
+#endif
+
+// largest CBOR upload, the JSON fallback is used for anything bigger
+#ifndef AG_CBOR_PAYLOAD_SIZE
+#define AG_CBOR_PAYLOAD_SIZE 512
+#endif
+
+/**
+ * POST a JSON payload to the measures endpoint for this device. Returns the
+ * HTTP status code, or a negative value if it couldn't be sent.
+ */
+int postPayload(const String& payload);
+
+// The same for an encoded CBOR payload.
+int postPayload(uint8_t* payload, size_t size);
+
+/**
+ * Build a payload with fill and POST it, as CBOR when AG_UPLOAD_CBOR is set
+ * and the server accepts it, otherwise as JSON.
+ */
+int uploadPayload(void (*fill)(JsonPayload& payload));
+
+// Upload the current measurements if the AirGradient platform is enabled and
+// they are due, see AirReport.h.
+void sendToServer();
+
+#endif
@@ -0,0 +1,140 @@
+/*
+  AirVariable.h - a measurement shown on the OLED of the PRO and BASIC boards.
+*/
+
+#ifndef AirVariable_h
+#define AirVariable_h
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+#include <type_traits>
+
+#include "AirBoard.h"
+#include "AirConversions.h"
+#include "AirFlash.h"
+#include "AirJson.h"
+
+// u8g2 reads strings a byte at a time, so flash strings go via the stack
+inline u8g2_uint_t drawFlashStr(U8G2& u8g2, u8g2_uint_t x, u8g2_uint_t y, FlashString str) {
+  char buffer[24];
+  return u8g2.drawStr(x, y, copyFlash(buffer, sizeof(buffer), str));
+}
+
+template <typename History>
+class BasicAirVariable
+{
+  static constexpr bool hasHistory = !std::is_same<History, NoHistory>::value;
+
+  History spark;
+  uint16_t last = 0;
+  FlashString label;
+  FlashString units;
+  UnitConversionFunction conversion;
+
+  private:
+    void formatNumber(char* s, size_t n, Fixed x) const {
+      x.format(s, n, x.isInteger() ? 0 : 1);
+    }
+
+  public:
+    void update(uint16_t measurement, boolean recordToSpark = false) {
+      last = measurement;
+      if constexpr (hasHistory) {
+        if (recordToSpark) {
+          spark.add(measurement);
+        }
+      }
+    }
+
+    FlashString getLabel() const {
+      return label;
+    }
+
+    uint16_t getLast() const {
+      return last;
+    }
+
+    // the last measurement in display units
+    Fixed getValue() const {
+      return conversion(last);
+    }
+
+    // {"label":"CO²","value":415,"units":"ppm"} as it is on the display
+    void appendJson(String& out) const {
+      char number_buffer[12];
+      formatNumber(number_buffer, sizeof(number_buffer), getValue());
+      out += F("{\"label\":");
+      appendJsonString(out, label);
+      out += F(",\"value\":");
+      out += number_buffer;
+      out += F(",\"units\":");
+      appendJsonString(out, units);
+      out += '}';
+    }
+
+    void setConversion(UnitConversionFunction newVal) {
+      conversion = newVal;
+    }
+
+    void setUnits(FlashString newVal) {
+      units = newVal;
+    }
+
+    void draw(U8G2& u8g2) const {
+      char number_buffer[6];
+      u8g2.setFont(u8g2_font_t0_18b_tf);
+
+      formatNumber(number_buffer, 6, conversion(last));
+      u8g2_uint_t width = u8g2.drawStr(0, 31, number_buffer);
+
+      u8g2.setFont(u8g2_font_t0_11_tf);
+      drawFlashStr(u8g2, 0, 11, label);
+      drawFlashStr(u8g2, width, 31, units);
+
+      if constexpr (hasHistory) {
+        formatNumber(number_buffer, 6, conversion(spark.findMax()));
+        u8g2.drawStr(98, 24, number_buffer);
+
+        formatNumber(number_buffer, 6, conversion(spark.findMin()));
+        u8g2.drawStr(98, 36, number_buffer);
+
+        u8g2.setFont(u8g2_font_siji_t_6x10);
+        u8g2.drawGlyph(86, 24, 0xe12b);
+        u8g2.drawGlyph(86, 36, 0xe12c);
+
+        spark.draw(0, 50, 76, 16, [&u8g2](uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
+          u8g2.drawLine(x0, y0, x1, y1);
+        });
+      }
+    }
+
+    // label and units must be PROGMEM strings, see AirFlash.h
+    BasicAirVariable(
+      FlashString _label,
+      FlashString _units,
+      UnitConversionFunction converter = identity
+    )
+      : label(_label),
+        units(_units),
+        conversion(converter)
+    {}
+};
+
+using AirVariable = BasicAirVariable<Board::History>;
+
+template <size_t N>
+String variablesJson(const AirVariable* const (&variables)[N]) {
+  String out;
+  out.reserve(48 * N);
+  out += '[';
+  for (size_t i = 0; i < N; i++) {
+    if (i > 0) {
+      out += ',';
+    }
+    variables[i]->appendJson(out);
+  }
+  out += ']';
+  return out;
+}
+
+#endif
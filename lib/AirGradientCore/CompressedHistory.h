@@ -0,0 +1,280 @@
+/*
+  CompressedHistory.h - timestamped samples kept compressed in RAM.
+*/
+
+#ifndef CompressedHistory_h
+#define CompressedHistory_h
+
+#include <Arduino.h>
+
+#include "AirFixed.h"
+
+/**
+ * A time series of uint16_t samples, compressed as they are added and read
+ * back with a streaming Reader.
+ *
+ * Timestamps are stored as delta-of-delta, so samples on a fixed schedule
+ * cost one bit each. Values are stored as the change from the previous
+ * sample, down to one bit when nothing changed. Each field is a prefix code
+ * choosing how many bits follow:
+ *
+ *   time:  0 same interval, 10 +7 bits, 110 +9, 1110 +12, 1111 +32 raw
+ *   value: 0 same value,    10 +2 bits, 110 +4, 1110 +6, 11110 +10,
+ *          11111 +16 raw
+ *
+ * The value widths were picked by replaying a day of 5 second samples, where
+ * most readings move by a count or two of sensor jitter.
+ *
+ * Samples go into a ring of fixed size blocks, each starting from an
+ * absolute time and value. When all blocks are full the oldest is dropped,
+ * so the history always covers the most recent span that fits.
+ */
+template <uint16_t BlockBytes, uint8_t BlockCount>
+class CompressedHistory
+{
+  static_assert(BlockBytes >= 16, "a block needs room for a few samples");
+  static_assert(BlockCount >= 2, "dropping the only block would lose everything");
+
+  // worst case for one sample, both fields at their widest
+  static constexpr uint16_t maxSampleBits = 4 + 32 + 5 + 16;
+
+  struct Block
+  {
+    uint32_t start = 0;
+    uint16_t first = 0;
+    uint16_t count = 0;
+    uint16_t bits = 0;
+    uint8_t data[BlockBytes];
+  };
+
+  Block blocks[BlockCount];
+  // the block being written and how many are in use
+  uint8_t current = 0;
+  uint8_t used = 0;
+
+  // encoder state, the last sample and interval of the current block
+  uint32_t lastTime = 0;
+  uint32_t lastInterval = 0;
+  uint16_t lastValue = 0;
+
+  // sign extend a two's complement field of width bits
+  static int32_t signExtend(uint32_t value, uint8_t bits) {
+    const uint32_t sign = 1UL << (bits - 1);
+    return static_cast<int32_t>((value ^ sign) - sign);
+  }
+
+  static bool fits(int32_t value, uint8_t bits) {
+    const int32_t limit = 1L << (bits - 1);
+    return value >= -limit && value < limit;
+  }
+
+  static void writeBits(Block& block, uint32_t value, uint8_t count) {
+    while (count > 0) {
+      const uint16_t index = block.bits >> 3;
+      const uint8_t offset = block.bits & 7;
+      const uint8_t room = 8 - offset;
+      const uint8_t take = count < room ? count : room;
+      const uint8_t chunk = (value >> (count - take)) & ((1u << take) - 1);
+      if (offset == 0) {
+        block.data[index] = 0;
+      }
+      block.data[index] |= chunk << (room - take);
+      block.bits += take;
+      count -= take;
+    }
+  }
+
+  // a prefix of ones terminated by a zero, except after the last width
+  template <size_t N>
+  static void writeField(Block& block, int32_t value, const uint8_t (&widths)[N], uint8_t rawBits, uint32_t raw) {
+    if (value == 0) {
+      writeBits(block, 0, 1);
+      return;
+    }
+    for (size_t i = 0; i < N; i++) {
+      if (fits(value, widths[i])) {
+        // i + 1 ones then a zero
+        writeBits(block, ((1UL << (i + 1)) - 1) << 1, i + 2);
+        writeBits(block, static_cast<uint32_t>(value), widths[i]);
+        return;
+      }
+    }
+    writeBits(block, (1UL << (N + 1)) - 1, N + 1);
+    writeBits(block, raw, rawBits);
+  }
+
+  static constexpr uint8_t timeWidths[] = {7, 9, 12};
+  static constexpr uint8_t valueWidths[] = {2, 4, 6, 10};
+
+  Block& startBlock(uint32_t time, uint16_t value) {
+    if (used > 0) {
+      current = (current + 1) % BlockCount;
+    }
+    if (used < BlockCount) {
+      ++used;
+    }
+    Block& block = blocks[current];
+    block.start = time;
+    block.first = value;
+    block.count = 1;
+    block.bits = 0;
+    return block;
+  }
+
+  public:
+    // Samples must be added in time order.
+    void add(uint32_t time, uint16_t value) {
+      Block& block = blocks[current];
+      if (used == 0 || block.bits + maxSampleBits > BlockBytes * 8 || block.count == UINT16_MAX) {
+        startBlock(time, value);
+        lastInterval = 0;
+      } else {
+        const uint32_t interval = time - lastTime;
+        writeField(block, static_cast<int32_t>(interval - lastInterval), timeWidths, 32, interval);
+        writeField(block, static_cast<int32_t>(value) - lastValue, valueWidths, 16, value);
+        ++block.count;
+        lastInterval = interval;
+      }
+      lastTime = time;
+      lastValue = value;
+    }
+
+    void clear() {
+      used = 0;
+      current = 0;
+    }
+
+    uint32_t size() const {
+      uint32_t total = 0;
+      for (uint8_t i = 0; i < used; i++) {
+        total += blocks[i].count;
+      }
+      return total;
+    }
+
+    // bytes holding samples, block headers included
+    uint32_t bytesUsed() const {
+      uint32_t total = 0;
+      for (uint8_t i = 0; i < used; i++) {
+        total += sizeof(Block) - BlockBytes + (blocks[i].bits + 7) / 8;
+      }
+      return total;
+    }
+
+    // against 6 bytes per sample for a plain uint32_t time and uint16_t value
+    Fixed compressionRatio() const {
+      const uint32_t bytes = bytesUsed();
+      return bytes == 0 ? Fixed::fromInt(1) : Fixed::ratio(size() * 6ULL, bytes);
+    }
+
+    // Time of the oldest sample still held, 0 when empty.
+    uint32_t oldest() const {
+      return used == 0 ? 0 : blocks[(current + BlockCount - used + 1) % BlockCount].start;
+    }
+
+    /**
+     * Decodes samples oldest first without copying the history. Adding a
+     * sample while reading is fine unless it drops the block being read.
+     */
+    class Reader
+    {
+      const CompressedHistory& history;
+      uint8_t remaining;
+      uint8_t block;
+      uint16_t index = 0;
+      uint16_t bit = 0;
+      uint32_t time = 0;
+      uint32_t interval = 0;
+      uint16_t value = 0;
+
+      uint32_t readBits(uint8_t count) {
+        const uint8_t* data = history.blocks[block].data;
+        uint32_t out = 0;
+        while (count > 0) {
+          const uint8_t offset = bit & 7;
+          const uint8_t room = 8 - offset;
+          const uint8_t take = count < room ? count : room;
+          const uint8_t chunk = (data[bit >> 3] >> (room - take)) & ((1u << take) - 1);
+          out = (out << take) | chunk;
+          bit += take;
+          count -= take;
+        }
+        return out;
+      }
+
+      template <size_t N>
+      bool readField(const uint8_t (&widths)[N], uint8_t rawBits, int32_t& delta, uint32_t& raw) {
+        size_t ones = 0;
+        while (ones <= N && readBits(1) == 1) {
+          ++ones;
+        }
+        if (ones == 0) {
+          delta = 0;
+          return false;
+        }
+        if (ones <= N) {
+          delta = signExtend(readBits(widths[ones - 1]), widths[ones - 1]);
+          return false;
+        }
+        raw = readBits(rawBits);
+        return true;
+      }
+
+      public:
+        explicit Reader(const CompressedHistory& source)
+          : history(source),
+            remaining(source.used),
+            block((source.current + BlockCount - source.used + 1) % BlockCount)
+        {}
+
+        // Skips whole blocks that end before since, call before next().
+        void seek(uint32_t since) {
+          while (remaining > 1 && history.blocks[(block + 1) % BlockCount].start <= since) {
+            block = (block + 1) % BlockCount;
+            --remaining;
+          }
+        }
+
+        bool next(uint32_t& sampleTime, uint16_t& sampleValue) {
+          while (remaining > 0 && index >= history.blocks[block].count) {
+            block = (block + 1) % BlockCount;
+            --remaining;
+            index = 0;
+            bit = 0;
+          }
+          if (remaining == 0) {
+            return false;
+          }
+          if (index == 0) {
+            const Block& header = history.blocks[block];
+            time = header.start;
+            interval = 0;
+            value = header.first;
+          } else {
+            int32_t delta;
+            uint32_t raw;
+            if (readField(timeWidths, 32, delta, raw)) {
+              interval = raw;
+            } else {
+              interval += delta;
+            }
+            time += interval;
+            if (readField(valueWidths, 16, delta, raw)) {
+              value = raw;
+            } else {
+              value += delta;
+            }
+          }
+          ++index;
+          sampleTime = time;
+          sampleValue = value;
+          return true;
+        }
+    };
+
+    Reader read() const {
+      return Reader(*this);
+    }
+};
+
+#endif
@@ -0,0 +1,285 @@
+/*
+  RecordRing.h - fixed size sample records appended to a ring of flash
+  sectors. Plain C++ so tools/history_bench.cpp can run it on the host.
+*/
+
+#ifndef RecordRing_h
+#define RecordRing_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * One stored sample. time is device seconds: uptime, continued from the last
+ * stored record after a reboot, so it only ever increases. What the values
+ * mean is up to the board, see Board::recordFields.
+ */
+struct SampleRecord
+{
+  // erased flash reads as all ones, which is never a written sequence
+  static const uint32_t erased = 0xFFFFFFFF;
+
+  uint32_t sequence;
+  uint32_t time;
+  uint16_t values[12];
+};
+static_assert(sizeof(SampleRecord) == 32, "records must tile a flash sector");
+
+/**
+ * Records are written in order through the region's sectors, erasing the
+ * next sector (and the oldest records) when the current one fills. The
+ * valid records form one logical byte stream from the oldest to the newest
+ * record, which is what /history serves.
+ *
+ * Region provides:
+ *   static constexpr size_t sectorSize;
+ *   size_t size() const;
+ *   const uint8_t* map() const;   // nullptr if reads have to be copied
+ *   bool read(size_t offset, void* out, size_t size) const;
+ *   bool write(size_t offset, const void* data, size_t size);
+ *   bool eraseSector(size_t offset);
+ */
+template <typename Region>
+class RecordRing
+{
+  static constexpr size_t recordSize = sizeof(SampleRecord);
+  static_assert(Region::sectorSize % recordSize == 0, "records must tile a flash sector");
+
+  Region& region;
+  size_t capacity = 0;
+  // physical offsets of the oldest record and the next write
+  size_t tail = 0;
+  size_t head = 0;
+  size_t length = 0;
+  uint32_t nextSequence = 0;
+  uint32_t newestTime = 0;
+
+  uint32_t sequenceAt(size_t physical) const {
+    uint32_t sequence = SampleRecord::erased;
+    region.read(physical, &sequence, sizeof(sequence));
+    return sequence;
+  }
+
+  size_t wrap(size_t offset) const {
+    return offset >= capacity ? offset - capacity : offset;
+  }
+
+  public:
+    explicit RecordRing(Region& storage) : region(storage) {}
+
+    /**
+     * Finds the oldest and newest records, reading one word per sector plus
+     * a binary search of the newest sector. Returns false without a usable
+     * region.
+     */
+    bool begin() {
+      capacity = region.size() - region.size() % Region::sectorSize;
+      tail = head = length = 0;
+      nextSequence = 0;
+      newestTime = 0;
+      if (capacity < 2 * Region::sectorSize) {
+        capacity = 0;
+        return false;
+      }
+
+      const size_t sectors = capacity / Region::sectorSize;
+      size_t newest = sectors;
+      uint32_t newestSequence = 0;
+      for (size_t sector = 0; sector < sectors; sector++) {
+        uint32_t sequence = sequenceAt(sector * Region::sectorSize);
+        if (sequence != SampleRecord::erased && (newest == sectors || sequence > newestSequence)) {
+          newest = sector;
+          newestSequence = sequence;
+        }
+      }
+      if (newest == sectors) {
+        return true;
+      }
+
+      // the newest sector fills from its start, so its written slots are a prefix
+      const size_t start = newest * Region::sectorSize;
+      size_t low = 1;
+      size_t high = Region::sectorSize / recordSize;
+      while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (sequenceAt(start + middle * recordSize) == SampleRecord::erased) {
+          high = middle;
+        } else {
+          low = middle + 1;
+        }
+      }
+      head = wrap(start + low * recordSize);
+
+      SampleRecord last;
+      region.read(start + (low - 1) * recordSize, &last, recordSize);
+      nextSequence = last.sequence + 1;
+      newestTime = last.time;
+
+      // after a wrap the oldest records are in the next written sector
+      const size_t next = wrap(start + Region::sectorSize);
+      tail = sequenceAt(next) != SampleRecord::erased ? next : 0;
+      length = head > tail ? head - tail : capacity - tail + head;
+      if (head == tail && sequenceAt(next) == SampleRecord::erased) {
+        length = 0;
+      }
+      return true;
+    }
+
+    /**
+     * Appends record, filling in its sequence. Starting a new sector erases
+     * it first, which can take tens of milliseconds.
+     */
+    bool append(SampleRecord& record) {
+      if (capacity == 0) {
+        return false;
+      }
+      if (head % Region::sectorSize == 0) {
+        if (length > 0 && tail / Region::sectorSize == head / Region::sectorSize) {
+          // the oldest sector is about to be erased
+          const size_t next = wrap(tail - tail % Region::sectorSize + Region::sectorSize);
+          length -= Region::sectorSize - tail % Region::sectorSize;
+          tail = next;
+        }
+        if (!region.eraseSector(head)) {
+          return false;
+        }
+      }
+      record.sequence = nextSequence;
+      if (!region.write(head, &record, recordSize)) {
+        return false;
+      }
+      ++nextSequence;
+      newestTime = record.time;
+      head = wrap(head + recordSize);
+      length += recordSize;
+      return true;
+    }
+
+    // bytes of valid records, a multiple of sizeof(SampleRecord)
+    size_t size() const {
+      return length;
+    }
+
+    size_t count() const {
+      return length / recordSize;
+    }
+
+    // time of the newest record, 0 if there is none
+    uint32_t lastTime() const {
+      return newestTime;
+    }
+
+    bool recordAt(size_t index, SampleRecord& record) const {
+      if (index >= count()) {
+        return false;
+      }
+      return region.read(wrap(tail + index * recordSize), &record, recordSize);
+    }
+
+    // index of the first record with time >= time, count() if none
+    size_t lowerBoundTime(uint32_t time) const {
+      size_t low = 0;
+      size_t high = count();
+      SampleRecord record;
+      while (low < high) {
+        size_t middle = (low + high) / 2;
+        recordAt(middle, record);
+        if (record.time < time) {
+          low = middle + 1;
+        } else {
+          high = middle;
+        }
+      }
+      return low;
+    }
+
+    // index of the first record with a sequence above sequence
+    size_t upperBoundSequence(uint32_t sequence) const {
+      size_t low = 0;
+      size_t high = count();
+      SampleRecord record;
+      while (low < high) {
+        size_t middle = (low + high) / 2;
+        recordAt(middle, record);
+        if (record.sequence <= sequence) {
+          low = middle + 1;
+        } else {
+          high = middle;
+        }
+      }
+      return low;
+    }
+
+    /**
+     * Hands the logical bytes [offset, offset + size) to sink(data, size) in
+     * pieces of at most chunk bytes. When the region is memory mapped they
+     * point straight into flash, otherwise they are read into scratch, which
+     * must hold chunk bytes. Stops early if sink returns false.
+     */
+    template <typename Sink>
+    bool stream(size_t offset, size_t size, uint8_t* scratch, size_t chunk, Sink sink) const {
+      if (offset + size > length) {
+        return false;
+      }
+      const uint8_t* mapped = region.map();
+      while (size > 0) {
+        const size_t physical = wrap(tail + offset);
+        size_t piece = capacity - physical;
+        piece = piece < size ? piece : size;
+        piece = piece < chunk ? piece : chunk;
+        const uint8_t* data = mapped ? mapped + physical : scratch;
+        if (!mapped && !region.read(physical, scratch, piece)) {
+          return false;
+        }
+        if (!sink(data, piece)) {
+          return false;
+        }
+        offset += piece;
+        size -= piece;
+      }
+      return true;
+    }
+};
+
+/**
+ * Parses a single "bytes=first-last", "bytes=first-" or "bytes=-suffix"
+ * Range header against a body of total bytes. Returns false if it isn't
+ * satisfiable, multiple ranges included.
+ */
+inline bool parseByteRange(const char* header, size_t total, size_t& first, size_t& last) {
+  if (strncmp(header, "bytes=", 6) != 0 || total == 0) {
+    return false;
+  }
+  const char* p = header + 6;
+  char* end;
+  if (*p == '-') {
+    unsigned long suffix = strtoul(p + 1, &end, 10);
+    if (end == p + 1 || *end != '\0' || suffix == 0) {
+      return false;
+    }
+    first = suffix >= total ? 0 : total - suffix;
+    last = total - 1;
+    return true;
+  }
+  unsigned long start = strtoul(p, &end, 10);
+  if (end == p || *end != '-' || start >= total) {
+    return false;
+  }
+  p = end + 1;
+  if (*p == '\0') {
+    first = start;
+    last = total - 1;
+    return true;
+  }
+  unsigned long stop = strtoul(p, &end, 10);
+  if (end == p || *end != '\0' || stop < start) {
+    return false;
+  }
+  first = start;
+  last = stop < total ? stop : total - 1;
+  return true;
+}
+
+#endif
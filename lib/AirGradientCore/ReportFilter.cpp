@@ -0,0 +1,113 @@
+#include "ReportFilter.h"
+#include "AirFlash.h"
+
+static const char co2Key[] PROGMEM = "rco2";
+static const char pm01Key[] PROGMEM = "pm01";
+static const char pm25Key[] PROGMEM = "pm02";
+static const char pm10Key[] PROGMEM = "pm10";
+static const char tempKey[] PROGMEM = "atmp";
+static const char humKey[] PROGMEM = "rhum";
+static const char tvocKey[] PROGMEM = "tvoc_index";
+static const char noxKey[] PROGMEM = "nox_index";
+
+struct DeadBand
+{
+  PGM_P key;
+  uint16_t Settings::*band;
+  // hundredths of the measurement per unit of the setting
+  uint8_t scale;
+};
+
+static const DeadBand deadBands[] = {
+  {co2Key, &Settings::deadbandCo2, 100},
+  {pm01Key, &Settings::deadbandPm, 100},
+  {pm25Key, &Settings::deadbandPm, 100},
+  {pm10Key, &Settings::deadbandPm, 100},
+  {tempKey, &Settings::deadbandTemp, 10},
+  {humKey, &Settings::deadbandHum, 100},
+  {tvocKey, &Settings::deadbandIndex, 100},
+  {noxKey, &Settings::deadbandIndex, 100},
+};
+
+// "23.45", "-3.5" or "812" as hundredths, the finest any measurement is
+// compared at
+static int32_t toHundredths(const String& value) {
+  const char* p = value.c_str();
+  const bool negative = *p == '-';
+  if (negative) {
+    ++p;
+  }
+  int32_t result = 0;
+  for (; *p >= '0' && *p <= '9'; ++p) {
+    result = result * 10 + (*p - '0');
+  }
+  result *= 100;
+  if (*p == '.') {
+    ++p;
+    for (int32_t scale = 10; scale > 0 && *p >= '0' && *p <= '9'; ++p, scale /= 10) {
+      result += (*p - '0') * scale;
+    }
+  }
+  return negative ? -result : result;
+}
+
+void ReportFilter::readField(FlashString key, const String& value, void* context) {
+  static_assert(sizeof(deadBands) / sizeof(deadBands[0]) == bandCount, "a dead-band per bandCount");
+  ReportFilter& filter = *static_cast<ReportFilter*>(context);
+  char name[16];
+  copyFlash(name, sizeof(name), key);
+  for (uint8_t i = 0; i < bandCount; i++) {
+    if (strcmp_P(name, deadBands[i].key) == 0) {
+      filter.current[i] = toHundredths(value);
+      filter.currentSeen |= 1 << i;
+      return;
+    }
+  }
+}
+
+// true once any measurement has left its dead-band
+bool ReportFilter::moved(const Settings& settings) const {
+  for (uint8_t i = 0; i < bandCount; i++) {
+    const uint8_t bit = 1 << i;
+    if (!(currentSeen & bit)) {
+      continue;
+    }
+    if (!(referenceSeen & bit)) {
+      return true;
+    }
+    const int32_t limit = static_cast<int32_t>(settings.*deadBands[i].band) * deadBands[i].scale;
+    if (abs(current[i] - reference[i]) > limit) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ReportFilter::decide(const Settings& settings, uint32_t now) {
+  if (settings.reportHeartbeat == 0 || !haveReference || moved(settings)) {
+    ++counts.due;
+    return true;
+  }
+  if (now - lastSent >= settings.reportHeartbeat * 60000UL) {
+    ++counts.due;
+    ++counts.heartbeats;
+    return true;
+  }
+  ++counts.suppressed;
+  ++suppressedSinceSent;
+  return false;
+}
+
+void ReportFilter::sent(uint32_t now) {
+  memcpy(reference, current, sizeof(reference));
+  referenceSeen = currentSeen;
+  haveReference = true;
+  lastSent = now;
+  suppressedSinceSent = 0;
+}
+
+void ReportFilter::addSummary(JsonPayload& payload, const Settings& settings) const {
+  if (settings.reportHeartbeat > 0) {
+    payload.addRaw(F("suppressed"), suppressedSinceSent);
+  }
+}
@@ -0,0 +1,72 @@
+/*
+  ReportFilter.h - the dead-band and heartbeat state behind AirReport.h, one
+  per device.
+
+  The board keeps a single filter in AirReport.cpp; tools that play many
+  devices keep one each and pass in their own settings and clock.
+*/
+
+#ifndef ReportFilter_h
+#define ReportFilter_h
+
+#include <Arduino.h>
+
+#include "AirJson.h"
+#include "AirSettings.h"
+
+struct ReportStats
+{
+  // samples that were due for upload, for any reason
+  uint32_t due = 0;
+  // of those, due only because the heartbeat passed
+  uint32_t heartbeats = 0;
+  uint32_t suppressed = 0;
+};
+
+class ReportFilter
+{
+  // measurements with a dead-band, see ReportFilter.cpp
+  static constexpr uint8_t bandCount = 8;
+
+  // in hundredths, as of the last due() and the last accepted upload
+  int32_t current[bandCount] = {};
+  int32_t reference[bandCount] = {};
+  // bit per dead-band, set for the measurements the board reported
+  uint8_t currentSeen = 0;
+  uint8_t referenceSeen = 0;
+  bool haveReference = false;
+  uint32_t lastSent = 0;
+  uint32_t suppressedSinceSent = 0;
+  ReportStats counts;
+
+  static void readField(FlashString key, const String& value, void* context);
+  bool moved(const Settings& settings) const;
+  bool decide(const Settings& settings, uint32_t now);
+
+  public:
+    /**
+     * True if the measurements fill() adds should be uploaded at now, in
+     * milliseconds. Call once per sample just before uploading, and sent()
+     * if the upload was accepted.
+     */
+    template <typename Fill>
+    bool due(const Settings& settings, uint32_t now, Fill fill) {
+      currentSeen = 0;
+      JsonPayload fields(readField, this);
+      fill(fields);
+      return decide(settings, now);
+    }
+
+    // The measurements due() saw become the reference for the dead-bands.
+    void sent(uint32_t now);
+
+    // Adds the samples held back since the last upload, nothing without a
+    // heartbeat.
+    void addSummary(JsonPayload& payload, const Settings& settings) const;
+
+    const ReportStats& stats() const {
+      return counts;
+    }
+};
+
+#endif
@@ -0,0 +1,62 @@
+/*
+  RingAverage.h - sliding window mean over the most recent samples.
+*/
+
+#ifndef RingAverage_h
+#define RingAverage_h
+
+#include <Arduino.h>
+
+#include "AirFixed.h"
+
+/**
+ * Fixed capacity ring of samples that keeps a running sum, so the mean over
+ * the last `window` samples is available after every sample instead of only
+ * once a batch has been collected. Adding a sample is O(1).
+ */
+template <typename T, uint16_t Capacity>
+class RingAverage
+{
+  T samples[Capacity] = {};
+  int32_t sum = 0;
+  uint16_t head = 0;
+  uint16_t size = 0;
+  uint16_t window = Capacity;
+
+  public:
+    void setWindow(uint16_t newWindow) {
+      newWindow = constrain(newWindow, 1, Capacity);
+      if (newWindow == window) {
+        return;
+      }
+      window = newWindow;
+      clear();
+    }
+
+    void clear() {
+      sum = 0;
+      head = 0;
+      size = 0;
+    }
+
+    void add(T x) {
+      // once the window is full the slot at head holds the oldest sample
+      if (size == window) {
+        sum -= samples[head];
+      } else {
+        ++size;
+      }
+      samples[head] = x;
+      sum += x;
+      if (++head == window) {
+        head = 0;
+      }
+    }
+
+    // samples stored in units of 1/scale come back as whole units
+    Fixed mean(int32_t scale = 1) const {
+      return size == 0 ? Fixed() : Fixed::ratio(sum, static_cast<int64_t>(size) * scale);
+    }
+};
+
+#endif
@@ -0,0 +1,260 @@
+/*
+  SensorDriver.h - common calling convention for the sensors on the
+  AirGradient boards and a compile-time registry that services them.
+*/
+
+#ifndef SensorDriver_h
+#define SensorDriver_h
+
+#include <Arduino.h>
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "AirLog.h"
+
+/**
+ * A sensor driver is any default constructible class that provides:
+ *
+ *   static constexpr const char* name;
+ *   static constexpr uint32_t warmUpMs;   // delay after boot before sampling
+ *   static constexpr uint32_t intervalMs; // time between measurement starts
+ *   static constexpr uint32_t timeoutMs;  // how long ready() may stay false
+ *
+ *   bool begin();  // once from setup()
+ *   bool start();  // kick off a measurement, must not block
+ *   bool ready();  // poll, true once a result can be read
+ *   bool read();   // collect and publish the result, false on failure
+ *
+ * Drivers for sensors that only have a blocking API return true from ready()
+ * and do the transfer in read(). Timing lives in the registry so loop() only
+ * has to call service(), and nothing is dispatched through a vtable.
+ *
+ * Starts are scheduled on a fixed grid of intervalMs from the first one, so a
+ * late loop() delays a single sample instead of shifting all the ones after
+ * it. How late each start was is kept in the status.
+ *
+ * A driver that samples adaptively (see AdaptiveCadence.h) also provides
+ *
+ *   uint32_t cadenceMs() const; // time to the next start, >= intervalMs
+ *
+ * which is asked after every read, so a change takes effect from the start
+ * of that read. intervalMs is then the fastest it will ask for.
+ *
+ * A driver whose successful reads don't always change what it publishes,
+ * say while the sensor is still conditioning, also provides
+ *
+ *   bool published() const; // whether the last read changed a reading
+ *
+ * so service() doesn't report a change every time it reads.
+ */
+enum class SensorState : uint8_t
+{
+  IDLE,
+  MEASURING,
+  FAILED
+};
+
+struct SensorStatus
+{
+  SensorState state = SensorState::IDLE;
+  uint32_t lastStart = 0;
+  uint32_t nextStart = 0;
+  uint32_t reads = 0;
+  uint32_t errors = 0;
+  uint32_t timeouts = 0;
+  // reset by every successful read, so a dead sensor is easy to spot
+  uint16_t consecutiveErrors = 0;
+  // ms between the scheduled and the actual start
+  uint16_t lastLateMs = 0;
+  uint16_t maxLateMs = 0;
+  // grid slots missed entirely because loop() was busy
+  uint32_t skipped = 0;
+  bool started = false;
+};
+
+template <typename Driver, typename = void>
+struct HasCadence : std::false_type {};
+
+template <typename Driver>
+struct HasCadence<Driver, std::void_t<decltype(std::declval<const Driver &>().cadenceMs())>> : std::true_type {};
+
+template <typename Driver, typename = void>
+struct HasPublished : std::false_type {};
+
+template <typename Driver>
+struct HasPublished<Driver, std::void_t<decltype(std::declval<const Driver &>().published())>> : std::true_type {};
+
+template <typename Driver>
+struct SensorSlot
+{
+  Driver driver;
+  SensorStatus status;
+};
+
+template <typename... Drivers>
+class SensorRegistry
+{
+  using Slots = std::tuple<SensorSlot<Drivers>...>;
+  using Indices = std::index_sequence_for<Drivers...>;
+
+  Slots slots;
+  uint32_t bootTime = 0;
+
+  template <typename Driver>
+  static void fail(SensorSlot<Driver> &slot)
+  {
+    slot.status.errors++;
+    slot.status.consecutiveErrors++;
+    slot.status.state = SensorState::IDLE;
+  }
+
+  template <typename Driver>
+  static uint32_t intervalFor(const Driver &driver)
+  {
+    if constexpr (HasCadence<Driver>::value)
+    {
+      return driver.cadenceMs();
+    }
+    else
+    {
+      return Driver::intervalMs;
+    }
+  }
+
+  static void schedule(SensorStatus &status, uint32_t now, uint32_t interval)
+  {
+    uint32_t late = status.started ? now - status.nextStart : 0;
+    if (late >= interval)
+    {
+      status.skipped += late / interval;
+      late %= interval;
+    }
+    status.lastLateMs = late > UINT16_MAX ? UINT16_MAX : late;
+    if (status.lastLateMs > status.maxLateMs)
+    {
+      status.maxLateMs = status.lastLateMs;
+    }
+    status.started = true;
+    status.lastStart = now;
+    status.nextStart = now - late + interval;
+  }
+
+  // true when the driver published a new reading
+  template <typename Driver>
+  bool service(SensorSlot<Driver> &slot, uint32_t now)
+  {
+    SensorStatus &status = slot.status;
+    switch (status.state)
+    {
+    case SensorState::FAILED:
+      return false;
+
+    case SensorState::IDLE:
+      if (now - bootTime < Driver::warmUpMs)
+      {
+        return false;
+      }
+      if (status.started && static_cast<int32_t>(now - status.nextStart) < 0)
+      {
+        return false;
+      }
+      schedule(status, now, intervalFor(slot.driver));
+      if (!slot.driver.start())
+      {
+        fail(slot);
+        return false;
+      }
+      status.state = SensorState::MEASURING;
+      // blocking drivers are ready straight away
+      [[fallthrough]];
+
+    case SensorState::MEASURING:
+      if (!slot.driver.ready())
+      {
+        if (now - status.lastStart > Driver::timeoutMs)
+        {
+          LOG_WARN("%s timed out", Driver::name);
+          status.timeouts++;
+          fail(slot);
+        }
+        return false;
+      }
+      if (!slot.driver.read())
+      {
+        fail(slot);
+        return false;
+      }
+      if constexpr (HasCadence<Driver>::value)
+      {
+        // still on the grid, a burst shouldn't wait out the slow interval
+        status.nextStart = status.lastStart - status.lastLateMs + slot.driver.cadenceMs();
+      }
+      status.reads++;
+      status.consecutiveErrors = 0;
+      status.state = SensorState::IDLE;
+      if constexpr (HasPublished<Driver>::value)
+      {
+        return slot.driver.published();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  template <std::size_t... I>
+  void beginAll(std::index_sequence<I...>)
+  {
+    (beginSlot(std::get<I>(slots)), ...);
+  }
+
+  template <typename Driver>
+  static void beginSlot(SensorSlot<Driver> &slot)
+  {
+    if (!slot.driver.begin())
+    {
+      LOG_ERROR("%s failed to initialize", Driver::name);
+      slot.status.state = SensorState::FAILED;
+    }
+  }
+
+  template <std::size_t... I>
+  bool serviceAll(uint32_t now, std::index_sequence<I...>)
+  {
+    // | rather than || so every driver is serviced
+    return (service(std::get<I>(slots), now) | ...);
+  }
+
+public:
+  // the shortest sampling interval, how often readings can change even when
+  // some drivers are sampling slower
+  static constexpr uint32_t intervalMs = std::min({Drivers::intervalMs...});
+
+  void begin()
+  {
+    bootTime = millis();
+    beginAll(Indices{});
+  }
+
+  // Call from every loop() iteration, never blocks on non-blocking drivers.
+  // Returns true when any driver published a new reading.
+  bool service()
+  {
+    return serviceAll(millis(), Indices{});
+  }
+
+  template <std::size_t I>
+  auto &driver()
+  {
+    return std::get<I>(slots).driver;
+  }
+
+  template <std::size_t I>
+  const SensorStatus &status() const
+  {
+    return std::get<I>(slots).status;
+  }
+};
+
+#endif
@@ -0,0 +1,141 @@
+/*
+  SparkHistory.h - fixed length sample history drawn as a sparkline.
+*/
+
+#ifndef SparkHistory_h
+#define SparkHistory_h
+
+#include <Arduino.h>
+#include <type_traits>
+
+/**
+ * Ring of the last Length samples that keeps its minimum and maximum in
+ * monotonic deques, so both are O(1) to read and amortised O(1) to update.
+ * The scaled polyline is cached and only rebuilt after a new sample or a
+ * change of size, since the display redraws far more often than samples
+ * arrive.
+ */
+template <typename T, uint16_t Length>
+class SparkHistory
+{
+  static_assert(Length >= 2, "a sparkline needs at least two points");
+
+  // positions in samples[], small enough for a byte on every board
+  using Slot = typename std::conditional<(Length <= 256), uint8_t, uint16_t>::type;
+
+  class Deque
+  {
+    Slot slots[Length];
+    uint16_t first = 0;
+
+    public:
+      uint16_t size = 0;
+
+      Slot front() const {
+        return slots[first];
+      }
+
+      Slot back() const {
+        return slots[(first + size - 1) % Length];
+      }
+
+      void popFront() {
+        first = (first + 1) % Length;
+        --size;
+      }
+
+      void popBack() {
+        --size;
+      }
+
+      void pushBack(Slot slot) {
+        slots[(first + size) % Length] = slot;
+        ++size;
+      }
+  };
+
+  T samples[Length] = {};
+  uint16_t head = 0;
+  uint16_t count = 0;
+
+  // slots with decreasing values for the maximum, increasing for the minimum
+  Deque maxima;
+  Deque minima;
+
+  mutable uint8_t pointX[Length];
+  mutable uint8_t pointY[Length];
+  mutable uint8_t cachedWidth = 0;
+  mutable uint8_t cachedHeight = 0;
+  mutable bool dirty = true;
+
+  void rescale(uint8_t width, uint8_t height) const {
+    const T low = findMin();
+    const uint32_t range = findMax() - low;
+    uint16_t slot = (head + Length - count) % Length;
+    for (uint16_t i = 0; i < count; i++) {
+      pointX[i] = static_cast<uint32_t>(i) * width / (count - 1);
+      pointY[i] = range == 0
+        ? height / 2
+        : static_cast<uint32_t>(samples[slot] - low) * height / range;
+      slot = (slot + 1) % Length;
+    }
+    cachedWidth = width;
+    cachedHeight = height;
+    dirty = false;
+  }
+
+  public:
+    void add(T value) {
+      if (count == Length) {
+        // head holds the oldest sample, which is leaving the window
+        if (maxima.front() == head) {
+          maxima.popFront();
+        }
+        if (minima.front() == head) {
+          minima.popFront();
+        }
+      } else {
+        ++count;
+      }
+      samples[head] = value;
+
+      while (maxima.size > 0 && samples[maxima.back()] <= value) {
+        maxima.popBack();
+      }
+      maxima.pushBack(head);
+      while (minima.size > 0 && samples[minima.back()] >= value) {
+        minima.popBack();
+      }
+      minima.pushBack(head);
+
+      head = (head + 1) % Length;
+      dirty = true;
+    }
+
+    T findMax() const {
+      return maxima.size > 0 ? samples[maxima.front()] : T();
+    }
+
+    T findMin() const {
+      return minima.size > 0 ? samples[minima.front()] : T();
+    }
+
+    /**
+     * Draws oldest to newest across width with the line's baseline at y, so
+     * it spans y - height to y. line is called as line(x0, y0, x1, y1).
+     */
+    template <typename Line>
+    void draw(uint16_t x, uint16_t y, uint8_t width, uint8_t height, Line line) const {
+      if (count < 2) {
+        return;
+      }
+      if (dirty || width != cachedWidth || height != cachedHeight) {
+        rescale(width, height);
+      }
+      for (uint16_t i = 1; i < count; i++) {
+        line(x + pointX[i - 1], y - pointY[i - 1], x + pointX[i], y - pointY[i]);
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,146 @@
+/*
+  TileDisplay.h - pushes a full buffer u8g2 display to the panel a few tiles
+  at a time, so the I2C transfers never hold up loop() for a whole frame.
+*/
+
+#ifndef TileDisplay_h
+#define TileDisplay_h
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+#include <algorithm>
+
+// I2C time service() may spend per call, in microseconds
+#ifndef AG_DISPLAY_BUDGET_US
+#define AG_DISPLAY_BUDGET_US 2000
+#endif
+
+struct DisplayStats
+{
+  // frames completely on the panel
+  uint32_t frames = 0;
+  uint32_t tiles = 0;
+  // I2C time and tiles sent for the last complete frame
+  uint32_t lastFrameUs = 0;
+  uint16_t lastFrameTiles = 0;
+  // longest single service() call
+  uint32_t maxSliceUs = 0;
+};
+
+/**
+ * draw() renders into the u8g2 buffer and marks the 8x8 tiles that differ
+ * from what the panel shows, kept in a shadow copy. service() sends dirty
+ * tiles with updateDisplayArea(), joined into runs along a tile row, until
+ * its budget is spent, so an unchanged frame costs no I2C at all and a
+ * changed one is spread over several calls. Runs are cut to fit what is
+ * left of the budget at the measured cost per tile, so a call overruns it by
+ * at most one tile.
+ *
+ * The tile size is the u8g2 buffer's, 16x8 for a 128x64 panel.
+ */
+template <uint8_t TileWidth, uint8_t TileHeight>
+class TileDisplay
+{
+  static_assert(TileWidth <= 16, "dirty tiles are a uint16_t per row");
+
+  static constexpr uint16_t rowBytes = TileWidth * 8;
+
+  U8G2& u8g2;
+  uint8_t shown[TileHeight * rowBytes] = {};
+  // bit per tile column
+  uint16_t dirty[TileHeight];
+  uint32_t usPerTile = 300;
+  uint32_t frameUs = 0;
+  uint16_t frameTiles = 0;
+  DisplayStats stats;
+
+  private:
+    // sends tiles until the budget is spent, returns the I2C time
+    uint32_t push(uint32_t budgetUs, bool& waiting) {
+      const uint8_t* buffer = u8g2.getBufferPtr();
+      uint32_t spent = 0;
+      waiting = false;
+      for (uint8_t ty = 0; ty < TileHeight && !waiting; ty++) {
+        while (dirty[ty] != 0) {
+          const uint32_t left = spent < budgetUs ? budgetUs - spent : 0;
+          // one tile always goes, so every call makes progress
+          if (spent > 0 && left < usPerTile) {
+            waiting = true;
+            break;
+          }
+          const uint8_t tx = __builtin_ctz(dirty[ty]);
+          uint8_t run = 1;
+          while (tx + run < TileWidth && (dirty[ty] >> (tx + run)) & 1) {
+            run++;
+          }
+          run = std::min<uint32_t>(run, std::max<uint32_t>(1, left / usPerTile));
+
+          const uint32_t start = micros();
+          u8g2.updateDisplayArea(tx, ty, run, 1);
+          const uint32_t took = micros() - start;
+
+          usPerTile = std::max<uint32_t>(1, (usPerTile * 3 + took / run) / 4);
+          memcpy(shown + ty * rowBytes + tx * 8, buffer + ty * rowBytes + tx * 8, run * 8);
+          dirty[ty] &= ~(((1U << run) - 1) << tx);
+          spent += took;
+          frameTiles += run;
+          stats.tiles += run;
+        }
+      }
+      if (spent > 0) {
+        frameUs += spent;
+        if (!waiting) {
+          stats.lastFrameUs = frameUs;
+          stats.lastFrameTiles = frameTiles;
+          stats.frames++;
+          frameUs = 0;
+          frameTiles = 0;
+        }
+      }
+      return spent;
+    }
+
+  public:
+    explicit TileDisplay(U8G2& display) : u8g2(display) {
+      invalidate();
+    }
+
+    // Resend every tile, for when the panel may not show what we think.
+    void invalidate() {
+      std::fill(dirty, dirty + TileHeight, (1U << TileWidth) - 1);
+    }
+
+    template <typename Draw>
+    void draw(Draw render) {
+      u8g2.clearBuffer();
+      render();
+      const uint8_t* buffer = u8g2.getBufferPtr();
+      for (uint8_t ty = 0; ty < TileHeight; ty++) {
+        for (uint8_t tx = 0; tx < TileWidth; tx++) {
+          const uint16_t offset = ty * rowBytes + tx * 8;
+          if (memcmp(buffer + offset, shown + offset, 8) != 0) {
+            dirty[ty] |= 1U << tx;
+          }
+        }
+      }
+    }
+
+    // Call from loop(), true while tiles are still waiting.
+    bool service(uint32_t budgetUs = AG_DISPLAY_BUDGET_US) {
+      bool waiting;
+      stats.maxSliceUs = std::max(stats.maxSliceUs, push(budgetUs, waiting));
+      return waiting;
+    }
+
+    // Send everything that is waiting now, regardless of the budget.
+    void flush() {
+      bool waiting;
+      push(UINT32_MAX, waiting);
+    }
+
+    const DisplayStats& getStats() const {
+      return stats;
+    }
+};
+
+#endif
@@ -30,13 +30,20 @@ MIT License
 #include <PMS/PMS5003.h>
 #include <Arduino.h>
 #include <EEPROM.h>
-#include <ESP8266HTTPClient.h>
-#include <ESP8266WebServer.h>
 #include <ESP8266WiFi.h>
-#include <SoftwareSerial.h>
-#include <WiFiClient.h>
-#include <WiFiManager.h>
 
+#include <AdaptiveCadence.h>
+#include <AirBoard.h>
+#include <AirConversions.h>
+#include <AirFlash.h>
+#include <AirJson.h>
+#include <AirLog.h>
+#include <AirPortal.h>
+#include <AirRadio.h>
+#include <AirSettings.h>
+#include <AirUpload.h>
+#include <AirVariable.h>
+#include <SensorDriver.h>
 #include <U8g2lib.h>
 
 Sht sht(BoardType::DIY_BASIC);
@@ -46,124 +53,29 @@ PMS5003 pms(BoardType::DIY_BASIC);
 // Display bottom right
 U8G2_SSD1306_64X48_ER_1_HW_I2C u8g2(U8G2_R0, /* reset=*/U8X8_PIN_NONE);
 
-// CONFIGURATION START
-// for persistent saving and loading
-const uint8_t settings_addr = 4;
-const uint8_t hostname_addr = 8;
-const uint8_t hostname_len = 24;
-
-//set to the endpoint you would like to use
-boolean useAGPlatform = false;
-String APIROOT = "http://hw.airgradient.com/";
-
-// set to true to switch from Celcius to Fahrenheit
-boolean useFahrenheit = true;
-
-// PM2.5 in US AQI (default ug/m3)
-boolean useUSAQI = true;
-
-char hostname[24];
-
-// CONFIGURATION END
-
-const std::function<float(const uint16_t x)> identity = [](const uint16_t val) { return static_cast<float>(val); };
-const std::function<float(const uint16_t x)> K_TO_C = [](uint16_t kelvin_hundredths) {
-  return (kelvin_hundredths / 100.0) - 273.15;
-};
-const std::function<float(const uint16_t x)> K_TO_F = [](uint16_t kelvin_hundredths) {
-  return (K_TO_C(kelvin_hundredths) * 9. / 5. + 32.);
-};
-
-// Calculate PM2.5 US AQI
-const std::function<float(const uint16_t x)> PM_TO_AQI_US = [](const uint16_t pm02) {
-  if (pm02 <= 12.0) return ((50 - 0) / (12.0 - .0) * (pm02 - .0) + 0);
-  else if (pm02 <= 35.4) return ((100 - 50) / (35.4 - 12.0) * (pm02 - 12.0) + 50);
-  else if (pm02 <= 55.4) return ((150 - 100) / (55.4 - 35.4) * (pm02 - 35.4) + 100);
-  else if (pm02 <= 150.4) return ((200 - 150) / (150.4 - 55.4) * (pm02 - 55.4) + 150);
-  else if (pm02 <= 250.4) return ((300 - 200) / (250.4 - 150.4) * (pm02 - 150.4) + 200);
-  else if (pm02 <= 350.4) return ((400 - 300) / (350.4 - 250.4) * (pm02 - 250.4) + 300);
-  else if (pm02 <= 500.4) return ((500 - 400) / (500.4 - 350.4) * (pm02 - 350.4) + 400);
-  else return 500.;
-};
-
-class AirVariable 
-{
-  using UnitConversionFunction = std::function<float(const uint16_t x)>;
-  uint16_t last = 0;
-  String label;
-  String units;
-  UnitConversionFunction conversion;
-
-  private:
-    void formatNumber(char* s, size_t n, float x) const {
-      uint16_t asint = static_cast<uint16_t>(x);
-      if (asint == x) {
-        snprintf(s, n, "%d", asint);
-      } else {
-        snprintf(s, n, "%.1f", x);
-      }
-    }
-  
-  public:
-    void update(uint16_t measurement) {
-      last = measurement;
-    }
-
-    String getLabel() const {
-      return label;
-    }
-
-    uint16_t getLast() const {
-      return last;
-    }
-
-    void setConversion(UnitConversionFunction newVal) {
-      conversion = newVal;
-    }
-
-    void setUnits(String newVal) {
-      units = newVal;
-    }
-
-    void draw() const {
-      char number_buffer[6];
-      u8g2.setFont(u8g2_font_t0_18b_tf);
-      
-      formatNumber(number_buffer, 6, conversion(last));
-      u8g2_uint_t width = u8g2.drawStr(0, 31, number_buffer);
-
-      u8g2.setFont(u8g2_font_t0_11_tf);
-      u8g2.drawStr(0, 11, label.c_str());
-      u8g2.drawStr(width, 31, units.c_str());
-    }
-
-    AirVariable(
-      const char* _label,
-      const char* _units,
-      UnitConversionFunction converter = identity
-    )
-      : label(_label),
-        units(_units),
-        conversion(converter)
-    {}  
-};
-
-const char* cubic_microgram_unit = "\xB5g/m\xB3";
-AirVariable CO2("CO\xB2", "ppm");
-AirVariable pm10("PM 10", cubic_microgram_unit);
-AirVariable pm25(
-  "PM 2.5", 
-  useUSAQI ? "AQI" : cubic_microgram_unit, 
-  useUSAQI ? PM_TO_AQI_US : identity
-);
-AirVariable pm01("PM 1", cubic_microgram_unit);
-AirVariable pm03("PM 0.03", "");
-AirVariable temp(
-  "TEMPERATURE", 
-  useFahrenheit ? "\xB0" "F" : "\xB0" "C", 
-  useFahrenheit ? K_TO_F : K_TO_C
-);
-AirVariable hum("HUMIDITY", "%");
+// labels and units are read from flash by AirVariable, see AirFlash.h
+static const char cubic_microgram_unit[] PROGMEM = "\xB5g/m\xB3";
+static const char no_unit[] PROGMEM = "";
+static const char co2_label[] PROGMEM = "CO\xB2";
+static const char ppm_unit[] PROGMEM = "ppm";
+static const char pm10_label[] PROGMEM = "PM 10";
+static const char pm25_label[] PROGMEM = "PM 2.5";
+static const char aqi_unit[] PROGMEM = "AQI";
+static const char pm01_label[] PROGMEM = "PM 1";
+static const char pm03_label[] PROGMEM = "PM 0.03";
+static const char temp_label[] PROGMEM = "TEMPERATURE";
+static const char fahrenheit_unit[] PROGMEM = "\xB0" "F";
+static const char celsius_unit[] PROGMEM = "\xB0" "C";
+static const char hum_label[] PROGMEM = "HUMIDITY";
+static const char percent_unit[] PROGMEM = "%";
+
+AirVariable CO2(FPSTR(co2_label), FPSTR(ppm_unit));
+AirVariable pm10(FPSTR(pm10_label), FPSTR(cubic_microgram_unit));
+AirVariable pm25(FPSTR(pm25_label), FPSTR(aqi_unit), PM_TO_AQI_US);
+AirVariable pm01(FPSTR(pm01_label), FPSTR(cubic_microgram_unit));
+AirVariable pm03(FPSTR(pm03_label), FPSTR(no_unit));
+AirVariable temp(FPSTR(temp_label), FPSTR(fahrenheit_unit), K_TO_F);
+AirVariable hum(FPSTR(hum_label), FPSTR(percent_unit));
 
 const AirVariable* const allVariables[] = {
   &CO2,
@@ -183,266 +95,177 @@ uint8_t displayVariable = 0;
 // wifi display state toggle
 boolean displaySSID = true;
 
-// current spark interval
-uint8_t currentInterval = 0;
-
 int lastState = HIGH;
 int buttonState = HIGH;
 unsigned long debounceStart = 0;
 const unsigned long debounceDelay = 50;
 
-// Wifi Manager
-const String ag_platform_yes = "yes";
-const String temp_units_fahrenheit = "fahrenheit";
-const String pm_units_usaqi = "USAQI";
-
-/** 
- * WiFiManagerParameter sucks if you want something other than a text input 
- * The only way to get it to use the entire customHTML is to null out getID
- * and if you do that, then value can never be set.
- * 
- * init() always nulls out _value.
- * init() calls setValue().
- * setValue() is the only way to set _value.
- * setValue() only sets _value if _id is not null.
- * init() is the only way to set _id
- */
-class CustomParameter : public WiFiManagerParameter
-{
-  public:
-    CustomParameter(
-      const char* value, 
-      int length, 
-      const char* customHtml
-    ) : WiFiManagerParameter(customHtml) {
-      _id = "";
-      setValue(value, length);
-      _id = nullptr;
-    }
-};
-
-WiFiManager wifiManager;
-WiFiManagerParameter wifi_hostname("hostname", "Hostname", "hostname", 23);
-
-// Note that each param's name is important. param_# is a format that 
-// WiFiManager insists on if you're going to implement completely custom params.
-CustomParameter wifi_ag_platform(
-  "yes",
-  4,
-  "<label for=\"param_1\">AirGradient Platform</label>"
-  "<select id=\"param_1\" name=\"param_1\">"
-    "<option value=\"yes\" selected>Yes</option>"
-    "<option value=\"no\">No</option>"
-  "</select>"
-);
-CustomParameter wifi_temp_units(
-  "Celsius",
-  10,
-  "<label for=\"param_2\">Temperature Units</label>"
-  "<select id=\"param_2\" name=\"param_2\">"
-    "<option value=\"fahrenheit\" selected>°F</option>"
-    "<option value=\"celsius\">°C</option>"
-  "</select>"
-);
-CustomParameter wifi_pm_units(
-  "USAQI",
-  10,
-  "<label for=\"param_3\">PM 2.5 Units</label>"
-  "<select id=\"param_3\" name=\"param_3\">"
-    "<option value=\"USAQI\" selected>AQI</option>"
-    "<option value=\"cubic_mg\">µg/m³</option>"
-  "</select>"
-);
-CustomParameter wifi_spark_interval(
-  "1",
-  4,
-  "<label for=\"param_4\">Chart Time Window</label>"
-  "<select id=\"param_4\" name=\"param_4\">"
-    "<option value=\"1\" selected>5 min</option>"
-    "<option value=\"2\">10 min</option>"
-    "<option value=\"6\">30 min</option>"
-    "<option value=\"12\">1 hour</option>"
-    "<option value=\"72\">6 hour</option>"
-    "<option value=\"144\">12 hour</option>"
-    "<option value=\"288\">1 day</option>"
-  "</select>"
-);
-
-void readSettings() {
-  uint8_t settings = EEPROM.read(settings_addr);
-  useAGPlatform = (settings & 1) == 1;
-  useFahrenheit = ((settings >> 1) & 1) == 1;
-  useUSAQI = ((settings >> 2) & 1) == 1;
-
-  for (unsigned long i = 0; i < hostname_len; i++) {
-    hostname[i] = EEPROM.read(hostname_addr + i);
-  }
-
-  temp.setConversion(useFahrenheit ? K_TO_F : K_TO_C);
-  temp.setUnits(useFahrenheit ? "\xB0" "F" : "\xB0" "C");
-  pm25.setConversion(useUSAQI ? PM_TO_AQI_US : identity);
-  pm25.setUnits(useUSAQI ? "AQI" : "\xB5g/m\xB3");
-  wifiManager.setHostname(hostname);
+void applySettings() {
+  temp.setConversion(settings.useFahrenheit ? K_TO_F : K_TO_C);
+  temp.setUnits(FPSTR(settings.useFahrenheit ? fahrenheit_unit : celsius_unit));
+  pm25.setConversion(settings.useUSAQI ? PM_TO_AQI_US : identity);
+  pm25.setUnits(FPSTR(settings.useUSAQI ? aqi_unit : cubic_microgram_unit));
 }
 
-void writeSettings() {
-  uint8_t settings = 0;
-  if (useAGPlatform) {
-    settings |= 1;
-  }
-  if (useFahrenheit) {
-    settings |= (1 << 1);
-  }
-  if (useUSAQI) {
-    settings |= (1 << 2);
-  }
-  EEPROM.write(settings_addr, settings);
+void addMeasurements(JsonPayload& payload) {
+  payload.add(F("rco2"), CO2.getLast());
+  payload.add(F("pm01"), pm01.getLast());
+  payload.add(F("pm02"), pm25.getLast());
+  payload.add(F("pm10"), pm10.getLast());
+  payload.add(F("pm003_count"), pm03.getLast());
+  payload.add(F("atmp"), K_TO_C(temp.getLast()));
+  payload.add(F("rhum"), hum.getLast());
+}
 
-  for (unsigned long i = 0; i < hostname_len; i++) {
-    EEPROM.write(hostname_addr + i, hostname[i]);
-  }
+void addVariables(JsonPayload& payload) {
+  payload.addRaw(F("variables"), variablesJson(allVariables));
+}
 
-  EEPROM.commit();
+// The AirGradient library drivers only have blocking reads, so these do all
+// of their work in read() and report ready straight away.
+struct Co2Driver {
+  static constexpr const char* name = "CO2";
+  static constexpr uint32_t warmUpMs = 10000;
+  static constexpr uint32_t intervalMs = 5000;
+  static constexpr uint32_t timeoutMs = 0;
 
-  temp.setConversion(useFahrenheit ? K_TO_F : K_TO_C);
-  temp.setUnits(useFahrenheit ? "\xB0" "F" : "\xB0" "C");
-  pm25.setConversion(useUSAQI ? PM_TO_AQI_US : identity);
-  pm25.setUnits(useUSAQI ? "AQI" : "\xB5g/m\xB3");
-  wifiManager.setHostname(hostname);
-}
+  AdaptiveCadence cadence{intervalMs, 30000};
 
-void sendToServer() {
-  if (!useAGPlatform) { 
-    return;
+  uint32_t cadenceMs() const {
+    return cadence.intervalMs();
   }
 
-  String payload = "{\"wifi\":\"" + String(WiFi.RSSI())
-    + "\", \"rco2\":\"" + String(CO2.getLast())
-    + "\", \"pm01\":\"" + String(pm01.getLast())
-    + "\", \"pm02\":\"" + String(pm25.getLast())
-    + "\", \"pm10\":\"" + String(pm10.getLast())
-    + "\", \"pm003_count\":\"" + String(pm03.getLast())
-    + "\", \"atmp\":\"" + String(K_TO_C(temp.getLast()))
-    + "\", \"rhum\":\"" + String(hum.getLast())
-  + "\"\n}";
-
-  if (WiFi.status() == WL_CONNECTED) {
-    String POSTURL = APIROOT + "sensors/airgradient:" + String(ESP.getChipId(), HEX) + "/measures";
-    WiFiClient client;
-    HTTPClient http;
-    http.begin(client, POSTURL);
-    http.addHeader("content-type", "application/json");
-    int httpCode = http.POST(payload);
-    String response = http.getString();
-    http.end();
-  } else {
-    Serial.println("WiFi Disconnected");
+  bool begin() {
+    return co2.begin(&Serial);
   }
-}
 
-void wifi_handleMetrics() {
-  // Use json-exporter if you want to ingest this to prometheus. Not worth being 
-  // prometheus-specific at this point.
-  String metrics = "{\n"
-      "\"id\":\"" + String(ESP.getChipId(), HEX)
-    + "\", \"mac\":\"" + WiFi.macAddress()
-    + "\", \"hostname\":\"" + String(hostname)
-    + "\", \"rco2\":\"" + String(CO2.getLast())
-    + "\", \"pm01\":\"" + String(pm01.getLast())
-    + "\", \"pm02\":\"" + String(pm25.getLast())
-    + "\", \"pm10\":\"" + String(pm10.getLast())
-    + "\", \"pm003_count\":\"" + String(pm03.getLast())
-    + "\", \"atmp\":\"" + String(K_TO_C(temp.getLast()))
-    + "\", \"rhum\":\"" + String(hum.getLast())
-  + "\"\n}";
-  wifiManager.server->send(200, "application/json", metrics);
-}
+  bool start() {
+    return true;
+  }
 
-void wifi_addRoutes() {
-  Serial.println("*wm:Adding metrics route");
-  wifiManager.server->on("/metrics", wifi_handleMetrics);
-}
+  bool ready() {
+    return true;
+  }
 
-void wifi_saveParameters() {
-  strncpy(hostname, wifi_hostname.getValue(), 24);
+  bool read() {
+    int value = co2.getCo2();
+    if (value < 0) {
+      LOG_WARN("CO2 read failed");
+      return false;
+    }
+    // 15 ppm is about the sensor's noise
+    cadence.compare(value, CO2.getLast(), 15);
+    cadence.decide(millis());
+    CO2.update(value);
+    return true;
+  }
+};
 
-  Serial.println("hostname param: " + String(wifi_hostname.getValue()));
-  Serial.println("platform param: " + String(wifi_ag_platform.getValue()));
-  Serial.println("temp param: " + String(wifi_temp_units.getValue()));
-  Serial.println("pm units param: " + String(wifi_pm_units.getValue()));
-  Serial.println("spark interval param: " + String(wifi_spark_interval.getValue()));
+struct PmsDriver {
+  static constexpr const char* name = "PMS";
+  static constexpr uint32_t warmUpMs = 10000;
+  static constexpr uint32_t intervalMs = 5000;
+  static constexpr uint32_t timeoutMs = 0;
 
-  useAGPlatform = ag_platform_yes.equals(wifi_ag_platform.getValue());
-  useFahrenheit = temp_units_fahrenheit.equals(wifi_temp_units.getValue());
-  useUSAQI = pm_units_usaqi.equals(wifi_pm_units.getValue());
-  writeSettings();
-}
+  AdaptiveCadence cadence{intervalMs, 30000};
 
-void setupWifi() {
-  wifiManager.setTimeout(90);
-  wifiManager.setConfigPortalBlocking(false);
-
-  wifiManager.setSaveParamsCallback(wifi_saveParameters);
-  wifiManager.setWebServerCallback(wifi_addRoutes);
+  uint32_t cadenceMs() const {
+    return cadence.intervalMs();
+  }
 
-  wifiManager.addParameter(&wifi_hostname);
-  wifiManager.addParameter(&wifi_ag_platform);
-  wifiManager.addParameter(&wifi_temp_units);
-  wifiManager.addParameter(&wifi_pm_units);
-  wifiManager.addParameter(&wifi_spark_interval);
-  uint param_num = wifiManager.getParametersCount();
-  Serial.println("Params: " + String(param_num));
+  bool begin() {
+    return pms.begin(&Serial);
+  }
 
-  String HOTSPOT = "AG-" + String(ESP.getChipId(), HEX);
-  if (String(hostname).isEmpty()) {
-    strncpy(hostname, HOTSPOT.c_str(), 24);
+  bool start() {
+    return true;
   }
-  wifi_hostname.setValue(hostname, 24);
-  wifiManager.autoConnect((const char*)hostname);
-}
 
-void updateCo2() {
-  int value = co2.getCo2();
-  if (value < 0) {
-    Serial.println("CO2 read failed");
-  } else {
-    CO2.update(value);
+  bool ready() {
+    return true;
   }
-}
 
-void updatePm() {
-  if (pms.isFailed() == false) {
+  bool read() {
+    if (pms.isFailed()) {
+      LOG_WARN("PMS read failed");
+      return false;
+    }
+    cadence.compare(pms.getPm25Ae(), pm25.getLast(), 3);
+    cadence.compare(pms.getPm10Ae(), pm10.getLast(), 5);
+    cadence.decide(millis());
     pm01.update(pms.getPm01Ae());
     pm25.update(pms.getPm25Ae());
     pm10.update(pms.getPm10Ae());
     pm03.update(pms.getPm03ParticleCount());
 
-    Serial.printf(
-      "PM1 %d\r\nPM2.5 %d\r\nPM10 %d\r\nPM0.3 %d\r\n", 
+    LOG_DEBUG(
+      "PM1 %u PM2.5 %u PM10 %u PM0.3 %u", 
       pm01.getLast(), 
       pm25.getLast(), 
       pm10.getLast(), 
       pm03.getLast()
     );
-  } else {
-    Serial.printf("PMS read failed\r\n");
+    return true;
+  }
+};
+
+struct ShtDriver {
+  static constexpr const char* name = "SHT";
+  static constexpr uint32_t warmUpMs = 10000;
+  static constexpr uint32_t intervalMs = 5000;
+  static constexpr uint32_t timeoutMs = 0;
+
+  AdaptiveCadence cadence{intervalMs, 30000};
+
+  uint32_t cadenceMs() const {
+    return cadence.intervalMs();
+  }
+
+  bool begin() {
+    // 0x40 is the default I2C address for the SHT4x
+    return sht.begin(Wire, Serial);
+  }
+
+  bool start() {
+    return true;
+  }
+
+  bool ready() {
+    return true;
   }
-}
 
-void updateTempHum() {
-  if (sht.measure()) {
+  bool read() {
+    if (!sht.measure()) {
+      LOG_WARN("Error in updateTempHum()");
+      return false;
+    }
     // temp is hundreths of a degree to avoid using floats
     uint16_t kelvin = static_cast<uint16_t>(std::round(
       (sht.getTemperature() + 273.15) * 100
     ));
+    uint16_t humidity = static_cast<uint16_t>(sht.getRelativeHumidity());
+    // 0.1 degree and 1 %RH
+    cadence.compare(kelvin, temp.getLast(), 10);
+    cadence.compare(humidity, hum.getLast(), 1);
+    cadence.decide(millis());
     temp.update(kelvin);
-    Serial.printf("Temp %d\r\nHum %d\r\n", kelvin / 100, sht.getRelativeHumidity());
-    hum.update(
-      static_cast<uint16_t>(sht.getRelativeHumidity())
-    );
-  } else {
-    Serial.printf("Error in updateTempHum()\r\n");
+    LOG_DEBUG("Temp %u Hum %u", kelvin / 100, humidity);
+    hum.update(humidity);
+    return true;
   }
+};
+
+SensorRegistry<ShtDriver, Co2Driver, PmsDriver> sensors;
+
+void addDiagnostics(JsonPayload& payload) {
+  const AdaptiveCadence& shtCadence = sensors.driver<0>().cadence;
+  const AdaptiveCadence& co2Cadence = sensors.driver<1>().cadence;
+  const AdaptiveCadence& pmsCadence = sensors.driver<2>().cadence;
+  payload.addRaw(F("sht_sample_ms"), shtCadence.sampleMs());
+  payload.addRaw(F("co2_sample_ms"), co2Cadence.sampleMs());
+  payload.addRaw(F("pms_sample_ms"), pmsCadence.sampleMs());
+  payload.addRaw(F("cadence_bursts"), shtCadence.bursts + co2Cadence.bursts + pmsCadence.bursts);
+  payload.addRaw(F("cadence_backoffs"), shtCadence.backoffs + co2Cadence.backoffs + pmsCadence.backoffs);
 }
 
 void renderWifi() {
@@ -454,13 +277,13 @@ void renderWifi() {
     if (displaySSID) {
       u8g2.drawStr(12, 48, wifiManager.getWiFiSSID().substring(0, 19).c_str());
     } else {
-      u8g2.drawStr(12, 48, "HOTSPOT");
+      drawFlashStr(u8g2, 12, 48, F("HOTSPOT"));
     }
   } else if (WiFi.status() != WL_CONNECTED) {
     u8g2.drawGlyph(0, 48, 0xe217);
 
     u8g2.setFont(u8g2_font_t0_11_tf);
-    u8g2.drawStr(12, 48, "OFFLINE");
+    drawFlashStr(u8g2, 12, 48, F("OFFLINE"));
   } else {
     u8g2.drawGlyph(0, 48, 0xe21a);
 
@@ -469,7 +292,7 @@ void renderWifi() {
       u8g2.drawStr(12, 48, wifiManager.getWiFiSSID().substring(0, 19).c_str());
     } else {
       char sliced[9] = { "\0" };
-      strncpy(sliced, hostname, 8);
+      strncpy(sliced, settings.hostname, 8);
       u8g2.drawStr(12, 48, sliced);
     }
   }
@@ -479,18 +302,18 @@ void renderVariable() {
   const AirVariable* variable = allVariables[displayVariable];
   u8g2.firstPage();
   do {
-    variable->draw();
+    variable->draw(u8g2);
     renderWifi();
   } while (u8g2.nextPage());
 }
 
-void renderText(String ln1, String ln2, String ln3) {
+void renderText(FlashString ln1, FlashString ln2, FlashString ln3) {
   u8g2.firstPage();
   do {
     u8g2.setFont(u8g2_font_t0_16_tf);
-    u8g2.drawStr(1, 10, String(ln1).c_str());
-    u8g2.drawStr(1, 28, String(ln2).c_str());
-    u8g2.drawStr(1, 48, String(ln3).c_str());
+    drawFlashStr(u8g2, 1, 10, ln1);
+    drawFlashStr(u8g2, 1, 28, ln2);
+    drawFlashStr(u8g2, 1, 48, ln3);
   } while (u8g2.nextPage());
 }
 
@@ -498,7 +321,7 @@ void setup() {
   Serial.begin(115200);
   delay(100);
 
-  Serial.println("Hello");
+  LOG_INFO("Hello");
 
   EEPROM.begin(512);
 
@@ -507,7 +330,7 @@ void setup() {
   Wire.setClock(100000);
   delay(1000);
 
-  Serial.println("Setting up display");
+  LOG_INFO("Setting up display");
   u8g2.setBusClock(100000);
   u8g2.begin();
   delay(1000);
@@ -515,12 +338,9 @@ void setup() {
   readSettings();
   setupWifi();
 
-  // 0x40 is the default I2C address for the SHT4x
-  Serial.println("Setting up SHT");
-  sht.begin(Wire, Serial);
-
-  co2.begin(&Serial);
-  pms.begin(&Serial);
+  LOG_INFO("Setting up sensors");
+  sensors.begin();
+  setMetricsMaxAge(sensors.intervalMs / 1000);
 }
 
 void loop() {
@@ -528,28 +348,21 @@ void loop() {
   static esp8266::polledTimeout::periodicMs fivSecond(5000);
   static esp8266::polledTimeout::periodicMs tenSecond(10000);
   
-  if (fivSecond && warmUp) {
-    updateTempHum();
-    updateCo2();
-    updatePm();
+  logDrain();
+  if (sensors.service()) {
+    measurementsChanged();
+  }
 
+  if (fivSecond && warmUp) {
     displayVariable = (displayVariable + 1) % (sizeof(allVariables) / sizeof(allVariables[0]));
   }
   if (tenSecond) {
-    sendToServer();
+    radioQueue(sendToServer);
 
     displaySSID = !displaySSID;
   }
 
-  wifiManager.process();
-  // if the wifi is connected and the web portal is not active, then start it.
-  if (
-    WiFi.status() == WL_CONNECTED &&
-    !wifiManager.getWebPortalActive() && 
-    !wifiManager.getConfigPortalActive()
-  ) {
-    wifiManager.startWebPortal();
-  }
+  processWifi();
   
   int reading = digitalRead(D7);
   if (reading != lastState) {
@@ -561,15 +374,12 @@ void loop() {
 
       if (buttonState == LOW) {
         // reset
-        wifiManager.resetSettings();
-        useAGPlatform = false;
-        useFahrenheit = true;
-        useUSAQI = true;
-        strcpy(hostname, "");
-        writeSettings();
-        renderText("Resetting", "", "");
+        LOG_INFO("Resetting");
+        resetSettings();
+        renderText(F("Resetting"), F(""), F(""));
         delay(1000);
 
+        logFlush();
         ESP.reset();
       }
     }
@@ -23,128 +23,66 @@ CC BY-SA 4.0 Attribution-ShareAlike 4.0 International License
 #include <EEPROM.h>
 #include <HardwareSerial.h>
 #include <Wire.h>
-#include <HTTPClient.h>
-#include <WiFiManager.h>
-
-#define DEBUG true
-
-HTTPClient client;
-
-PMS pms1 = PMS();
-PMS pms2 = PMS();
-
-float pm1Mean = 0;
-float pm25Mean = 0;
-float pm10Mean = 0;
-float pm03Mean = 0;
-float pmTempMean = 0;
-float pmHumMean = 0;
-
-int count = 1;
-int targetCount = 40;
+#include <WiFi.h>
+
+#include <AdaptiveCadence.h>
+#include <AirHistory.h>
+#include <AirJson.h>
+#include <AirLiveness.h>
+#include <AirLog.h>
+#include <AirPortal.h>
+#include <AirRadio.h>
+#include <AirReport.h>
+#include <AirSettings.h>
+#include <AirUpload.h>
+#include <RingAverage.h>
+#include <SensorDriver.h>
+
+// both PMS modules add a sample every 2 seconds while the air is changing, so
+// 120 samples is 2 minutes, and up to 6 minutes while it is steady
+const uint16_t maxAverageWindow = 120;
+
+RingAverage<uint16_t, maxAverageWindow> pm1Window;
+RingAverage<uint16_t, maxAverageWindow> pm25Window;
+RingAverage<uint16_t, maxAverageWindow> pm10Window;
+RingAverage<uint16_t, maxAverageWindow> pm03Window;
+RingAverage<int16_t, maxAverageWindow> pmTempWindow;
+RingAverage<uint16_t, maxAverageWindow> pmHumWindow;
+
+// samples added since the last post
+uint16_t count = 0;
 unsigned long loopCount = 0;
-unsigned long lastTime = 0;
-unsigned long startTime = 0;
-
-// CONFIGURATION START
-// for persistent saving and loading
-const uint8_t settings_addr = 4;
-const uint8_t hostname_addr = 8;
-const uint8_t hostname_len = 24;
-const uint8_t sparkInterval_addr = 32;
-
-//set to the endpoint you would like to use
-boolean useAGPlatform = false;
-String APIROOT = "http://hw.airgradient.com/";
-
-char hostname[24];
-
-// Wifi Manager
-const String ag_platform_yes = "yes";
-
-/** 
- * WiFiManagerParameter sucks if you want something other than a text input 
- * The only way to get it to use the entire customHTML is to null out getID
- * and if you do that, then value can never be set.
- * 
- * init() always nulls out _value.
- * init() calls setValue().
- * setValue() is the only way to set _value.
- * setValue() only sets _value if _id is not null.
- * init() is the only way to set _id
- */
-class CustomParameter : public WiFiManagerParameter
-{
-  public:
-    CustomParameter(
-      const char* value, 
-      int length, 
-      const char* customHtml
-    ) : WiFiManagerParameter(customHtml) {
-      _id = "";
-      setValue(value, length);
-      _id = nullptr;
-    }
-};
-
-WiFiManager wifiManager;
-WiFiManagerParameter wifi_hostname("hostname", "Hostname", "hostname", 23);
-
-// Note that each param's name is important. param_# is a format that 
-// WiFiManager insists on if you're going to implement completely custom params.
-CustomParameter wifi_ag_platform(
-  "yes",
-  4,
-  "<label for=\"param_1\">AirGradient Platform</label>"
-  "<select id=\"param_1\" name=\"param_1\">"
-    "<option value=\"yes\" selected>Yes</option>"
-    "<option value=\"no\">No</option>"
-  "</select>"
-);
-
-
-void readSettings() {
-  uint8_t settings = EEPROM.read(settings_addr);
-  useAGPlatform = (settings & 1) == 1;
-
-  for (unsigned long i = 0; i < hostname_len; i++) {
-    hostname[i] = EEPROM.read(hostname_addr + i);
-  }
-  wifiManager.setHostname(hostname);
-
-}
-
-void writeSettings() {
-  uint8_t settings = 0;
-  if (useAGPlatform) {
-    settings |= 1;
-  }
-  EEPROM.write(settings_addr, settings);
-
-  for (unsigned long i = 0; i < hostname_len; i++) {
-    EEPROM.write(hostname_addr + i, hostname[i]);
-  }
 
-  EEPROM.commit();
-  wifiManager.setHostname(hostname);
+// set by the reset button, acted on from loop() since none of it is ISR safe
+volatile bool resetRequested = false;
+
+// external watchdog, fed by the liveness monitor once setup() is done
+const uint8_t watchdogPin = 2;
+// an upload can block for its connect and read timeouts
+LivenessTask loopTask = livenessRegister("loop", 30000);
+
+void applySettings() {
+  pm1Window.setWindow(settings.averageWindow);
+  pm25Window.setWindow(settings.averageWindow);
+  pm10Window.setWindow(settings.averageWindow);
+  pm03Window.setWindow(settings.averageWindow);
+  pmTempWindow.setWindow(settings.averageWindow);
+  pmHumWindow.setWindow(settings.averageWindow);
 }
 
-void debugln(String msg)
-{
-  if (DEBUG)
-    Serial.println(msg);
+void addMeasurements(JsonPayload& payload) {
+  payload.add(F("pm01"), pm1Window.mean());
+  payload.add(F("pm02"), pm25Window.mean());
+  payload.add(F("pm10"), pm10Window.mean());
+  payload.add(F("pm003_count"), pm03Window.mean());
+  // the PMS reports temperature and humidity in tenths
+  payload.add(F("atmp"), pmTempWindow.mean(10));
+  payload.add(F("rhum"), pmHumWindow.mean(10));
 }
 
 void IRAM_ATTR isr()
 {
-  wifiManager.resetSettings();
-  useAGPlatform = false;
-  strcpy(hostname, "");
-  writeSettings();
-  debugln("resetting");
-  delay(1000);
-
-  ESP.restart();
+  resetRequested = true;
 }
 
 void switchLED(boolean ledON)
@@ -159,136 +97,162 @@ void switchLED(boolean ledON)
   }
 }
 
-void resetWatchdog()
-{
-  digitalWrite(2, HIGH);
-  delay(20);
-  digitalWrite(2, LOW);
-}
-
-String getNormalizedMac()
-{
-  String mac = WiFi.macAddress();
-  mac.replace(":", "");
-  mac.toLowerCase();
-  return mac;
-}
-
-void sendPayload(String payload)
+int sendPayload(void (*fill)(JsonPayload& payload))
 {
-  if (WiFi.status() != WL_CONNECTED)
-  {
-    debugln("post skipped, not network connection");
-  }
-
   switchLED(true);
-  String url = APIROOT + "sensors/airgradient:" + getNormalizedMac() + "/measures";
-  debugln(url);
-  debugln(payload);
-  client.setConnectTimeout(5 * 1000);
-  client.begin(url);
-  client.addHeader("content-type", "application/json");
-  int httpCode = client.POST(payload);
-  debugln(String(httpCode));
-  client.end();
-  resetWatchdog();
+  int httpCode = uploadPayload(fill);
   switchLED(false);
+  return httpCode;
 }
 
 void sendPing()
 {
-  if (!useAGPlatform) {
+  if (!settings.useAGPlatform) {
     return;
   }
-  String payload = "{\"wifi\":" + String(WiFi.RSSI()) + ", \"boot\":" + loopCount + "}";
-  sendPayload(payload);
+  sendPayload([](JsonPayload& payload) {
+    payload.addRaw(F("wifi"), WiFi.RSSI());
+    payload.addRaw(F("boot"), loopCount);
+  });
 }
 
 void postToServer()
 {
-  if (!useAGPlatform) {
+  if (!settings.useAGPlatform || !reportDue()) {
     return;
   }
-  String payload = "{\"wifi\":\"" + String(WiFi.RSSI()) + \
-    "\", \"pm01\":\"" + String(pm1Mean) + \
-    "\", \"pm02\":\"" + String(pm25Mean) + \
-    "\", \"pm10\":\"" + String(pm10Mean) + \
-    "\", \"pm003_count\":\"" + String(pm03Mean) + \
-    "\", \"atmp\":\"" + String(pmTempMean / 10) + \
-    "\", \"rhum\": \"" + String(pmHumMean / 10) + \
-    "\", \"boot\":\"" + loopCount + "\", \"channels\": {} }";
+  int httpCode = sendPayload([](JsonPayload& payload) {
+    payload.add(F("wifi"), WiFi.RSSI());
+    addMeasurements(payload);
+    addLinkHealth(payload);
+    addReportSummary(payload);
+    payload.add(F("boot"), loopCount);
+    payload.addRaw(F("channels"), "{}");
+  });
+  if (httpCode >= 200 && httpCode < 300) {
+    reportSent();
+  }
   loopCount++;
-  sendPayload(payload);
 }
 
-void wifi_handleMetrics() {
-  // Use json-exporter if you want to ingest this to prometheus. Not worth being 
-  // prometheus-specific at this point.
-  String metrics = "{\n"
-    "\"mac\":\"" + WiFi.macAddress() + \
-    "\", \"hostname\":\"" + String(hostname) + \
-    "\", \"pm01\":\"" + String(pm1Mean) + \
-    "\", \"pm02\":\"" + String(pm25Mean) + \
-    "\", \"pm10\":\"" + String(pm10Mean) + \
-    "\", \"pm003_count\":\"" + String(pm03Mean) + \
-    "\", \"atmp\":\"" + String(pmTempMean / 10) + \
-    "\", \"rhum\": \"" + String(pmHumMean / 10) + "\"\n"
-  "}";
-  wifiManager.server->send(200, "application/json", metrics);
-}
-
-void wifi_addRoutes() {
-  Serial.println("Adding metrics route");
-  wifiManager.server->on("/metrics", wifi_handleMetrics);
+void addToWindows(const PMS::Data& data) {
+  pm1Window.add(data.PM_AE_UG_1_0);
+  pm25Window.add(data.PM_AE_UG_2_5);
+  pm10Window.add(data.PM_AE_UG_10_0);
+  pm03Window.add(data.PM_RAW_0_3);
+  pmTempWindow.add(data.PM_TMP);
+  pmHumWindow.add(data.PM_HUM);
+  ++count;
 }
 
-void wifi_saveParameters() {
-  strncpy(hostname, wifi_hostname.getValue(), 24);
-
-  Serial.println("hostname param: " + String(wifi_hostname.getValue()));
-  Serial.println("platform param: " + String(wifi_ag_platform.getValue()));
+/**
+ * One driver per PMS connector, both sampled in passive mode every 2 seconds
+ * while PM2.5 or PM10 moves and backing off to every 6 seconds while not.
+ */
+template <HardwareSerial& port, int rxPin, int txPin>
+struct PmsDriver {
+  static constexpr const char* name = rxPin < 0 ? "PMS1" : "PMS2";
+  static constexpr uint32_t warmUpMs = 10000;
+  static constexpr uint32_t intervalMs = 2000;
+  static constexpr uint32_t timeoutMs = 2000;
+
+  PMS pms;
+  LivenessTask liveness;
+  AdaptiveCadence cadence{intervalMs, 6000};
+  // the windows only keep means, so the previous reading is kept here
+  uint16_t lastPm25 = 0;
+  uint16_t lastPm10 = 0;
+
+  uint32_t cadenceMs() const {
+    return cadence.intervalMs();
+  }
 
-  useAGPlatform = ag_platform_yes.equals(wifi_ag_platform.getValue());
+  bool begin() {
+    port.begin(9600, SERIAL_8N1, rxPin, txPin);
+    pms.init(port, PmsModel::PMS5003T);
+    pms.passiveMode();
+    // registered last, a driver left FAILED by begin() is never started
+    // and would reset the board every minute
+    liveness = livenessRegister(name, 60000);
+    return true;
+  }
 
-  writeSettings();
-}
+  bool start() {
+    // Progress is the schedule still running, not frames arriving. A PMS
+    // that stops answering shows up in its timeouts and link counters, and
+    // resetting every minute wouldn't bring it back.
+    livenessProgress(liveness);
+    pms.requestRead();
+    return true;
+  }
 
-void setupWifi() {
-  wifiManager.setTimeout(90);
-  wifiManager.setConfigPortalBlocking(false);
+  bool ready() {
+    while (port.available()) {
+      if (pms.readPMS()) {
+        return true;
+      }
+    }
+    return false;
+  }
 
-  wifiManager.setSaveParamsCallback(wifi_saveParameters);
-  wifiManager.setWebServerCallback(wifi_addRoutes);
+  bool read() {
+    const PMS::Data& data = pms.getData();
+    cadence.compare(data.PM_AE_UG_2_5, lastPm25, 3);
+    cadence.compare(data.PM_AE_UG_10_0, lastPm10, 5);
+    cadence.decide(millis());
+    lastPm25 = data.PM_AE_UG_2_5;
+    lastPm10 = data.PM_AE_UG_10_0;
+    addToWindows(data);
+    return true;
+  }
+};
 
-  wifiManager.addParameter(&wifi_hostname);
-  wifiManager.addParameter(&wifi_ag_platform);
-  uint param_num = wifiManager.getParametersCount();
-  Serial.println("Params: " + String(param_num));
+// default hardware serial, PMS connector on the right side of the C3 mini on the Open Air
+// second hardware serial, PMS connector on the left side of the C3 mini on the Open Air
+SensorRegistry<PmsDriver<Serial0, -1, -1>, PmsDriver<Serial1, 0, 1>> sensors;
+
+void addLinkHealth(JsonPayload& payload) {
+  const LinkCounters& pms1 = sensors.driver<0>().pms.getCounters();
+  const LinkCounters& pms2 = sensors.driver<1>().pms.getCounters();
+  payload.addRaw(F("pms1_frames"), pms1.frames);
+  payload.addRaw(F("pms1_checksum_errors"), pms1.checksumErrors);
+  payload.addRaw(F("pms1_resyncs"), pms1.resyncs);
+  payload.addRaw(F("pms1_discarded"), pms1.discarded);
+  payload.addRaw(F("pms1_timeouts"), pms1.timeouts);
+  payload.addRaw(F("pms1_overflows"), pms1.overflows);
+  payload.addRaw(F("pms2_frames"), pms2.frames);
+  payload.addRaw(F("pms2_checksum_errors"), pms2.checksumErrors);
+  payload.addRaw(F("pms2_resyncs"), pms2.resyncs);
+  payload.addRaw(F("pms2_discarded"), pms2.discarded);
+  payload.addRaw(F("pms2_timeouts"), pms2.timeouts);
+  payload.addRaw(F("pms2_overflows"), pms2.overflows);
+}
 
-  String HOTSPOT = "AG-" + String(getNormalizedMac());
-  if (String(hostname).isEmpty()) {
-    strncpy(hostname, HOTSPOT.c_str(), 24);
-  }
-  wifi_hostname.setValue(hostname, 24);
-  wifiManager.autoConnect((const char*)hostname);
+void addDiagnostics(JsonPayload& payload) {
+  // the stall that got this device reset by the watchdog, if any
+  payload.add(F("last_stall_task"), String(lastStall().task));
+  payload.addRaw(F("last_stall_ms"), lastStall().stalledMs);
+  payload.addRaw(F("stalls_recovered"), recoveredStalls());
+
+  const AdaptiveCadence& pms1Cadence = sensors.driver<0>().cadence;
+  const AdaptiveCadence& pms2Cadence = sensors.driver<1>().cadence;
+  payload.addRaw(F("pms1_sample_ms"), pms1Cadence.sampleMs());
+  payload.addRaw(F("pms2_sample_ms"), pms2Cadence.sampleMs());
+  payload.addRaw(F("cadence_bursts"), pms1Cadence.bursts + pms2Cadence.bursts);
+  payload.addRaw(F("cadence_backoffs"), pms1Cadence.backoffs + pms2Cadence.backoffs);
 }
 
 void setup()
 {
-  if (DEBUG)
-  {
-    Serial.begin(115200);
-    // see https://github.com/espressif/arduino-esp32/issues/6983
-    Serial.setTxTimeoutMs(0); // <<<====== solves the delay issue
-  }
-
-  debugln("Serial Number: " + getNormalizedMac());
+  Serial.begin(115200);
+  // see https://github.com/espressif/arduino-esp32/issues/6983
+  Serial.setTxTimeoutMs(0); // <<<====== solves the delay issue
 
-  // default hardware serial, PMS connector on the right side of the C3 mini on the Open Air
-  Serial0.begin(9600);
+  LOG_INFO("Serial Number: %s", deviceId().c_str());
 
-  // second hardware serial, PMS connector on the left side of the C3 mini on the Open Air
-  Serial1.begin(9600, SERIAL_8N1, 0, 1);
+  EEPROM.begin(512);
+  readSettings();
+  setupHistory();
 
   // led
   pinMode(10, OUTPUT);
@@ -297,81 +261,51 @@ void setup()
   pinMode(9, INPUT_PULLUP);
   attachInterrupt(9, isr, FALLING);
 
-  pinMode(2, OUTPUT);
-  digitalWrite(2, LOW);
+  pinMode(watchdogPin, OUTPUT);
+  digitalWrite(watchdogPin, LOW);
 
-  pms1.init(Serial0);
-  pms1.passiveMode();
-  pms2.init(Serial1);
-  pms2.passiveMode();
+  sensors.begin();
+  setMetricsMaxAge(sensors.intervalMs / 1000);
 
   setupWifi();
-  sendPing();
+  radioQueue(sendPing, RadioSend::Heartbeat);
   switchLED(false);
-
-  startTime = millis();
-}
-
-uint16_t addToMean(uint16_t avg, uint16_t count, uint16_t x) {
-  return avg + (x - avg) / count;
-}
-
-void updateMeansWithData(const PMS::Data& data) {
-  pm1Mean = addToMean(pm1Mean, count, data.PM_AE_UG_1_0);
-  pm25Mean = addToMean(pm25Mean, count, data.PM_AE_UG_2_5);
-  pm10Mean = addToMean(pm10Mean, count, data.PM_AE_UG_10_0);
-  pm03Mean = addToMean(pm03Mean, count, data.PM_RAW_0_3);
-  pmTempMean = addToMean(pmTempMean, count, data.PM_TMP);
-  pmHumMean = addToMean(pmHumMean, count, data.PM_HUM);
-  ++count;
+  setupLiveness(watchdogPin);
 }
 
 void loop()
 {
-  wifiManager.process();
-
-  // if the wifi is connected and the web portal is not active, then start it.
-  if (
-    WiFi.status() == WL_CONNECTED &&
-    !wifiManager.getWebPortalActive() && 
-    !wifiManager.getConfigPortalActive()
-  ) {
-    wifiManager.startWebPortal();
-  }
+  if (resetRequested)
+  {
+    LOG_INFO("Resetting");
+    resetSettings();
+    delay(1000);
 
-  unsigned long now = millis();
-  // allow sensors to warm up
-  if (now - startTime < 10000) {
-    return;
+    logFlush();
+    ESP.restart();
   }
 
-  // only take samples every 2 seconds
-  if (now - lastTime < 2000) {
-    return;
-  }
-  lastTime = now;
+  logDrain();
+  livenessProgress(loopTask);
+  livenessService();
+  processWifi();
 
-  pms1.requestRead();
-  if (pms1.readUntil(2000))
-  {
-    updateMeansWithData(pms1.getData());
-  }
-  pms2.requestRead();
-  if (pms2.readUntil(2000))
+  if (sensors.service())
   {
-    updateMeansWithData(pms2.getData());
+    measurementsChanged();
   }
 
-  if (count >= targetCount)
+  if (count >= settings.averageWindow)
   {
-    postToServer();
-
-    count = 1;
-    pm1Mean = 0;
-    pm25Mean = 0;
-    pm10Mean = 0;
-    pm03Mean = 0;
-    pmTempMean = 0;
-    pmHumMean = 0;
+    recordSample({
+      static_cast<uint16_t>(pm1Window.mean().round()),
+      static_cast<uint16_t>(pm25Window.mean().round()),
+      static_cast<uint16_t>(pm10Window.mean().round()),
+      static_cast<uint16_t>(pm03Window.mean().round()),
+      static_cast<uint16_t>(pmTempWindow.mean().round()),
+      static_cast<uint16_t>(pmHumWindow.mean().round())
+    });
+    radioQueue(postToServer);
+    count = 0;
   }
 }
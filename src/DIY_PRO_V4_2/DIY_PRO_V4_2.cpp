@@ -31,19 +31,29 @@ CC BY-SA 4.0 Attribution-ShareAlike 4.0 International License
 #include <Arduino.h>
 #include <AirGradient.h>
 #include <EEPROM.h>
-#include <ESP8266HTTPClient.h>
-#include <ESP8266WebServer.h>
 #include <ESP8266WiFi.h>
 #include <SoftwareSerial.h>
-#include <WiFiClient.h>
-#include <WiFiManager.h>
 
 #include "SHTSensor.h"
+#include <SensirionCore.h>
 #include <SensirionI2CSgp41.h>
 #include <NOxGasIndexAlgorithm.h>
 #include <VOCGasIndexAlgorithm.h>
 
-#include <SparkLine.h>
+#include <AdaptiveCadence.h>
+#include <AirBoard.h>
+#include <AirConversions.h>
+#include <AirFlash.h>
+#include <AirHistory.h>
+#include <AirJson.h>
+#include <AirLog.h>
+#include <AirPortal.h>
+#include <AirRadio.h>
+#include <AirSettings.h>
+#include <AirUpload.h>
+#include <AirVariable.h>
+#include <SensorDriver.h>
+#include <TileDisplay.h>
 #include <U8g2lib.h>
 
 SoftwareSerial pmSerial(D5, D6);
@@ -62,149 +72,37 @@ U8G2_SH1106_128X64_NONAME_F_HW_I2C u8g2(U8G2_R0, /* reset=*/U8X8_PIN_NONE);
 // Replace above if you have display on top left
 //U8G2_SH1106_128X64_NONAME_F_HW_I2C u8g2(U8G2_R2, /* reset=*/ U8X8_PIN_NONE);
 
-// CONFIGURATION START
-// for persistent saving and loading
-const uint8_t settings_addr = 4;
-const uint8_t hostname_addr = 8;
-const uint8_t hostname_len = 24;
-const uint8_t sparkInterval_addr = 32;
-
-//set to the endpoint you would like to use
-boolean useAGPlatform = false;
-String APIROOT = "http://hw.airgradient.com/";
-
-// set to true to switch from Celcius to Fahrenheit
-boolean useFahrenheit = true;
-
-// PM2.5 in US AQI (default ug/m3)
-boolean useUSAQI = true;
-
-// interval to record measurements to spark
-uint16_t sparkInterval = 1;
-
-char hostname[24];
-
-// CONFIGURATION END
-
-const std::function<float(const uint16_t x)> identity = [](const uint16_t val) { return static_cast<float>(val); };
-const std::function<float(const uint16_t x)> K_TO_C = [](uint16_t kelvin_hundredths) {
-  return (kelvin_hundredths / 100.0) - 273.15;
-};
-const std::function<float(const uint16_t x)> K_TO_F = [](uint16_t kelvin_hundredths) {
-  return (K_TO_C(kelvin_hundredths) * 9. / 5. + 32.);
-};
-
-// Calculate PM2.5 US AQI
-const std::function<float(const uint16_t x)> PM_TO_AQI_US = [](const uint16_t pm02) {
-  if (pm02 <= 12.0) return ((50 - 0) / (12.0 - .0) * (pm02 - .0) + 0);
-  else if (pm02 <= 35.4) return ((100 - 50) / (35.4 - 12.0) * (pm02 - 12.0) + 50);
-  else if (pm02 <= 55.4) return ((150 - 100) / (55.4 - 35.4) * (pm02 - 35.4) + 100);
-  else if (pm02 <= 150.4) return ((200 - 150) / (150.4 - 55.4) * (pm02 - 55.4) + 150);
-  else if (pm02 <= 250.4) return ((300 - 200) / (250.4 - 150.4) * (pm02 - 150.4) + 200);
-  else if (pm02 <= 350.4) return ((400 - 300) / (350.4 - 250.4) * (pm02 - 250.4) + 300);
-  else if (pm02 <= 500.4) return ((500 - 400) / (500.4 - 350.4) * (pm02 - 350.4) + 400);
-  else return 500.;
-};
-
-class AirVariable 
-{
-  using UnitConversionFunction = std::function<float(const uint16_t x)>;
-  SparkLine<uint16_t> spark;
-  uint16_t last = 0;
-  String label;
-  String units;
-  UnitConversionFunction conversion;
-
-  private:
-    void formatNumber(char* s, size_t n, float x) const {
-      uint16_t asint = static_cast<uint16_t>(x);
-      if (asint == x) {
-        snprintf(s, n, "%d", asint);
-      } else {
-        snprintf(s, n, "%.1f", x);
-      }
-    }
-  
-  public:
-    void update(uint16_t measurement, boolean recordToSpark) {
-      last = measurement;
-      if (recordToSpark) {
-        spark.add(measurement);
-      }
-    }
-
-    String getLabel() const {
-      return label;
-    }
-
-    uint16_t getLast() const {
-      return last;
-    }
-
-    void setConversion(UnitConversionFunction newVal) {
-      conversion = newVal;
-    }
-
-    void setUnits(String newVal) {
-      units = newVal;
-    }
-
-    void draw() const {
-      char number_buffer[6];
-      u8g2.setFont(u8g2_font_t0_18b_tf);
-      
-      formatNumber(number_buffer, 6, conversion(last));
-      u8g2_uint_t width = u8g2.drawStr(0, 31, number_buffer);
-
-      u8g2.setFont(u8g2_font_t0_11_tf);
-      u8g2.drawStr(0, 11, label.c_str());
-      u8g2.drawStr(width, 31, units.c_str());
-
-      formatNumber(number_buffer, 6, conversion(spark.findMax()));
-      u8g2.drawStr(98, 24, number_buffer);
-
-      formatNumber(number_buffer, 6, conversion(spark.findMin()));
-      u8g2.drawStr(98, 36, number_buffer);
-
-      u8g2.setFont(u8g2_font_siji_t_6x10);
-      u8g2.drawGlyph(86, 24, 0xe12b);
-      u8g2.drawGlyph(86, 36, 0xe12c);
-
-      spark.draw(0, 50, 76, 16);
-    }
-
-    AirVariable(
-      const char* _label,
-      const char* _units,
-      UnitConversionFunction converter = identity
-    )
-      : spark(60, [&](const uint16_t x0, const uint16_t y0, const uint16_t x1, const uint16_t y1) { 
-          u8g2.drawLine(x0, y0, x1, y1);
-        }),
-        label(_label),
-        units(_units),
-        conversion(converter)
-    {}  
-};
-
-const char* cubic_microgram_unit = "\xB5g/m\xB3";
-AirVariable TVOC("TVOC", "");
-AirVariable NOX("NOX", "");
-AirVariable CO2("CO\xB2", "ppm");
-AirVariable pm10("PM 10", cubic_microgram_unit);
-AirVariable pm25(
-  "PM 2.5", 
-  useUSAQI ? "AQI" : cubic_microgram_unit, 
-  useUSAQI ? PM_TO_AQI_US : identity
-);
-AirVariable pm01("PM 1", cubic_microgram_unit);
-AirVariable pm03("PM 0.03", "");
-AirVariable temp(
-  "TEMPERATURE", 
-  useFahrenheit ? "\xB0" "F" : "\xB0" "C", 
-  useFahrenheit ? K_TO_F : K_TO_C
-);
-AirVariable hum("HUMIDITY", "%");
+// the OLED shares the I2C bus with the SHT and SGP41, so frames go out a few
+// tiles per loop() instead of 1 KB at once
+TileDisplay<16, 8> display(u8g2);
+
+// labels and units are read from flash by AirVariable, see AirFlash.h
+static const char cubic_microgram_unit[] PROGMEM = "\xB5g/m\xB3";
+static const char no_unit[] PROGMEM = "";
+static const char tvoc_label[] PROGMEM = "TVOC";
+static const char nox_label[] PROGMEM = "NOX";
+static const char co2_label[] PROGMEM = "CO\xB2";
+static const char ppm_unit[] PROGMEM = "ppm";
+static const char pm10_label[] PROGMEM = "PM 10";
+static const char pm25_label[] PROGMEM = "PM 2.5";
+static const char aqi_unit[] PROGMEM = "AQI";
+static const char pm01_label[] PROGMEM = "PM 1";
+static const char pm03_label[] PROGMEM = "PM 0.03";
+static const char temp_label[] PROGMEM = "TEMPERATURE";
+static const char fahrenheit_unit[] PROGMEM = "\xB0" "F";
+static const char celsius_unit[] PROGMEM = "\xB0" "C";
+static const char hum_label[] PROGMEM = "HUMIDITY";
+static const char percent_unit[] PROGMEM = "%";
+
+AirVariable TVOC(FPSTR(tvoc_label), FPSTR(no_unit));
+AirVariable NOX(FPSTR(nox_label), FPSTR(no_unit));
+AirVariable CO2(FPSTR(co2_label), FPSTR(ppm_unit));
+AirVariable pm10(FPSTR(pm10_label), FPSTR(cubic_microgram_unit));
+AirVariable pm25(FPSTR(pm25_label), FPSTR(aqi_unit), PM_TO_AQI_US);
+AirVariable pm01(FPSTR(pm01_label), FPSTR(cubic_microgram_unit));
+AirVariable pm03(FPSTR(pm03_label), FPSTR(no_unit));
+AirVariable temp(FPSTR(temp_label), FPSTR(fahrenheit_unit), K_TO_F);
+AirVariable hum(FPSTR(hum_label), FPSTR(percent_unit));
 
 const AirVariable* const allVariables[] = {
   &TVOC, 
@@ -227,369 +125,381 @@ uint8_t displayVariable = 0;
 boolean displaySSID = true;
 
 // current spark interval
-uint8_t currentInterval = 0;
+uint16_t currentInterval = 0;
 
 int lastState = HIGH;
 int buttonState = HIGH;
 unsigned long debounceStart = 0;
 const unsigned long debounceDelay = 50;
 
-// Wifi Manager
-const String ag_platform_yes = "yes";
-const String temp_units_fahrenheit = "fahrenheit";
-const String pm_units_usaqi = "USAQI";
-
-/** 
- * WiFiManagerParameter sucks if you want something other than a text input 
- * The only way to get it to use the entire customHTML is to null out getID
- * and if you do that, then value can never be set.
- * 
- * init() always nulls out _value.
- * init() calls setValue().
- * setValue() is the only way to set _value.
- * setValue() only sets _value if _id is not null.
- * init() is the only way to set _id
- */
-class CustomParameter : public WiFiManagerParameter
-{
-  public:
-    CustomParameter(
-      const char* value, 
-      int length, 
-      const char* customHtml
-    ) : WiFiManagerParameter(customHtml) {
-      _id = "";
-      setValue(value, length);
-      _id = nullptr;
-    }
-};
+void applySettings() {
+  temp.setConversion(settings.useFahrenheit ? K_TO_F : K_TO_C);
+  temp.setUnits(FPSTR(settings.useFahrenheit ? fahrenheit_unit : celsius_unit));
+  pm25.setConversion(settings.useUSAQI ? PM_TO_AQI_US : identity);
+  pm25.setUnits(FPSTR(settings.useUSAQI ? aqi_unit : cubic_microgram_unit));
+}
 
-WiFiManager wifiManager;
-WiFiManagerParameter wifi_hostname("hostname", "Hostname", "hostname", 23);
-
-// Note that each param's name is important. param_# is a format that 
-// WiFiManager insists on if you're going to implement completely custom params.
-CustomParameter wifi_ag_platform(
-  "yes",
-  4,
-  "<label for=\"param_1\">AirGradient Platform</label>"
-  "<select id=\"param_1\" name=\"param_1\">"
-    "<option value=\"yes\" selected>Yes</option>"
-    "<option value=\"no\">No</option>"
-  "</select>"
-);
-CustomParameter wifi_temp_units(
-  "Celsius",
-  10,
-  "<label for=\"param_2\">Temperature Units</label>"
-  "<select id=\"param_2\" name=\"param_2\">"
-    "<option value=\"fahrenheit\" selected>°F</option>"
-    "<option value=\"celsius\">°C</option>"
-  "</select>"
-);
-CustomParameter wifi_pm_units(
-  "USAQI",
-  10,
-  "<label for=\"param_3\">PM 2.5 Units</label>"
-  "<select id=\"param_3\" name=\"param_3\">"
-    "<option value=\"USAQI\" selected>AQI</option>"
-    "<option value=\"cubic_mg\">µg/m³</option>"
-  "</select>"
-);
-CustomParameter wifi_spark_interval(
-  "1",
-  4,
-  "<label for=\"param_4\">Chart Time Window</label>"
-  "<select id=\"param_4\" name=\"param_4\">"
-    "<option value=\"1\" selected>5 min</option>"
-    "<option value=\"2\">10 min</option>"
-    "<option value=\"6\">30 min</option>"
-    "<option value=\"12\">1 hour</option>"
-    "<option value=\"72\">6 hour</option>"
-    "<option value=\"144\">12 hour</option>"
-    "<option value=\"288\">1 day</option>"
-  "</select>"
-);
-
-void validateSparkInterval() {
-  switch (sparkInterval) {
-    case 1:
-    case 2:
-    case 6:
-    case 12:
-    case 72:
-    case 144:
-    case 288:
-      return;
-    default:
-      sparkInterval = 1;
-  }
+void addMeasurements(JsonPayload& payload) {
+  payload.add(F("rco2"), CO2.getLast());
+  payload.add(F("pm01"), pm01.getLast());
+  payload.add(F("pm02"), pm25.getLast());
+  payload.add(F("pm10"), pm10.getLast());
+  payload.add(F("pm003_count"), pm03.getLast());
+  payload.add(F("tvoc_index"), TVOC.getLast());
+  payload.add(F("nox_index"), NOX.getLast());
+  payload.add(F("atmp"), K_TO_C(temp.getLast()));
+  payload.add(F("rhum"), hum.getLast());
 }
 
-void readSettings() {
-  uint8_t settings = EEPROM.read(settings_addr);
-  useAGPlatform = (settings & 1) == 1;
-  useFahrenheit = ((settings >> 1) & 1) == 1;
-  useUSAQI = ((settings >> 2) & 1) == 1;
+void addVariables(JsonPayload& payload) {
+  payload.addRaw(F("variables"), variablesJson(allVariables));
+}
 
-  for (unsigned long i = 0; i < hostname_len; i++) {
-    hostname[i] = EEPROM.read(hostname_addr + i);
-  }
+boolean recordToSpark() {
+  return currentInterval % settings.sparkInterval == 0;
+}
 
-  temp.setConversion(useFahrenheit ? K_TO_F : K_TO_C);
-  temp.setUnits(useFahrenheit ? "\xB0" "F" : "\xB0" "C");
-  pm25.setConversion(useUSAQI ? PM_TO_AQI_US : identity);
-  pm25.setUnits(useUSAQI ? "AQI" : "\xB5g/m\xB3");
-  wifiManager.setHostname(hostname);
+// The adaptive sensors can go 30 s between reads, so their sparklines take
+// the last reading at every spark tick instead of recording each read.
+void recordSparks() {
+  for (AirVariable* variable : {&CO2, &pm01, &pm25, &pm10, &pm03, &temp, &hum}) {
+    variable->update(variable->getLast(), true);
+  }
+}
 
-  sparkInterval = EEPROM.read(sparkInterval_addr);
+// SGP41 compensation in sensor ticks, refreshed by each SHT read rather than
+// recomputed for every 1 Hz SGP41 sample. Defaults are 50 %RH and 25 C.
+uint16_t compensationRhTicks = 0x8000;
+uint16_t compensationTTicks = 0x6666;
+
+void updateCompensation(uint16_t kelvin_hundredths, uint16_t humidity) {
+  // ticks = (T + 45) * 65535 / 175, with T in hundredths of a Kelvin
+  int32_t t = constrain(static_cast<int32_t>(kelvin_hundredths) - 27315 + 4500, 0, 17500);
+  uint32_t rh = constrain(humidity, 0, 100);
+  compensationTTicks = static_cast<uint32_t>(t) * 65535 / 17500;
+  compensationRhTicks = rh * 65535 / 100;
+}
 
-  validateSparkInterval();
+void logSgp41Error(uint16_t error) {
+  char error_message[64];
+  errorToString(error, error_message, sizeof(error_message));
+  LOG_ERROR("Error from TVOC: %s", error_message);
 }
 
-void writeSettings() {
-  validateSparkInterval();
+/**
+ * SensirionI2CSgp41 delays 50ms between sending a command and reading the
+ * result, so this sends the same frames itself and lets the registry wait.
+ * During warm-up it runs the conditioning command instead of a measurement.
+ *
+ * The gas index algorithms are tuned for one sample a second, so this lane
+ * runs at 1 Hz independently of the 5 s sensors and only every fifth sample
+ * goes to the sparkline.
+ */
+struct Sgp41Driver {
+  static constexpr const char* name = "SGP41";
+  static constexpr uint32_t warmUpMs = 0;
+  static constexpr uint32_t intervalMs = 1000;
+  static constexpr uint32_t timeoutMs = 500;
+
+  static constexpr uint8_t address = 0x59;
+  static constexpr uint16_t conditioningCommand = 0x2612;
+  static constexpr uint16_t measureCommand = 0x2619;
+  static constexpr uint32_t conditioningMs = 10000;
+  static constexpr uint32_t commandDelayMs = 50;
+  static constexpr uint8_t samplesPerSpark = 5;
+
+  uint32_t commandTime = 0;
+  uint8_t samples = 0;
+  boolean conditioning = true;
+  // whether the last read changed an index or recorded a sample
+  boolean changed = false;
+
+  bool begin() {
+    sgp41.begin(Wire);
+    return true;
+  }
 
-  uint8_t settings = 0;
-  if (useAGPlatform) {
-    settings |= 1;
+  bool start() {
+    conditioning = millis() < conditioningMs;
+
+    uint8_t buffer[8];
+    SensirionI2CTxFrame txFrame = SensirionI2CTxFrame::createWithUInt16Command(
+      conditioning ? conditioningCommand : measureCommand,
+      buffer,
+      8
+    );
+    uint16_t error = txFrame.addUInt16(compensationRhTicks);
+    error |= txFrame.addUInt16(compensationTTicks);
+    if (!error) {
+      error = SensirionI2CCommunication::sendFrame(address, txFrame, Wire);
+    }
+    if (error) {
+      logSgp41Error(error);
+      return false;
+    }
+    commandTime = millis();
+    return true;
   }
-  if (useFahrenheit) {
-    settings |= (1 << 1);
+
+  bool ready() {
+    return millis() - commandTime >= commandDelayMs;
   }
-  if (useUSAQI) {
-    settings |= (1 << 2);
+
+  bool read() {
+    uint8_t buffer[6];
+    uint16_t srawVoc = 0;
+    uint16_t srawNox = 0;
+
+    // conditioning only returns the VOC signal
+    SensirionI2CRxFrame rxFrame(buffer, 6);
+    uint16_t error = SensirionI2CCommunication::receiveFrame(
+      address,
+      conditioning ? 3 : 6,
+      rxFrame,
+      Wire
+    );
+    if (!error) {
+      error = rxFrame.getUInt16(srawVoc);
+      if (!conditioning) {
+        error |= rxFrame.getUInt16(srawNox);
+      }
+    }
+    if (error) {
+      logSgp41Error(error);
+      return false;
+    }
+    changed = false;
+    if (conditioning) {
+      return true;
+    }
+
+    samples = (samples + 1) % samplesPerSpark;
+    boolean spark = samples == 0 && recordToSpark();
+    const uint16_t vocIndex = voc_algorithm.process(srawVoc);
+    const uint16_t noxIndex = nox_algorithm.process(srawNox);
+    // the indices move slowly, most 1 Hz reads publish nothing new
+    changed = samples == 0 || vocIndex != TVOC.getLast() || noxIndex != NOX.getLast();
+    TVOC.update(vocIndex, spark);
+    NOX.update(noxIndex, spark);
+    LOG_DEBUG("TVOC: %u NOX: %u", TVOC.getLast(), NOX.getLast());
+    return true;
   }
-  EEPROM.write(settings_addr, settings);
 
-  for (unsigned long i = 0; i < hostname_len; i++) {
-    EEPROM.write(hostname_addr + i, hostname[i]);
+  bool published() const {
+    return changed;
   }
+};
 
-  EEPROM.write(sparkInterval_addr, sparkInterval);
-  EEPROM.commit();
+struct Co2Driver {
+  static constexpr const char* name = "CO2";
+  static constexpr uint32_t warmUpMs = 10000;
+  static constexpr uint32_t intervalMs = 5000;
+  static constexpr uint32_t timeoutMs = 500;
 
-  temp.setConversion(useFahrenheit ? K_TO_F : K_TO_C);
-  temp.setUnits(useFahrenheit ? "\xB0" "F" : "\xB0" "C");
-  pm25.setConversion(useUSAQI ? PM_TO_AQI_US : identity);
-  pm25.setUnits(useUSAQI ? "AQI" : "\xB5g/m\xB3");
-  wifiManager.setHostname(hostname);
-}
+  AdaptiveCadence cadence{intervalMs, 30000};
 
-void sendToServer() {
-  if (!useAGPlatform) { 
-    return;
+  uint32_t cadenceMs() const {
+    return cadence.intervalMs();
   }
 
-  String payload = "{\"wifi\":\"" + String(WiFi.RSSI())
-                    + "\", \"rco2\":\"" + String(CO2.getLast())
-                    + "\", \"pm01\":\"" + String(pm01.getLast())
-                    + "\", \"pm02\":\"" + String(pm25.getLast())
-                    + "\", \"pm10\":\"" + String(pm10.getLast())
-                    + "\", \"pm003_count\":\"" + String(pm03.getLast())
-                    + "\", \"tvoc_index\":\"" + String(TVOC.getLast())
-                    + "\", \"nox_index\":\"" + String(NOX.getLast())
-                    + "\", \"atmp\":\"" + String(K_TO_C(temp.getLast()))
-                    + "\", \"rhum\":\"" + String(hum.getLast())
-                    + "\"\n}";
-
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println(payload);
-    String POSTURL = APIROOT + "sensors/airgradient:" + String(ESP.getChipId(), HEX) + "/measures";
-    Serial.println(POSTURL);
-    WiFiClient client;
-    HTTPClient http;
-    http.begin(client, POSTURL);
-    http.addHeader("content-type", "application/json");
-    int httpCode = http.POST(payload);
-    String response = http.getString();
-    Serial.println(httpCode);
-    Serial.println(response);
-    http.end();
-  } else {
-    Serial.println("WiFi Disconnected");
+  bool begin() {
+    coSerial.begin(9600);
+    co.init(coSerial);
+    return true;
   }
-}
-
-void wifi_handleMetrics() {
-  // Use json-exporter if you want to ingest this to prometheus. Not worth being 
-  // prometheus-specific at this point.
-  String metrics = "{\n"
-      "\"id\":\"" + String(ESP.getChipId(), HEX)
-    + "\", \"mac\":\"" + WiFi.macAddress()
-    + "\", \"hostname\":\"" + String(hostname)
-    + "\", \"rco2\":\"" + String(CO2.getLast())
-    + "\", \"pm01\":\"" + String(pm01.getLast())
-    + "\", \"pm02\":\"" + String(pm25.getLast())
-    + "\", \"pm10\":\"" + String(pm10.getLast())
-    + "\", \"pm003_count\":\"" + String(pm03.getLast())
-    + "\", \"tvoc_index\":\"" + String(TVOC.getLast())
-    + "\", \"nox_index\":\"" + String(NOX.getLast())
-    + "\", \"atmp\":\"" + String(K_TO_C(temp.getLast()))
-    + "\", \"rhum\":\"" + String(hum.getLast())
-  + "\"\n}";
-  wifiManager.server->send(200, "application/json", metrics);
-}
-
-void wifi_addRoutes() {
-  Serial.println("Adding metrics route");
-  wifiManager.server->on("/metrics", wifi_handleMetrics);
-}
 
-void wifi_saveParameters() {
-  strncpy(hostname, wifi_hostname.getValue(), 24);
+  bool start() {
+    return co.requestRead();
+  }
 
-  Serial.println("hostname param: " + String(wifi_hostname.getValue()));
-  Serial.println("platform param: " + String(wifi_ag_platform.getValue()));
-  Serial.println("temp param: " + String(wifi_temp_units.getValue()));
-  Serial.println("pm units param: " + String(wifi_pm_units.getValue()));
-  Serial.println("spark interval param: " + String(wifi_spark_interval.getValue()));
+  bool ready() {
+    return co.responseAvailable();
+  }
 
-  useAGPlatform = ag_platform_yes.equals(wifi_ag_platform.getValue());
-  useFahrenheit = temp_units_fahrenheit.equals(wifi_temp_units.getValue());
-  useUSAQI = pm_units_usaqi.equals(wifi_pm_units.getValue());
-  sparkInterval = String(wifi_spark_interval.getValue()).toInt();
+  bool read() {
+    int value = co.readResponse();
+    if (value < 0) {
+      LOG_WARN("CO2 read failed with %d", value);
+      return false;
+    }
+    if (co.getStatus() != 0) {
+      LOG_WARN("CO2 meter status %04x", co.getStatus());
+    }
+    // 15 ppm is about the sensor's noise
+    cadence.compare(value, CO2.getLast(), 15);
+    cadence.decide(millis());
+    CO2.update(value);
+    LOG_DEBUG("CO2: %u", CO2.getLast());
+    return true;
+  }
+};
 
-  validateSparkInterval();
-  writeSettings();
-}
+struct PmsDriver {
+  static constexpr const char* name = "PMS";
+  static constexpr uint32_t warmUpMs = 10000;
+  static constexpr uint32_t intervalMs = 5000;
+  static constexpr uint32_t timeoutMs = 2000;
 
-void setupWifi() {
-  wifiManager.setTimeout(90);
-  wifiManager.setConfigPortalBlocking(false);
+  AdaptiveCadence cadence{intervalMs, 30000};
 
-  wifiManager.setSaveParamsCallback(wifi_saveParameters);
-  wifiManager.setWebServerCallback(wifi_addRoutes);
+  uint32_t cadenceMs() const {
+    return cadence.intervalMs();
+  }
 
-  wifiManager.addParameter(&wifi_hostname);
-  wifiManager.addParameter(&wifi_ag_platform);
-  wifiManager.addParameter(&wifi_temp_units);
-  wifiManager.addParameter(&wifi_pm_units);
-  wifiManager.addParameter(&wifi_spark_interval);
-  uint param_num = wifiManager.getParametersCount();
-  Serial.println("Params: " + String(param_num));
+  bool begin() {
+    pmSerial.begin(9600);
+    pm.init(pmSerial);
+    return true;
+  }
 
-  String HOTSPOT = "AG-" + String(ESP.getChipId(), HEX);
-  if (String(hostname).isEmpty()) {
-    strncpy(hostname, HOTSPOT.c_str(), 24);
+  bool start() {
+    pm.requestRead();
+    return true;
   }
-  wifi_hostname.setValue(hostname, 24);
-  wifiManager.autoConnect((const char*)hostname);
-}
 
-void conditionTVOC() {
-  uint16_t srawVoc = 0;
-  uint16_t temp_celsius = static_cast<uint16_t>(std::round(K_TO_C(temp.getLast())));
-  uint16_t compensationT = static_cast<uint16_t>((temp_celsius + 45) * 65535. / 175.);
-  uint16_t compensationRh = static_cast<uint16_t>(hum.getLast() * 65535. / 100.);
-
-  uint16_t error = sgp41.executeConditioning(
-    compensationRh, 
-    compensationT, 
-    srawVoc
-  );
-
-  if (error) {
-    char error_message[256];
-    errorToString(error, error_message, 256);
-    Serial.println("Error from TVOC: " + String(error_message));
+  bool ready() {
+    while (pmSerial.available()) {
+      if (pm.readPMS()) {
+        return true;
+      }
+    }
+    return false;
   }
-}
 
-void updateTVOC() {
-  uint16_t srawVoc = 0;
-  uint16_t srawNox = 0;
-
-  uint16_t temp_celsius = static_cast<uint16_t>(std::round(K_TO_C(temp.getLast())));
-  uint16_t compensationT = static_cast<uint16_t>((temp_celsius + 45) * 65535. / 175.);
-  uint16_t compensationRh = static_cast<uint16_t>(hum.getLast() * 65535. / 100.);
-
-  uint16_t error = sgp41.measureRawSignals(
-    compensationRh, 
-    compensationT, 
-    srawVoc,
-    srawNox
-  );
-
-  if (error) {
-    char error_message[256];
-    errorToString(error, error_message, 256);
-    Serial.println("Error from TVOC: " + String(error_message));
-    return;
+  bool read() {
+    const PMS::Data& pm_data = pm.getData();
+    cadence.compare(pm_data.PM_AE_UG_2_5, pm25.getLast(), 3);
+    cadence.compare(pm_data.PM_AE_UG_10_0, pm10.getLast(), 5);
+    cadence.decide(millis());
+    pm01.update(pm_data.PM_AE_UG_1_0);
+    pm25.update(pm_data.PM_AE_UG_2_5);
+    pm10.update(pm_data.PM_AE_UG_10_0);
+    pm03.update(pm_data.PM_RAW_0_3);
+    LOG_DEBUG("PM25: %u", pm25.getLast());
+    return true;
   }
+};
 
-  TVOC.update(voc_algorithm.process(srawVoc), currentInterval % sparkInterval == 0);
-  NOX.update(nox_algorithm.process(srawNox), currentInterval % sparkInterval == 0);
-  Serial.println("TVOC: " + String(TVOC.getLast()));
-}
+// arduino-sht only has a blocking read, which takes a few milliseconds
+struct ShtDriver {
+  static constexpr const char* name = "SHT";
+  static constexpr uint32_t warmUpMs = 10000;
+  static constexpr uint32_t intervalMs = 5000;
+  static constexpr uint32_t timeoutMs = 0;
 
-void updateCo2() {
-  CO2.update(co.getCO2_Raw(), currentInterval % sparkInterval == 0);
-  Serial.println("\nCO2: " + String(CO2.getLast()));
-}
+  AdaptiveCadence cadence{intervalMs, 30000};
 
-void updatePm() {
-  pm.requestRead();
-  if (!pm.readUntil(2000)) {
-    Serial.println("PM read failed");
-    return;
+  uint32_t cadenceMs() const {
+    return cadence.intervalMs();
   }
 
-  const PMS::Data& pm_data = pm.getData();
-  pm01.update(pm_data.PM_AE_UG_1_0, currentInterval % sparkInterval == 0);
-  pm25.update(pm_data.PM_AE_UG_2_5, currentInterval % sparkInterval == 0);
-  pm10.update(pm_data.PM_AE_UG_10_0, currentInterval % sparkInterval == 0);
-  pm03.update(pm_data.PM_RAW_0_3, currentInterval % sparkInterval == 0);
-  Serial.println("PM25: " + String(pm25.getLast()));
-}
+  bool begin() {
+    if (!sht.init()) {
+      return false;
+    }
+    sht.setAccuracy(SHTSensor::SHT_ACCURACY_MEDIUM);
+    return true;
+  }
+
+  bool start() {
+    return true;
+  }
 
-void updateTempHum() {
-  if (sht.readSample()) {
+  bool ready() {
+    return true;
+  }
+
+  bool read() {
+    if (!sht.readSample()) {
+      LOG_WARN("Error in readSample()");
+      return false;
+    }
     // temp is hundreths of a degree to avoid using floats
     uint16_t kelvin = static_cast<uint16_t>(std::round(
       (sht.getTemperature() + 273.15) * 100
     ));
-    temp.update(kelvin, currentInterval % sparkInterval == 0);
-    hum.update(
-      static_cast<uint16_t>(sht.getHumidity()),
-      currentInterval % sparkInterval == 0
-    );
-    Serial.println("TEMP: " + String(K_TO_C(temp.getLast())) + " HUM: " + String(hum.getLast()));
-  } else {
-    Serial.println("Error in readSample()");
+    uint16_t humidity = static_cast<uint16_t>(sht.getHumidity());
+    // 0.1 degree and 1 %RH
+    cadence.compare(kelvin, temp.getLast(), 10);
+    cadence.compare(humidity, hum.getLast(), 1);
+    cadence.decide(millis());
+    temp.update(kelvin);
+    hum.update(humidity);
+    updateCompensation(temp.getLast(), hum.getLast());
+    LOG_DEBUG("TEMP: %s HUM: %u", K_TO_C(temp.getLast()).toString().c_str(), hum.getLast());
+    return true;
   }
+};
+
+// SHT first so the SGP41 compensation uses the freshest temperature
+SensorRegistry<ShtDriver, Sgp41Driver, Co2Driver, PmsDriver> sensors;
+
+void addDiagnostics(JsonPayload& payload) {
+  const SensorStatus& sgp41Status = sensors.status<1>();
+  payload.addRaw(F("sgp41_late_ms"), sgp41Status.lastLateMs);
+  payload.addRaw(F("sgp41_late_max_ms"), sgp41Status.maxLateMs);
+  payload.addRaw(F("sgp41_skipped"), sgp41Status.skipped);
+
+  const AdaptiveCadence& shtCadence = sensors.driver<0>().cadence;
+  const AdaptiveCadence& co2Cadence = sensors.driver<2>().cadence;
+  const AdaptiveCadence& pmsCadence = sensors.driver<3>().cadence;
+  payload.addRaw(F("sht_sample_ms"), shtCadence.sampleMs());
+  payload.addRaw(F("co2_sample_ms"), co2Cadence.sampleMs());
+  payload.addRaw(F("pms_sample_ms"), pmsCadence.sampleMs());
+  payload.addRaw(F("cadence_bursts"), shtCadence.bursts + co2Cadence.bursts + pmsCadence.bursts);
+  payload.addRaw(F("cadence_backoffs"), shtCadence.backoffs + co2Cadence.backoffs + pmsCadence.backoffs);
+
+  const DisplayStats& displayStats = display.getStats();
+  payload.addRaw(F("display_frames"), displayStats.frames);
+  payload.addRaw(F("display_frame_us"), displayStats.lastFrameUs);
+  payload.addRaw(F("display_frame_tiles"), displayStats.lastFrameTiles);
+  payload.addRaw(F("display_slice_max_us"), displayStats.maxSliceUs);
+}
+
+void addLinkHealth(JsonPayload& payload) {
+  const LinkCounters& pms = pm.getCounters();
+  payload.addRaw(F("pms_frames"), pms.frames);
+  payload.addRaw(F("pms_checksum_errors"), pms.checksumErrors);
+  payload.addRaw(F("pms_resyncs"), pms.resyncs);
+  payload.addRaw(F("pms_discarded"), pms.discarded);
+  payload.addRaw(F("pms_timeouts"), pms.timeouts);
+  payload.addRaw(F("pms_overflows"), pms.overflows);
+
+  const LinkCounters co2 = co.getLinkCounters();
+  payload.addRaw(F("co2_frames"), co2.frames);
+  payload.addRaw(F("co2_checksum_errors"), co2.checksumErrors);
+  payload.addRaw(F("co2_resyncs"), co2.resyncs);
+  payload.addRaw(F("co2_discarded"), co2.discarded);
+  payload.addRaw(F("co2_timeouts"), co2.timeouts);
+  payload.addRaw(F("co2_overflows"), co2.overflows);
 }
 
 void renderSparkCaption() {
-  String sparkCaption;
-  switch (sparkInterval) {
-    case 1:
-      sparkCaption = "last 5m";
-      break;
+  FlashString sparkCaption;
+  switch (settings.sparkInterval) {
     case 2: 
-      sparkCaption = "last 10m";
+      sparkCaption = F("last 10m");
       break;
     case 6:
-      sparkCaption = "last 30m";
+      sparkCaption = F("last 30m");
       break;
     case 12:
-      sparkCaption = "last 1h";
+      sparkCaption = F("last 1h");
       break;
     case 72:
-      sparkCaption = "last 6h";
+      sparkCaption = F("last 6h");
       break;
     case 144:
-      sparkCaption = "last 12h";
+      sparkCaption = F("last 12h");
       break;
     case 288:
-      sparkCaption = "last 1d";
+      sparkCaption = F("last 1d");
       break;
     default:
-      sparkInterval = 1;
-      sparkCaption = "last 5m";
+      sparkCaption = F("last 5m");
   }
   u8g2.setFont(u8g2_font_t0_11_tf);
-  u8g2.drawStr(79, 50, sparkCaption.c_str());
+  drawFlashStr(u8g2, 79, 50, sparkCaption);
 }
 
 void renderWifi() {
@@ -601,13 +511,13 @@ void renderWifi() {
     if (displaySSID) {
       u8g2.drawStr(12, 64, wifiManager.getWiFiSSID().substring(0, 19).c_str());
     } else {
-      u8g2.drawStr(12, 64, "HOTSPOT ACTIVE");
+      drawFlashStr(u8g2, 12, 64, F("HOTSPOT ACTIVE"));
     }
   } else if (WiFi.status() != WL_CONNECTED) {
     u8g2.drawGlyph(0, 64, 0xe217);
 
     u8g2.setFont(u8g2_font_t0_11_tf);
-    u8g2.drawStr(12, 64, "DISCONNECTED");
+    drawFlashStr(u8g2, 12, 64, F("DISCONNECTED"));
   } else {
     u8g2.drawGlyph(0, 64, 0xe21a);
 
@@ -615,8 +525,8 @@ void renderWifi() {
     if (displaySSID) {
       u8g2.drawStr(12, 64, wifiManager.getWiFiSSID().substring(0, 19).c_str());
     } else {
-      char sliced[20];
-      strncpy(sliced, hostname, 19);
+      char sliced[20] = { "\0" };
+      strncpy(sliced, settings.hostname, 19);
       u8g2.drawStr(12, 64, sliced);
     }
   }
@@ -624,27 +534,27 @@ void renderWifi() {
 
 void renderVariable() {
   const AirVariable* variable = allVariables[displayVariable];
-  u8g2.firstPage();
-  do {
-    variable->draw();
+  display.draw([variable]() {
+    variable->draw(u8g2);
     renderWifi();
     renderSparkCaption();
-  } while (u8g2.nextPage());
+  });
 }
 
-void renderText(String ln1, String ln2, String ln3) {
-  u8g2.firstPage();
-  do {
+// shown straight away, for messages right before a blocking reset
+void renderText(FlashString ln1, FlashString ln2, FlashString ln3) {
+  display.draw([&]() {
     u8g2.setFont(u8g2_font_t0_16_tf);
-    u8g2.drawStr(1, 10, String(ln1).c_str());
-    u8g2.drawStr(1, 30, String(ln2).c_str());
-    u8g2.drawStr(1, 50, String(ln3).c_str());
-  } while (u8g2.nextPage());
+    drawFlashStr(u8g2, 1, 10, ln1);
+    drawFlashStr(u8g2, 1, 30, ln2);
+    drawFlashStr(u8g2, 1, 50, ln3);
+  });
+  display.flush();
 }
 
 void setup() {
   Serial.begin(115200);
-  Serial.println("Hello");
+  LOG_INFO("Hello");
   u8g2.begin();
 
   EEPROM.begin(512);
@@ -652,50 +562,42 @@ void setup() {
   pinMode(D7, INPUT_PULLUP);
 
   readSettings();
+  setupHistory();
   setupWifi();
 
-  sht.init();
-  sht.setAccuracy(SHTSensor::SHT_ACCURACY_MEDIUM);
-  sgp41.begin(Wire);
-
-  pmSerial.begin(9600);
-  pm.init(pmSerial);
-
-  coSerial.begin(9600);
-  co.init(coSerial);
+  sensors.begin();
+  setMetricsMaxAge(sensors.intervalMs / 1000);
 }
 
 void loop() {
   static esp8266::polledTimeout::oneShot warmUp(10000);
   static esp8266::polledTimeout::periodicMs fivSecond(5000);
   static esp8266::polledTimeout::periodicMs tenSecond(10000);
+  static esp8266::polledTimeout::periodicMs redraw(250);
   
-  if (fivSecond && warmUp) {
-    updateTVOC();
-    updateTempHum();
-    updateCo2();
-    updatePm();
+  logDrain();
+  if (sensors.service()) {
+    measurementsChanged();
+  }
 
-    currentInterval = (currentInterval + 1) % (sparkInterval + 1);
+  if (fivSecond && warmUp) {
+    recordSample({
+      CO2.getLast(), pm01.getLast(), pm25.getLast(), pm10.getLast(), pm03.getLast(),
+      TVOC.getLast(), NOX.getLast(), temp.getLast(), hum.getLast()
+    });
+    if (recordToSpark()) {
+      recordSparks();
+    }
+    currentInterval = (currentInterval + 1) % (settings.sparkInterval + 1);
     displayVariable = (displayVariable + 1) % (sizeof(allVariables) / sizeof(allVariables[0]));
-  } else if (fivSecond) {
-    conditionTVOC();
   }
   if (tenSecond) {
-    sendToServer();
+    radioQueue(sendToServer);
 
     displaySSID = !displaySSID;
   }
 
-  wifiManager.process();
-  // if the wifi is connected and the web portal is not active, then start it.
-  if (
-    WiFi.status() == WL_CONNECTED &&
-    !wifiManager.getWebPortalActive() && 
-    !wifiManager.getConfigPortalActive()
-  ) {
-    wifiManager.startWebPortal();
-  }
+  processWifi();
   
   int reading = digitalRead(D7);
   if (reading != lastState) {
@@ -707,21 +609,21 @@ void loop() {
 
       if (buttonState == LOW) {
         // reset
-        wifiManager.resetSettings();
-        useAGPlatform = false;
-        useFahrenheit = true;
-        useUSAQI = true;
-        sparkInterval = 1;
-        strcpy(hostname, "");
-        writeSettings();
-        renderText("Resetting", "", "");
+        LOG_INFO("Resetting");
+        resetSettings();
+        renderText(F("Resetting"), F(""), F(""));
         delay(1000);
 
+        logFlush();
         ESP.reset();
       }
     }
   }
   lastState = reading;
   
-  renderVariable();
+  // drawing is cheap, tiles that didn't change aren't sent
+  if (redraw) {
+    renderVariable();
+  }
+  display.service();
 }
@@ -0,0 +1,355 @@
+/*
+  cbor_test.cpp - decodes what CborWriter and JsonPayload's CBOR mode write
+  with a strict decoder of its own, checking the encoding (shortest heads,
+  the indefinite map and its break, tag 4 decimal fractions, tag 262 JSON)
+  and that every value comes back. Then compares the size and encode time
+  of a measurements payload against the JSON body.
+
+  g++ -O2 -std=c++17 -Wall -Itools/host -Ilib/AirGradientCore tools/cbor_test.cpp -o cbor_test
+  ./cbor_test
+*/
+
+#include <AirConversions.h>
+#include <AirJson.h>
+#include <Check.h>
+
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+uint32_t millis() {
+  return 0;
+}
+
+struct Value
+{
+  enum Kind { INTEGER, TEXT, BYTES, BOOLEAN, DECIMAL, JSON, MAP, INVALID } kind = INVALID;
+  int64_t integer = 0;
+  // DECIMAL is mantissa * 10^exponent
+  int64_t exponent = 0;
+  std::string text;
+  std::vector<std::pair<std::string, Value>> fields;
+};
+
+/**
+ * Decodes the subset CborWriter produces and rejects anything it should not:
+ * heads longer than needed, definite length maps, unknown tags and simple
+ * values.
+ */
+class Decoder
+{
+  const uint8_t* data;
+  size_t size;
+  size_t position = 0;
+
+  bool head(uint8_t& major, uint64_t& argument, bool& indefinite) {
+    if (position >= size) {
+      return false;
+    }
+    const uint8_t initial = data[position++];
+    major = initial >> 5;
+    const uint8_t info = initial & 31;
+    indefinite = info == 31;
+    if (info < 24 || indefinite) {
+      argument = info;
+      return true;
+    }
+    if (info > 27) {
+      return false;
+    }
+    const size_t bytes = 1 << (info - 24);
+    if (position + bytes > size) {
+      return false;
+    }
+    argument = 0;
+    for (size_t i = 0; i < bytes; i++) {
+      argument = argument << 8 | data[position++];
+    }
+    const uint64_t smallest[] = {24, 0x100, 0x10000, 0x100000000};
+    return argument >= smallest[info - 24];
+  }
+
+  bool integer(int64_t& value) {
+    Value item = next();
+    value = item.integer;
+    return item.kind == Value::INTEGER;
+  }
+
+  public:
+    Decoder(const uint8_t* bytes, size_t length) : data(bytes), size(length) {}
+
+    bool done() const {
+      return position == size;
+    }
+
+    Value next() {
+      Value value;
+      uint8_t major;
+      uint64_t argument;
+      bool indefinite;
+      if (!head(major, argument, indefinite) || (indefinite && major != 5)) {
+        return value;
+      }
+      switch (major) {
+        case 0:
+        case 1:
+          value.kind = Value::INTEGER;
+          value.integer = major == 0 ? static_cast<int64_t>(argument) : -1 - static_cast<int64_t>(argument);
+          return value;
+
+        case 2:
+        case 3:
+          if (position + argument > size) {
+            return value;
+          }
+          value.kind = major == 2 ? Value::BYTES : Value::TEXT;
+          value.text.assign(reinterpret_cast<const char*>(data + position), argument);
+          position += argument;
+          return value;
+
+        case 5:
+          if (!indefinite) {
+            return value;
+          }
+          while (position < size && data[position] != 0xFF) {
+            Value key = next();
+            Value field = next();
+            if (key.kind != Value::TEXT || field.kind == Value::INVALID) {
+              return Value();
+            }
+            value.fields.emplace_back(key.text, field);
+          }
+          if (position == size) {
+            return value;
+          }
+          position++;
+          value.kind = Value::MAP;
+          return value;
+
+        case 6:
+          if (argument == 4) {
+            uint8_t arrayMajor;
+            uint64_t length;
+            if (!head(arrayMajor, length, indefinite) || arrayMajor != 4 || indefinite || length != 2) {
+              return value;
+            }
+            if (!integer(value.exponent) || !integer(value.integer)) {
+              return value;
+            }
+            value.kind = Value::DECIMAL;
+            return value;
+          }
+          if (argument == 262) {
+            Value json = next();
+            if (json.kind == Value::BYTES) {
+              value.kind = Value::JSON;
+              value.text = json.text;
+            }
+          }
+          return value;
+
+        case 7:
+          if (argument == 20 || argument == 21) {
+            value.kind = Value::BOOLEAN;
+            value.integer = argument == 21;
+          }
+          return value;
+      }
+      return value;
+    }
+};
+
+static std::vector<uint8_t> encoded(const CborWriter& writer) {
+  return std::vector<uint8_t>(writer.data(), writer.data() + writer.size());
+}
+
+static Value decodeOne(const CborWriter& writer) {
+  Decoder decoder(writer.data(), writer.size());
+  Value value = decoder.next();
+  if (!decoder.done()) {
+    return Value();
+  }
+  return value;
+}
+
+static void testIntegers() {
+  const int64_t values[] = {
+    0, 1, 23, 24, 255, 256, 65535, 65536, INT32_MAX,
+    -1, -24, -25, -256, -257, -65536, -65537, INT32_MIN
+  };
+  for (int64_t expected : values) {
+    uint8_t buffer[8];
+    CborWriter writer(buffer, sizeof(buffer));
+    writer.integer(expected);
+    const Value value = decodeOne(writer);
+    CHECK(value.kind == Value::INTEGER && value.integer == expected);
+  }
+
+  // RFC 8949 appendix A
+  uint8_t buffer[8];
+  CborWriter writer(buffer, sizeof(buffer));
+  writer.integer(24);
+  CHECK(encoded(writer) == (std::vector<uint8_t>{0x18, 0x18}));
+  writer.reset();
+  writer.integer(-1000);
+  CHECK(encoded(writer) == (std::vector<uint8_t>{0x39, 0x03, 0xE7}));
+  writer.reset();
+  writer.integer(1000000);
+  CHECK(encoded(writer) == (std::vector<uint8_t>{0x1A, 0x00, 0x0F, 0x42, 0x40}));
+}
+
+static void testDecimalFractions() {
+  uint8_t buffer[16];
+  CborWriter writer(buffer, sizeof(buffer));
+
+  // 21.5 is 4([-1, 215])
+  writer.fixed(Fixed::fromThousandths(21500));
+  CHECK(encoded(writer) == (std::vector<uint8_t>{0xC4, 0x82, 0x20, 0x18, 0xD7}));
+
+  // whole numbers stay integers
+  writer.reset();
+  writer.fixed(Fixed::fromInt(-7));
+  CHECK(encoded(writer) == (std::vector<uint8_t>{0x26}));
+
+  // every conversion result round trips to the thousandth
+  const UnitConversionFunction conversions[] = {K_TO_C, K_TO_F, PM_TO_AQI_US};
+  uint32_t mismatches = 0;
+  for (UnitConversionFunction convert : conversions) {
+    for (uint32_t reading = 0; reading <= UINT16_MAX; reading++) {
+      const Fixed expected = convert(reading);
+      writer.reset();
+      writer.fixed(expected);
+      const Value value = decodeOne(writer);
+      int64_t thousandths = value.integer;
+      if (value.kind == Value::DECIMAL) {
+        // trailing zeros are dropped, so the exponent is -1 to -3 and the
+        // mantissa isn't a multiple of 10
+        if (value.exponent >= 0 || value.exponent < -3 || value.integer % 10 == 0) {
+          mismatches++;
+        }
+        for (int64_t exponent = value.exponent; exponent > -3; exponent--) {
+          thousandths *= 10;
+        }
+      } else if (value.kind == Value::INTEGER) {
+        thousandths *= 1000;
+      } else {
+        mismatches++;
+      }
+      if (thousandths != expected.raw()) {
+        mismatches++;
+      }
+    }
+  }
+  CHECK(mismatches == 0);
+}
+
+static void testPayload() {
+  uint8_t buffer[256];
+  CborWriter writer(buffer, sizeof(buffer));
+  JsonPayload payload(writer);
+  payload.add(F("rco2"), 612);
+  payload.add(F("atmp"), K_TO_C(29465));
+  payload.add(F("serialno"), String("a1b2c3"));
+  payload.addRaw(F("channels"), "{}");
+  payload.addRaw(F("uptime"), 70000);
+  payload.addFlag(F("ota"), true);
+  payload.finish();
+  CHECK(writer.ok());
+
+  // an indefinite map, closed by a break
+  CHECK(buffer[0] == 0xBF);
+  CHECK(buffer[writer.size() - 1] == 0xFF);
+
+  const Value map = decodeOne(writer);
+  CHECK(map.kind == Value::MAP);
+  std::map<std::string, Value> fields(map.fields.begin(), map.fields.end());
+  CHECK(fields.size() == 6);
+  CHECK(fields["rco2"].kind == Value::INTEGER && fields["rco2"].integer == 612);
+  CHECK(fields["atmp"].kind == Value::DECIMAL && fields["atmp"].exponent == -1 && fields["atmp"].integer == 215);
+  CHECK(fields["serialno"].kind == Value::TEXT && fields["serialno"].text == "a1b2c3");
+  CHECK(fields["channels"].kind == Value::JSON && fields["channels"].text == "{}");
+  CHECK(fields["uptime"].kind == Value::INTEGER && fields["uptime"].integer == 70000);
+  CHECK(fields["ota"].kind == Value::BOOLEAN && fields["ota"].integer == 1);
+
+  // an empty map is just the two markers
+  CborWriter empty(buffer, sizeof(buffer));
+  JsonPayload(empty).finish();
+  CHECK(encoded(empty) == (std::vector<uint8_t>{0xBF, 0xFF}));
+}
+
+static void testOverflow() {
+  // the writer stops at its capacity, the guard bytes stay untouched
+  uint8_t buffer[12];
+  memset(buffer, 0xAA, sizeof(buffer));
+  CborWriter writer(buffer, 8);
+  JsonPayload payload(writer);
+  payload.add(F("pm003_count"), 1234);
+  payload.finish();
+  CHECK(!writer.ok());
+  CHECK(writer.size() <= 8);
+  CHECK(buffer[8] == 0xAA && buffer[11] == 0xAA);
+
+  writer.reset();
+  CHECK(writer.ok() && writer.size() == 0);
+}
+
+// a pro's measurements, as the platform gets them
+static uint16_t co2 = 612;
+
+static void addPro(JsonPayload& payload) {
+  payload.add(F("wifi"), -61);
+  payload.add(F("rco2"), co2);
+  payload.add(F("pm01"), 3);
+  payload.add(F("pm02"), 7);
+  payload.add(F("pm10"), 9);
+  payload.add(F("pm003_count"), 1234);
+  payload.add(F("tvoc_index"), 100);
+  payload.add(F("nox_index"), 1);
+  payload.add(F("atmp"), K_TO_C(29465));
+  payload.add(F("rhum"), 41);
+}
+
+static void benchmark() {
+  using Clock = std::chrono::steady_clock;
+  const int payloads = 200000;
+  size_t jsonSize = 0;
+  size_t cborSize = 0;
+
+  const auto start = Clock::now();
+  for (int i = 0; i < payloads; i++) {
+    co2 = 400 + i % 1000;
+    JsonPayload payload;
+    addPro(payload);
+    jsonSize = payload.finish().length();
+  }
+  const auto middle = Clock::now();
+  uint8_t buffer[256];
+  for (int i = 0; i < payloads; i++) {
+    co2 = 400 + i % 1000;
+    CborWriter writer(buffer, sizeof(buffer));
+    JsonPayload payload(writer);
+    addPro(payload);
+    payload.finish();
+    cborSize = writer.size();
+  }
+  const auto end = Clock::now();
+
+  CHECK(cborSize < jsonSize);
+  auto nanos = [&](Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::nano>(to - from).count() / payloads;
+  };
+  printf("measurements: JSON %zu bytes %.0f ns, CBOR %zu bytes %.0f ns\n",
+    jsonSize, nanos(start, middle), cborSize, nanos(middle, end));
+}
+
+int main() {
+  testIntegers();
+  testDecimalFractions();
+  testPayload();
+  testOverflow();
+  benchmark();
+  return checkResult("cbor_test");
+}
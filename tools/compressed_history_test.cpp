@@ -0,0 +1,238 @@
+/*
+  compressed_history_test.cpp - round trips CompressedHistory through every
+  field width, block rollover and seek(), then replays a trace through the
+  pro's per variable Series and reports bits per sample, the compression
+  ratio and how much time each variable's history covers.
+
+  g++ -O2 -std=c++17 -Wall -Itools/host -Ilib/AirGradientCore tools/compressed_history_test.cpp -o compressed_history_test
+  ./compressed_history_test [trace.csv]
+
+  A trace is a CSV file with a header row, time in seconds in the first
+  column and one uint16_t measurement per column after it:
+
+    t,rco2,pm02,kelvin_hundredths
+    5,451,5,29310
+    10,450,5,29311
+
+  Without one, a day of 5 second samples shaped like an office is made up.
+  Every replay is also checked to decode back exactly.
+*/
+
+#include <Check.h>
+#include <CompressedHistory.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// what the pro could spare per variable, 768 bytes of samples
+using Series = CompressedHistory<128, 6>;
+
+struct Trace
+{
+  std::vector<std::string> names;
+  std::vector<uint32_t> times;
+  // a column per name
+  std::vector<std::vector<uint16_t>> values;
+};
+
+static bool loadCsv(const char* path, Trace& trace) {
+  std::ifstream in(path);
+  std::string line;
+  if (!std::getline(in, line)) {
+    return false;
+  }
+  std::stringstream header(line);
+  std::string name;
+  std::getline(header, name, ',');
+  while (std::getline(header, name, ',')) {
+    trace.names.push_back(name);
+  }
+  trace.values.resize(trace.names.size());
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::stringstream row(line);
+    std::string field;
+    std::getline(row, field, ',');
+    trace.times.push_back(std::stoul(field));
+    for (std::vector<uint16_t>& column : trace.values) {
+      if (!std::getline(row, field, ',')) {
+        return false;
+      }
+      column.push_back(std::stoul(field));
+    }
+  }
+  return !trace.times.empty();
+}
+
+// CO2 following occupancy, temperature and humidity on a daily cycle, each
+// with jitter at its sensor's resolution and the odd late sample
+static Trace officeDay() {
+  std::mt19937 random(7);
+  std::normal_distribution<double> noise(0, 1);
+  std::uniform_real_distribution<double> chance(0, 1);
+  Trace trace;
+  trace.names = {"rco2", "pm02", "kelvin_hundredths", "rhum", "tvoc_index"};
+  trace.values.resize(trace.names.size());
+  double co2 = 450;
+  double pm = 4;
+  double tvoc = 100;
+  uint32_t time = 0;
+  for (uint32_t i = 0; i < 17280; i++) {
+    time += chance(random) < 0.002 ? 10 : 5;
+    const double hour = fmod(i * 5 / 3600.0, 24);
+    const bool occupied = hour >= 9 && hour < 18;
+    co2 += ((occupied ? 1100 : 430) - co2) * 0.002 + noise(random) * 1.5;
+    pm = std::max(0.0, pm + (3 - pm) * 0.01 + noise(random) * 0.6);
+    tvoc += (100 + 60 * occupied - tvoc) * 0.003 + noise(random) * 0.4;
+    trace.times.push_back(time);
+    trace.values[0].push_back(std::lround(co2));
+    trace.values[1].push_back(std::lround(pm));
+    trace.values[2].push_back(std::lround(29415 + 150 * sin(2 * M_PI * (hour - 9) / 24) + noise(random) * 2));
+    trace.values[3].push_back(std::lround(42 + 6 * sin(2 * M_PI * (hour - 3) / 24) + noise(random) * 0.4));
+    trace.values[4].push_back(std::lround(tvoc));
+  }
+  return trace;
+}
+
+// whether history holds exactly the newest of the samples, in order
+template <typename History>
+static bool holdsTail(const History& history, const std::vector<uint32_t>& times, const std::vector<uint16_t>& values) {
+  if (history.size() > times.size()) {
+    return false;
+  }
+  size_t i = times.size() - history.size();
+  auto reader = history.read();
+  uint32_t time;
+  uint16_t value;
+  while (reader.next(time, value)) {
+    if (i == times.size() || time != times[i] || value != values[i]) {
+      return false;
+    }
+    i++;
+  }
+  return i == times.size();
+}
+
+static void testWidths() {
+  // value steps at and either side of every width, and raw jumps
+  const int32_t steps[] = {0, 1, -1, 2, -2, 3, 7, -8, 8, 31, -32, 32, 511, -512, 512, 40000, -40000};
+  // interval changes likewise, up to a clock jump
+  const int64_t jitters[] = {0, 1, -1, 63, -64, 64, 255, -256, 256, 2047, -2048, 2048, 100000, 1L << 31};
+
+  std::vector<uint32_t> times;
+  std::vector<uint16_t> values;
+  CompressedHistory<64, 4> history;
+  uint32_t time = 1000;
+  uint32_t interval = 5;
+  int32_t value = 30000;
+  uint32_t mismatches = 0;
+  for (int64_t jitter : jitters) {
+    for (int32_t step : steps) {
+      // keep the interval positive and the value in range
+      interval = jitter >= 0 || static_cast<int64_t>(interval) + jitter >= 0 ? interval + jitter : 5;
+      value = std::min<int32_t>(UINT16_MAX, std::max<int32_t>(0, value + step));
+      time += interval;
+      history.add(time, value);
+      times.push_back(time);
+      values.push_back(value);
+      // the next sample drops back to the steady interval
+      interval = 5;
+      if (!holdsTail(history, times, values)) {
+        mismatches++;
+      }
+    }
+  }
+  CHECK(mismatches == 0);
+  // the blocks rolled over, so only the newest samples are left
+  CHECK(history.size() < times.size());
+  CHECK(history.oldest() > times.front());
+
+  history.clear();
+  CHECK(history.size() == 0 && history.oldest() == 0 && history.bytesUsed() == 0);
+  uint32_t unused;
+  uint16_t none;
+  auto reader = history.read();
+  CHECK(!reader.next(unused, none));
+}
+
+static void testSeek() {
+  CompressedHistory<32, 8> history;
+  std::vector<uint32_t> times;
+  for (uint32_t i = 0; i < 400; i++) {
+    times.push_back(i * 5);
+    history.add(i * 5, i);
+  }
+  uint32_t misses = 0;
+  for (uint32_t since = history.oldest(); since < times.back(); since += 7) {
+    auto reader = history.read();
+    reader.seek(since);
+    uint32_t time;
+    uint16_t value;
+    if (!reader.next(time, value) || time > since) {
+      misses++;
+      continue;
+    }
+    // whole blocks only, so at most one block's worth before since
+    while (time < since && reader.next(time, value)) {
+    }
+    if (time < since) {
+      misses++;
+    }
+  }
+  CHECK(misses == 0);
+}
+
+static void replay(const Trace& trace) {
+  using Clock = std::chrono::steady_clock;
+  const double hours = (trace.times.back() - trace.times.front()) / 3600.0;
+  printf("%zu samples over %.1f h into CompressedHistory<128, 6>\n", trace.times.size(), hours);
+  printf("%-18s %9s %7s %7s %8s %8s %8s\n", "series", "bits/smp", "ratio", "held", "span h", "add ns", "read ns");
+
+  for (size_t column = 0; column < trace.names.size(); column++) {
+    const std::vector<uint16_t>& values = trace.values[column];
+    Series history;
+    const auto start = Clock::now();
+    for (size_t i = 0; i < trace.times.size(); i++) {
+      history.add(trace.times[i], values[i]);
+    }
+    const auto added = Clock::now();
+    CHECK(holdsTail(history, trace.times, values));
+    const auto read = Clock::now();
+
+    const double span = (trace.times.back() - history.oldest()) / 3600.0;
+    printf("%-18s %9.2f %7s %7u %8.2f %8.1f %8.1f\n",
+      trace.names[column].c_str(),
+      history.bytesUsed() * 8.0 / history.size(),
+      history.compressionRatio().toString().c_str(),
+      history.size(),
+      span,
+      std::chrono::duration<double, std::nano>(added - start).count() / trace.times.size(),
+      std::chrono::duration<double, std::nano>(read - added).count() / history.size());
+  }
+}
+
+int main(int argc, char** argv) {
+  testWidths();
+  testSeek();
+
+  Trace trace;
+  if (argc > 1) {
+    if (!loadCsv(argv[1], trace)) {
+      printf("can't read a trace from %s\n", argv[1]);
+      return 2;
+    }
+  } else {
+    trace = officeDay();
+  }
+  replay(trace);
+  return checkResult("compressed_history_test");
+}
@@ -0,0 +1,179 @@
+/*
+  fixed_test.cpp - runs every uint16_t reading through the fixed point unit
+  conversions (AirConversions.h) and the float code they replaced, and checks
+  the values and the text the payloads and the display get. Then times the
+  Fahrenheit conversion and its formatting both ways.
+
+  g++ -O2 -std=c++17 -Wall -Itools/host -Ilib/AirGradientCore tools/fixed_test.cpp -o fixed_test
+  ./fixed_test
+
+  The timings are for the host, which has an FPU. The ESP8266 and the
+  ESP32-C3 do not, so the gap there is wider.
+*/
+
+#include <AirConversions.h>
+#include <Check.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// the float code, as it was
+static float floatKToC(uint16_t kelvin) {
+  return (kelvin / 100.0) - 273.15;
+}
+
+static float floatKToF(uint16_t kelvin) {
+  return floatKToC(kelvin) * 9. / 5. + 32.;
+}
+
+static float floatPmToAqi(uint16_t pm02) {
+  if (pm02 <= 12.0) return ((50 - 0) / (12.0 - .0) * (pm02 - .0) + 0);
+  else if (pm02 <= 35.4) return ((100 - 50) / (35.4 - 12.0) * (pm02 - 12.0) + 50);
+  else if (pm02 <= 55.4) return ((150 - 100) / (55.4 - 35.4) * (pm02 - 35.4) + 100);
+  else if (pm02 <= 150.4) return ((200 - 150) / (150.4 - 55.4) * (pm02 - 55.4) + 150);
+  else if (pm02 <= 250.4) return ((300 - 200) / (250.4 - 150.4) * (pm02 - 150.4) + 200);
+  else if (pm02 <= 350.4) return ((400 - 300) / (350.4 - 250.4) * (pm02 - 250.4) + 300);
+  else if (pm02 <= 500.4) return ((500 - 400) / (500.4 - 350.4) * (pm02 - 350.4) + 400);
+  else return 500.;
+}
+
+static float floatIdentity(uint16_t value) {
+  return value;
+}
+
+// the display showed whole numbers without decimals, anything else with one;
+// the old uint16_t test missed negative whole numbers, which is not kept
+static void floatDisplay(char* buffer, size_t size, float value) {
+  if (value == static_cast<int32_t>(value)) {
+    snprintf(buffer, size, "%d", static_cast<int32_t>(value));
+  } else {
+    snprintf(buffer, size, "%.1f", value);
+  }
+}
+
+static void fixedDisplay(char* buffer, size_t size, Fixed value) {
+  value.format(buffer, size, value.isInteger() ? 0 : 1);
+}
+
+// printf keeps the sign of a value that rounds to zero, format() does not
+static void dropNegativeZero(char* text) {
+  if (text[0] == '-' && atof(text) == 0) {
+    memmove(text, text + 1, strlen(text));
+  }
+}
+
+// how far x is from the nearest point halfway between two steps of size step
+static double fromTie(double x, double step) {
+  const double fraction = std::fabs(x / step - std::floor(x / step));
+  return std::fabs(fraction - 0.5) * step;
+}
+
+struct Conversion
+{
+  const char* name;
+  float (*floating)(uint16_t);
+  UnitConversionFunction fixed;
+};
+
+static const Conversion conversions[] = {
+  {"K_TO_C", floatKToC, K_TO_C},
+  {"K_TO_F", floatKToF, K_TO_F},
+  {"PM_TO_AQI_US", floatPmToAqi, PM_TO_AQI_US},
+  {"identity", floatIdentity, identity},
+};
+
+static void testConversion(const Conversion& conversion) {
+  uint32_t valueDiffs = 0;
+  uint32_t payloadDiffs = 0;
+  uint32_t displayDiffs = 0;
+
+  for (uint32_t reading = 0; reading <= UINT16_MAX; reading++) {
+    const float old = conversion.floating(reading);
+    const Fixed fixed = conversion.fixed(reading);
+
+    // the float result rounded to the nearest thousandth
+    if (std::fabs(old * 1000.0 - fixed.raw()) > 0.5001) {
+      valueDiffs++;
+    }
+
+    // payloads carry two decimals; fixed rounds twice, to thousandths and
+    // then to hundredths, so it may land one hundredth off where the value
+    // is within half a thousandth of a tie
+    char oldText[24];
+    char fixedText[24];
+    snprintf(oldText, sizeof(oldText), "%.2f", old);
+    dropNegativeZero(oldText);
+    fixed.format(fixedText, sizeof(fixedText), 2);
+    if (strcmp(oldText, fixedText) != 0) {
+      const double apart = std::fabs(atof(oldText) - atof(fixedText));
+      if (apart > 0.0101 || (apart > 0 && fromTie(old, 0.01) > 0.0005)) {
+        payloadDiffs++;
+        printf("  %s(%u): payload %s, was %s\n", conversion.name, reading, fixedText, oldText);
+      }
+    }
+
+    // the display, except at ties to the tenth, which float only breaks
+    // one way or the other by its representation error
+    floatDisplay(oldText, sizeof(oldText), old);
+    dropNegativeZero(oldText);
+    fixedDisplay(fixedText, sizeof(fixedText), fixed);
+    if (strcmp(oldText, fixedText) != 0 && abs(fixed.raw()) % 100 != 50) {
+      displayDiffs++;
+      printf("  %s(%u): display %s, was %s\n", conversion.name, reading, fixedText, oldText);
+    }
+  }
+
+  CHECK(valueDiffs == 0);
+  CHECK(payloadDiffs == 0);
+  CHECK(displayDiffs == 0);
+}
+
+static void testFormat() {
+  char buffer[8];
+  CHECK(Fixed::fromThousandths(-1995).format(buffer, sizeof(buffer), 2) == 5);
+  CHECK(strcmp(buffer, "-2.00") == 0);
+  CHECK(Fixed::fromThousandths(1234).format(buffer, sizeof(buffer), 3) == 5);
+  CHECK(strcmp(buffer, "1.234") == 0);
+  // "-1234.5" and its terminator need 8
+  CHECK(Fixed::fromThousandths(-1234500).format(buffer, 8, 1) == 7);
+  CHECK(Fixed::fromThousandths(-1234500).format(buffer, 7, 1) == 0);
+  CHECK(buffer[0] == '\0');
+}
+
+template <typename Convert>
+static double nanosPerReading(Convert convert) {
+  const int rounds = 20;
+  volatile char sink = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < rounds; round++) {
+    for (uint32_t reading = 0; reading <= UINT16_MAX; reading++) {
+      char text[12];
+      convert(text, sizeof(text), reading);
+      sink = sink + text[0];
+    }
+  }
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / (rounds * 65536.0);
+}
+
+static void benchmark() {
+  const double floating = nanosPerReading([](char* text, size_t size, uint16_t reading) {
+    floatDisplay(text, size, floatKToF(reading));
+  });
+  const double fixed = nanosPerReading([](char* text, size_t size, uint16_t reading) {
+    fixedDisplay(text, size, K_TO_F(reading));
+  });
+  printf("K_TO_F and display text: float %.1f ns, fixed %.1f ns\n", floating, fixed);
+}
+
+int main() {
+  for (const Conversion& conversion : conversions) {
+    testConversion(conversion);
+  }
+  testFormat();
+  benchmark();
+  return checkResult("fixed_test");
+}
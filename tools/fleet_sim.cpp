@@ -0,0 +1,1056 @@
+/*
+  fleet_sim.cpp - thousands of virtual devices uploading to one endpoint, for
+  capacity planning the collector side.
+
+  g++ -O2 -std=c++17 -pthread -Itools/host -Ilib/AirGradientCore tools/fleet_sim.cpp lib/AirGradientCore/ReportFilter.cpp -o fleet_sim
+  ./fleet_sim --url http://127.0.0.1:8080/ [--devices 1000] [--mix 60,10,30]
+              [--threads 4] [--speed 1] [--seconds 60] [--report 10]
+              [--heartbeat 0] [--cbor] [--keep-alive] [--metrics-port 9100]
+              [--seed 1]
+
+  --mix is the percentage of pro, basic and outdoor devices. Each device
+  follows its sketch's schedule on a virtual clock running --speed times
+  real time. The pro and basic read each sensor on its driver's
+  AdaptiveCadence, every 5 seconds while readings move and backing off to
+  30 while they don't, and have a sample to upload every 10 seconds. The
+  outdoor feeds two PMS readings every 2 seconds into its averaging windows
+  and has a sample when averageWindow readings are in.
+
+  Every sample goes through a ReportFilter with the portal's default
+  dead-bands, as sendToServer() and postToServer() do, and is only uploaded
+  when it is due; a filter only takes an upload as its new reference on a
+  2xx. --heartbeat sets the report heartbeat in minutes. At 0, the firmware
+  default, every sample is uploaded; above it uploads carry suppressed.
+
+  Readings come from synthetic streams with a daily cycle, drift and
+  noise. Payloads are built by the firmware's own JsonPayload, CborWriter,
+  RingAverage and unit conversions, with the sketches' fields in the
+  sketches' order; the link counters are made up. --cbor uploads CBOR with
+  the same JSON fallback on 415.
+
+  The sketches keep their state in globals, so their loop() can't be
+  instanced thousands of times in one process; the schedules above are
+  taken from them and need updating if the sketches change. Devices start
+  as if already running, so the outdoor boot ping isn't sent.
+
+  Uploads open a connection each, like HTTPClient on the devices, unless
+  --keep-alive is given. With --metrics-port, GET /<id>/metrics returns a
+  device's /metrics body, as CBOR for Accept: application/cbor.
+
+  Every --report seconds it prints achieved uploads per second against the
+  samples scheduled, how many samples the dead-bands held back, failures,
+  upload latency and how many virtual seconds the most overdue device was
+  behind its schedule. A lag that keeps growing means
+  the endpoint or this host can't keep up at that fleet size.
+*/
+
+#include <AirCbor.h>
+#include <AdaptiveCadence.h>
+#include <AirConversions.h>
+#include <AirJson.h>
+#include <ReportFilter.h>
+#include <RingAverage.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// the firmware's defaults
+static constexpr uint16_t maxAverageWindow = 120;
+static constexpr uint16_t averageWindow = 40;
+static constexpr size_t cborPayloadSize = 512;
+static constexpr size_t cborMetricsSize = 1024;
+
+static volatile std::sig_atomic_t stopping = 0;
+
+static uint64_t monotonicNs() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// xorshift64*, one per device so runs are repeatable for a --seed
+class Random
+{
+  uint64_t state;
+
+  public:
+    explicit Random(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    uint64_t next() {
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      return state * 2685821657736338717ULL;
+    }
+
+    // uniform in [0, 1)
+    double uniform() {
+      return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    double normal() {
+      double u = uniform();
+      double v = uniform();
+      return std::sqrt(-2.0 * std::log(u + 1e-12)) * std::cos(2 * M_PI * v);
+    }
+};
+
+/**
+ * Slowly wandering noise, each step keeping most of the last value, so
+ * readings drift like real air instead of jumping every sample.
+ */
+struct Drift
+{
+  double value = 0;
+
+  double step(Random& random, double keep, double spread) {
+    value = value * keep + random.normal() * spread * std::sqrt(1 - keep * keep);
+    return value;
+  }
+};
+
+// a driver's AdaptiveCadence and the virtual ms it next reads at
+struct Cadenced
+{
+  AdaptiveCadence cadence{5000, 30000};
+  uint64_t next = 0;
+
+  bool due(uint64_t now) const {
+    return now >= next;
+  }
+
+  // after compare(), schedules the next read as SensorRegistry does
+  void read(uint64_t now) {
+    cadence.decide(now);
+    next = now + cadence.intervalMs();
+  }
+};
+
+enum class Kind
+{
+  PRO,
+  BASIC,
+  OUTDOOR
+};
+
+struct Device
+{
+  Kind kind;
+  char id[16];
+  char mac[18];
+  std::mutex lock;
+  Random random;
+
+  // per device character: how dirty and how busy its room is
+  double pmBase;
+  double occupancy;
+  Drift pmDrift;
+  Drift co2Drift;
+  Drift tvocDrift;
+  Drift temperatureDrift;
+  Drift humidityDrift;
+  Drift rssiDrift;
+
+  // latest readings, in the units the sketches' AirVariables hold
+  uint16_t co2 = 0;
+  uint16_t pm01 = 0;
+  uint16_t pm25 = 0;
+  uint16_t pm10 = 0;
+  uint16_t pm03 = 0;
+  uint16_t tvoc = 0;
+  uint16_t nox = 0;
+  uint16_t kelvinHundredths = 0;
+  uint16_t humidity = 0;
+  int32_t rssi = -60;
+
+  // the pro and basic sketches' SHT, CO2 and PMS drivers
+  Cadenced sht;
+  Cadenced co2Sensor;
+  Cadenced pms;
+
+  // the outdoor sketch's averaging
+  RingAverage<uint16_t, maxAverageWindow> pm1Window;
+  RingAverage<uint16_t, maxAverageWindow> pm25Window;
+  RingAverage<uint16_t, maxAverageWindow> pm10Window;
+  RingAverage<uint16_t, maxAverageWindow> pm03Window;
+  RingAverage<int16_t, maxAverageWindow> pmTempWindow;
+  RingAverage<uint16_t, maxAverageWindow> pmHumWindow;
+  uint16_t count = 0;
+  uint32_t loopCount = 0;
+  // reads of each sensor, for the link counters
+  int32_t reads = 0;
+
+  uint32_t historyRecords = 0;
+  bool cborRejected = false;
+  // virtual ms of the next upload for the pro and basic
+  uint64_t nextUpload = 0;
+  ReportFilter report;
+
+  Device(Kind deviceKind, uint32_t index, uint64_t seed) : kind(deviceKind), random(seed ^ (index * 0x100000001B3ULL)) {
+    if (kind == Kind::OUTDOOR) {
+      // ESP32 ids are the MAC without colons
+      uint8_t octets[6] = {0x34, 0x85, 0x18, static_cast<uint8_t>(index >> 16), static_cast<uint8_t>(index >> 8), static_cast<uint8_t>(index)};
+      snprintf(id, sizeof(id), "%02x%02x%02x%02x%02x%02x", octets[0], octets[1], octets[2], octets[3], octets[4], octets[5]);
+      snprintf(mac, sizeof(mac), "%02X:%02X:%02X:%02X:%02X:%02X", octets[0], octets[1], octets[2], octets[3], octets[4], octets[5]);
+    } else {
+      // ESP8266 ids are the chip id in hex
+      snprintf(id, sizeof(id), "%x", 0x100000 + index);
+      snprintf(mac, sizeof(mac), "5C:CF:7F:%02X:%02X:%02X", (index >> 16) & 0xFF, (index >> 8) & 0xFF, index & 0xFF);
+    }
+    pmBase = 2 + random.uniform() * (kind == Kind::OUTDOOR ? 25 : 12);
+    occupancy = random.uniform();
+    pm1Window.setWindow(averageWindow);
+    pm25Window.setWindow(averageWindow);
+    pm10Window.setWindow(averageWindow);
+    pm03Window.setWindow(averageWindow);
+    pmTempWindow.setWindow(averageWindow);
+    pmHumWindow.setWindow(averageWindow);
+  }
+
+  /**
+   * New readings for virtual time now, hours being the local time of day.
+   * Particles follow a morning and evening peak, CO2 and TVOC the room's
+   * occupancy, temperature and humidity a daily swing. The air changes on
+   * every call; the pro and basic only take a sensor's reading when its
+   * cadence is due, comparing against the last one with the sketches'
+   * thresholds.
+   */
+  void sense(double hours, uint64_t now) {
+    const double day = std::sin((hours - 9) / 24 * 2 * M_PI);
+    const double rushHours = std::exp(-std::pow(hours - 8, 2) / 2) + std::exp(-std::pow(hours - 18, 2) / 3);
+    const bool outdoor = kind == Kind::OUTDOOR;
+
+    double pm = pmBase * (1 + 0.8 * rushHours) * std::exp(pmDrift.step(random, 0.98, 0.35)) + random.normal() * 0.5;
+    pm = std::max(0.0, pm);
+    const uint16_t pm03Now = std::lround(std::max(0.0, pm * 115 + random.normal() * 30));
+    if (outdoor || pms.due(now)) {
+      const uint16_t pm25Now = std::lround(pm);
+      const uint16_t pm10Now = std::lround(pm * (outdoor ? 1.6 : 1.25));
+      if (!outdoor) {
+        pms.cadence.compare(pm25Now, pm25, 3);
+        pms.cadence.compare(pm10Now, pm10, 5);
+        pms.read(now);
+      }
+      pm25 = pm25Now;
+      pm01 = std::lround(pm * 0.68);
+      pm10 = pm10Now;
+      pm03 = pm03Now;
+    }
+
+    const double present = hours > 8 && hours < 19 ? occupancy : occupancy * 0.15;
+    const uint16_t co2Now = std::lround(std::max(400.0, 420 + present * 900 + co2Drift.step(random, 0.95, 40)));
+    if (co2Sensor.due(now)) {
+      co2Sensor.cadence.compare(co2Now, co2, 15);
+      co2Sensor.read(now);
+      co2 = co2Now;
+    }
+    // the SGP41 is read every second, so always has a fresh index
+    tvoc = std::lround(std::max(1.0, 100 + present * 60 + tvocDrift.step(random, 0.9, 25)));
+    nox = random.uniform() < 0.02 ? 2 + random.next() % 5 : 1;
+
+    const double celsius = (outdoor ? 12 + 7 * day : 21.5 + 1.5 * day) + temperatureDrift.step(random, 0.99, 0.6);
+    const double relative = (outdoor ? 65 - 20 * day : 42 - 5 * day) + humidityDrift.step(random, 0.99, 4);
+    if (outdoor || sht.due(now)) {
+      const uint16_t kelvinNow = std::lround((celsius + 273.15) * 100);
+      const uint16_t humidityNow = std::lround(std::min(100.0, std::max(5.0, relative)));
+      if (!outdoor) {
+        sht.cadence.compare(kelvinNow, kelvinHundredths, 10);
+        sht.cadence.compare(humidityNow, humidity, 1);
+        sht.read(now);
+      }
+      kelvinHundredths = kelvinNow;
+      humidity = humidityNow;
+    }
+    rssi = std::lround(std::min(-35.0, -62 + rssiDrift.step(random, 0.97, 6)));
+    ++reads;
+
+    if (outdoor) {
+      // the PMS5003T reports temperature and humidity in tenths
+      for (int sensor = 0; sensor < 2; sensor++) {
+        const int jitter = sensor == 0 ? 0 : static_cast<int>(random.normal());
+        pm1Window.add(std::max(0, pm01 + jitter));
+        pm25Window.add(std::max(0, pm25 + jitter));
+        pm10Window.add(std::max(0, pm10 + jitter));
+        pm03Window.add(std::max(0, pm03 + jitter * 20));
+        pmTempWindow.add(std::lround(celsius * 10) + jitter);
+        pmHumWindow.add(std::lround(std::min(100.0, std::max(5.0, relative)) * 10));
+        ++count;
+      }
+    }
+  }
+
+  // the sketches' addMeasurements()
+  void addMeasurements(JsonPayload& payload) const {
+    switch (kind) {
+      case Kind::PRO:
+        payload.add(F("rco2"), co2);
+        payload.add(F("pm01"), pm01);
+        payload.add(F("pm02"), pm25);
+        payload.add(F("pm10"), pm10);
+        payload.add(F("pm003_count"), pm03);
+        payload.add(F("tvoc_index"), tvoc);
+        payload.add(F("nox_index"), nox);
+        payload.add(F("atmp"), K_TO_C(kelvinHundredths));
+        payload.add(F("rhum"), humidity);
+        break;
+      case Kind::BASIC:
+        payload.add(F("rco2"), co2);
+        payload.add(F("pm01"), pm01);
+        payload.add(F("pm02"), pm25);
+        payload.add(F("pm10"), pm10);
+        payload.add(F("pm003_count"), pm03);
+        payload.add(F("atmp"), K_TO_C(kelvinHundredths));
+        payload.add(F("rhum"), humidity);
+        break;
+      case Kind::OUTDOOR:
+        payload.add(F("pm01"), pm1Window.mean());
+        payload.add(F("pm02"), pm25Window.mean());
+        payload.add(F("pm10"), pm10Window.mean());
+        payload.add(F("pm003_count"), pm03Window.mean());
+        payload.add(F("atmp"), pmTempWindow.mean(10));
+        payload.add(F("rhum"), pmHumWindow.mean(10));
+        break;
+    }
+  }
+
+  // the sketches' addLinkHealth(), for links that lose a frame now and then
+  void addLinkHealth(JsonPayload& payload) const {
+    static const char* const proKeys[] = {
+      "pms_frames", "pms_checksum_errors", "pms_resyncs", "pms_discarded", "pms_timeouts", "pms_overflows",
+      "co2_frames", "co2_checksum_errors", "co2_resyncs", "co2_discarded", "co2_timeouts", "co2_overflows"
+    };
+    static const char* const outdoorKeys[] = {
+      "pms1_frames", "pms1_checksum_errors", "pms1_resyncs", "pms1_discarded", "pms1_timeouts", "pms1_overflows",
+      "pms2_frames", "pms2_checksum_errors", "pms2_resyncs", "pms2_discarded", "pms2_timeouts", "pms2_overflows"
+    };
+    if (kind == Kind::BASIC) {
+      return;
+    }
+    const char* const* keys = kind == Kind::PRO ? proKeys : outdoorKeys;
+    const int32_t values[] = {reads, reads / 2000, reads / 5000, reads / 400, reads / 3000, 0};
+    for (int link = 0; link < 2; link++) {
+      for (int i = 0; i < 6; i++) {
+        payload.addRaw(F(keys[link * 6 + i]), values[i]);
+      }
+    }
+  }
+
+  // the parts of AirPortal's addMetrics() that don't need a radio
+  void addMetrics(JsonPayload& metrics) const {
+    metrics.add(F("id"), String(id));
+    metrics.add(F("mac"), String(mac));
+    metrics.add(F("hostname"), String(""));
+    addMeasurements(metrics);
+    addLinkHealth(metrics);
+    metrics.addRaw(F("free_heap"), kind == Kind::OUTDOOR ? 212000 : 21000);
+    metrics.addRaw(F("log_dropped"), 0);
+    metrics.addRaw(F("event_subscribers"), 0);
+    metrics.addFlag(F("mqtt_connected"), false);
+    metrics.addRaw(F("mqtt_dropped"), 0);
+    if (kind != Kind::BASIC) {
+      metrics.addRaw(F("history_records"), static_cast<int32_t>(historyRecords));
+    }
+  }
+};
+
+struct Endpoint
+{
+  std::string host;
+  std::string root;
+  sockaddr_storage address;
+  socklen_t addressLength;
+
+  // http://host[:port]/root/, like APIROOT
+  bool parse(const std::string& url) {
+    if (url.compare(0, 7, "http://") != 0) {
+      return false;
+    }
+    size_t slash = url.find('/', 7);
+    std::string authority = url.substr(7, slash == std::string::npos ? std::string::npos : slash - 7);
+    root = slash == std::string::npos ? "/" : url.substr(slash);
+    if (root.back() != '/') {
+      root += '/';
+    }
+    std::string port = "80";
+    size_t colon = authority.rfind(':');
+    host = authority.substr(0, colon);
+    if (colon != std::string::npos) {
+      port = authority.substr(colon + 1);
+    }
+    addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+      return false;
+    }
+    memcpy(&address, found->ai_addr, found->ai_addrlen);
+    addressLength = found->ai_addrlen;
+    freeaddrinfo(found);
+    return true;
+  }
+};
+
+/**
+ * A blocking HTTP/1.1 client for one worker, with the 5 second timeouts the
+ * firmware's HTTPClient uses.
+ */
+class Uploader
+{
+  const Endpoint& endpoint;
+  const bool keepAlive;
+  int fd = -1;
+
+  void disconnect() {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  bool connect() {
+    fd = socket(endpoint.address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&endpoint.address), endpoint.addressLength) != 0) {
+      disconnect();
+      return false;
+    }
+    return true;
+  }
+
+  bool sendAll(const char* head, size_t headSize, const void* body, size_t bodySize) {
+    iovec parts[2] = {{const_cast<char*>(head), headSize}, {const_cast<void*>(body), bodySize}};
+    size_t remaining = headSize + bodySize;
+    int count = 2;
+    iovec* part = parts;
+    while (remaining > 0) {
+      ssize_t sent = writev(fd, part, count);
+      if (sent <= 0) {
+        if (sent < 0 && errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      remaining -= sent;
+      while (count > 0 && static_cast<size_t>(sent) >= part->iov_len) {
+        sent -= part->iov_len;
+        ++part;
+        --count;
+      }
+      if (count > 0) {
+        part->iov_base = static_cast<char*>(part->iov_base) + sent;
+        part->iov_len -= sent;
+      }
+    }
+    return true;
+  }
+
+  // the status code, -1 if there was no complete response
+  int readResponse(bool& serverCloses) {
+    char response[2048];
+    size_t length = 0;
+    const char* headerEnd = nullptr;
+    while (headerEnd == nullptr) {
+      if (length == sizeof(response) - 1) {
+        return -1;
+      }
+      ssize_t received = recv(fd, response + length, sizeof(response) - 1 - length, 0);
+      if (received <= 0) {
+        return -1;
+      }
+      length += received;
+      response[length] = '\0';
+      headerEnd = strstr(response, "\r\n\r\n");
+    }
+    int status;
+    if (sscanf(response, "HTTP/1.%*d %d", &status) != 1) {
+      return -1;
+    }
+    const size_t headerSize = headerEnd + 4 - response;
+    size_t contentLength = 0;
+    serverCloses = false;
+    for (const char* line = strstr(response, "\r\n") + 2; line < headerEnd; line = strstr(line, "\r\n") + 2) {
+      if (strncasecmp(line, "content-length:", 15) == 0) {
+        contentLength = strtoul(line + 15, nullptr, 10);
+      } else if (strncasecmp(line, "connection:", 11) == 0 && strncasecmp(line + 11, " close", 6) == 0) {
+        serverCloses = true;
+      }
+    }
+    // discard the body
+    size_t body = length - headerSize;
+    while (body < contentLength) {
+      ssize_t received = recv(fd, response, std::min(sizeof(response), contentLength - body), 0);
+      if (received <= 0) {
+        return -1;
+      }
+      body += received;
+    }
+    return status;
+  }
+
+  public:
+    Uploader(const Endpoint& target, bool reuse) : endpoint(target), keepAlive(reuse) {}
+
+    ~Uploader() {
+      disconnect();
+    }
+
+    int post(const char* id, const char* contentType, const void* body, size_t size) {
+      char head[512];
+      const int headSize = snprintf(
+        head, sizeof(head),
+        "POST %ssensors/airgradient:%s/measures HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "User-Agent: ESP8266HTTPClient\r\n"
+        "Connection: %s\r\n"
+        "content-type: %s\r\n"
+        "Content-Length: %zu\r\n\r\n",
+        endpoint.root.c_str(), id, endpoint.host.c_str(), keepAlive ? "keep-alive" : "close", contentType, size
+      );
+      // a kept connection may have been closed by the server, retry once
+      for (int attempt = 0; attempt < 2; attempt++) {
+        const bool reused = fd >= 0;
+        if (!reused && !connect()) {
+          return -1;
+        }
+        bool serverCloses = true;
+        int status = sendAll(head, headSize, body, size) ? readResponse(serverCloses) : -1;
+        if (status < 0 || serverCloses || !keepAlive) {
+          disconnect();
+        }
+        if (status >= 0 || !reused) {
+          return status;
+        }
+      }
+      return -1;
+    }
+};
+
+// Written by its worker, read and reset by the reporter.
+struct WorkerStats
+{
+  std::atomic<uint64_t> uploads{0};
+  std::atomic<uint64_t> suppressed{0};
+  std::atomic<uint64_t> failed{0};
+  std::atomic<uint64_t> rejected{0};
+  std::atomic<uint64_t> bytesOut{0};
+  std::atomic<uint64_t> maxLagMs{0};
+  std::mutex latencyLock;
+  std::vector<uint32_t> latencyUs;
+};
+
+struct Options
+{
+  Endpoint endpoint;
+  uint32_t devices = 1000;
+  int mix[3] = {60, 10, 30};
+  int threads = 4;
+  double speed = 1;
+  int seconds = 60;
+  int reportSeconds = 10;
+  bool cbor = false;
+  bool keepAlive = false;
+  int metricsPort = 0;
+  uint64_t seed = 1;
+  // the portal's settings for every device, only the report ones are used
+  Settings settings;
+};
+
+static Options options;
+static std::vector<std::unique_ptr<Device>> fleet;
+static uint64_t startNs;
+// local time of day the virtual clock starts at, in hours
+static double startHours;
+
+static uint64_t virtualMs() {
+  return static_cast<uint64_t>((monotonicNs() - startNs) / 1e6 * options.speed);
+}
+
+static double hoursAt(uint64_t virtualTime) {
+  return std::fmod(startHours + virtualTime / 3600000.0, 24.0);
+}
+
+class Worker
+{
+  WorkerStats& stats;
+  Uploader uploader;
+
+  struct Due
+  {
+    uint64_t at;
+    Device* device;
+
+    bool operator>(const Due& other) const {
+      return at > other.at;
+    }
+  };
+  std::priority_queue<Due, std::vector<Due>, std::greater<Due>> queue;
+
+  // uploadPayload() from AirUpload.cpp, minus the radio; the status code,
+  // -1 if there was no response
+  template <typename Fill>
+  int upload(Device& device, Fill fill) {
+    String json;
+    uint8_t cbor[cborPayloadSize];
+    const void* body = nullptr;
+    size_t size = 0;
+    const char* contentType = "application/json";
+    {
+      std::lock_guard<std::mutex> guard(device.lock);
+      if (options.cbor && !device.cborRejected) {
+        CborWriter writer(cbor, sizeof(cbor));
+        JsonPayload payload(writer);
+        fill(payload);
+        payload.finish();
+        if (writer.ok()) {
+          body = cbor;
+          size = writer.size();
+          contentType = "application/cbor";
+        }
+      }
+      if (body == nullptr) {
+        JsonPayload payload;
+        fill(payload);
+        json = payload.finish();
+        body = json.c_str();
+        size = json.length();
+      }
+    }
+
+    const uint64_t start = monotonicNs();
+    int status = uploader.post(device.id, contentType, body, size);
+    const uint32_t latency = (monotonicNs() - start) / 1000;
+    if (status == 415 && body == cbor) {
+      device.cborRejected = true;
+      return upload(device, fill);
+    }
+
+    stats.uploads.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesOut.fetch_add(size, std::memory_order_relaxed);
+    if (status < 0) {
+      stats.failed.fetch_add(1, std::memory_order_relaxed);
+    } else if (status >= 300) {
+      stats.rejected.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (status >= 0) {
+      std::lock_guard<std::mutex> guard(stats.latencyLock);
+      stats.latencyUs.push_back(latency);
+    }
+    return status;
+  }
+
+  // the reportDue() and reportSent() around the sketches' uploads, true if
+  // the sample was due
+  template <typename Fill>
+  bool uploadDue(Device& device, uint64_t now, Fill fill) {
+    bool due;
+    {
+      std::lock_guard<std::mutex> guard(device.lock);
+      due = device.report.due(options.settings, now, [&device](JsonPayload& fields) {
+        device.addMeasurements(fields);
+      });
+    }
+    if (!due) {
+      stats.suppressed.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    const int status = upload(device, fill);
+    if (status >= 200 && status < 300) {
+      std::lock_guard<std::mutex> guard(device.lock);
+      device.report.sent(now);
+    }
+    return true;
+  }
+
+  // one step of a device's sketch loop(), returns when it is next due
+  uint64_t step(Device& device, uint64_t now) {
+    if (device.kind == Kind::OUTDOOR) {
+      bool full;
+      {
+        std::lock_guard<std::mutex> guard(device.lock);
+        device.sense(hoursAt(now), now);
+        full = device.count >= averageWindow;
+        if (full) {
+          ++device.historyRecords;
+        }
+      }
+      if (full) {
+        const bool due = uploadDue(device, now, [&device](JsonPayload& payload) {
+          payload.add(F("wifi"), device.rssi);
+          device.addMeasurements(payload);
+          device.addLinkHealth(payload);
+          device.report.addSummary(payload, options.settings);
+          payload.add(F("boot"), static_cast<int32_t>(device.loopCount));
+          payload.addRaw(F("channels"), "{}");
+        });
+        std::lock_guard<std::mutex> guard(device.lock);
+        // postToServer() only counts the samples it uploads
+        if (due) {
+          ++device.loopCount;
+        }
+        device.count = 0;
+      }
+      return now + 2000;
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(device.lock);
+      device.sense(hoursAt(now), now);
+      if (device.kind == Kind::PRO) {
+        ++device.historyRecords;
+      }
+    }
+    if (now >= device.nextUpload) {
+      device.nextUpload += 10000;
+      uploadDue(device, now, [&device](JsonPayload& payload) {
+        payload.add(F("wifi"), device.rssi);
+        device.addMeasurements(payload);
+        device.addLinkHealth(payload);
+        device.report.addSummary(payload, options.settings);
+      });
+    }
+    return now + 5000;
+  }
+
+  public:
+    Worker(WorkerStats& own) : stats(own), uploader(options.endpoint, options.keepAlive) {}
+
+    /**
+     * Devices join part way through their schedules, as if the fleet had
+     * been running a while, so uploads are at the steady rate from the start.
+     */
+    void add(Device& device) {
+      if (device.kind == Kind::OUTDOOR) {
+        device.count = 2 * (device.random.next() % (averageWindow / 2));
+        device.loopCount = device.random.next() % 1000;
+        queue.push({device.random.next() % 2000, &device});
+      } else {
+        const uint64_t offset = device.random.next() % 5000;
+        device.nextUpload = offset + (device.random.next() % 2) * 5000;
+        queue.push({offset, &device});
+      }
+    }
+
+    void run(uint64_t endNs) {
+      while (!stopping && monotonicNs() < endNs) {
+        const uint64_t now = virtualMs();
+        const Due due = queue.top();
+        if (due.at > now) {
+          const double waitMs = std::min((due.at - now) / options.speed, 50.0);
+          usleep(static_cast<useconds_t>(waitMs * 1000) + 1);
+          continue;
+        }
+        queue.pop();
+        const uint64_t lag = now - due.at;
+        if (lag > stats.maxLagMs.load(std::memory_order_relaxed)) {
+          stats.maxLagMs.store(lag, std::memory_order_relaxed);
+        }
+        queue.push({step(*due.device, due.at), due.device});
+      }
+    }
+};
+
+/**
+ * Answers GET /<id>/metrics for the whole fleet, one request per
+ * connection. It only exists to put scrape traffic on a collector, so it is
+ * deliberately simple.
+ */
+static void serveMetrics(int port) {
+  std::unordered_map<std::string, Device*> byId;
+  for (auto& device : fleet) {
+    byId[device->id] = device.get();
+  }
+  int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 256) != 0) {
+    perror("metrics");
+    return;
+  }
+  timeval timeout = {0, 200000};
+  setsockopt(listener, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  while (!stopping) {
+    int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    timeval clientTimeout = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &clientTimeout, sizeof(clientTimeout));
+    char request[2048];
+    size_t length = 0;
+    while (length < sizeof(request) - 1) {
+      ssize_t received = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+      if (received <= 0) {
+        break;
+      }
+      length += received;
+      request[length] = '\0';
+      if (strstr(request, "\r\n\r\n")) {
+        break;
+      }
+    }
+    request[length] = '\0';
+
+    char id[32] = "";
+    const bool cbor = strcasestr(request, "accept: application/cbor") != nullptr;
+    std::string response;
+    auto found = sscanf(request, "GET /%31[^/]/metrics ", id) == 1 ? byId.find(id) : byId.end();
+    if (found == byId.end()) {
+      response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    } else {
+      Device& device = *found->second;
+      std::string body;
+      std::lock_guard<std::mutex> guard(device.lock);
+      if (cbor) {
+        uint8_t buffer[cborMetricsSize];
+        CborWriter writer(buffer, sizeof(buffer));
+        JsonPayload metrics(writer);
+        device.addMetrics(metrics);
+        metrics.finish();
+        body.assign(reinterpret_cast<const char*>(buffer), writer.ok() ? writer.size() : 0);
+      } else {
+        JsonPayload metrics;
+        device.addMetrics(metrics);
+        body = metrics.finish().c_str();
+      }
+      char head[160];
+      snprintf(
+        head, sizeof(head),
+        "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nVary: Accept\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        cbor ? "application/cbor" : "application/json", body.size()
+      );
+      response = head + body;
+    }
+    send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+    close(fd);
+  }
+  close(listener);
+}
+
+static void stop(int) {
+  stopping = 1;
+}
+
+static void usage(const char* name) {
+  fprintf(
+    stderr,
+    "usage: %s --url http://host:port/ [--devices N] [--mix pro,basic,outdoor] [--threads N]\n"
+    "          [--speed X] [--seconds N] [--report N] [--heartbeat minutes] [--cbor]\n"
+    "          [--keep-alive] [--metrics-port N] [--seed N]\n",
+    name
+  );
+  exit(2);
+}
+
+static void parseOptions(int argc, char** argv) {
+  bool haveUrl = false;
+  for (int i = 1; i < argc; i++) {
+    const std::string option = argv[i];
+    if (option == "--cbor") {
+      options.cbor = true;
+      continue;
+    }
+    if (option == "--keep-alive") {
+      options.keepAlive = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+    }
+    const char* value = argv[++i];
+    if (option == "--url") {
+      if (!options.endpoint.parse(value)) {
+        fprintf(stderr, "can't use %s\n", value);
+        exit(2);
+      }
+      haveUrl = true;
+    } else if (option == "--devices") {
+      options.devices = atoi(value);
+    } else if (option == "--mix") {
+      if (sscanf(value, "%d,%d,%d", &options.mix[0], &options.mix[1], &options.mix[2]) != 3) {
+        usage(argv[0]);
+      }
+    } else if (option == "--threads") {
+      options.threads = std::max(1, atoi(value));
+    } else if (option == "--speed") {
+      options.speed = atof(value);
+    } else if (option == "--seconds") {
+      options.seconds = atoi(value);
+    } else if (option == "--report") {
+      options.reportSeconds = std::max(1, atoi(value));
+    } else if (option == "--heartbeat") {
+      options.settings.reportHeartbeat = atoi(value);
+    } else if (option == "--metrics-port") {
+      options.metricsPort = atoi(value);
+    } else if (option == "--seed") {
+      options.seed = strtoull(value, nullptr, 10);
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (!haveUrl || options.devices == 0 || options.speed <= 0 || options.mix[0] + options.mix[1] + options.mix[2] <= 0 ||
+      options.settings.reportHeartbeat > 24 * 60) {
+    usage(argv[0]);
+  }
+}
+
+static uint32_t percentile(std::vector<uint32_t>& sorted, double fraction) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))];
+}
+
+int main(int argc, char** argv) {
+  parseOptions(argc, argv);
+
+  struct sigaction action = {};
+  action.sa_handler = stop;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  // the fleet in --mix proportions, interleaved so every worker gets a share
+  const int total = options.mix[0] + options.mix[1] + options.mix[2];
+  double scheduled = 0;
+  int kinds[3] = {0, 0, 0};
+  for (uint32_t i = 0; i < options.devices; i++) {
+    const int slot = (i * 37) % total;
+    const Kind kind = slot < options.mix[0] ? Kind::PRO : slot < options.mix[0] + options.mix[1] ? Kind::BASIC : Kind::OUTDOOR;
+    fleet.emplace_back(new Device(kind, i, options.seed));
+    ++kinds[static_cast<int>(kind)];
+    // samples per virtual second, each an upload unless suppressed
+    scheduled += kind == Kind::OUTDOOR ? 1.0 / 40 : 1.0 / 10;
+  }
+  scheduled *= options.speed;
+
+  std::vector<WorkerStats> stats(options.threads);
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (int i = 0; i < options.threads; i++) {
+    workers.emplace_back(new Worker(stats[i]));
+  }
+  for (uint32_t i = 0; i < fleet.size(); i++) {
+    workers[i % options.threads]->add(*fleet[i]);
+  }
+
+  time_t wall = time(nullptr);
+  tm local;
+  localtime_r(&wall, &local);
+  startHours = local.tm_hour + local.tm_min / 60.0;
+  startNs = monotonicNs();
+  const uint64_t endNs = startNs + options.seconds * 1000000000ULL;
+
+  printf(
+    "%u devices (%d pro, %d basic, %d outdoor) on %d workers at %gx, %.1f samples/s scheduled, heartbeat %u min\n",
+    options.devices, kinds[0], kinds[1], kinds[2], options.threads, options.speed, scheduled,
+    options.settings.reportHeartbeat
+  );
+  fflush(stdout);
+
+  std::vector<std::thread> running;
+  for (auto& worker : workers) {
+    running.emplace_back([&worker, endNs] { worker->run(endNs); });
+  }
+  std::thread metrics;
+  if (options.metricsPort > 0) {
+    metrics = std::thread(serveMetrics, options.metricsPort);
+  }
+
+  uint64_t lastReport = startNs;
+  uint64_t uploads = 0;
+  uint64_t suppressed = 0;
+  uint64_t failed = 0;
+  uint64_t rejected = 0;
+  uint64_t bytes = 0;
+  std::vector<uint32_t> latencies;
+  auto report = [&](uint64_t now) {
+    uint64_t intervalUploads = 0;
+    uint64_t intervalSuppressed = 0;
+    uint64_t intervalFailed = 0;
+    uint64_t intervalRejected = 0;
+    uint64_t intervalBytes = 0;
+    uint64_t lag = 0;
+    latencies.clear();
+    for (WorkerStats& worker : stats) {
+      intervalUploads += worker.uploads.exchange(0);
+      intervalSuppressed += worker.suppressed.exchange(0);
+      intervalFailed += worker.failed.exchange(0);
+      intervalRejected += worker.rejected.exchange(0);
+      intervalBytes += worker.bytesOut.exchange(0);
+      lag = std::max<uint64_t>(lag, worker.maxLagMs.exchange(0));
+      std::lock_guard<std::mutex> guard(worker.latencyLock);
+      latencies.insert(latencies.end(), worker.latencyUs.begin(), worker.latencyUs.end());
+      worker.latencyUs.clear();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    const double seconds = (now - lastReport) / 1e9;
+    printf(
+      "[%5.0fs] %.1f uploads/s, %.1f suppressed/s of %.1f, %.1f KB/s, %llu failed, %llu rejected, lag %.1fs, latency p50 %.2fms p99 %.2fms max %.2fms\n",
+      (now - startNs) / 1e9, intervalUploads / seconds, intervalSuppressed / seconds, scheduled, intervalBytes / seconds / 1e3,
+      static_cast<unsigned long long>(intervalFailed), static_cast<unsigned long long>(intervalRejected),
+      lag / 1000.0,
+      percentile(latencies, 0.5) / 1e3, percentile(latencies, 0.99) / 1e3, percentile(latencies, 1.0) / 1e3
+    );
+    fflush(stdout);
+    uploads += intervalUploads;
+    suppressed += intervalSuppressed;
+    failed += intervalFailed;
+    rejected += intervalRejected;
+    bytes += intervalBytes;
+    lastReport = now;
+  };
+
+  while (!stopping && monotonicNs() < endNs) {
+    usleep(100000);
+    const uint64_t now = monotonicNs();
+    if (now - lastReport >= options.reportSeconds * 1000000000ULL) {
+      report(now);
+    }
+  }
+  for (std::thread& thread : running) {
+    thread.join();
+  }
+  stopping = 1;
+  if (metrics.joinable()) {
+    metrics.join();
+  }
+  if (monotonicNs() - lastReport > 500000000ULL) {
+    report(monotonicNs());
+  }
+
+  const double elapsed = (monotonicNs() - startNs) / 1e9;
+  printf(
+    "total %llu uploads and %llu suppressed in %.1fs, %.1f/s of %.1f scheduled, %.1f KB/s, %llu failed, %llu rejected\n",
+    static_cast<unsigned long long>(uploads), static_cast<unsigned long long>(suppressed), elapsed,
+    uploads / elapsed, scheduled, bytes / elapsed / 1e3,
+    static_cast<unsigned long long>(failed), static_cast<unsigned long long>(rejected)
+  );
+  return failed + rejected > 0 ? 1 : 0;
+}
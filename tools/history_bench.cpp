@@ -0,0 +1,217 @@
+/*
+  history_bench.cpp - runs the /history record ring on the host, over a file
+  mapped with mmap() in place of the flash region, and reports append and
+  streaming throughput.
+
+  g++ -O2 -std=c++17 -Ilib/AirGradientCore tools/history_bench.cpp -o history_bench
+  ./history_bench [file] [megabytes]
+
+  The file defaults to history.bin in the current directory and 1408 KB, the
+  size of the outdoor "history" partition. Streaming copies each chunk into a
+  socket sized buffer, so the numbers are an upper bound for what the device
+  can hand to its TCP stack, not the rate a client will see over WiFi.
+*/
+
+#include <RecordRing.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+class MmapRegion
+{
+  uint8_t* data = nullptr;
+  size_t length = 0;
+
+  public:
+    static constexpr size_t sectorSize = 4096;
+    // a copied region, to time the ESP8266 path
+    bool copyReads = false;
+
+    bool begin(const char* path, size_t size) {
+      int fd = open(path, O_RDWR | O_CREAT, 0644);
+      if (fd < 0 || ftruncate(fd, size) != 0) {
+        return false;
+      }
+      void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+      if (mapped == MAP_FAILED) {
+        return false;
+      }
+      data = static_cast<uint8_t*>(mapped);
+      length = size;
+      return true;
+    }
+
+    void end() {
+      munmap(data, length);
+    }
+
+    // a freshly erased chip
+    void wipe() {
+      memset(data, 0xFF, length);
+    }
+
+    size_t size() const {
+      return length;
+    }
+
+    const uint8_t* map() const {
+      return copyReads ? nullptr : data;
+    }
+
+    bool read(size_t offset, void* out, size_t size) const {
+      memcpy(out, data + offset, size);
+      return true;
+    }
+
+    // like NOR flash, writing can only clear bits
+    bool write(size_t offset, const void* in, size_t size) {
+      const uint8_t* bytes = static_cast<const uint8_t*>(in);
+      for (size_t i = 0; i < size; i++) {
+        data[offset + i] &= bytes[i];
+      }
+      return true;
+    }
+
+    bool eraseSector(size_t offset) {
+      memset(data + offset, 0xFF, sectorSize);
+      return true;
+    }
+};
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static int failures = 0;
+
+static void expect(bool condition, const char* what) {
+  if (!condition) {
+    printf("FAIL %s\n", what);
+    ++failures;
+  }
+}
+
+static void checkRange(const char* header, size_t total, bool ok, size_t first, size_t last) {
+  size_t gotFirst = 0;
+  size_t gotLast = 0;
+  bool got = parseByteRange(header, total, gotFirst, gotLast);
+  if (got != ok || (ok && (gotFirst != first || gotLast != last))) {
+    printf("FAIL range \"%s\" of %zu\n", header, total);
+    ++failures;
+  }
+}
+
+// streams [offset, offset + size) rounds times, in MB/s
+static double streamRate(const RecordRing<MmapRegion>& ring, size_t offset, size_t size, int rounds) {
+  static uint8_t scratch[512];
+  static uint8_t socket[1460];
+  uint64_t checksum = 0;
+  auto start = Clock::now();
+  for (int round = 0; round < rounds; round++) {
+    ring.stream(offset, size, scratch, sizeof(scratch), [&](const uint8_t* data, size_t piece) {
+      memcpy(socket, data, piece);
+      checksum += socket[0];
+      return true;
+    });
+  }
+  double elapsed = seconds(start);
+  // keep the copy from being optimised away
+  if (checksum == 1) {
+    printf(" ");
+  }
+  return size * static_cast<double>(rounds) / elapsed / 1e6;
+}
+
+int main(int argc, char** argv) {
+  const char* path = argc > 1 ? argv[1] : "history.bin";
+  const size_t size = argc > 2 ? atoi(argv[2]) * 1024 * 1024 : 0x160000;
+
+  MmapRegion region;
+  if (!region.begin(path, size)) {
+    perror(path);
+    return 1;
+  }
+  region.wipe();
+
+  RecordRing<MmapRegion> ring(region);
+  expect(ring.begin() && ring.count() == 0, "empty region");
+
+  // two and a half times round the ring, one record every 5 seconds
+  const size_t slots = size / sizeof(SampleRecord);
+  const size_t appends = slots * 5 / 2;
+  SampleRecord record;
+  memset(&record, 0, sizeof(record));
+  auto start = Clock::now();
+  for (size_t i = 0; i < appends; i++) {
+    record.time = i * 5;
+    record.values[0] = i & 0xFFFF;
+    expect(ring.append(record), "append");
+  }
+  double elapsed = seconds(start);
+  printf("append: %zu records in %.1f ms, %.0f ns each\n", appends, elapsed * 1e3, elapsed * 1e9 / appends);
+
+  // a full ring keeps all but the sector being refilled
+  const size_t count = ring.count();
+  expect(count > slots - MmapRegion::sectorSize / sizeof(SampleRecord), "ring holds most of the region");
+  SampleRecord oldest;
+  SampleRecord newest;
+  ring.recordAt(0, oldest);
+  ring.recordAt(count - 1, newest);
+  expect(newest.sequence == appends - 1, "newest sequence");
+  expect(newest.sequence - oldest.sequence == count - 1, "records are consecutive");
+
+  // what setupHistory() sees after a reboot
+  RecordRing<MmapRegion> rebooted(region);
+  start = Clock::now();
+  rebooted.begin();
+  printf("begin: %zu records found in %.1f us\n", rebooted.count(), seconds(start) * 1e6);
+  expect(rebooted.count() == count && rebooted.lastTime() == newest.time, "rescan after reboot");
+
+  size_t index = ring.lowerBoundTime(newest.time - 3600);
+  expect(index == count - 721, "since an hour ago");
+  index = ring.upperBoundSequence(newest.sequence - 10);
+  expect(index == count - 10, "after a sequence");
+
+  int rounds = 200;
+  printf("stream, mapped: %.0f MB/s\n", streamRate(ring, 0, ring.size(), rounds));
+  printf("stream, last hour: %.0f MB/s\n", streamRate(ring, (count - 720) * sizeof(SampleRecord), 720 * sizeof(SampleRecord), rounds * 100));
+  region.copyReads = true;
+  printf("stream, copied: %.0f MB/s\n", streamRate(ring, 0, ring.size(), rounds));
+  region.copyReads = false;
+
+  // a streamed range crossing the end of the region comes out in order
+  uint32_t expected = oldest.sequence;
+  bool ordered = true;
+  static uint8_t scratch[512];
+  ring.stream(0, ring.size(), scratch, sizeof(scratch), [&](const uint8_t* data, size_t piece) {
+    for (size_t at = 0; at + sizeof(SampleRecord) <= piece; at += sizeof(SampleRecord)) {
+      SampleRecord r;
+      memcpy(&r, data + at, sizeof(r));
+      ordered = ordered && r.sequence == expected++;
+    }
+    return true;
+  });
+  expect(ordered && expected == appends, "stream order across the wrap");
+
+  checkRange("bytes=0-99", 1000, true, 0, 99);
+  checkRange("bytes=900-", 1000, true, 900, 999);
+  checkRange("bytes=-100", 1000, true, 900, 999);
+  checkRange("bytes=-5000", 1000, true, 0, 999);
+  checkRange("bytes=500-5000", 1000, true, 500, 999);
+  checkRange("bytes=1000-", 1000, false, 0, 0);
+  checkRange("bytes=5-4", 1000, false, 0, 0);
+  checkRange("bytes=0-1,5-6", 1000, false, 0, 0);
+  checkRange("bytes=-0", 1000, false, 0, 0);
+  checkRange("items=0-1", 1000, false, 0, 0);
+  checkRange("bytes=0-", 0, false, 0, 0);
+
+  region.end();
+  printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+  return failures ? 1 : 0;
+}
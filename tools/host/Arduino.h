@@ -0,0 +1,110 @@
+/*
+  Arduino.h - the few Arduino core pieces the header-only parts of
+  lib/AirGradientCore use, so host tools can build the same payloads as the
+  firmware. Put tools/host ahead of lib/AirGradientCore on the include path.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+// flash strings are ordinary strings off the ESP8266
+class __FlashStringHelper;
+#define F(literal) (reinterpret_cast<const __FlashStringHelper*>(literal))
+#define PROGMEM
+typedef const char* PGM_P;
+#define pgm_read_byte(p) (*reinterpret_cast<const uint8_t*>(p))
+#define pgm_read_word(p) (*reinterpret_cast<const uint16_t*>(p))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncpy_P strncpy
+#define memcpy_P memcpy
+#define PSTR(literal) (literal)
+
+typedef bool boolean;
+
+// defined by each tool, so code timed with them can run on a virtual clock
+uint32_t millis();
+void delay(uint32_t ms);
+// [0, max), defined by each tool that builds code using it
+long random(long max);
+
+inline uint16_t makeWord(uint8_t high, uint8_t low) {
+  return (high << 8) | low;
+}
+
+template <typename T, typename L, typename H>
+constexpr T constrain(T value, L low, H high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+// Arduino's String, backed by std::string.
+class String
+{
+  std::string text;
+
+  public:
+    String() = default;
+    String(const char* value) : text(value ? value : "") {}
+    String(const __FlashStringHelper* value) : text(reinterpret_cast<const char*>(value)) {}
+    explicit String(int value) : text(std::to_string(value)) {}
+    explicit String(long value) : text(std::to_string(value)) {}
+    explicit String(unsigned int value) : text(std::to_string(value)) {}
+    explicit String(unsigned long value) : text(std::to_string(value)) {}
+
+    void reserve(size_t size) {
+      text.reserve(size);
+    }
+
+    const char* c_str() const {
+      return text.c_str();
+    }
+
+    size_t length() const {
+      return text.size();
+    }
+
+    String& operator+=(const String& other) {
+      text += other.text;
+      return *this;
+    }
+
+    String& operator+=(const char* other) {
+      text += other;
+      return *this;
+    }
+
+    String& operator+=(const __FlashStringHelper* other) {
+      text += reinterpret_cast<const char*>(other);
+      return *this;
+    }
+
+    String& operator+=(char c) {
+      text += c;
+      return *this;
+    }
+
+    bool operator==(const String& other) const {
+      return text == other.text;
+    }
+
+    friend String operator+(String left, const String& right) {
+      return left += right;
+    }
+
+    friend String operator+(String left, const __FlashStringHelper* right) {
+      return left += right;
+    }
+
+    friend String operator+(String left, char right) {
+      return left += right;
+    }
+};
+
+#endif
@@ -0,0 +1,35 @@
+/*
+  Check.h - the assertion the host tests under tools/ share. A failed check
+  prints its line and the test carries on, main() returns checkFailures() so
+  a failure shows in the exit code.
+*/
+
+#ifndef Check_h
+#define Check_h
+
+#include <stdio.h>
+
+inline int& checkFailures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      ++checkFailures(); \
+    } \
+  } while (0)
+
+// "ok" or the number of failures, for the end of main()
+inline int checkResult(const char* name) {
+  if (checkFailures() == 0) {
+    printf("%s: ok\n", name);
+  } else {
+    printf("%s: %d failed\n", name, checkFailures());
+  }
+  return checkFailures() == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,29 @@
+/*
+  Print.h - the byte writing half of Arduino's Stream, for host tools.
+*/
+
+#ifndef Print_h
+#define Print_h
+
+#include <Arduino.h>
+
+class Print
+{
+  public:
+    virtual ~Print() = default;
+
+    virtual size_t write(uint8_t byte) = 0;
+
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      size_t written = 0;
+      while (size-- > 0) {
+        written += write(*buffer++);
+      }
+      return written;
+    }
+
+    virtual void flush() {
+    }
+};
+
+#endif
@@ -0,0 +1,22 @@
+/*
+  Stream.h - Arduino's Stream as the sensor drivers in lib/AirGradient use
+  it, so host tools can feed them captured or made up serial traffic.
+*/
+
+#ifndef Stream_h
+#define Stream_h
+
+#include <Print.h>
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+
+    virtual int peek() {
+      return -1;
+    }
+};
+
+#endif
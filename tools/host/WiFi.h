@@ -0,0 +1,27 @@
+/*
+  WiFi.h - the WiFi calls made by lib/AirGradientCore, declared only. A host
+  tool that builds code using them defines them over its own simulated link.
+*/
+
+#ifndef WiFi_h
+#define WiFi_h
+
+#include <Arduino.h>
+
+#define WL_CONNECTED 3
+
+enum WiFiMode_t { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA };
+enum wifi_ps_type_t { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM };
+
+class WiFiClass
+{
+  public:
+    int status();
+    int8_t RSSI();
+    WiFiMode_t getMode();
+    bool setSleep(wifi_ps_type_t type);
+};
+
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,25 @@
+/*
+  WiFiClient.h - the TCP client calls made by lib/AirGradientCore, declared
+  only. A host tool that builds code using them defines them over its own
+  simulated connection.
+*/
+
+#ifndef WiFiClient_h
+#define WiFiClient_h
+
+#include <Arduino.h>
+
+class WiFiClient
+{
+  public:
+    int connect(const char* host, uint16_t port);
+    void setTimeout(unsigned long timeoutMs);
+    void setNoDelay(bool noDelay);
+    size_t write(const uint8_t* buffer, size_t size);
+    int available();
+    int read();
+    uint8_t connected();
+    void stop();
+};
+
+#endif
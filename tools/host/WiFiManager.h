@@ -0,0 +1,25 @@
+/*
+  WiFiManager.h - just enough of WiFiManager for AirPortal.h to compile in
+  host tools that build code including it. Nothing here is defined.
+*/
+
+#ifndef WiFiManager_h
+#define WiFiManager_h
+
+#include <Arduino.h>
+
+class WiFiManagerParameter
+{
+  protected:
+    const char* _id = nullptr;
+
+  public:
+    explicit WiFiManagerParameter(const char* custom);
+    void setValue(const char* value, int length);
+};
+
+class WiFiManager
+{
+};
+
+#endif
@@ -0,0 +1,8 @@
+/*
+  Wire.h - lib/AirGradient includes it, the host tools don't use I2C.
+*/
+
+#ifndef Wire_h
+#define Wire_h
+
+#endif
@@ -0,0 +1,1319 @@
+/*
+  ingest_server.cpp - a self-hosted endpoint for device uploads.
+
+  g++ -O2 -std=c++17 -pthread tools/ingest_server.cpp -o ingest_server
+  ./ingest_server [--port 8080] [--threads N] [--ring 128] [--report 10]
+
+  Takes POST /sensors/airgradient:<id>/measures with the JSON or CBOR bodies
+  built by uploadPayload() and keeps the last --ring samples of each device
+  in memory. Build the devices with -D 'AG_API_ROOT="http://<host>:8080/"'
+  to send to it instead of hw.airgradient.com.
+
+  Each worker thread runs its own epoll loop on its own SO_REUSEPORT
+  listening socket, so the kernel spreads connections over the workers and
+  they share nothing but the device table. Bodies are parsed in place; the
+  only allocations are one per connection and one ring per new device.
+
+  Every --report seconds it prints requests and bytes per second and latency
+  percentiles, measured from the first byte of a request to its response
+  being handed to the socket. GET /stats returns the totals as JSON and
+  GET /sensors/airgradient:<id>/measures?n=<count> a device's latest samples.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// a whole request, headers and body, must fit; device uploads are under 512
+static constexpr size_t inputSize = 4096;
+static constexpr size_t maxIdLength = 32;
+static constexpr int idleSeconds = 60;
+
+static volatile std::sig_atomic_t stopping = 0;
+
+static uint64_t monotonicNs() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int64_t wallMs() {
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// The fields devices upload, stored as thousandths like the device's Fixed.
+static const char* const fieldNames[] = {
+  "wifi", "rco2", "pm01", "pm02", "pm10", "pm003_count",
+  "tvoc_index", "nox_index", "atmp", "rhum", "boot"
+};
+static constexpr size_t fieldCount = sizeof(fieldNames) / sizeof(fieldNames[0]);
+
+static int fieldIndex(std::string_view name) {
+  for (size_t i = 0; i < fieldCount; i++) {
+    if (name == fieldNames[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+struct Sample
+{
+  int64_t receivedMs;
+  // a bit per field that was in the upload
+  uint32_t present;
+  int32_t values[fieldCount];
+
+  void set(int field, int32_t value) {
+    if (field >= 0) {
+      values[field] = value;
+      present |= 1u << field;
+    }
+  }
+};
+
+/**
+ * "-12.345" to thousandths, digits past the third decimal truncated. Values
+ * outside +-2147483.647 don't fit and are rejected.
+ */
+static bool parseThousandths(std::string_view text, int32_t& out) {
+  size_t i = 0;
+  bool negative = false;
+  if (i < text.size() && (text[i] == '-' || text[i] == '+')) {
+    negative = text[i++] == '-';
+  }
+  int64_t value = 0;
+  size_t digits = 0;
+  for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; i++, digits++) {
+    value = value * 10 + (text[i] - '0');
+    if (value > INT32_MAX / 1000) {
+      return false;
+    }
+  }
+  value *= 1000;
+  if (i < text.size() && text[i] == '.') {
+    int64_t scale = 100;
+    for (++i; i < text.size() && text[i] >= '0' && text[i] <= '9'; i++, digits++) {
+      value += (text[i] - '0') * scale;
+      scale /= 10;
+    }
+  }
+  if (digits == 0 || i != text.size() || value > INT32_MAX) {
+    return false;
+  }
+  out = negative ? -value : value;
+  return true;
+}
+
+// mantissa * 10^exponent in thousandths, for CBOR decimal fractions
+static bool scaleThousandths(int64_t mantissa, int64_t exponent, int32_t& out) {
+  exponent += 3;
+  for (; exponent > 0; exponent--) {
+    if (mantissa > INT32_MAX || mantissa < -INT32_MAX) {
+      return false;
+    }
+    mantissa *= 10;
+  }
+  for (; exponent < 0 && mantissa != 0; exponent++) {
+    mantissa /= 10;
+  }
+  if (mantissa > INT32_MAX || mantissa < -INT32_MAX) {
+    return false;
+  }
+  out = mantissa;
+  return true;
+}
+
+/**
+ * Reads the flat JSON object JsonPayload writes. Numbers may be quoted or
+ * not, unknown fields and nested values like "channels" are skipped.
+ */
+class JsonReader
+{
+  const char* p;
+  const char* end;
+
+  void space() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+      ++p;
+    }
+  }
+
+  bool string(std::string_view& out) {
+    if (p == end || *p != '"') {
+      return false;
+    }
+    const char* start = ++p;
+    while (p < end && *p != '"') {
+      p += *p == '\\' ? 2 : 1;
+    }
+    if (p >= end) {
+      return false;
+    }
+    out = std::string_view(start, p - start);
+    ++p;
+    return true;
+  }
+
+  // objects, arrays and literals, only checking brackets balance
+  bool skip() {
+    if (p < end && (*p == '{' || *p == '[')) {
+      int depth = 0;
+      while (p < end) {
+        if (*p == '"') {
+          std::string_view ignored;
+          if (!string(ignored)) {
+            return false;
+          }
+          continue;
+        }
+        if (*p == '{' || *p == '[') {
+          ++depth;
+        } else if ((*p == '}' || *p == ']') && --depth == 0) {
+          ++p;
+          return true;
+        }
+        ++p;
+      }
+      return false;
+    }
+    const char* start = p;
+    while (p < end && *p >= 'a' && *p <= 'z') {
+      ++p;
+    }
+    return p > start;
+  }
+
+  public:
+    JsonReader(const char* data, size_t size) : p(data), end(data + size) {}
+
+    bool read(Sample& sample) {
+      space();
+      if (p == end || *p != '{') {
+        return false;
+      }
+      ++p;
+      space();
+      if (p < end && *p == '}') {
+        ++p;
+        space();
+        return p == end;
+      }
+      while (true) {
+        std::string_view key;
+        if (!string(key)) {
+          return false;
+        }
+        space();
+        if (p == end || *p != ':') {
+          return false;
+        }
+        ++p;
+        space();
+        const int field = fieldIndex(key);
+        int32_t value;
+        if (p < end && *p == '"') {
+          std::string_view text;
+          if (!string(text)) {
+            return false;
+          }
+          if (parseThousandths(text, value)) {
+            sample.set(field, value);
+          }
+        } else if (p < end && (*p == '-' || (*p >= '0' && *p <= '9'))) {
+          const char* start = p;
+          while (p < end && (*p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E' || (*p >= '0' && *p <= '9'))) {
+            ++p;
+          }
+          if (parseThousandths(std::string_view(start, p - start), value)) {
+            sample.set(field, value);
+          }
+        } else if (!skip()) {
+          return false;
+        }
+        space();
+        if (p < end && *p == ',') {
+          ++p;
+          space();
+          continue;
+        }
+        if (p < end && *p == '}') {
+          ++p;
+          space();
+          return p == end;
+        }
+        return false;
+      }
+    }
+};
+
+/**
+ * Reads the CBOR map CborWriter produces: text keys, integers, decimal
+ * fractions (tag 4), booleans and tagged embedded JSON, which is skipped.
+ */
+class CborReader
+{
+  static constexpr uint8_t indefinite = 31;
+  static constexpr int maxDepth = 16;
+
+  const uint8_t* p;
+  const uint8_t* end;
+
+  bool head(uint8_t& major, uint8_t& info, uint64_t& argument) {
+    if (p == end) {
+      return false;
+    }
+    major = *p >> 5;
+    info = *p & 0x1F;
+    ++p;
+    if (info < 24 || info == indefinite) {
+      argument = info;
+      return true;
+    }
+    if (info > 27) {
+      return false;
+    }
+    const size_t size = 1u << (info - 24);
+    if (static_cast<size_t>(end - p) < size) {
+      return false;
+    }
+    argument = 0;
+    for (size_t i = 0; i < size; i++) {
+      argument = argument << 8 | *p++;
+    }
+    return true;
+  }
+
+  bool bytes(uint64_t size) {
+    if (static_cast<uint64_t>(end - p) < size) {
+      return false;
+    }
+    p += size;
+    return true;
+  }
+
+  bool isBreak() {
+    if (p < end && *p == 0xFF) {
+      ++p;
+      return true;
+    }
+    return false;
+  }
+
+  bool integer(int64_t& out) {
+    uint8_t major, info;
+    uint64_t argument;
+    if (!head(major, info, argument) || major > 1 || info == indefinite || argument > INT64_MAX) {
+      return false;
+    }
+    out = major == 0 ? static_cast<int64_t>(argument) : -1 - static_cast<int64_t>(argument);
+    return true;
+  }
+
+  // one complete item, with numeric set when it converted to thousandths
+  bool item(int depth, int32_t& value, bool& numeric) {
+    numeric = false;
+    uint8_t major, info;
+    uint64_t argument;
+    if (depth > maxDepth || !head(major, info, argument)) {
+      return false;
+    }
+    if (info == indefinite && (major < 2 || major == 6)) {
+      return false;
+    }
+    switch (major) {
+      case 0:
+      case 1: {
+        if (argument > INT32_MAX / 1000) {
+          return true;
+        }
+        const int64_t whole = major == 0 ? static_cast<int64_t>(argument) : -1 - static_cast<int64_t>(argument);
+        value = whole * 1000;
+        numeric = true;
+        return true;
+      }
+      case 2:
+      case 3: {
+        if (info == indefinite) {
+          while (!isBreak()) {
+            int32_t ignored;
+            bool chunkNumeric;
+            if (!item(depth + 1, ignored, chunkNumeric)) {
+              return false;
+            }
+          }
+          return true;
+        }
+        const char* text = reinterpret_cast<const char*>(p);
+        if (!bytes(argument)) {
+          return false;
+        }
+        numeric = major == 3 && parseThousandths(std::string_view(text, argument), value);
+        return true;
+      }
+      case 4:
+      case 5: {
+        const uint64_t items = major == 5 ? argument * 2 : argument;
+        for (uint64_t i = 0; info == indefinite ? !isBreak() : i < items; i++) {
+          int32_t ignored;
+          bool itemNumeric;
+          if (!item(depth + 1, ignored, itemNumeric)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case 6: {
+        if (argument == 4) {
+          // decimal fraction [exponent, mantissa]
+          uint8_t arrayMajor, arrayInfo;
+          uint64_t length;
+          int64_t exponent, mantissa;
+          if (!head(arrayMajor, arrayInfo, length) || arrayMajor != 4 || length != 2 || arrayInfo == indefinite) {
+            return false;
+          }
+          if (!integer(exponent) || !integer(mantissa)) {
+            return false;
+          }
+          numeric = exponent > -20 && exponent < 20 && scaleThousandths(mantissa, exponent, value);
+          return true;
+        }
+        int32_t ignored;
+        bool taggedNumeric;
+        return item(depth + 1, ignored, taggedNumeric);
+      }
+      default:
+        if (info == 20 || info == 21) {
+          value = info == 21 ? 1000 : 0;
+          numeric = true;
+          return true;
+        }
+        if (info == indefinite) {
+          // a break outside an indefinite item
+          return false;
+        }
+        // simple values and floats, already consumed by head()
+        return true;
+    }
+  }
+
+  public:
+    CborReader(const char* data, size_t size)
+      : p(reinterpret_cast<const uint8_t*>(data)),
+        end(reinterpret_cast<const uint8_t*>(data) + size)
+    {}
+
+    bool read(Sample& sample) {
+      uint8_t major, info;
+      uint64_t pairs;
+      if (!head(major, info, pairs) || major != 5) {
+        return false;
+      }
+      for (uint64_t i = 0; info == indefinite ? !isBreak() : i < pairs; i++) {
+        uint8_t keyMajor, keyInfo;
+        uint64_t keyLength;
+        if (!head(keyMajor, keyInfo, keyLength) || keyMajor != 3 || keyInfo == indefinite) {
+          return false;
+        }
+        const char* key = reinterpret_cast<const char*>(p);
+        if (!bytes(keyLength)) {
+          return false;
+        }
+        int32_t value;
+        bool numeric;
+        if (!item(0, value, numeric)) {
+          return false;
+        }
+        if (numeric) {
+          sample.set(fieldIndex(std::string_view(key, keyLength)), value);
+        }
+      }
+      return p == end;
+    }
+};
+
+struct Device
+{
+  char id[maxIdLength + 1];
+  size_t idLength;
+  std::mutex lock;
+  // samples ever stored, the newest is at (stored - 1) % ring size
+  uint64_t stored = 0;
+  std::unique_ptr<Sample[]> ring;
+};
+
+/**
+ * Devices by id, in shards so workers rarely wait on each other. Each shard
+ * is an open addressed table of pointers; devices are never removed, so a
+ * Device stays put once found and only its own lock is needed to store.
+ */
+class DeviceTable
+{
+  static constexpr size_t shardCount = 64;
+
+  struct Shard
+  {
+    std::mutex lock;
+    std::vector<Device*> slots = std::vector<Device*>(16);
+    size_t used = 0;
+  };
+
+  Shard shards[shardCount];
+  const size_t ringSize;
+  std::atomic<size_t> count{0};
+
+  static uint64_t hash(std::string_view id) {
+    uint64_t h = 14695981039346656037ULL;
+    for (char c : id) {
+      h = (h ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+    }
+    return h;
+  }
+
+  static Device*& probe(Shard& shard, std::string_view id, uint64_t h) {
+    const size_t mask = shard.slots.size() - 1;
+    for (size_t i = (h / shardCount) & mask;; i = (i + 1) & mask) {
+      Device*& slot = shard.slots[i];
+      if (slot == nullptr || std::string_view(slot->id, slot->idLength) == id) {
+        return slot;
+      }
+    }
+  }
+
+  static void grow(Shard& shard) {
+    std::vector<Device*> old(shard.slots.size() * 2);
+    old.swap(shard.slots);
+    for (Device* device : old) {
+      if (device != nullptr) {
+        std::string_view id(device->id, device->idLength);
+        probe(shard, id, hash(id)) = device;
+      }
+    }
+  }
+
+  public:
+    explicit DeviceTable(size_t samplesPerDevice) : ringSize(samplesPerDevice) {}
+
+    ~DeviceTable() {
+      for (Shard& shard : shards) {
+        for (Device* device : shard.slots) {
+          delete device;
+        }
+      }
+    }
+
+    // nullptr if the device hasn't uploaded and create is false
+    Device* find(std::string_view id, bool create) {
+      const uint64_t h = hash(id);
+      Shard& shard = shards[h % shardCount];
+      std::lock_guard<std::mutex> guard(shard.lock);
+      Device** slot = &probe(shard, id, h);
+      if (*slot != nullptr || !create) {
+        return *slot;
+      }
+      // keep the table under 70% full
+      if ((shard.used + 1) * 10 > shard.slots.size() * 7) {
+        grow(shard);
+        slot = &probe(shard, id, h);
+      }
+      Device* device = new Device;
+      memcpy(device->id, id.data(), id.size());
+      device->id[id.size()] = '\0';
+      device->idLength = id.size();
+      device->ring.reset(new Sample[ringSize]);
+      *slot = device;
+      ++shard.used;
+      count.fetch_add(1, std::memory_order_relaxed);
+      return device;
+    }
+
+    void store(Device& device, const Sample& sample) {
+      std::lock_guard<std::mutex> guard(device.lock);
+      device.ring[device.stored % ringSize] = sample;
+      ++device.stored;
+    }
+
+    // copies up to max of the newest samples, oldest first
+    size_t latest(Device& device, Sample* out, size_t max) {
+      std::lock_guard<std::mutex> guard(device.lock);
+      const size_t available = std::min<uint64_t>(device.stored, ringSize);
+      const size_t n = std::min(max, available);
+      for (size_t i = 0; i < n; i++) {
+        out[i] = device.ring[(device.stored - n + i) % ringSize];
+      }
+      return n;
+    }
+
+    size_t size() const {
+      return count.load(std::memory_order_relaxed);
+    }
+
+    size_t samplesPerDevice() const {
+      return ringSize;
+    }
+};
+
+/**
+ * Latency counts in log-linear buckets, 8 per power of two of nanoseconds,
+ * so percentiles are within 12.5%.
+ */
+class LatencyHistogram
+{
+  public:
+    static constexpr int bucketCount = 62 * 8;
+
+    static int bucketFor(uint64_t ns) {
+      if (ns < 8) {
+        return ns;
+      }
+      const int msb = 63 - __builtin_clzll(ns);
+      return (msb - 2) * 8 + ((ns >> (msb - 3)) & 7);
+    }
+
+    // the largest latency that lands in bucket
+    static uint64_t upperBound(int bucket) {
+      if (bucket < 8) {
+        return bucket;
+      }
+      const int msb = bucket / 8 + 2;
+      return ((8ULL + bucket % 8 + 1) << (msb - 3)) - 1;
+    }
+
+    std::atomic<uint64_t> counts[bucketCount] = {};
+
+    void record(uint64_t ns) {
+      std::atomic<uint64_t>& count = counts[std::min(bucketFor(ns), bucketCount - 1)];
+      count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+// Written only by its worker, read by the reporter.
+struct alignas(64) WorkerStats
+{
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> samples{0};
+  std::atomic<uint64_t> rejected{0};
+  std::atomic<uint64_t> bytesIn{0};
+  std::atomic<uint64_t> connections{0};
+  LatencyHistogram latency;
+};
+
+static void bump(std::atomic<uint64_t>& counter, uint64_t by = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+struct Totals
+{
+  uint64_t requests = 0;
+  uint64_t samples = 0;
+  uint64_t rejected = 0;
+  uint64_t bytesIn = 0;
+  uint64_t connections = 0;
+  uint64_t latency[LatencyHistogram::bucketCount] = {};
+
+  void add(const WorkerStats& stats) {
+    requests += stats.requests.load(std::memory_order_relaxed);
+    samples += stats.samples.load(std::memory_order_relaxed);
+    rejected += stats.rejected.load(std::memory_order_relaxed);
+    bytesIn += stats.bytesIn.load(std::memory_order_relaxed);
+    connections += stats.connections.load(std::memory_order_relaxed);
+    for (int i = 0; i < LatencyHistogram::bucketCount; i++) {
+      latency[i] += stats.latency.counts[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  // the latency in ns that fraction of requests since previous were under
+  uint64_t percentile(const Totals& previous, double fraction) const {
+    const uint64_t total = requests - previous.requests;
+    if (total == 0) {
+      return 0;
+    }
+    const uint64_t target = static_cast<uint64_t>(fraction * total);
+    uint64_t seen = 0;
+    int last = 0;
+    for (int i = 0; i < LatencyHistogram::bucketCount; i++) {
+      const uint64_t count = latency[i] - previous.latency[i];
+      if (count == 0) {
+        continue;
+      }
+      seen += count;
+      last = i;
+      if (seen > target) {
+        return LatencyHistogram::upperBound(i);
+      }
+    }
+    return LatencyHistogram::upperBound(last);
+  }
+};
+
+struct Connection
+{
+  int fd;
+  // position in Worker::open, for removal
+  size_t slot;
+  uint64_t lastActive;
+  // when the first byte of the request being read arrived, 0 between requests
+  uint64_t started = 0;
+  char in[inputSize];
+  size_t inLength = 0;
+  std::string out;
+  size_t outSent = 0;
+  bool closeAfterWrite = false;
+  bool sentContinue = false;
+  bool writing = false;
+};
+
+struct Request
+{
+  std::string_view method;
+  std::string_view path;
+  std::string_view query;
+  std::string_view contentType;
+  std::string_view body;
+  size_t length = 0;
+  bool keepAlive = true;
+  bool expectContinue = false;
+  bool chunked = false;
+};
+
+static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool containsIgnoreCase(std::string_view haystack, std::string_view needle) {
+  for (size_t i = 0; i + needle.size() <= haystack.size(); i++) {
+    if (equalsIgnoreCase(haystack.substr(i, needle.size()), needle)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static std::string_view trim(std::string_view text) {
+  while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+enum class ParseResult
+{
+  COMPLETE,
+  INCOMPLETE,
+  BAD,
+  TOO_LARGE
+};
+
+// One request from the start of data, with views into data.
+static ParseResult parseRequest(const char* data, size_t size, Request& request) {
+  std::string_view input(data, size);
+  const size_t headerEnd = input.find("\r\n\r\n");
+  if (headerEnd == std::string_view::npos) {
+    return size == inputSize ? ParseResult::TOO_LARGE : ParseResult::INCOMPLETE;
+  }
+  std::string_view headers = input.substr(0, headerEnd + 2);
+
+  size_t lineEnd = headers.find("\r\n");
+  std::string_view line = headers.substr(0, lineEnd);
+  const size_t methodEnd = line.find(' ');
+  const size_t targetEnd = line.rfind(' ');
+  if (methodEnd == std::string_view::npos || targetEnd <= methodEnd) {
+    return ParseResult::BAD;
+  }
+  request.method = line.substr(0, methodEnd);
+  std::string_view target = line.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+  std::string_view version = line.substr(targetEnd + 1);
+  if (version.substr(0, 7) != "HTTP/1.") {
+    return ParseResult::BAD;
+  }
+  request.keepAlive = version != "HTTP/1.0";
+  const size_t question = target.find('?');
+  request.path = target.substr(0, question);
+  request.query = question == std::string_view::npos ? std::string_view() : target.substr(question + 1);
+
+  size_t contentLength = 0;
+  for (size_t start = lineEnd + 2; start < headers.size(); start = lineEnd + 2) {
+    lineEnd = headers.find("\r\n", start);
+    line = headers.substr(start, lineEnd - start);
+    const size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      return ParseResult::BAD;
+    }
+    std::string_view name = line.substr(0, colon);
+    std::string_view value = trim(line.substr(colon + 1));
+    if (equalsIgnoreCase(name, "content-length")) {
+      if (value.empty() || value.size() > 9) {
+        return ParseResult::BAD;
+      }
+      contentLength = 0;
+      for (char c : value) {
+        if (c < '0' || c > '9') {
+          return ParseResult::BAD;
+        }
+        contentLength = contentLength * 10 + (c - '0');
+      }
+    } else if (equalsIgnoreCase(name, "content-type")) {
+      request.contentType = trim(value.substr(0, value.find(';')));
+    } else if (equalsIgnoreCase(name, "connection")) {
+      if (containsIgnoreCase(value, "close")) {
+        request.keepAlive = false;
+      } else if (containsIgnoreCase(value, "keep-alive")) {
+        request.keepAlive = true;
+      }
+    } else if (equalsIgnoreCase(name, "transfer-encoding")) {
+      request.chunked = true;
+    } else if (equalsIgnoreCase(name, "expect")) {
+      request.expectContinue = equalsIgnoreCase(value, "100-continue");
+    }
+  }
+
+  const size_t bodyStart = headerEnd + 4;
+  if (bodyStart + contentLength > inputSize) {
+    return ParseResult::TOO_LARGE;
+  }
+  if (bodyStart + contentLength > size) {
+    return ParseResult::INCOMPLETE;
+  }
+  request.body = input.substr(bodyStart, contentLength);
+  request.length = bodyStart + contentLength;
+  return ParseResult::COMPLETE;
+}
+
+static const char* reason(int code) {
+  switch (code) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 415: return "Unsupported Media Type";
+    case 501: return "Not Implemented";
+    default: return "Error";
+  }
+}
+
+static void appendThousandths(std::string& out, int32_t value) {
+  char text[16];
+  const int64_t magnitude = value < 0 ? -static_cast<int64_t>(value) : value;
+  int length = snprintf(text, sizeof(text), "%s%lld", value < 0 ? "-" : "", static_cast<long long>(magnitude / 1000));
+  int fraction = magnitude % 1000;
+  if (fraction != 0) {
+    int digits = 3;
+    while (fraction % 10 == 0) {
+      fraction /= 10;
+      --digits;
+    }
+    length += snprintf(text + length, sizeof(text) - length, ".%0*d", digits, fraction);
+  }
+  out.append(text, length);
+}
+
+static const std::string_view measuresPrefix = "/sensors/airgradient:";
+static const std::string_view measuresSuffix = "/measures";
+
+static bool validId(std::string_view id) {
+  if (id.empty() || id.size() > maxIdLength) {
+    return false;
+  }
+  for (char c : id) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_' && c != '.') {
+      return false;
+    }
+  }
+  return true;
+}
+
+class Worker
+{
+  DeviceTable& devices;
+  WorkerStats& stats;
+  const std::vector<WorkerStats>& allStats;
+  int port;
+  int listener = -1;
+  int epoll = -1;
+  std::vector<Connection*> open;
+  // scratch for GET requests, sized for a whole ring
+  std::unique_ptr<Sample[]> samples;
+
+  void watch(Connection& connection, uint32_t events, int operation) {
+    epoll_event event = {};
+    event.events = events;
+    event.data.ptr = &connection;
+    epoll_ctl(epoll, operation, connection.fd, &event);
+  }
+
+  void close(Connection* connection) {
+    epoll_ctl(epoll, EPOLL_CTL_DEL, connection->fd, nullptr);
+    ::close(connection->fd);
+    open.back()->slot = connection->slot;
+    open[connection->slot] = open.back();
+    open.pop_back();
+    delete connection;
+  }
+
+  void accept() {
+    while (true) {
+      int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        return;
+      }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      Connection* connection = new Connection;
+      connection->fd = fd;
+      connection->slot = open.size();
+      connection->lastActive = monotonicNs();
+      connection->out.reserve(512);
+      open.push_back(connection);
+      watch(*connection, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+      bump(stats.connections);
+    }
+  }
+
+  void respond(Connection& connection, int code, std::string_view contentType, std::string_view body) {
+    char head[160];
+    int length = snprintf(
+      head, sizeof(head),
+      "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n%s%.*s%s%s\r\n",
+      code, reason(code), body.size(),
+      contentType.empty() ? "" : "Content-Type: ",
+      static_cast<int>(contentType.size()), contentType.data(),
+      contentType.empty() ? "" : "\r\n",
+      connection.closeAfterWrite ? "Connection: close\r\n" : ""
+    );
+    connection.out.append(head, length);
+    connection.out.append(body.data(), body.size());
+    if (code >= 400) {
+      bump(stats.rejected);
+    }
+  }
+
+  void postMeasures(Connection& connection, const Request& request, std::string_view id) {
+    Sample sample = {};
+    bool parsed;
+    if (equalsIgnoreCase(request.contentType, "application/json")) {
+      parsed = JsonReader(request.body.data(), request.body.size()).read(sample);
+    } else if (equalsIgnoreCase(request.contentType, "application/cbor")) {
+      parsed = CborReader(request.body.data(), request.body.size()).read(sample);
+    } else {
+      respond(connection, 415, "", "");
+      return;
+    }
+    if (!parsed) {
+      respond(connection, 400, "text/plain", "Malformed payload");
+      return;
+    }
+    sample.receivedMs = wallMs();
+    devices.store(*devices.find(id, true), sample);
+    bump(stats.samples);
+    respond(connection, 200, "", "");
+  }
+
+  void getMeasures(Connection& connection, const Request& request, std::string_view id) {
+    Device* device = devices.find(id, false);
+    if (device == nullptr) {
+      respond(connection, 404, "text/plain", "Unknown device");
+      return;
+    }
+    size_t wanted = 1;
+    if (request.query.substr(0, 2) == "n=") {
+      wanted = strtoul(std::string(request.query.substr(2)).c_str(), nullptr, 10);
+    }
+    wanted = std::max<size_t>(1, std::min(wanted, devices.samplesPerDevice()));
+    const size_t n = devices.latest(*device, samples.get(), wanted);
+
+    std::string body = "[";
+    for (size_t i = 0; i < n; i++) {
+      const Sample& sample = samples[i];
+      body += i == 0 ? "{\"t\":" : ",{\"t\":";
+      body += std::to_string(sample.receivedMs);
+      for (size_t field = 0; field < fieldCount; field++) {
+        if (sample.present & (1u << field)) {
+          body += ",\"";
+          body += fieldNames[field];
+          body += "\":";
+          appendThousandths(body, sample.values[field]);
+        }
+      }
+      body += '}';
+    }
+    body += "]";
+    respond(connection, 200, "application/json", body);
+  }
+
+  void getStats(Connection& connection) {
+    Totals totals;
+    for (const WorkerStats& worker : allStats) {
+      totals.add(worker);
+    }
+    char body[256];
+    int length = snprintf(
+      body, sizeof(body),
+      "{\"devices\":%zu,\"requests\":%llu,\"samples\":%llu,\"rejected\":%llu,\"bytes_in\":%llu,\"connections\":%llu}",
+      devices.size(),
+      static_cast<unsigned long long>(totals.requests),
+      static_cast<unsigned long long>(totals.samples),
+      static_cast<unsigned long long>(totals.rejected),
+      static_cast<unsigned long long>(totals.bytesIn),
+      static_cast<unsigned long long>(totals.connections)
+    );
+    respond(connection, 200, "application/json", std::string_view(body, length));
+  }
+
+  void route(Connection& connection, const Request& request) {
+    const std::string_view path = request.path;
+    if (path.size() > measuresPrefix.size() + measuresSuffix.size()
+        && path.substr(0, measuresPrefix.size()) == measuresPrefix
+        && path.substr(path.size() - measuresSuffix.size()) == measuresSuffix) {
+      std::string_view id = path.substr(measuresPrefix.size(), path.size() - measuresPrefix.size() - measuresSuffix.size());
+      if (!validId(id)) {
+        respond(connection, 404, "text/plain", "Bad device id");
+      } else if (request.method == "POST") {
+        postMeasures(connection, request, id);
+      } else if (request.method == "GET") {
+        getMeasures(connection, request, id);
+      } else {
+        respond(connection, 405, "", "");
+      }
+    } else if (path == "/stats" && request.method == "GET") {
+      getStats(connection);
+    } else {
+      respond(connection, 404, "", "");
+    }
+  }
+
+  // Answers every complete request in the input. Returns false once closed.
+  bool process(Connection& connection) {
+    while (!connection.closeAfterWrite && connection.inLength > 0) {
+      Request request;
+      ParseResult result = parseRequest(connection.in, connection.inLength, request);
+      if (result == ParseResult::INCOMPLETE) {
+        if (request.expectContinue && !connection.sentContinue) {
+          connection.out.append("HTTP/1.1 100 Continue\r\n\r\n");
+          connection.sentContinue = true;
+        }
+        break;
+      }
+      if (result != ParseResult::COMPLETE || request.chunked) {
+        connection.closeAfterWrite = true;
+        if (result == ParseResult::TOO_LARGE) {
+          respond(connection, 413, "", "");
+        } else if (result == ParseResult::BAD) {
+          respond(connection, 400, "", "");
+        } else {
+          respond(connection, 501, "", "");
+        }
+        break;
+      }
+
+      connection.closeAfterWrite = !request.keepAlive;
+      route(connection, request);
+      bump(stats.requests);
+      stats.latency.record(monotonicNs() - connection.started);
+
+      connection.inLength -= request.length;
+      memmove(connection.in, connection.in + request.length, connection.inLength);
+      connection.sentContinue = false;
+      if (connection.inLength == 0) {
+        connection.started = 0;
+      }
+    }
+    return flush(connection);
+  }
+
+  // Writes what it can of the output. Returns false once closed.
+  bool flush(Connection& connection) {
+    while (connection.outSent < connection.out.size()) {
+      ssize_t sent = send(
+        connection.fd, connection.out.data() + connection.outSent,
+        connection.out.size() - connection.outSent, MSG_NOSIGNAL
+      );
+      if (sent < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          // stop reading until the client catches up
+          if (!connection.writing) {
+            connection.writing = true;
+            watch(connection, EPOLLOUT | EPOLLRDHUP, EPOLL_CTL_MOD);
+          }
+          return true;
+        }
+        close(&connection);
+        return false;
+      }
+      connection.outSent += sent;
+    }
+    connection.out.clear();
+    connection.outSent = 0;
+    if (connection.closeAfterWrite) {
+      close(&connection);
+      return false;
+    }
+    if (connection.writing) {
+      connection.writing = false;
+      watch(connection, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_MOD);
+    }
+    return true;
+  }
+
+  void readable(Connection& connection) {
+    bool peerClosed = false;
+    while (connection.inLength < inputSize) {
+      ssize_t received = recv(connection.fd, connection.in + connection.inLength, inputSize - connection.inLength, 0);
+      if (received > 0) {
+        if (connection.started == 0) {
+          connection.started = monotonicNs();
+        }
+        connection.inLength += received;
+        bump(stats.bytesIn, received);
+        continue;
+      }
+      if (received == 0) {
+        peerClosed = true;
+      } else if (errno == EINTR) {
+        continue;
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        peerClosed = true;
+      }
+      break;
+    }
+    connection.lastActive = monotonicNs();
+    if (!process(connection)) {
+      return;
+    }
+    if (peerClosed) {
+      close(&connection);
+    }
+  }
+
+  void writable(Connection& connection) {
+    connection.lastActive = monotonicNs();
+    if (flush(connection) && !connection.writing) {
+      // requests that arrived while the output was blocked
+      process(connection);
+    }
+  }
+
+  void closeIdle() {
+    const uint64_t cutoff = monotonicNs() - idleSeconds * 1000000000ULL;
+    for (size_t i = open.size(); i-- > 0;) {
+      if (open[i]->lastActive < cutoff) {
+        close(open[i]);
+      }
+    }
+  }
+
+  public:
+    Worker(DeviceTable& table, WorkerStats& own, const std::vector<WorkerStats>& all, int listenPort)
+      : devices(table), stats(own), allStats(all), port(listenPort),
+        samples(new Sample[table.samplesPerDevice()])
+    {}
+
+    ~Worker() {
+      while (!open.empty()) {
+        close(open.back());
+      }
+      if (epoll >= 0) {
+        ::close(epoll);
+      }
+      if (listener >= 0) {
+        ::close(listener);
+      }
+    }
+
+    bool listen() {
+      listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      int one = 1;
+      setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+      sockaddr_in address = {};
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_ANY);
+      address.sin_port = htons(port);
+      if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listener, 1024) != 0) {
+        perror("listen");
+        return false;
+      }
+      epoll = epoll_create1(EPOLL_CLOEXEC);
+      epoll_event event = {};
+      event.events = EPOLLIN;
+      event.data.ptr = nullptr;
+      epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+      return true;
+    }
+
+    void run() {
+      epoll_event events[256];
+      uint64_t lastSweep = monotonicNs();
+      while (!stopping) {
+        int ready = epoll_wait(epoll, events, 256, 250);
+        for (int i = 0; i < ready; i++) {
+          Connection* connection = static_cast<Connection*>(events[i].data.ptr);
+          if (connection == nullptr) {
+            accept();
+          } else if (events[i].events & EPOLLOUT) {
+            writable(*connection);
+          } else if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            readable(*connection);
+          }
+        }
+        if (monotonicNs() - lastSweep > 1000000000ULL) {
+          closeIdle();
+          lastSweep = monotonicNs();
+        }
+      }
+    }
+};
+
+static void stop(int) {
+  stopping = 1;
+}
+
+static void printLatency(const char* label, uint64_t ns) {
+  if (ns < 10000) {
+    printf(" %s %lluns", label, static_cast<unsigned long long>(ns));
+  } else if (ns < 10000000) {
+    printf(" %s %.1fus", label, ns / 1e3);
+  } else {
+    printf(" %s %.1fms", label, ns / 1e6);
+  }
+}
+
+static void report(const char* label, const Totals& now, const Totals& before, double seconds, size_t devices) {
+  printf(
+    "%s %.0f req/s %.2f MB/s, %llu samples, %llu rejected, %zu devices,",
+    label,
+    (now.requests - before.requests) / seconds,
+    (now.bytesIn - before.bytesIn) / seconds / 1e6,
+    static_cast<unsigned long long>(now.samples - before.samples),
+    static_cast<unsigned long long>(now.rejected - before.rejected),
+    devices
+  );
+  printLatency("p50", now.percentile(before, 0.5));
+  printLatency("p99", now.percentile(before, 0.99));
+  printLatency("p99.9", now.percentile(before, 0.999));
+  printLatency("max", now.percentile(before, 1.0));
+  printf("\n");
+  fflush(stdout);
+}
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [--port 8080] [--threads N] [--ring 128] [--report 10]\n", name);
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  int port = 8080;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t ring = 128;
+  int reportSeconds = 10;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+    }
+    const int value = atoi(argv[i + 1]);
+    if (value <= 0) {
+      usage(argv[0]);
+    }
+    if (strcmp(argv[i], "--port") == 0) {
+      port = value;
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      threads = value;
+    } else if (strcmp(argv[i], "--ring") == 0) {
+      ring = value;
+    } else if (strcmp(argv[i], "--report") == 0) {
+      reportSeconds = value;
+    } else {
+      usage(argv[0]);
+    }
+    ++i;
+  }
+
+  struct sigaction action = {};
+  action.sa_handler = stop;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  DeviceTable devices(ring);
+  std::vector<WorkerStats> stats(threads);
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back(new Worker(devices, stats[i], stats, port));
+    if (!workers.back()->listen()) {
+      return 1;
+    }
+  }
+  std::vector<std::thread> running;
+  for (auto& worker : workers) {
+    running.emplace_back([&worker] { worker->run(); });
+  }
+  printf("listening on port %d with %d workers, %zu samples per device\n", port, threads, ring);
+  fflush(stdout);
+
+  const uint64_t start = monotonicNs();
+  auto first = std::make_unique<Totals>();
+  auto before = std::make_unique<Totals>();
+  uint64_t lastReport = start;
+  while (!stopping) {
+    usleep(100000);
+    const uint64_t now = monotonicNs();
+    if (now - lastReport >= reportSeconds * 1000000000ULL) {
+      auto totals = std::make_unique<Totals>();
+      for (const WorkerStats& worker : stats) {
+        totals->add(worker);
+      }
+      char label[32];
+      snprintf(label, sizeof(label), "[%5.0fs]", (now - start) / 1e9);
+      report(label, *totals, *before, (now - lastReport) / 1e9, devices.size());
+      before = std::move(totals);
+      lastReport = now;
+    }
+  }
+
+  for (std::thread& thread : running) {
+    thread.join();
+  }
+  auto totals = std::make_unique<Totals>();
+  for (const WorkerStats& worker : stats) {
+    totals->add(worker);
+  }
+  report("total", *totals, *first, (monotonicNs() - start) / 1e9, devices.size());
+  return 0;
+}
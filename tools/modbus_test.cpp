@@ -0,0 +1,143 @@
+/*
+  modbus_test.cpp - runs the Modbus RTU master (ModbusRtu.cpp) and the S8
+  driver on top of it against made up serial traffic: CRC, chained reads,
+  resyncing past stray bytes, exception and malformed frames, and the link
+  counters each of those bumps.
+
+  g++ -std=c++17 -Wall -Itools/host -Ilib/AirGradient tools/modbus_test.cpp lib/AirGradient/AirGradient.cpp lib/AirGradient/ModbusRtu.cpp -o modbus_test
+  ./modbus_test
+*/
+
+#include <AirGradient.h>
+#include <Check.h>
+
+#include <deque>
+#include <vector>
+
+uint32_t millis() {
+  return 0;
+}
+
+void delay(uint32_t) {
+}
+
+using Bytes = std::vector<uint8_t>;
+
+// the sensor's end of the UART
+class FakeSerial : public Stream
+{
+  std::deque<uint8_t> incoming;
+
+  public:
+    Bytes sent;
+
+    int available() override {
+      return incoming.size();
+    }
+
+    int read() override {
+      if (incoming.empty()) {
+        return -1;
+      }
+      int byte = incoming.front();
+      incoming.pop_front();
+      return byte;
+    }
+
+    size_t write(uint8_t byte) override {
+      sent.push_back(byte);
+      return 1;
+    }
+
+    void feed(const Bytes& bytes) {
+      incoming.insert(incoming.end(), bytes.begin(), bytes.end());
+    }
+};
+
+static void testCrc() {
+  // from the S8 manual, read input register 3
+  const uint8_t request[] = {0xFE, 0x04, 0x00, 0x03, 0x00, 0x01};
+  CHECK(modbusCrc16(request, sizeof(request)) == 0xC5D5);
+  // a frame with its CRC appended checks to 0
+  const uint8_t frame[] = {0xFE, 0x04, 0x00, 0x03, 0x00, 0x01, 0xD5, 0xC5};
+  CHECK(modbusCrc16(frame, sizeof(frame)) == 0);
+}
+
+static void testReads() {
+  FakeSerial serial;
+  CO2Sensor co;
+  co.init(serial);
+
+  CHECK(co.requestRead());
+  CHECK(serial.sent == (Bytes{0xFE, 0x04, 0x00, 0x00, 0x00, 0x04, 0xE5, 0xC6}));
+  CHECK(!co.responseAvailable());
+
+  // a stray byte, then the response in two pieces
+  serial.feed({0x00, 0xFE, 0x04, 0x08, 0, 0, 0, 0, 0, 0});
+  CHECK(!co.responseAvailable());
+  serial.feed({0x01, 0x90, 0x16, 0xE6});
+  CHECK(co.responseAvailable());
+  CHECK(co.readResponse() == 400);
+  CHECK(co.getStatus() == 0);
+
+  // the ABC period read is chained after the first measurement
+  CHECK(Bytes(serial.sent.begin() + 8, serial.sent.end()) == (Bytes{0xFE, 0x03, 0x00, 0x1F, 0x00, 0x01, 0xA1, 0xC3}));
+  serial.feed({0xFE, 0x03, 0x02, 0x00, 0xB4, 0xAC, 0x27});
+  co.requestRead();
+  CHECK(co.getAbcPeriod() == 180);
+
+  // last CRC byte off by one
+  serial.feed({0xFE, 0x04, 0x08, 0, 0, 0, 0, 0, 0, 0x01, 0x90, 0x16, 0xE7});
+  CHECK(co.responseAvailable());
+  CHECK(co.readResponse() == -6);
+
+  // exception 2, illegal data address
+  co.requestRead();
+  serial.feed({0xFE, 0x84, 0x02, 0xF2, 0xF1});
+  CHECK(co.responseAvailable());
+  CHECK(co.readResponse() == -7);
+
+  // one register where four were asked for
+  co.requestRead();
+  serial.feed({0xFE, 0x04, 0x02, 0x01, 0x90});
+  CHECK(co.responseAvailable());
+  CHECK(co.readResponse() == -4);
+
+  // never answered, replaced by the next request
+  co.requestRead();
+  co.requestRead();
+
+  const ModbusRtu::Counters& counters = co.getCounters();
+  CHECK(counters.responses == 2);
+  CHECK(counters.crcErrors == 1);
+  CHECK(counters.exceptions == 1);
+  CHECK(counters.frameErrors == 1);
+  CHECK(counters.timeouts == 1);
+  // the stray byte, and the malformed frame's registers flushed by the next
+  // request
+  CHECK(counters.discarded == 3);
+  CHECK(counters.resyncs == 1);
+}
+
+static void testOverflow() {
+  FakeSerial serial;
+  CO2Sensor co;
+  co.init(serial);
+  co.requestRead();
+  // stray bytes, then a response announcing 200 bytes of registers
+  serial.feed({0x00, 0x01, 0xFE, 0x04, 200});
+  CHECK(co.responseAvailable());
+
+  const LinkCounters link = co.getLinkCounters();
+  CHECK(link.resyncs == 1);
+  CHECK(link.discarded == 2);
+  CHECK(link.overflows == 1);
+  CHECK(co.getCounters().frameErrors == 0);
+}
+
+int main() {
+  testCrc();
+  testReads();
+  testOverflow();
+  return checkResult("modbus_test");
+}
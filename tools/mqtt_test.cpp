@@ -0,0 +1,368 @@
+/*
+  mqtt_test.cpp - runs the MQTT client (AirMqtt.cpp) against a broker made
+  of two byte queues and checks its QoS 1 bookkeeping: packet ids, PUBACKs
+  in any order, resending with DUP after a reconnect, the oldest messages
+  making room when the slots or the arena run out, wrapping in the arena
+  and what counts as dropped.
+
+  g++ -std=c++17 -Wall -Itools/host -Ilib/AirGradientCore tools/mqtt_test.cpp lib/AirGradientCore/AirMqtt.cpp -o mqtt_test
+  ./mqtt_test
+*/
+
+#include <AirJson.h>
+#include <AirMqtt.h>
+#include <AirSettings.h>
+#include <Check.h>
+#include <WiFi.h>
+#include <WiFiClient.h>
+
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+static uint32_t now = 1000;
+
+uint32_t millis() {
+  return now;
+}
+
+void delay(uint32_t ms) {
+  now += ms;
+}
+
+long random(long) {
+  return 0;
+}
+
+void logWrite(uint8_t, PGM_P, ...) {
+}
+
+Settings settings;
+WiFiClass WiFi;
+
+int WiFiClass::status() {
+  return WL_CONNECTED;
+}
+
+String deviceId() {
+  return "test";
+}
+
+// what addMeasurements() gives the next publishMqtt()
+static std::string payload;
+
+void addMeasurements(JsonPayload& fields) {
+  fields.addRaw(F("x"), payload.c_str());
+}
+
+// the broker's end of the connection
+static std::vector<uint8_t> fromDevice;
+static std::deque<uint8_t> toDevice;
+static bool open = false;
+
+int WiFiClient::connect(const char*, uint16_t) {
+  open = true;
+  return 1;
+}
+
+void WiFiClient::setTimeout(unsigned long) {
+}
+
+void WiFiClient::setNoDelay(bool) {
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+  fromDevice.insert(fromDevice.end(), buffer, buffer + size);
+  return size;
+}
+
+int WiFiClient::available() {
+  return toDevice.size();
+}
+
+int WiFiClient::read() {
+  const uint8_t b = toDevice.front();
+  toDevice.pop_front();
+  return b;
+}
+
+uint8_t WiFiClient::connected() {
+  return open;
+}
+
+void WiFiClient::stop() {
+  open = false;
+}
+
+struct Packet
+{
+  uint8_t type;
+  bool dup;
+  uint8_t qos;
+  uint16_t id;
+  std::string topic;
+  std::string body;
+};
+
+// everything the device sent since the last call
+static std::vector<Packet> sent() {
+  std::vector<Packet> packets;
+  size_t i = 0;
+  while (i < fromDevice.size()) {
+    Packet packet = {};
+    const uint8_t header = fromDevice[i++];
+    packet.type = header >> 4;
+    packet.dup = header & 0x08;
+    packet.qos = (header >> 1) & 3;
+    size_t length = 0;
+    for (int shift = 0;; shift += 7) {
+      const uint8_t digit = fromDevice[i++];
+      length |= (digit & 0x7F) << shift;
+      if (!(digit & 0x80)) {
+        break;
+      }
+    }
+    const size_t end = i + length;
+    if (packet.type == 3) {
+      const size_t topicLength = fromDevice[i] << 8 | fromDevice[i + 1];
+      packet.topic.assign(fromDevice.begin() + i + 2, fromDevice.begin() + i + 2 + topicLength);
+      i += 2 + topicLength;
+      if (packet.qos > 0) {
+        packet.id = fromDevice[i] << 8 | fromDevice[i + 1];
+        i += 2;
+      }
+      packet.body.assign(fromDevice.begin() + i, fromDevice.begin() + end);
+    }
+    i = end;
+    packets.push_back(packet);
+  }
+  fromDevice.clear();
+  return packets;
+}
+
+static void puback(uint16_t id) {
+  toDevice.insert(toDevice.end(), {0x40, 0x02, static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id & 0xFF)});
+  processMqtt();
+}
+
+// drops the connection and connects again, returns the messages resent
+static std::vector<Packet> reconnect() {
+  restartMqtt();
+  // and its DISCONNECT
+  sent();
+  processMqtt();
+  const std::vector<Packet> connect = sent();
+  CHECK(connect.size() == 1 && connect[0].type == 1);
+  toDevice.insert(toDevice.end(), {0x20, 0x02, 0x01, 0x00});
+  processMqtt();
+  CHECK(mqttConnected());
+  return sent();
+}
+
+// a QoS 1 PUBLISH of body with the device's topic, returns its id
+static uint16_t publishOne(const std::string& body) {
+  payload = body;
+  publishMqtt();
+  const std::vector<Packet> packets = sent();
+  if (packets.size() != 1 || packets[0].type != 3 || packets[0].qos != 1 || packets[0].dup) {
+    CHECK(false);
+    return 0;
+  }
+  return packets[0].id;
+}
+
+static std::string bodyOf(const std::string& text) {
+  return "{\"x\":" + text + "}";
+}
+
+static void testAcknowledged() {
+  reconnect();
+  const uint16_t first = publishOne("1");
+  const uint16_t second = publishOne("2");
+  const uint16_t third = publishOne("3");
+  CHECK(first != 0 && second == first + 1 && third == second + 1);
+
+  // out of order; the first stays in flight, the third is done
+  puback(third);
+  const std::vector<Packet> resent = reconnect();
+  CHECK(resent.size() == 2);
+  CHECK(resent[0].id == first && resent[0].dup && resent[0].topic == "airgradient/test" && resent[0].body == bodyOf("1"));
+  CHECK(resent[1].id == second && resent[1].dup && resent[1].body == bodyOf("2"));
+
+  puback(first);
+  puback(second);
+  CHECK(reconnect().empty());
+  CHECK(mqttStats().acknowledged == 3 && mqttStats().dropped == 0);
+}
+
+static void testSlotsFull() {
+  restartMqtt();
+  sent();
+  const uint32_t dropped = mqttStats().dropped;
+  // held while disconnected, the three oldest make room
+  for (int i = 0; i < AG_MQTT_INFLIGHT + 3; i++) {
+    payload = std::to_string(i);
+    publishMqtt();
+  }
+  CHECK(sent().empty());
+  CHECK(mqttStats().dropped - dropped == 3);
+
+  const std::vector<Packet> resent = reconnect();
+  CHECK(resent.size() == AG_MQTT_INFLIGHT);
+  for (size_t i = 0; i < resent.size(); i++) {
+    // sent for the first time, so no DUP
+    CHECK(!resent[i].dup && resent[i].body == bodyOf(std::to_string(i + 3)));
+    puback(resent[i].id);
+  }
+  CHECK(reconnect().empty());
+}
+
+static void testArenaFull() {
+  reconnect();
+  const uint32_t dropped = mqttStats().dropped;
+  // a small message, then four large ones that leave less than one's room
+  publishOne("1");
+  for (char fill = '2'; fill <= '5'; fill++) {
+    // delivered, but held behind the small one
+    puback(publishOne(std::string(450, fill)));
+  }
+
+  // only dropping the small one counts, the four behind it were delivered
+  const uint16_t last = publishOne(std::string(450, '6'));
+  CHECK(mqttStats().dropped - dropped == 1);
+  const std::vector<Packet> resent = reconnect();
+  CHECK(resent.size() == 1 && resent[0].id == last && resent[0].body == bodyOf(std::string(450, '6')));
+  puback(last);
+
+  // too large for a packet, nothing is sent and nothing else is lost
+  payload = std::string(AG_MQTT_PACKET_SIZE, '7');
+  publishMqtt();
+  CHECK(sent().empty());
+  CHECK(mqttStats().dropped - dropped == 2);
+  CHECK(reconnect().empty());
+}
+
+// AirMqtt.cpp's in flight ring as the spec says it should behave: slots and
+// arena bytes are freed from the front only, acknowledged messages wait
+// behind the oldest one that isn't, and the oldest makes room
+struct ModelMessage
+{
+  uint16_t id;
+  std::string body;
+  bool acknowledged;
+
+  size_t size() const {
+    return strlen("airgradient/test") + bodyOf(body).size();
+  }
+};
+
+struct Model
+{
+  std::deque<ModelMessage> messages;
+  size_t used = 0;
+  uint32_t dropped = 0;
+
+  void popAcknowledged() {
+    while (!messages.empty() && messages.front().acknowledged) {
+      used -= messages.front().size();
+      messages.pop_front();
+    }
+  }
+
+  void publish(uint16_t id, const std::string& body) {
+    const ModelMessage message = {id, body, false};
+    while (messages.size() == AG_MQTT_INFLIGHT || AG_MQTT_INFLIGHT_BYTES - used < message.size()) {
+      dropped++;
+      used -= messages.front().size();
+      messages.pop_front();
+      popAcknowledged();
+    }
+    messages.push_back(message);
+    used += message.size();
+  }
+
+  void acknowledge(uint16_t id) {
+    for (ModelMessage& message : messages) {
+      message.acknowledged = message.acknowledged || message.id == id;
+    }
+    popAcknowledged();
+  }
+};
+
+static void testWrap() {
+  reconnect();
+  const uint32_t dropped = mqttStats().dropped;
+  std::mt19937 random(3);
+  Model model;
+  // ids still waiting for a PUBACK, some of which get one late or never
+  std::vector<uint16_t> pending;
+  uint32_t mismatches = 0;
+  for (int i = 0; i < 2000; i++) {
+    while (!pending.empty() && random() % 3 == 0) {
+      const size_t index = random() % pending.size();
+      puback(pending[index]);
+      model.acknowledge(pending[index]);
+      pending.erase(pending.begin() + index);
+    }
+    const std::string body = std::string(1 + random() % 400, 'a' + i % 26);
+    const uint16_t id = publishOne(body);
+    model.publish(id, body);
+    pending.push_back(id);
+
+    // everything the model still holds unacknowledged comes back intact
+    if (i % 50 == 49) {
+      std::vector<const ModelMessage*> expected;
+      for (const ModelMessage& message : model.messages) {
+        if (!message.acknowledged) {
+          expected.push_back(&message);
+        }
+      }
+      const std::vector<Packet> resent = reconnect();
+      if (resent.size() != expected.size()) {
+        mismatches++;
+        continue;
+      }
+      for (size_t j = 0; j < resent.size(); j++) {
+        if (resent[j].id != expected[j]->id || !resent[j].dup || resent[j].body != bodyOf(expected[j]->body)) {
+          mismatches++;
+        }
+      }
+    }
+  }
+  CHECK(mismatches == 0);
+  CHECK(model.dropped > 0);
+  CHECK(mqttStats().dropped - dropped == model.dropped);
+  for (const ModelMessage& message : model.messages) {
+    puback(message.id);
+  }
+  CHECK(reconnect().empty());
+}
+
+static void testQos0() {
+  settings.mqttQos = 0;
+  restartMqtt();
+  sent();
+  const uint32_t dropped = mqttStats().dropped;
+  payload = "1";
+  publishMqtt();
+  CHECK(mqttStats().dropped - dropped == 1);
+
+  reconnect();
+  publishMqtt();
+  const std::vector<Packet> packets = sent();
+  CHECK(packets.size() == 1 && packets[0].qos == 0 && packets[0].body == bodyOf("1"));
+  CHECK(mqttStats().dropped - dropped == 1);
+  settings.mqttQos = 1;
+}
+
+int main() {
+  strcpy(settings.mqttHost, "broker");
+  settings.mqttQos = 1;
+  testAcknowledged();
+  testSlotsFull();
+  testArenaFull();
+  testWrap();
+  testQos0();
+  return checkResult("mqtt_test");
+}
@@ -0,0 +1,168 @@
+/*
+  pms_test.cpp - feeds made up Plantower frames to the PMS parser for each
+  PmsModel: every field lands where its PmsLayout says, fields a model
+  doesn't report stay 0, another model's frames and bad checksums are
+  dropped, and the link counters add up over garbage, short, oversized and
+  unanswered frames.
+
+  g++ -std=c++17 -Wall -Itools/host -Ilib/AirGradient tools/pms_test.cpp lib/AirGradient/AirGradient.cpp lib/AirGradient/ModbusRtu.cpp -o pms_test
+  ./pms_test
+*/
+
+#include <AirGradient.h>
+#include <Check.h>
+
+#include <vector>
+
+uint32_t millis() {
+  return 0;
+}
+
+void delay(uint32_t) {
+}
+
+using Bytes = std::vector<uint8_t>;
+
+// the sensor's end of the UART, requests are thrown away
+class Feed : public Stream
+{
+  Bytes incoming;
+  size_t position = 0;
+
+  public:
+    int available() override {
+      return incoming.size() - position;
+    }
+
+    int read() override {
+      return position < incoming.size() ? incoming[position++] : -1;
+    }
+
+    size_t write(uint8_t) override {
+      return 1;
+    }
+
+    void feed(const Bytes& bytes) {
+      incoming.insert(incoming.end(), bytes.begin(), bytes.end());
+    }
+};
+
+// a frame around words, with its length and checksum
+static Bytes frame(const std::vector<uint16_t>& words) {
+  const uint16_t length = 2 * words.size() + 2;
+  Bytes bytes = {0x42, 0x4D, static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length & 0xFF)};
+  for (uint16_t word : words) {
+    bytes.push_back(word >> 8);
+    bytes.push_back(word & 0xFF);
+  }
+  uint16_t sum = 0;
+  for (uint8_t byte : bytes) {
+    sum += byte;
+  }
+  bytes.push_back(sum >> 8);
+  bytes.push_back(sum & 0xFF);
+  return bytes;
+}
+
+// true if any frame was accepted, data is what the parser holds after
+static bool parse(PmsModel model, const Bytes& bytes, PMS::Data& data) {
+  Feed feed;
+  feed.feed(bytes);
+  PMS pms;
+  pms.init(feed, model);
+  bool accepted = false;
+  while (feed.available()) {
+    accepted |= pms.readPMS();
+  }
+  data = pms.getData();
+  return accepted;
+}
+
+// PMS5003 and PMSA003: 12 data words and a reserved one
+static const std::vector<uint16_t> standard = {1, 2, 3, 4, 5, 6, 300, 50, 10, 3, 2, 1, 0x9999};
+
+static void testLayouts() {
+  PMS::Data data;
+
+  CHECK(parse(PmsModel::PMS5003, frame(standard), data));
+  CHECK(data.PM_SP_UG_1_0 == 1 && data.PM_SP_UG_2_5 == 2 && data.PM_SP_UG_10_0 == 3);
+  CHECK(data.PM_AE_UG_1_0 == 4 && data.PM_AE_UG_2_5 == 5 && data.PM_AE_UG_10_0 == 6);
+  CHECK(data.PM_RAW_0_3 == 300 && data.PM_RAW_0_5 == 50 && data.PM_RAW_1_0 == 10);
+  CHECK(data.PM_RAW_2_5 == 3 && data.PM_RAW_5_0 == 2 && data.PM_RAW_10_0 == 1);
+  CHECK(data.PM_TMP == 0 && data.PM_HUM == 0 && data.AMB_HCHO == 0);
+
+  CHECK(parse(PmsModel::PMSA003, frame(standard), data));
+  CHECK(data.PM_AE_UG_2_5 == 5 && data.PM_RAW_10_0 == 1);
+
+  // temperature, signed, and humidity in place of the 5.0 and 10 um counts
+  std::vector<uint16_t> withClimate = standard;
+  withClimate[10] = static_cast<uint16_t>(-35);
+  withClimate[11] = 456;
+  CHECK(parse(PmsModel::PMS5003T, frame(withClimate), data));
+  CHECK(data.PM_RAW_2_5 == 3 && data.PM_TMP == -35 && data.PM_HUM == 456);
+  CHECK(data.PM_RAW_5_0 == 0 && data.PM_RAW_10_0 == 0);
+
+  // formaldehyde, temperature and humidity after the standard words, then
+  // a reserved word and the version and error code
+  const std::vector<uint16_t> extended = {1, 2, 3, 4, 5, 6, 300, 50, 10, 3, 2, 1, 42, 215, 501, 0, 0x0100};
+  CHECK(parse(PmsModel::PMS5003ST, frame(extended), data));
+  CHECK(data.PM_RAW_5_0 == 2 && data.PM_RAW_10_0 == 1);
+  CHECK(data.AMB_HCHO == 42 && data.PM_TMP == 215 && data.PM_HUM == 501);
+
+  // another model's frame length is dropped rather than misread
+  CHECK(!parse(PmsModel::PMS5003, frame(extended), data));
+  CHECK(!parse(PmsModel::PMS5003ST, frame(standard), data));
+  // as is the 20 byte frame of the PMS1003 and PMS3003
+  CHECK(!parse(PmsModel::PMS5003, frame(std::vector<uint16_t>(9, 7)), data));
+
+  Bytes corrupt = frame(standard);
+  corrupt[10] ^= 1;
+  CHECK(!parse(PmsModel::PMSA003, corrupt, data));
+
+  // garbage with a stray start byte, then a good frame
+  Bytes noisy = {0x42, 0x00, 0x11, 0x4D};
+  const Bytes good = frame(standard);
+  noisy.insert(noisy.end(), good.begin(), good.end());
+  CHECK(parse(PmsModel::PMSA003, noisy, data));
+  CHECK(data.PM_SP_UG_1_0 == 1);
+}
+
+static void testCounters() {
+  const std::vector<uint16_t> words(13, 7);
+  Feed feed;
+  PMS pms;
+  pms.init(feed);
+  pms.passiveMode();
+
+  feed.feed({1, 2, 3});                // 3 discarded
+  feed.feed({0x42, 0x11});             // a resync, 2 discarded
+  feed.feed({0x42, 0x4D, 0x00, 0x14}); // 20 byte frame, a resync, 4 discarded
+  feed.feed({0x42, 0x4D, 0x01, 0x00}); // 256 byte frame, an overflow and a resync, 4 discarded
+  Bytes corrupt = frame(words);
+  corrupt[6] ^= 1;
+  feed.feed(corrupt);
+  feed.feed(frame(words));
+  feed.feed(frame(words));
+
+  // the first request goes unanswered
+  pms.requestRead();
+  pms.requestRead();
+  while (feed.available()) {
+    pms.readPMS();
+  }
+  pms.requestRead();
+
+  const LinkCounters& counters = pms.getCounters();
+  CHECK(counters.frames == 2);
+  CHECK(counters.checksumErrors == 1);
+  CHECK(counters.resyncs == 3);
+  CHECK(counters.discarded == 13);
+  CHECK(counters.timeouts == 1);
+  CHECK(counters.overflows == 1);
+}
+
+int main() {
+  testLayouts();
+  testCounters();
+  return checkResult("pms_test");
+}
@@ -0,0 +1,358 @@
+/*
+  radio_sim.cpp - runs the firmware's radio scheduler (AirRadio.cpp) on a
+  virtual clock over a simulated WiFi link, against the old always-on
+  behaviour on the same link.
+
+  g++ -O2 -std=c++17 -Itools/host -Ilib/AirGradientCore tools/radio_sim.cpp lib/AirGradientCore/AirRadio.cpp -o radio_sim
+  ./radio_sim [--board pro|outdoor] [--hours 24] [--rssi -65]
+              [--fades 2] [--outages 0.5] [--seed 1] [--verbose]
+
+  The link drifts a few dB around --rssi, fades 20 dB below it --fades
+  times an hour for 30 s to 3 minutes, and drops the association --outages
+  times an hour for 10 to 90 s. A POST takes longer as the signal gets
+  weaker and fails more often below -78 dBm, a failed one blocks for the 5 s
+  connect timeout. The pro queues an upload every 10 s, the outdoor one
+  every 40 s plus its boot ping.
+
+  Radio current is modelled as 75 mA fully on, 18 mA average in modem sleep
+  with a listen interval of 3 and 100 mA more while a POST is on the air,
+  rough ESP32-C3 figures; the charge is only good for comparing the runs.
+  The radio on time the firmware reports for each hour is checked against
+  the simulator's own count.
+*/
+
+#include <AirRadio.h>
+#include <WiFi.h>
+
+#include <cmath>
+#include <cstdarg>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+static uint64_t nowMs = 0;
+
+uint32_t millis() {
+  return static_cast<uint32_t>(nowMs);
+}
+
+static bool verbose = false;
+
+void logWrite(uint8_t, PGM_P format, ...) {
+  if (!verbose) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  printf("%8.1f  ", nowMs / 1000.0);
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+}
+
+static const double onMa = 75;
+static const double sleepMa = 18;
+static const double txMa = 100;
+
+struct Options
+{
+  bool outdoor = false;
+  double hours = 24;
+  double rssi = -65;
+  double fadesPerHour = 2;
+  double outagesPerHour = 0.5;
+  uint32_t seed = 1;
+};
+
+/**
+ * Signal and association, stepped once a second. Both runs see the same
+ * sequence for the same seed.
+ */
+class Link
+{
+  std::mt19937 random;
+  double base;
+  double drift = 0;
+  uint32_t fadeLeft = 0;
+  uint32_t outageLeft = 0;
+  double fadePerSecond;
+  double outagePerSecond;
+
+  public:
+    bool connected = true;
+    int8_t rssi = 0;
+
+    Link(const Options& options) :
+      random(options.seed),
+      base(options.rssi),
+      fadePerSecond(options.fadesPerHour / 3600),
+      outagePerSecond(options.outagesPerHour / 3600) {
+      step();
+    }
+
+    void step() {
+      std::uniform_real_distribution<double> unit(0, 1);
+      drift = std::max(-6.0, std::min(6.0, drift + (unit(random) - 0.5)));
+      if (fadeLeft > 0) {
+        --fadeLeft;
+      } else if (unit(random) < fadePerSecond) {
+        fadeLeft = 30 + random() % 150;
+      }
+      if (outageLeft > 0) {
+        --outageLeft;
+      } else if (unit(random) < outagePerSecond) {
+        outageLeft = 10 + random() % 80;
+      }
+      connected = outageLeft == 0;
+      rssi = static_cast<int8_t>(std::lround(base + drift - (fadeLeft > 0 ? 20 : 0)));
+    }
+};
+
+struct Run
+{
+  uint32_t attempts = 0;
+  uint32_t failed = 0;
+  // not even tried, the WiFi was down
+  uint32_t offline = 0;
+  uint64_t onMs = 0;
+  uint64_t sleepMs = 0;
+  uint64_t txMs = 0;
+  // from queuing to a delivered upload
+  uint64_t delaySum = 0;
+  uint64_t delayMax = 0;
+  uint32_t delivered = 0;
+  // the firmware's radio on time for each hour against the simulator's
+  uint32_t hoursChecked = 0;
+  uint64_t worstHourError = 0;
+
+  double mAh() const {
+    return (onMs * onMa + sleepMs * sleepMa + txMs * txMa) / 3600000.0;
+  }
+};
+
+static Options options;
+static Link* link = nullptr;
+static Run* run = nullptr;
+static std::mt19937 postRandom;
+static wifi_ps_type_t sleepMode = WIFI_PS_NONE;
+static uint64_t nextLinkStep = 0;
+static uint64_t dataQueuedAt = 0;
+// radio on time at each hour boundary
+static std::vector<uint64_t> onAtHour;
+static bool dataWaiting = false;
+
+WiFiClass WiFi;
+
+int WiFiClass::status() {
+  return link->connected ? WL_CONNECTED : 0;
+}
+
+int8_t WiFiClass::RSSI() {
+  return link->connected ? link->rssi : 0;
+}
+
+WiFiMode_t WiFiClass::getMode() {
+  return WIFI_STA;
+}
+
+bool WiFiClass::setSleep(wifi_ps_type_t type) {
+  sleepMode = type;
+  return true;
+}
+
+// moves the clock, counting radio time in the state it was in
+static void advance(uint64_t ms, bool transmitting = false) {
+  const uint64_t until = nowMs + ms;
+  while (nowMs < until) {
+    const uint64_t step = std::min(until, nextLinkStep) - nowMs;
+    if (nowMs % 3600000 == 0) {
+      onAtHour.push_back(run->onMs);
+    }
+    if (transmitting) {
+      run->txMs += step;
+    }
+    // the radio searches for the AP at full power while disconnected
+    if (sleepMode == WIFI_PS_NONE || !link->connected) {
+      run->onMs += step;
+    } else {
+      run->sleepMs += step;
+    }
+    nowMs += step;
+    if (nowMs == nextLinkStep) {
+      link->step();
+      nextLinkStep += 1000;
+    }
+  }
+}
+
+// HTTPClient's POST as far as the radio is concerned
+static bool post() {
+  if (!link->connected) {
+    ++run->offline;
+    return false;
+  }
+  ++run->attempts;
+  const double rssi = link->rssi;
+  const double failure = std::max(0.0, std::min(0.9, (-78 - rssi) / 15));
+  if (std::uniform_real_distribution<double>(0, 1)(postRandom) < failure) {
+    ++run->failed;
+    advance(5000, true);
+    return false;
+  }
+  advance(static_cast<uint64_t>(120 + std::max(0.0, -75 - rssi) * 40), true);
+  return true;
+}
+
+static void sendUpload() {
+  if (post() && dataWaiting) {
+    const uint64_t delay = nowMs - dataQueuedAt;
+    run->delaySum += delay;
+    run->delayMax = std::max(run->delayMax, delay);
+    ++run->delivered;
+  }
+  dataWaiting = false;
+}
+
+static void sendPing() {
+  post();
+}
+
+static void simulate(Run& result, bool scheduled) {
+  Link simulated(options);
+  link = &simulated;
+  run = &result;
+  postRandom.seed(options.seed + 1);
+  nowMs = 0;
+  nextLinkStep = 1000;
+  sleepMode = WIFI_PS_NONE;
+  dataWaiting = false;
+
+  const uint64_t uploadMs = options.outdoor ? 40000 : 10000;
+  const uint64_t endMs = static_cast<uint64_t>(options.hours * 3600000);
+  uint64_t nextUpload = uploadMs;
+  size_t hoursChecked = 1;
+  onAtHour.clear();
+
+  if (options.outdoor) {
+    if (scheduled) {
+      radioQueue(sendPing, RadioSend::Heartbeat);
+    } else {
+      sendPing();
+    }
+  }
+  while (nowMs < endMs) {
+    if (nowMs >= nextUpload) {
+      nextUpload += uploadMs;
+      if (!dataWaiting) {
+        dataQueuedAt = nowMs;
+      }
+      dataWaiting = true;
+      if (scheduled) {
+        radioQueue(sendUpload);
+      } else {
+        sendUpload();
+      }
+    }
+    if (scheduled) {
+      processRadio();
+      // the firmware's hour ends at the last boundary, as long as that is
+      // less than a bucket ago
+      if (onAtHour.size() > hoursChecked) {
+        const uint64_t truth = onAtHour[hoursChecked] - onAtHour[hoursChecked - 1];
+        const uint64_t reported = radioOnMsLastHour();
+        const uint64_t error = truth > reported ? truth - reported : reported - truth;
+        result.worstHourError = std::max(result.worstHourError, error);
+        ++result.hoursChecked;
+        ++hoursChecked;
+      }
+    }
+    // an idle loop()
+    advance(10);
+  }
+}
+
+static void print(const char* name, const Run& result) {
+  const double hours = options.hours;
+  printf(
+    "%-10s radio on %6.0f s/h  charge %6.1f mAh/h  POSTs %6u  failed %5u  offline %4u  "
+    "delivered %6u  delay avg %5.1f s max %5.1f s\n",
+    name,
+    result.onMs / 1000.0 / hours,
+    result.mAh() / hours,
+    result.attempts,
+    result.failed,
+    result.offline,
+    result.delivered,
+    result.delivered ? result.delaySum / 1000.0 / result.delivered : 0.0,
+    result.delayMax / 1000.0
+  );
+}
+
+static void usage() {
+  fprintf(stderr,
+    "usage: radio_sim [--board pro|outdoor] [--hours 24] [--rssi -65]\n"
+    "                 [--fades 2] [--outages 0.5] [--seed 1] [--verbose]\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--verbose") {
+      verbose = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage();
+    }
+    const char* value = argv[++i];
+    if (arg == "--board") {
+      options.outdoor = std::string(value) == "outdoor";
+    } else if (arg == "--hours") {
+      options.hours = atof(value);
+    } else if (arg == "--rssi") {
+      options.rssi = atof(value);
+    } else if (arg == "--fades") {
+      options.fadesPerHour = atof(value);
+    } else if (arg == "--outages") {
+      options.outagesPerHour = atof(value);
+    } else if (arg == "--seed") {
+      options.seed = strtoul(value, nullptr, 10);
+    } else {
+      usage();
+    }
+  }
+
+  printf(
+    "%s, %.0f h at %.0f dBm, %.1f fades/h, %.1f outages/h, window %d ms, poor below %d dBm\n",
+    options.outdoor ? "outdoor" : "pro",
+    options.hours,
+    options.rssi,
+    options.fadesPerHour,
+    options.outagesPerHour,
+    AG_RADIO_WINDOW_MS,
+    AG_RADIO_POOR_RSSI
+  );
+
+  Run always;
+  simulate(always, false);
+  print("always on", always);
+
+  Run scheduled;
+  simulate(scheduled, true);
+  print("scheduled", scheduled);
+
+  const RadioStats& stats = radioStats();
+  printf(
+    "scheduler: %u windows, %u deferred, %u coalesced; reported radio on time off by at most %.1f s in %u hours\n",
+    stats.windows,
+    stats.deferred,
+    stats.coalesced,
+    scheduled.worstHourError / 1000.0,
+    scheduled.hoursChecked
+  );
+  // time spent in a blocking POST is counted where it ends, which is off by
+  // at most one failed POST when that straddles an hour
+  return scheduled.worstHourError > 5100 ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Compare the linked firmware's RAM and flash sections at two revisions.
+
+Usage: python3 tools/section_sizes.py <base rev> <head rev> [--env pro --env basic]
+
+Each revision is checked out into a temporary git worktree and built with
+`pio run -e <env>`, then the sections of .pio/build/<env>/firmware.elf are
+summed with `size -A`. On the ESP8266 .data, .rodata and .bss are DRAM, the
+80 KB the heap comes out of, .text is IRAM and .irom0.text is flash; the
+ESP32-C3 sections are mapped to the same columns. Set PIO or SIZE to use
+another pio or size binary, binutils' own size reads both targets' ELF.
+"""
+
+import argparse
+import os
+import subprocess
+import tempfile
+
+SECTIONS = {
+    "dram": (".data", ".rodata", ".bss", ".dram0.data", ".dram0.bss"),
+    "iram": (".text", ".iram0.text"),
+    "flash": (".irom0.text", ".flash.text", ".flash.rodata"),
+}
+
+
+def sections(elf):
+    output = subprocess.run(
+        [os.environ.get("SIZE", "size"), "-A", elf], check=True, capture_output=True, text=True
+    ).stdout
+    sizes = dict.fromkeys(SECTIONS, 0)
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) != 3 or not fields[1].isdigit():
+            continue
+        for column, names in SECTIONS.items():
+            if fields[0] in names:
+                sizes[column] += int(fields[1])
+    return sizes
+
+
+def build(root, rev, env, work):
+    tree = os.path.join(work, rev.replace("/", "_"))
+    if not os.path.isdir(tree):
+        subprocess.run(["git", "-C", root, "worktree", "add", "--detach", tree, rev], check=True)
+    subprocess.run([os.environ.get("PIO", "pio"), "run", "-s", "-e", env], cwd=tree, check=True)
+    return sections(os.path.join(tree, ".pio", "build", env, "firmware.elf"))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("base")
+    parser.add_argument("head")
+    parser.add_argument("--env", action="append", help="platformio env, pro and basic by default")
+    args = parser.parse_args()
+
+    root = subprocess.run(
+        ["git", "rev-parse", "--show-toplevel"], check=True, capture_output=True, text=True
+    ).stdout.strip()
+    with tempfile.TemporaryDirectory() as work:
+        try:
+            rows = []
+            for env in args.env or ["pro", "basic"]:
+                base = build(root, args.base, env, work)
+                head = build(root, args.head, env, work)
+                rows.append((env, base, head))
+        finally:
+            for name in os.listdir(work):
+                subprocess.run(["git", "-C", root, "worktree", "remove", "--force", os.path.join(work, name)])
+
+    print(f"{'env':<8}{'section':<8}{args.base[:12]:>14}{args.head[:12]:>14}{'change':>10}")
+    for env, base, head in rows:
+        for column in SECTIONS:
+            print(f"{env:<8}{column:<8}{base[column]:>14}{head[column]:>14}{head[column] - base[column]:>+10}")
+
+
+if __name__ == "__main__":
+    main()
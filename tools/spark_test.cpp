@@ -0,0 +1,169 @@
+/*
+  spark_test.cpp - checks SparkHistory's running minimum and maximum against
+  a scan of the window after every sample, and its cached polyline against
+  one scaled from scratch. Then times a display frame against the linear
+  scans and per frame float rescale it replaced.
+
+  g++ -O2 -std=c++17 -Wall -Itools/host -Ilib/AirGradientCore tools/spark_test.cpp -o spark_test
+  ./spark_test
+*/
+
+#include <Check.h>
+#include <SparkHistory.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static const uint16_t length = 60;
+
+struct Segment
+{
+  int x0, y0, x1, y1;
+
+  bool operator==(const Segment& other) const {
+    return x0 == other.x0 && y0 == other.y0 && x1 == other.x1 && y1 == other.y1;
+  }
+};
+
+// the old path: linear scans and a float rescale on every frame
+struct ScanningSpark
+{
+  uint16_t samples[length];
+  uint16_t head = 0;
+  uint16_t count = 0;
+
+  void add(uint16_t value) {
+    samples[head] = value;
+    head = (head + 1) % length;
+    count = std::min<uint16_t>(count + 1, length);
+  }
+
+  uint16_t findMax() const {
+    return *std::max_element(samples, samples + count);
+  }
+
+  uint16_t findMin() const {
+    return *std::min_element(samples, samples + count);
+  }
+
+  template <typename Line>
+  void draw(int x, int y, int width, int height, Line line) const {
+    const uint16_t low = findMin();
+    const uint16_t high = findMax();
+    const float scale = high > low ? static_cast<float>(height) / (high - low) : 0;
+    const float step = static_cast<float>(width) / (count - 1);
+    const uint16_t oldest = (head + length - count) % length;
+    for (uint16_t i = 1; i < count; i++) {
+      line(x + (i - 1) * step, y - (samples[(oldest + i - 1) % length] - low) * scale,
+           x + i * step, y - (samples[(oldest + i) % length] - low) * scale);
+    }
+  }
+};
+
+// the segments draw() should produce for window, oldest first
+static std::vector<Segment> expectedLine(const std::vector<uint16_t>& window, int x, int y, int width, int height) {
+  const uint16_t low = *std::min_element(window.begin(), window.end());
+  const uint32_t range = *std::max_element(window.begin(), window.end()) - low;
+  auto pointY = [&](size_t i) {
+    return y - static_cast<int>(range == 0 ? height / 2 : (window[i] - low) * height / range);
+  };
+  std::vector<Segment> segments;
+  for (size_t i = 1; i < window.size(); i++) {
+    segments.push_back({
+      x + static_cast<int>((i - 1) * width / (window.size() - 1)), pointY(i - 1),
+      x + static_cast<int>(i * width / (window.size() - 1)), pointY(i)
+    });
+  }
+  return segments;
+}
+
+static std::vector<Segment> drawn(const SparkHistory<uint16_t, length>& spark, int x, int y, int width, int height) {
+  std::vector<Segment> segments;
+  spark.draw(x, y, width, height, [&](int x0, int y0, int x1, int y1) {
+    segments.push_back({x0, y0, x1, y1});
+  });
+  return segments;
+}
+
+static void testAgainstScan() {
+  std::mt19937 random(1);
+  for (int trial = 0; trial < 200; trial++) {
+    SparkHistory<uint16_t, length> spark;
+    std::vector<uint16_t> all;
+    // every third trial has only four values, so most samples tie
+    const uint32_t values = trial % 3 == 0 ? 4 : 65536;
+    uint32_t minMaxDiffs = 0;
+    uint32_t lineDiffs = 0;
+
+    CHECK(drawn(spark, 0, 63, 76, 16).empty());
+    for (int i = 0; i < 500; i++) {
+      const uint16_t value = random() % values;
+      spark.add(value);
+      all.push_back(value);
+
+      const std::vector<uint16_t> window(all.end() - std::min<size_t>(all.size(), length), all.end());
+      if (spark.findMax() != *std::max_element(window.begin(), window.end()) ||
+          spark.findMin() != *std::min_element(window.begin(), window.end())) {
+        minMaxDiffs++;
+      }
+      // the same size twice to use the cache, then another to rebuild it
+      if (window.size() >= 2 && i % 7 == 0) {
+        lineDiffs += drawn(spark, 0, 63, 76, 16) != expectedLine(window, 0, 63, 76, 16);
+        lineDiffs += drawn(spark, 0, 63, 76, 16) != expectedLine(window, 0, 63, 76, 16);
+        lineDiffs += drawn(spark, 10, 40, 100, 30) != expectedLine(window, 10, 40, 100, 30);
+      }
+    }
+    CHECK(minMaxDiffs == 0);
+    CHECK(lineDiffs == 0);
+  }
+}
+
+template <typename Frame>
+static double nanosPerFrame(Frame frame) {
+  const int frames = 200000;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++) {
+    frame(i);
+  }
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / frames;
+}
+
+static void benchmark() {
+  std::mt19937 random(2);
+  SparkHistory<uint16_t, length> spark;
+  ScanningSpark scanning;
+  for (uint16_t i = 0; i < length; i++) {
+    const uint16_t value = 400 + random() % 800;
+    spark.add(value);
+    scanning.add(value);
+  }
+
+  volatile long sink = 0;
+  auto line = [&](int x0, int y0, int x1, int y1) {
+    sink = sink + (x0 ^ y0 ^ x1 ^ y1);
+  };
+  // the display shows the minimum and maximum next to the line
+  const double scanned = nanosPerFrame([&](int) {
+    sink = sink + scanning.findMax() + scanning.findMin();
+    scanning.draw(0, 63, 76, 16, line);
+  });
+  const double cached = nanosPerFrame([&](int) {
+    sink = sink + spark.findMax() + spark.findMin();
+    spark.draw(0, 63, 76, 16, line);
+  });
+  const double adding = nanosPerFrame([&](int i) {
+    spark.add(400 + i % 800);
+    sink = sink + spark.findMax() + spark.findMin();
+  });
+  printf("frame: scanning %.0f ns, cached %.0f ns; add with min and max %.1f ns\n", scanned, cached, adding);
+}
+
+int main() {
+  testAgainstScan();
+  benchmark();
+  return checkResult("spark_test");
+}
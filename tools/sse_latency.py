@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Subscribe to a device's /events stream and report sample-to-delivery latency.
+
+Usage: python3 tools/sse_latency.py <device host or ip> [--count N] [--port 80]
+
+Each event carries "t", the device's millis() when the sample was published.
+The device and host clocks aren't synchronised, so latency is reported
+relative to the fastest delivery seen: the minimum of (received - t) is
+taken as the clock offset plus the irreducible network delay, and each
+event's excess over that is its queuing and delivery latency. Run it for a
+while so the minimum is a good estimate.
+"""
+
+import argparse
+import http.client
+import json
+import statistics
+import time
+
+
+def events(host, port):
+    conn = http.client.HTTPConnection(host, port, timeout=60)
+    conn.request("GET", "/events", headers={"Accept": "text/event-stream"})
+    response = conn.getresponse()
+    if response.status != 200:
+        raise SystemExit(f"/events returned {response.status} {response.reason}")
+
+    event = {}
+    while True:
+        line = response.readline()
+        if not line:
+            raise SystemExit("stream closed by the device")
+        received = time.monotonic() * 1000
+        line = line.decode("utf-8").rstrip("\r\n")
+        if line == "":
+            if "data" in event:
+                yield received, event
+            event = {}
+        elif line.startswith(":"):
+            continue
+        else:
+            field, _, value = line.partition(":")
+            event[field] = value.lstrip(" ")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--count", type=int, default=100, help="events to collect")
+    args = parser.parse_args()
+
+    offsets = []
+    last_id = None
+    missed = 0
+    for received, event in events(args.host, args.port):
+        data = json.loads(event["data"])
+        offsets.append(received - data["t"])
+        event_id = int(event.get("id", 0))
+        if last_id is not None and event_id > last_id + 1:
+            missed += event_id - last_id - 1
+        last_id = event_id
+
+        baseline = min(offsets)
+        print(f"id {event_id:>6}  latency {offsets[-1] - baseline:7.1f} ms")
+        if len(offsets) >= args.count:
+            break
+
+    baseline = min(offsets)
+    latencies = sorted(o - baseline for o in offsets)
+    p95 = latencies[int(0.95 * (len(latencies) - 1))]
+    print(
+        f"\n{len(latencies)} events, {missed} missed ids, latency above best case: "
+        f"median {statistics.median(latencies):.1f} ms, p95 {p95:.1f} ms, max {latencies[-1]:.1f} ms"
+    )
+
+
+if __name__ == "__main__":
+    main()